@@ -0,0 +1,219 @@
+/**
+ * @file    acceptance_filter.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Selects the frames received on CAN that are forwarded to the SLCAN host.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "acceptance_filter.h"
+
+#include <logging/logger.h>
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+constexpr const char* s_tag = "CAN_FILTER";
+
+constexpr uint32_t s_stdIdMask = 0x7FFUL;
+constexpr uint32_t s_extIdMask = 0x1FFFFFFFUL;
+
+// Position of the identifier in the code and mask, SJA1000 single filter mode.
+constexpr uint32_t s_stdCodeShift = 21;
+constexpr uint32_t s_extCodeShift = 3;
+}    // namespace
+
+AcceptanceFilter::AcceptanceFilter()
+{
+    rebuildBitmap();
+}
+
+bool AcceptanceFilter::apply(const SlCan::Packet& packet)
+{
+    switch (packet.command) {
+        case SlCan::Command::SetAcceptanceCode: m_code = packet.data.acceptance; break;
+        case SlCan::Command::SetAcceptanceMask: m_mask = packet.data.acceptance; break;
+        case SlCan::Command::SetFilterRange:
+        {
+            const auto& range = packet.data.filterRange;
+            if (range.clear) {
+                m_rangeCount = 0;
+                break;
+            }
+            if (m_rangeCount == s_maxRanges) {
+                LOGW(s_tag, "Can't have more than %d ranges", s_maxRanges);
+                return false;
+            }
+
+            uint32_t idMask = range.isExtended ? s_extIdMask : s_stdIdMask;
+            uint32_t first  = range.first & idMask;
+            uint32_t last   = range.last & idMask;
+            if (first > last) { std::swap(first, last); }
+            m_ranges[m_rangeCount++] = {.first = first, .last = last, .isExtended = range.isExtended};
+            break;
+        }
+        default: return false;
+    }
+
+    rebuildBitmap();
+    return true;
+}
+
+void AcceptanceFilter::program(FDCAN_HandleTypeDef*      hcan,
+                               uint32_t                  firstFreeStdFilter,
+                               bool                      acceptAll,
+                               bool                      needsStdCatchAll,
+                               std::span<const uint32_t> stdIds,
+                               std::span<const uint32_t> extIds) const
+{
+    firstFreeStdFilter = std::min(firstFreeStdFilter, s_stdFilterCount);
+
+    // Only the ranges are programmed when there are some, the code and mask are then left to the software.
+    std::array<Range, s_maxRanges> stdRanges = {};
+    std::array<Range, s_maxRanges> extRanges = {};
+    size_t                         stdCount  = 0;
+    size_t                         extCount  = 0;
+    for (size_t i = 0; i < m_rangeCount; i++) {
+        if (m_ranges[i].isExtended) { extRanges[extCount++] = m_ranges[i]; }
+        else {
+            stdRanges[stdCount++] = m_ranges[i];
+        }
+    }
+
+    if (acceptAll) {
+        // A null care mask accepts everything.
+        programElements(hcan, false, firstFreeStdFilter, s_stdFilterCount - firstFreeStdFilter, {}, nullptr, 0, 0, 0);
+        programElements(hcan, true, 0, s_extFilterCount, {}, nullptr, 0, 0, 0);
+        return;
+    }
+
+    bool useRanges = m_rangeCount != 0;
+    if (needsStdCatchAll) {
+        // The final element would reject the frames of the CANopen receive buffers that have no element.
+        programElements(hcan, false, firstFreeStdFilter, s_stdFilterCount - firstFreeStdFilter, {}, nullptr, 0, 0, 0);
+    }
+    else {
+        programElements(hcan,
+                        false,
+                        firstFreeStdFilter,
+                        s_stdFilterCount - firstFreeStdFilter,
+                        stdIds,
+                        useRanges ? stdRanges.data() : nullptr,
+                        stdCount,
+                        m_code >> s_stdCodeShift & s_stdIdMask,
+                        ~m_mask >> s_stdCodeShift & s_stdIdMask);
+    }
+    programElements(hcan,
+                    true,
+                    0,
+                    s_extFilterCount,
+                    extIds,
+                    useRanges ? extRanges.data() : nullptr,
+                    extCount,
+                    m_code >> s_extCodeShift & s_extIdMask,
+                    ~m_mask >> s_extCodeShift & s_extIdMask);
+}
+
+bool AcceptanceFilter::computeAccepts(bool isExtended, uint32_t id) const
+{
+    if (!matchesCode(isExtended, id)) { return false; }
+    if (m_rangeCount == 0) { return true; }
+
+    for (size_t i = 0; i < m_rangeCount; i++) {
+        const auto& range = m_ranges[i];
+        if (range.isExtended == isExtended && id >= range.first && id <= range.last) { return true; }
+    }
+    return false;
+}
+
+bool AcceptanceFilter::matchesCode(bool isExtended, uint32_t id) const
+{
+    uint32_t shift  = isExtended ? s_extCodeShift : s_stdCodeShift;
+    uint32_t idMask = isExtended ? s_extIdMask : s_stdIdMask;
+    uint32_t code   = m_code >> shift & idMask;
+    uint32_t care   = ~m_mask >> shift & idMask;
+    return ((id ^ code) & care) == 0;
+}
+
+void AcceptanceFilter::rebuildBitmap()
+{
+    m_stdBitmap = {};
+    for (uint32_t id = 0; id <= s_stdIdMask; id++) {
+        if (computeAccepts(false, id)) { m_stdBitmap[id / 32] |= 1UL << (id % 32); }
+    }
+}
+
+void AcceptanceFilter::programElements(FDCAN_HandleTypeDef*      hcan,
+                                       bool                      isExtended,
+                                       uint32_t                  first,
+                                       uint32_t                  count,
+                                       std::span<const uint32_t> ids,
+                                       const Range*              ranges,
+                                       size_t                    rangeCount,
+                                       uint32_t                  code,
+                                       uint32_t                  care)
+{
+    // The identifiers, two per element, then either the ranges or the code and mask, followed by an element that
+    // rejects everything else. Nothing at all if everything is accepted.
+    bool   filters    = ranges != nullptr || care != 0;
+    size_t idElements = filters ? (ids.size() + 1) / 2 : 0;
+    size_t rules      = ranges != nullptr ? rangeCount : (care != 0 ? 1 : 0);
+    size_t needed     = filters ? idElements + rules + 1 : 0;
+    if (needed > count) {
+        LOGD(s_tag, "Not enough %s filter elements, filtering in software", isExtended ? "extended" : "standard");
+        needed     = 0;
+        idElements = 0;
+        rules      = 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        FDCAN_FilterTypeDef filter = {};
+        filter.IdType              = isExtended ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID;
+        filter.FilterIndex         = first + i;
+        size_t rule                = i - idElements;
+        if (i < idElements) {
+            // An odd identifier out is given twice.
+            filter.FilterType   = FDCAN_FILTER_DUAL;
+            filter.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
+            filter.FilterID1    = ids[2 * i];
+            filter.FilterID2    = ids[std::min<size_t>(2 * i + 1, ids.size() - 1)];
+        }
+        else if (rule < rules && ranges != nullptr) {
+            filter.FilterType   = FDCAN_FILTER_RANGE;
+            filter.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
+            filter.FilterID1    = ranges[rule].first;
+            filter.FilterID2    = ranges[rule].last;
+        }
+        else if (rule < rules) {
+            filter.FilterType   = FDCAN_FILTER_MASK;
+            filter.FilterConfig = FDCAN_FILTER_TO_RXFIFO0;
+            filter.FilterID1    = code;
+            filter.FilterID2    = care;
+        }
+        else if (i < needed) {
+            // Matches everything.
+            filter.FilterType   = FDCAN_FILTER_MASK;
+            filter.FilterConfig = FDCAN_FILTER_REJECT;
+            filter.FilterID1    = 0;
+            filter.FilterID2    = 0;
+        }
+        else {
+            filter.FilterType   = FDCAN_FILTER_MASK;
+            filter.FilterConfig = FDCAN_FILTER_DISABLE;
+        }
+
+        if (HAL_FDCAN_ConfigFilter(hcan, &filter) != HAL_OK) {
+            LOGW(s_tag, "Unable to configure filter element %d", filter.FilterIndex);
+            return;
+        }
+    }
+}
@@ -0,0 +1,126 @@
+/**
+ * @file    acceptance_filter.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Selects the frames received on CAN that are forwarded to the SLCAN host.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_ACCEPTANCE_FILTER_H
+#define CEP_ACCEPTANCE_FILTER_H
+
+#include "fdcan.h"
+#include "slcan/slcan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/**
+ * Acceptance filter of the SLCAN host, set with the 'M', 'm' and 'f' commands.
+ *
+ * A frame is accepted if it matches the acceptance code and mask, and if it's in one of the identifier ranges. An
+ * empty list of ranges accepts everything.
+ *
+ * The code and mask follow the single filter mode of the SJA1000: the identifier is left aligned in the 32 bits, and
+ * the bits set in the mask are the ones that aren't compared. The RTR bit and the data bytes covered by the code are
+ * ignored.
+ *
+ * The filter is always applied in software, standard identifiers through a bitmap. When there are enough filter
+ * elements available, it is also programmed in the FDCAN so that the frames nobody wants don't even reach the RX
+ * FIFOs. The hardware filter accepts a superset of the frames, the software one has the final say. It also accepts
+ * the identifiers the ISO-TP links receive on, whose frames are consumed before the software filter.
+ *
+ * The standard filter elements are shared with the CANopen stack, which has one per receive buffer, up to
+ * s_stdFilterCount. Its receive buffers past that have no element, their frames reach the stack through the global
+ * filter that accepts the frames no element matched. The USB filter would reject those frames in hardware, so
+ * it's then only applied in software to the standard identifiers, and its standard filter elements stay disabled.
+ *
+ * Not thread safe, it belongs to the CanManager's RX task.
+ */
+class AcceptanceFilter {
+public:
+    static constexpr size_t   s_maxRanges         = 16;
+    static constexpr uint32_t s_extFilterCount    = 8;     //!< Extended filter elements, all ours.
+    static constexpr uint32_t s_stdFilterCount    = 28;    //!< Standard filter elements, shared with CANopen.
+
+    AcceptanceFilter();
+
+    /**
+     * Applies a SetAcceptanceCode, SetAcceptanceMask or SetFilterRange command.
+     * @returns False if the command couldn't be applied, because there are too many ranges.
+     */
+    bool apply(const SlCan::Packet& packet);
+
+    [[nodiscard]] bool accepts(bool isExtended, uint32_t id) const
+    {
+        if (!isExtended) { return (m_stdBitmap[(id & 0x7FF) / 32] & (1UL << (id % 32))) != 0; }
+        return computeAccepts(true, id);
+    }
+
+    /**
+     * Programs the filter elements that aren't used by anything else.
+     * @param hcan The peripheral, its configuration must hold s_extFilterCount extended filter elements.
+     * @param firstFreeStdFilter Standard filter elements before this one belong to the CANopen stack.
+     * @param acceptAll Disable the filter elements, because something else needs every frame.
+     * @param needsStdCatchAll Disable the standard filter elements only, because something else needs every standard
+     * frame that no element matches.
+     * @param stdIds Standard identifiers to accept whatever the filter.
+     * @param extIds Extended identifiers to accept whatever the filter.
+     */
+    void program(FDCAN_HandleTypeDef*      hcan,
+                 uint32_t                  firstFreeStdFilter,
+                 bool                      acceptAll,
+                 bool                      needsStdCatchAll,
+                 std::span<const uint32_t> stdIds,
+                 std::span<const uint32_t> extIds) const;
+
+private:
+    struct Range {
+        uint32_t first;
+        uint32_t last;
+        bool     isExtended;
+    };
+
+    [[nodiscard]] bool computeAccepts(bool isExtended, uint32_t id) const;
+    [[nodiscard]] bool matchesCode(bool isExtended, uint32_t id) const;
+    void               rebuildBitmap();
+
+    /**
+     * Programs count filter elements, starting at first.
+     * @param ids Identifiers to accept, on top of the ranges or the code.
+     * @param ranges Ranges to accept, nullptr to use the code and care mask instead.
+     * @param care Bits of the identifier that must match the code, 0 accepts everything.
+     */
+    static void programElements(FDCAN_HandleTypeDef*      hcan,
+                                bool                      isExtended,
+                                uint32_t                  first,
+                                uint32_t                  count,
+                                std::span<const uint32_t> ids,
+                                const Range*              ranges,
+                                size_t                    rangeCount,
+                                uint32_t                  code,
+                                uint32_t                  care);
+
+private:
+    uint32_t m_code = 0;             //!< As sent by the host.
+    uint32_t m_mask = 0xFFFFFFFF;    //!< As sent by the host, accepts everything.
+
+    std::array<Range, s_maxRanges> m_ranges     = {};
+    size_t                         m_rangeCount = 0;
+
+    std::array<uint32_t, 2048 / 32> m_stdBitmap = {};    //!< Standard identifiers that are accepted.
+};
+
+#endif    // CEP_ACCEPTANCE_FILTER_H
@@ -0,0 +1,168 @@
+/**
+ * @file    bus_load_meter.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Measures how busy a CAN bus is over a sliding window.
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "bus_load_meter.h"
+
+#include "slcan/dlc.h"
+#include "timestamp.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+
+namespace {
+// Bits that are subject to stuffing, from the start of frame to the end of the DLC, without the data.
+constexpr uint32_t s_classicStdHeaderBits = 19;    // SOF, identifier, RTR, IDE, r0, DLC.
+constexpr uint32_t s_classicExtHeaderBits = 39;    // SOF, identifier, SRR, IDE, extension, RTR, r1, r0, DLC.
+// Classic frames: CRC, its delimiter, ACK slot and delimiter, end of frame and interframe space.
+constexpr uint32_t s_classicCrcBits     = 15;
+constexpr uint32_t s_classicTrailerBits = 1 + 1 + 1 + 7 + 3;
+
+// FD frames switch to the data bit rate after BRS, and back at the CRC delimiter.
+constexpr uint32_t s_fdStdArbitrationBits = 17;    // SOF, identifier, RRS, IDE, FDF, res, BRS.
+constexpr uint32_t s_fdExtArbitrationBits = 36;    // SOF, identifier, SRR, IDE, extension, RRS, FDF, res, BRS.
+constexpr uint32_t s_fdControlBits        = 5;     // ESI, DLC.
+constexpr uint32_t s_fdStuffCountBits     = 4;     // Stuff count and its parity.
+constexpr uint32_t s_fdTrailerBits        = s_classicTrailerBits;
+
+/**
+ * Gets the most stuff bits that can be inserted in a sequence: one after every 4 bits, each stuff bit starting the
+ * next run of identical bits.
+ */
+constexpr uint32_t worstCaseStuffBits(uint32_t bits)
+{
+    return bits == 0 ? 0 : (bits - 1) / 4;
+}
+
+static_assert(s_classicStdHeaderBits + s_classicCrcBits + s_classicTrailerBits == 47);
+static_assert(s_classicExtHeaderBits + s_classicCrcBits + s_classicTrailerBits == 67);
+}    // namespace
+
+BusLoadMeter::FrameBits BusLoadMeter::frameBits(
+  bool isExtended, bool isRemote, bool isFd, bool bitRateSwitch, size_t dataLen)
+{
+    if (isRemote) { dataLen = 0; }
+    auto dataBits = static_cast<uint32_t>(8 * dataLen);
+
+    if (!isFd) {
+        uint32_t stuffed = (isExtended ? s_classicExtHeaderBits : s_classicStdHeaderBits) + dataBits + s_classicCrcBits;
+        return {.nominal = static_cast<uint16_t>(stuffed + worstCaseStuffBits(stuffed) + s_classicTrailerBits)};
+    }
+
+    // Dynamic stuffing up to the end of the data, then a fixed stuff bit before the stuff count and after every 4
+    // bits of it and of the CRC.
+    uint32_t arbitration = isExtended ? s_fdExtArbitrationBits : s_fdStdArbitrationBits;
+    uint32_t control     = s_fdControlBits + dataBits;
+    uint32_t crcBits     = dataLen > 16 ? 21 : 17;
+    uint32_t crcField    = s_fdStuffCountBits + crcBits;
+    uint32_t fixedStuff  = 1 + crcField / 4;
+
+    // The stuff bits of the dynamic part go at the rate of the bits they follow.
+    uint32_t arbitrationStuff = worstCaseStuffBits(arbitration);
+    uint32_t controlStuff     = worstCaseStuffBits(arbitration + control) - arbitrationStuff;
+
+    uint32_t nominal = arbitration + arbitrationStuff + s_fdTrailerBits;
+    uint32_t data    = control + controlStuff + crcField + fixedStuff;
+    if (!bitRateSwitch) { return {.nominal = static_cast<uint16_t>(nominal + data)}; }
+    return {.nominal = static_cast<uint16_t>(nominal), .data = static_cast<uint16_t>(data)};
+}
+
+BusLoadMeter::FrameBits BusLoadMeter::frameBits(const SlCan::Packet& packet)
+{
+    const auto& frame = packet.data.packetData;
+    return frameBits(frame.isExtended, frame.isRemote, frame.isFd, frame.bitRateSwitch, frame.dataLen);
+}
+
+void BusLoadMeter::setBitTimes(uint32_t nominalBitNs, uint32_t dataBitNs)
+{
+    m_nominalBitNs = nominalBitNs;
+    m_dataBitNs    = dataBitNs;
+}
+
+void BusLoadMeter::recordFrame(FrameBits bits)
+{
+    record(bits.nominal * m_nominalBitNs + bits.data * m_dataBitNs, 1, 0);
+}
+
+void BusLoadMeter::recordErrors(uint32_t count)
+{
+    if (count == 0) { return; }
+    record(count * s_errorFrameBits * m_nominalBitNs, 0, count);
+}
+
+BusLoadMeter::Load BusLoadMeter::measure()
+{
+    UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+    uint32_t    now  = Timestamp::nowUs();
+    advance(now);
+    auto   slots     = m_slots;
+    size_t filled    = m_filled;
+    auto   elapsedUs = now - m_slotStartUs;
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+
+    // The slots that weren't used yet are empty.
+    uint64_t busyNs = 0;
+    uint32_t frames = 0;
+    uint32_t errors = 0;
+    for (const auto& slot : slots) {
+        busyNs += slot.busyNs;
+        frames += slot.frames;
+        errors += slot.errors;
+    }
+
+    Load load;
+    load.windowUs = static_cast<uint32_t>(std::min(filled, s_slotCount) - 1) * s_slotUs + elapsedUs;
+    if (load.windowUs == 0) { return load; }
+    load.busyPermille    = static_cast<uint32_t>(std::min<uint64_t>(busyNs / load.windowUs, 1000));
+    load.framesPerSecond = static_cast<uint32_t>(static_cast<uint64_t>(frames) * 1'000'000 / load.windowUs);
+    load.errorsPerSecond = static_cast<uint32_t>(static_cast<uint64_t>(errors) * 1'000'000 / load.windowUs);
+    return load;
+}
+
+void BusLoadMeter::record(uint32_t busyNs, uint32_t frames, uint32_t errors)
+{
+    UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+    advance(Timestamp::nowUs());
+    auto& slot = m_slots[m_current];
+    slot.busyNs += busyNs;
+    slot.frames += frames;
+    slot.errors += errors;
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+void BusLoadMeter::advance(uint32_t nowUs)
+{
+    if (m_filled == 0) {
+        // First use.
+        m_slotStartUs = nowUs;
+        m_filled      = 1;
+        return;
+    }
+
+    uint32_t elapsedSlots = (nowUs - m_slotStartUs) / s_slotUs;
+    if (elapsedSlots == 0) { return; }
+
+    // Everything that's older than the window is forgotten at once.
+    size_t recycled = std::min<size_t>(elapsedSlots, s_slotCount);
+    for (size_t i = 0; i < recycled; i++) {
+        m_current          = (m_current + 1) % s_slotCount;
+        m_slots[m_current] = {};
+    }
+    m_filled = std::min(m_filled + recycled, s_slotCount);
+    m_slotStartUs += elapsedSlots * s_slotUs;
+}
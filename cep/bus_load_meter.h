@@ -0,0 +1,99 @@
+/**
+ * @file    bus_load_meter.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Measures how busy a CAN bus is over a sliding window.
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_BUS_LOAD_METER_H
+#define CEP_BUS_LOAD_METER_H
+
+#include "slcan/slcan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Adds up the time the bus spent carrying frames, from the length of every frame received and sent and from the
+ * error frames counted by the peripheral.
+ *
+ * The length of a frame is derived from its identifier and data length, with as many stuff bits as its content could
+ * require. The load is thus an upper bound, exact up to the stuffing.
+ *
+ * The window is made of s_slotCount slots that are recycled as time goes, the oldest one being replaced by the
+ * current one, partially elapsed. Recording is safe from any context.
+ */
+class BusLoadMeter {
+public:
+    static constexpr size_t   s_slotCount = 10;
+    static constexpr uint32_t s_slotUs    = 100'000;    //!< Duration of a slot, the window is 1 s.
+
+    //! Length of a frame on the wire, in bits at each of the bit rates.
+    struct FrameBits {
+        uint16_t nominal = 0;
+        uint16_t data    = 0;    //!< Only for the FD frames with bit rate switching.
+    };
+
+    struct Load {
+        uint32_t windowUs        = 0;    //!< Time covered, shorter than the window right after the start.
+        uint32_t busyPermille    = 0;    //!< Share of the window during which the bus was busy.
+        uint32_t framesPerSecond = 0;
+        uint32_t errorsPerSecond = 0;    //!< Error frames.
+    };
+
+    /**
+     * Gets the worst-case length of a frame, from the start of frame to the end of the interframe space.
+     * @param dataLen Number of data bytes, ignored for remote frames.
+     */
+    [[nodiscard]] static FrameBits frameBits(
+      bool isExtended, bool isRemote, bool isFd, bool bitRateSwitch, size_t dataLen);
+    [[nodiscard]] static FrameBits frameBits(const SlCan::Packet& packet);
+
+    /**
+     * Sets the duration of the bits, must be called before recording anything.
+     */
+    void setBitTimes(uint32_t nominalBitNs, uint32_t dataBitNs);
+
+    void recordFrame(FrameBits bits);
+    void recordErrors(uint32_t count);    //!< Error frames, from the error counters of the peripheral.
+
+    [[nodiscard]] Load measure();
+
+private:
+    struct Slot {
+        uint32_t busyNs = 0;
+        uint32_t frames = 0;
+        uint32_t errors = 0;
+    };
+
+    //! Error flag, superposed with the other nodes' at worst, delimiter and interframe space.
+    static constexpr uint32_t s_errorFrameBits = 6 + 6 + 8 + 3;
+
+    void record(uint32_t busyNs, uint32_t frames, uint32_t errors);
+    //! Moves the current slot up to now. Must be called inside of a critical section.
+    void advance(uint32_t nowUs);
+
+private:
+    uint32_t m_nominalBitNs = 0;
+    uint32_t m_dataBitNs    = 0;
+
+    std::array<Slot, s_slotCount> m_slots       = {};
+    size_t                        m_current     = 0;    //!< Slot being filled.
+    size_t                        m_filled      = 0;    //!< Slots that were used since the start.
+    uint32_t                      m_slotStartUs = 0;    //!< Start of the current slot.
+};
+
+#endif    // CEP_BUS_LOAD_METER_H
@@ -17,136 +17,255 @@
 #include "can_manager.h"
 
 #include "fdcan.h"
+#include "timestamp.h"
 
+#include <algorithm>
 #include <utility>
 
 CanManager* CanManager::s_instance = nullptr;
 
 namespace {
 // Buffer so that CanManager is located in the bss segment.
-enum class Origin : uint8_t { Can = 0, Usb, Unknown };
 alignas(CanManager) unsigned char g_canManagerBuff[sizeof(CanManager)];
 
-constexpr const char* originToStr(Origin origin)
+SlCan::Packet packetFromGsFrame(const GS_HostFrame& frame, uint32_t timestamp)
 {
-    switch (origin) {
-        case Origin::Can: return "CAN";
-        case Origin::Usb: return "USB";
-        case Origin::Unknown:
-        default: return "Unknown";
+    bool     isExtended = (frame.can_id & GS_CAN_EFF_FLAG) != 0;
+    uint32_t id         = frame.can_id & (isExtended ? GS_CAN_EFF_MASK : GS_CAN_SFF_MASK);
+
+    SlCan::Packet packet = (frame.can_id & GS_CAN_RTR_FLAG) == 0
+                             ? SlCan::Packet {id, isExtended, &frame.data[0], frame.can_dlc}
+                             : SlCan::Packet {id, isExtended};
+    if (packet.data.packetData.isRemote) { packet.data.packetData.dataLen = frame.can_dlc; }
+    packet.data.packetData.timestamp = timestamp;
+    packet.channel                   = frame.channel;
+    return packet;
+}
+
+GS_HostFrame gsFrameFromPacket(const SlCan::Packet& packet, uint32_t echoId)
+{
+    const auto&  data  = packet.data.packetData;
+    GS_HostFrame frame = {
+      .echo_id      = echoId,
+      .can_id       = data.id,
+      .can_dlc      = data.dataLen,
+      .channel      = packet.channel,
+      .flags        = 0,
+      .reserved     = 0,
+      .data         = {},
+      .timestamp_us = data.timestamp,
+    };
+    if (data.isExtended) { frame.can_id |= GS_CAN_EFF_FLAG; }
+    if (data.isRemote) { frame.can_id |= GS_CAN_RTR_FLAG; }
+    else {
+        std::copy(&data.data[0], &data.data[data.dataLen], &frame.data[0]);
     }
+    return frame;
+}
+BusLoadMeter::FrameBits frameBitsFromHeader(const FDCAN_RxHeaderTypeDef& header)
+{
+    bool   isFd    = header.FDFormat == FDCAN_FD_CAN;
+    size_t dataLen = isFd ? SlCan::dlcToLen(header.DataLength) : std::min<size_t>(header.DataLength, 8);
+    return BusLoadMeter::frameBits(header.IdType == FDCAN_EXTENDED_ID,
+                                   header.RxFrameType == FDCAN_REMOTE_FRAME,
+                                   isFd,
+                                   header.BitRateSwitch == FDCAN_BRS_ON,
+                                   dataLen);
 }
-}    // namespace
 
-struct [[gnu::packed]] CanManager::RxPacket {
-    SlCan::Packet packet;
-    Origin        origin = Origin::Unknown;
-};
+void raiseHighWater(std::atomic<size_t>& highWater, size_t level)
+{
+    size_t current = highWater.load(std::memory_order_relaxed);
+    while (level > current && !highWater.compare_exchange_weak(current, level, std::memory_order_relaxed)) {}
+}
+}    // namespace
 
 extern "C" void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef* hfdcan, uint32_t RxFifo0ITs)
 {
     auto& that = CanManager::get();
-    if (hfdcan != that.m_can) { return; }
-    if ((RxFifo0ITs & FDCAN_IT_RX_FIFO0_NEW_MESSAGE) != 0) {
-        // :D
-        FDCAN_RxHeaderTypeDef rx;
-        // In theory, we only need 8 bytes. But in practice, the protocol supports up to 64 bytes...
-        static uint8_t data[64];
-
-        if (HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO0, &rx, &data[0]) != HAL_OK) {
-            // Unable to get frame.
-            return;
-        }
-
-        that.receiveFromIrq({.packet = {rx, &data[0], rx.DataLength}, .origin = Origin::Can});
+    auto* bus  = that.busFromHandle(hfdcan);
+    if (bus == nullptr) { return; }
+    if ((RxFifo0ITs & FDCAN_IT_RX_FIFO0_MESSAGE_LOST) != 0) { ++bus->rxFifoMessagesLost; }
+    if ((RxFifo0ITs & (FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO0_FULL)) != 0) {
+        if (that.drainRxFifoFromIrq(*bus) != 0) { that.notifyRxTaskFromIrq(); }
     }
 }
 
-extern "C" void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef* hfdcan, uint32_t RxFifo1ITs)
+extern "C" void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef* hfdcan, uint32_t BufferIndexes)
 {
     auto& that = CanManager::get();
-    if (hfdcan != that.m_can) { return; }
-    if ((RxFifo1ITs & FDCAN_IT_RX_FIFO1_NEW_MESSAGE) != 0) {
-        // :D
-        FDCAN_RxHeaderTypeDef rx;
-        // In theory, we only need 8 bytes. But in practice, the protocol supports up to 64 bytes...
-        static uint8_t data[64];
-
-        if (HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO1, &rx, &data[0]) != HAL_OK) {
-            // Unable to get frame.
-            return;
-        }
+    auto* bus  = that.busFromHandle(hfdcan);
+    if (bus == nullptr) { return; }
 
-        that.receiveFromIrq({.packet = {rx, &data[0], rx.DataLength}, .origin = Origin::Can});
-    }
+    bus->droppedCanPackets    = 0;
+    bus->attemptsForCanPacket = 0;
+    bus->busOffCount          = 0;
+    bus->stats.txFrames += static_cast<size_t>(__builtin_popcount(BufferIndexes));
+
+    bus->txScheduler.onTxDoneFromIrq(BufferIndexes, true);
+    that.notifyTxRoomFromIrq();
 }
 
-extern "C" void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef* hfdcan, [[maybe_unused]] uint32_t BufferIndexes)
+extern "C" void HAL_FDCAN_TxBufferAbortCallback(FDCAN_HandleTypeDef* hfdcan, uint32_t BufferIndexes)
 {
     auto& that = CanManager::get();
-    if (hfdcan != that.m_can) { return; }
+    auto* bus  = that.busFromHandle(hfdcan);
+    if (bus == nullptr) { return; }
 
-    that.m_droppedCanPackets    = 0;
-    that.m_attemptsForCanPacket = 0;
-
-    // Notify the tasks that are waiting for room in the FIFO, if any, prioritizing the RX task.
-    if (that.m_rxTaskWaitingForTxRoom) { vTaskNotifyGiveFromISR(that.m_rxTask, nullptr); }
-    else if (that.m_txTaskWaitingForTxRoom) {
-        vTaskNotifyGiveFromISR(that.m_txTask, nullptr);
-    }
+    bus->txScheduler.onTxDoneFromIrq(BufferIndexes, false);
+    that.notifyTxRoomFromIrq();
 }
 
 extern "C" void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef* hfdcan, uint32_t ErrorStatusITs)
 {
     auto& that = CanManager::get();
-    if (hfdcan != that.m_can) { return; }
+    auto* bus  = that.busFromHandle(hfdcan);
+    if (bus == nullptr) { return; }
 
-    that.handleCanError();
+    // The flags only say that the warning, passive or bus off status changed, the current ones are in PSR.
+    (void)ErrorStatusITs;
+    that.updateBusStateFromIrq(*bus);
 }
 
 extern "C" void HAL_FDCAN_ErrorCallback(FDCAN_HandleTypeDef* hfdcan)
 {
     auto& that = CanManager::get();
-    if (hfdcan != that.m_can) { return; }
+    auto* bus  = that.busFromHandle(hfdcan);
+    if (bus == nullptr) { return; }
 
-    that.handleCanError();
+    that.handleCanError(*bus);
 }
 
-CanManager::CanManager(CDC_DeviceInfo* usb, FDCAN_HandleTypeDef* hcan) : m_usb(usb), m_can(hcan)
+CanManager::Bus::Bus(FDCAN_HandleTypeDef* hcan, uint8_t channel) : can(hcan), channel(channel), txScheduler(hcan)
+{
+    // The FDCAN timestamp counter ticks once per nominal bit.
+    uint32_t canClockMhz = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN) / 1'000'000;
+    configASSERT(canClockMhz != 0);
+    uint32_t cyclesPerBit = hcan->Init.NominalPrescaler * (1 + hcan->Init.NominalTimeSeg1 + hcan->Init.NominalTimeSeg2);
+    bitTimeNs             = cyclesPerBit * 1000 / canClockMhz;
+    cyclesPerBit          = hcan->Init.DataPrescaler * (1 + hcan->Init.DataTimeSeg1 + hcan->Init.DataTimeSeg2);
+    dataBitTimeNs         = cyclesPerBit * 1000 / canClockMhz;
+
+    loadMeter.setBitTimes(bitTimeNs, dataBitTimeNs);
+    txScheduler.setBusLoadMeter(&loadMeter);
+}
+
+CanManager::CanManager(CDC_DeviceInfo* usb, std::initializer_list<FDCAN_HandleTypeDef*> buses)
+: m_usb(usb),
+  m_periodic(
+    [](void* ud, const SlCan::Packet& frame) { return static_cast<CanManager*>(ud)->transmitPeriodicFromIrq(frame); },
+    this),
+  m_isoTp([](void* ud, const SlCan::Packet& frame) { return static_cast<CanManager*>(ud)->transmitIsoTpFrame(frame); },
+          // From the RX task, the hardware filters are programmed on its next wake up.
+          [](void* ud) { xTaskNotify(static_cast<CanManager*>(ud)->m_rxTask, s_notifyFilters, eSetBits); },
+          this)
 {
     static_assert(std::is_trivially_copyable_v<RxPacket>);
     Logging::Logger::setLevel(s_tag, s_level);
 
+    Timestamp::init();
+
+    // The channel of a bus is its index, for both the SLCAN prefix and gs_usb.
+    configASSERT(buses.size() != 0 && buses.size() <= s_maxBusCount);
+    for (auto* hcan : buses) {
+        m_buses[m_busCount].emplace(hcan, static_cast<uint8_t>(m_busCount));
+        m_buses[m_busCount]->txScheduler.setLatencyHistogram(
+          &m_traceLatency[static_cast<size_t>(TraceStage::SchedulerToBus)]);
+        ++m_busCount;
+    }
+
     CDC_SetOnReceived(
       usb,
       [](CDC_DeviceInfo* dev, void* ud, const uint8_t* data, size_t len) {
-          if (len > 0 && data[len - 1] == '\r') {
-              get().receiveFromIrq({.packet = {data, len}, .origin = Origin::Usb});
-          }
+          // A single transfer can hold many frames, and a frame can be split across two transfers.
+          auto& that = *static_cast<CanManager*>(ud);
+          that.m_usbParser.feed(
+            data,
+            len,
+            [](void* ud, const uint8_t* line, size_t lineLen) {
+                auto&         that   = *static_cast<CanManager*>(ud);
+                SlCan::Packet packet = that.m_usbParser.framing() == SlCan::Framing::Binary
+                                         ? SlCan::Packet::fromBinary(line, lineLen)
+                                         : SlCan::Packet {line, lineLen};
+                if (that.handleUsbCommand(packet)) { return; }
+                if (SlCan::commandIsTransmit(packet.command)) { packet.data.packetData.timestamp = Timestamp::nowUs(); }
+                that.enqueueRxPacket(HostSource::Usb,
+                                     {.packet   = packet,
+                                      .origin   = Origin::Usb,
+                                      .rxCycles = LatencyHistogram::nowCycles()});
+            },
+            ud);
+          // Wake the RX task once for the whole transfer, instead of once per frame.
+          xTaskNotify(that.m_rxTask, s_notifyRxPending, eSetBits);
       },
-      nullptr);
+      this);
+
+    GS_SetOnFrame(
+      [](void* ud, const GS_HostFrame* frame) {
+          // One frame per transfer, it goes straight to the ring from the USB interrupt.
+          auto& that = *static_cast<CanManager*>(ud);
+          that.enqueueRxPacket(HostSource::GsUsb,
+                               {.packet   = packetFromGsFrame(*frame, Timestamp::nowUs()),
+                                .origin   = Origin::GsUsb,
+                                .echoId   = frame->echo_id,
+                                .rxCycles = LatencyHistogram::nowCycles()});
+          that.notifyRxTaskFromIrq();
+      },
+      this);
 
     m_txQueue = xQueueCreate(s_txQueueSize, sizeof(SlCan::Packet));
     configASSERT(m_txQueue != nullptr);
 
-    m_rxQueue = xQueueCreate(s_rxQueueSize, sizeof(RxPacket));
-    configASSERT(m_rxQueue != nullptr);
+    m_usbBacklog = xQueueCreate(s_usbBacklogSize, sizeof(RxPacket));
+    configASSERT(m_usbBacklog != nullptr);
 
     auto res = xTaskCreate(&txTask, "can_tx", s_txTaskStackSize, this, s_txTaskPriority, &m_txTask);
     configASSERT(res == pdPASS);
 
     res = xTaskCreate(&rxTask, "can_rx", s_rxTaskStackSize, this, s_rxTaskPriority, &m_rxTask);
     configASSERT(res == pdPASS);
+
+    // These two notify the RX task, which must exist by then.
+    // gs_usb wants every frame, the hardware filters are lifted while it's started.
+    GS_SetOnModeChanged(
+      [](void* ud, uint8_t, bool) {
+          auto&      that  = *static_cast<CanManager*>(ud);
+          BaseType_t woken = pdFALSE;
+          xTaskNotifyFromISR(that.m_rxTask, s_notifyFilters, eSetBits, &woken);
+          portYIELD_FROM_ISR(woken);
+      },
+      this);
+
+    GS_SetOnFrameSent(
+      [](void* ud, uint32_t queuedCycles) {
+          auto& that = *static_cast<CanManager*>(ud);
+          that.m_traceLatency[static_cast<size_t>(TraceStage::GsUsbToHost)].recordSince(queuedCycles);
+      },
+      this);
+
+    CDC_SetOnTxRoom(
+      usb,
+      [](CDC_DeviceInfo*, void* ud, uint32_t firstReservedCycles) {
+          auto& that = *static_cast<CanManager*>(ud);
+          that.m_traceLatency[static_cast<size_t>(TraceStage::UsbToHost)].recordSince(firstReservedCycles);
+
+          // Only wake the RX task if it has something to send, this fires after every transfer.
+          if (uxQueueMessagesWaitingFromISR(that.m_usbBacklog) == 0 && !that.m_isoTp.hasHostOutput()) { return; }
+          BaseType_t woken = pdFALSE;
+          xTaskNotifyFromISR(that.m_rxTask, s_notifyUsbRoom, eSetBits, &woken);
+          portYIELD_FROM_ISR(woken);
+      },
+      this);
 }
 
-bool CanManager::init(CDC_DeviceInfo* usb, FDCAN_HandleTypeDef* hcan)
+bool CanManager::init(CDC_DeviceInfo* usb, std::initializer_list<FDCAN_HandleTypeDef*> buses)
 {
     if (s_instance != nullptr) {
         LOGE(s_tag, "Already initialized!");
         return false;
     }
 
-    s_instance = new (&g_canManagerBuff[0]) CanManager(usb, hcan);
+    s_instance = new (&g_canManagerBuff[0]) CanManager(usb, buses);
     return true;
 }
 
@@ -155,6 +274,7 @@ void CanManager::transmit(const SlCan::Packet& packet)
     if (packet.command != SlCan::Command::Invalid) {
         // Don't queue invalid packets!
         xQueueSend(m_txQueue, &packet, portMAX_DELAY);
+        raiseHighWater(m_txQueueHighWater, uxQueueMessagesWaiting(m_txQueue));
     }
 }
 
@@ -166,68 +286,511 @@ void CanManager::transmitFromIrq(const SlCan::Packet& packet)
         // If we assert false here, we're not sending messages fast enough. Increase the size of the queue, or augment
         // the priority of the task.
         configASSERT(res == pdPASS && "Unable to queue packet in txQueue");
+        raiseHighWater(m_txQueueHighWater, uxQueueMessagesWaitingFromISR(m_txQueue));
+    }
+}
+
+bool CanManager::startBus(size_t channel)
+{
+    Bus* bus = busFromChannel(channel);
+    if (bus == nullptr) {
+        LOGE(s_tag, "No bus on channel %d", channel);
+        return false;
+    }
+
+    // Nothing has a filter element, so everything lands in FIFO0 until the USB acceptance filter gets programmed.
+    if (HAL_FDCAN_ConfigGlobalFilter(
+          bus->can, FDCAN_ACCEPT_IN_RX_FIFO0, FDCAN_ACCEPT_IN_RX_FIFO0, FDCAN_FILTER_REMOTE, FDCAN_FILTER_REMOTE) !=
+          HAL_OK ||
+        HAL_FDCAN_ActivateNotification(bus->can,
+                                       FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO0_FULL |
+                                         FDCAN_IT_RX_FIFO0_MESSAGE_LOST | FDCAN_IT_TX_COMPLETE | FDCAN_IT_TX_ABORT_COMPLETE | FDCAN_IT_BUS_OFF |
+                                         FDCAN_IT_ARB_PROTOCOL_ERROR | FDCAN_IT_DATA_PROTOCOL_ERROR |
+                                         FDCAN_IT_ERROR_PASSIVE | FDCAN_IT_ERROR_WARNING,
+                                       FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2) != HAL_OK ||
+        HAL_FDCAN_Start(bus->can) != HAL_OK) {
+        LOGE(s_tag, "Unable to start bus %d", channel);
+        return false;
     }
+
+    onCanStarted(bus->can, 0);
+    return true;
+}
+
+CanTxScheduler& CanManager::getTxScheduler(size_t channel)
+{
+    Bus* bus = busFromChannel(channel);
+    configASSERT(bus != nullptr);
+    return bus->txScheduler;
+}
+
+CanManager::BusStats CanManager::getBusStats(size_t channel)
+{
+    configASSERT(channel < m_busCount);
+    Bus& bus = *m_buses[channel];
+
+    uint32_t ecr = readErrorCounters(bus);
+    taskENTER_CRITICAL();
+    uint32_t psr   = bus.can->Instance->PSR;
+    BusStats stats = bus.stats;
+    taskEXIT_CRITICAL();
+
+    stats.txSchedulerHighWater = bus.txScheduler.highWater();
+    stats.txInvalid            = bus.txScheduler.invalidFrames();
+    stats.txErrorCount         = static_cast<uint8_t>((ecr & FDCAN_ECR_TEC_Msk) >> FDCAN_ECR_TEC_Pos);
+    stats.rxErrorCount         = static_cast<uint8_t>((ecr & FDCAN_ECR_REC_Msk) >> FDCAN_ECR_REC_Pos);
+    stats.lastErrorCode        = static_cast<uint8_t>((psr & FDCAN_PSR_LEC_Msk) >> FDCAN_PSR_LEC_Pos);
+    stats.errorWarning         = (psr & FDCAN_PSR_EW) != 0;
+    stats.errorPassive         = (psr & FDCAN_PSR_EP) != 0;
+    stats.busOff               = (psr & FDCAN_PSR_BO) != 0;
+    return stats;
 }
 
-void CanManager::receiveFromIrq(const CanManager::RxPacket& packet)
+BusLoadMeter::Load CanManager::getBusLoad(size_t channel)
 {
-    if (packet.packet.command != SlCan::Command::Invalid) {
+    configASSERT(channel < m_busCount);
+    return m_buses[channel]->loadMeter.measure();
+}
+
+CanManager::HostStats CanManager::getHostStats(HostSource host) const
+{
+    auto index = static_cast<size_t>(host);
+    configASSERT(index < s_hostSourceCount);
+
+    HostStats stats = m_hostStats[index];
+    stats.txFrames  = m_hostTxFrames[index];
+    stats.txDropped = m_hostTxDropped[index];
+    return stats;
+}
+
+CanManager::QueueStats CanManager::getQueueStats() const
+{
+    return {
+      .txQueueHighWater    = m_txQueueHighWater,
+      .usbBacklogHighWater = m_usbBacklogHighWater,
+    };
+}
+
+void CanManager::resetStats()
+{
+    // Racing with the producers only means that a level reached right now might not be kept.
+    for (size_t i = 0; i < m_busCount; i++) {
+        Bus& bus = *m_buses[i];
+        taskENTER_CRITICAL();
+        bus.stats.rxRingHighWater = 0;
+        taskEXIT_CRITICAL();
+        bus.txScheduler.resetHighWater();
+    }
+    for (size_t i = 0; i < s_hostSourceCount; i++) {
+        m_hostStats[i].rxRingHighWater = 0;
+        m_latencyToHost[i].reset();
+    }
+    for (auto& histogram : m_traceLatency) {
+        histogram.reset();
+    }
+    m_txQueueHighWater    = 0;
+    m_usbBacklogHighWater = 0;
+}
+
+void CanManager::onCanStarted(FDCAN_HandleTypeDef* hcan, uint32_t firstFreeStdFilter, bool needsStdCatchAll)
+{
+    Bus* bus = busFromHandle(hcan);
+    configASSERT(bus != nullptr);
+
+    // The filters are only touched by the RX task.
+    bus->firstFreeStdFilter = firstFreeStdFilter;
+    bus->needsStdCatchAll   = needsStdCatchAll;
+    xTaskNotify(m_rxTask, s_notifyFilters, eSetBits);
+}
+
+CanManager::Bus* CanManager::busFromHandle(const FDCAN_HandleTypeDef* hcan)
+{
+    for (size_t i = 0; i < m_busCount; i++) {
+        if (m_buses[i]->can == hcan) { return &*m_buses[i]; }
+    }
+
+    return nullptr;
+}
+
+CanManager::Bus* CanManager::busFromChannel(size_t channel)
+{
+    return channel < m_busCount ? &*m_buses[channel] : nullptr;
+}
+
+void CanManager::enqueueRxPacket(HostSource source, const CanManager::RxPacket& packet)
+{
+    if (packet.packet.command == SlCan::Command::Invalid) {
         // Don't queue invalid packets!
-        auto res = xQueueSendFromISR(m_rxQueue, &packet, nullptr);
-        // If we assert false here, we're not reading messages fast enough. Increase the size of the queue, or augment
-        // the priority of the task.
-        configASSERT(res == pdPASS && "Unable to queue packet in rxQueue");
+        return;
+    }
+
+    auto index = static_cast<size_t>(source);
+    auto& ring  = m_rxRings[index];
+    if (!ring.push(packet)) {
+        // We're not reading messages fast enough. Drop the packet, the RX task will report it.
+        ++m_rxRingOverflows[index];
+        return;
     }
+
+    size_t level = ring.size();
+    if (level > m_hostStats[index].rxRingHighWater) { m_hostStats[index].rxRingHighWater = level; }
 }
 
-void CanManager::transmitPacketOverUsb(const SlCan::Packet& packet)
+size_t CanManager::drainRxFifoFromIrq(Bus& bus)
 {
-    static int missed = 0;
-    if (!CDC_IsConnected(m_usb)) { return; }
-    uint8_t buff[SlCan::Packet::s_mtu];
-    int8_t  len = packet.toSerial(&buff[0], sizeof(buff));
-    if (len > 0) {
-        // TODO We should take advantage of the USB Tx FIFO so that we can just yeet our data in.
-        if (CDC_Queue(m_usb, &buff[0], len) == 0) {
-            // Wait a lil bit, then retry.
-            // Since the host *should* poll us every millisecond, only waiting for that amount of time
-            // should be good enough:tm:
-            vTaskDelay(pdMS_TO_TICKS(2));
-            if (CDC_Queue(m_usb, &buff[0], len) == 0) {
-                buff[len] = '\0';    // Remove the \r, it's fine to do so here, since we're dropping the packet lol
-                LOGW(s_tag, "USB forward fail #%d: %s", ++missed, &buff[0]);
+    auto&  ring  = bus.rxRing;
+    size_t count = 0;
+
+    // The filter elements before this one belong to the CANopen receive buffers.
+    uint32_t canopenFilters = bus.firstFreeStdFilter.load(std::memory_order_relaxed);
+
+    // Both clocks are sampled once, the frames are dated relative to this instant.
+    uint32_t counter = HAL_FDCAN_GetTimestampCounter(bus.can);
+    uint32_t now     = Timestamp::nowUs();
+
+    while (true) {
+        // Frames that arrive while we're reading are picked up by this same pass. Their new message flag is cleared
+        // before looking at the fill level, so that they don't trigger another interrupt that would find the FIFO
+        // empty, while a frame arriving right after the check still raises it.
+        __HAL_FDCAN_CLEAR_FLAG(bus.can, FDCAN_FLAG_RX_FIFO0_NEW_MESSAGE);
+        uint32_t level = HAL_FDCAN_GetRxFifoFillLevel(bus.can, FDCAN_RX_FIFO0);
+        if (level == 0) { break; }
+
+        for (; level != 0; --level) {
+            // The data bytes are read straight into the ring slot. The element must be acknowledged even when there's
+            // no room for it, otherwise the FIFO stays full, so it's then read into a scratch buffer and dropped.
+            RxPacket*             slot = ring.reserve();
+            FDCAN_RxHeaderTypeDef rx;
+            uint8_t               scratch[SlCan::s_maxFdDataLen];
+            uint8_t*              data = slot != nullptr ? &slot->packet.data.packetData.data[0] : &scratch[0];
+            if (HAL_FDCAN_GetRxMessage(bus.can, FDCAN_RX_FIFO0, &rx, data) != HAL_OK) {
+                // Unable to get frame.
+                return count;
+            }
+
+            ++bus.stats.rxFrames;
+            bus.loadMeter.recordFrame(frameBitsFromHeader(rx));
+            if (slot == nullptr) {
+                ++bus.rxRingOverflows;
+                continue;
             }
+
+            // The element that accepted the frame tells the CANopen stack which receive buffer it's for. The elements
+            // of the USB acceptance filter come after those.
+            bool matched =
+              rx.IsFilterMatchingFrame == 0 && rx.IdType == FDCAN_STANDARD_ID && rx.FilterIndex < canopenFilters;
+            slot->packet.setRxHeader(rx);
+            slot->origin                           = Origin::Can;
+            slot->filterIndex                      = matched ? static_cast<uint8_t>(rx.FilterIndex) : s_filterNoMatch;
+            slot->echoId                           = GS_ECHO_ID_RX;
+            slot->dequeuedCycles                   = 0;
+            slot->packet.channel                   = bus.channel;
+            slot->rxCycles                         = LatencyHistogram::nowCycles();
+            slot->packet.data.packetData.timestamp = rxTimestampFromIrq(bus, rx.RxTimestamp, counter, now);
+            ring.commit();
+            ++count;
         }
     }
+
+    size_t level = ring.size();
+    if (level > bus.stats.rxRingHighWater) { bus.stats.rxRingHighWater = level; }
+    return count;
 }
 
-void CanManager::transmitPacketOverCan(const SlCan::Packet& packet, bool isFromRxTask)
+void CanManager::notifyTxRoomFromIrq()
 {
-    if (m_droppedCanPackets > s_maxDroppedCanPackets) {
-        ++m_droppedCanPackets;
+    // Notify the tasks that are waiting for room in the scheduler, if any, prioritizing the RX task.
+    BaseType_t woken = pdFALSE;
+    if (m_rxTaskWaitingForTxRoom) { xTaskNotifyFromISR(m_rxTask, s_notifyTxRoom, eSetBits, &woken); }
+    else if (m_txTaskWaitingForTxRoom) {
+        xTaskNotifyFromISR(m_txTask, s_notifyTxRoom, eSetBits, &woken);
+    }
+    // ISO-TP frames are never waited for, the RX task tries them again on its next pass.
+    if (m_isoTp.wantsTxRoom()) { xTaskNotifyFromISR(m_rxTask, s_notifyIsoTp, eSetBits, &woken); }
+    portYIELD_FROM_ISR(woken);
+}
+
+void CanManager::notifyRxTaskFromIrq()
+{
+    // Only called once the packets are in the rings, so that the RX task never wakes up to empty rings.
+    BaseType_t woken = pdFALSE;
+    xTaskNotifyFromISR(m_rxTask, s_notifyRxPending, eSetBits, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+size_t CanManager::drainRxRings()
+{
+    size_t handled = 0;
+    auto   handle  = [this](const RxPacket& packet) { handleRxPacket(packet); };
+    for (size_t b = 0; b < m_busCount; b++) {
+        Bus& bus = *m_buses[b];
+        handled += bus.rxRing.drain(handle);
+
+        // Not atomic, but losing the count of a frame dropped in between is harmless.
+        size_t overflows = bus.rxRingOverflows;
+        if (overflows != 0) {
+            bus.rxRingOverflows = 0;
+            bus.stats.rxRingOverflows += overflows;
+            LOGW(s_tag, "Bus %d: RX ring full, dropped %d frames", b, overflows);
+        }
+
+        size_t lost = bus.rxFifoMessagesLost;
+        if (lost != 0) {
+            bus.rxFifoMessagesLost = 0;
+            bus.stats.rxFifoOverruns += lost;
+            LOGW(s_tag, "Bus %d: RX FIFO overrun, lost %d frames", b, lost);
+        }
+    }
+
+    for (size_t i = 0; i < s_hostSourceCount; i++) {
+        handled += m_rxRings[i].drain(handle);
+
+        size_t overflows = m_rxRingOverflows[i];
+        if (overflows != 0) {
+            m_rxRingOverflows[i] = 0;
+            m_hostStats[i].rxRingOverflows += overflows;
+            LOGW(s_tag, "Host RX ring %d full, dropped %d packets", i, overflows);
+        }
+    }
+
+    size_t usbDropped = getUsbDroppedFrames();
+    if (usbDropped != m_usbDroppedFramesReported) {
+        LOGW(s_tag, "USB full, dropped %d frames", usbDropped - m_usbDroppedFramesReported);
+        m_usbDroppedFramesReported = usbDropped;
+    }
+
+    return handled;
+}
+
+uint32_t CanManager::rxTimestampFromIrq(const Bus& bus, uint32_t rxTimestamp, uint32_t counter, uint32_t now)
+{
+    // The FDCAN counter is captured at the start of the frame, but it is only 16 bits wide and counts bits instead of
+    // microseconds. Frames are at most a few ms old by the time they're read, way less than a wrap-around (65 ms at
+    // 1 Mbit/s).
+    uint32_t ageTicks = (counter - rxTimestamp) & 0xFFFFUL;
+    return now - ageTicks * bus.bitTimeNs / 1000;
+}
+
+bool CanManager::handleUsbCommand(const SlCan::Packet& packet)
+{
+    // The commands that change how the rest of the transfer is interpreted are applied right away.
+    switch (packet.command) {
+        case SlCan::Command::SetFraming: setUsbFraming(packet.data.framing); return true;
+        case SlCan::Command::SetTimestamp: setUsbTimestampMode(packet.data.timestampMode); return true;
+        default: return false;
+    }
+}
+
+void CanManager::applyUsbFilter(const SlCan::Packet& packet)
+{
+    Bus* bus = busFromChannel(packet.channel);
+    if (bus == nullptr || !bus->usbFilter.apply(packet)) {
+        LOGW(s_tag, "Unable to apply USB filter command '%c'", SlCan::commandToChar(packet.command));
+        return;
+    }
+
+    updateHardwareFilters();
+}
+
+void CanManager::updateHardwareFilters()
+{
+    for (size_t i = 0; i < m_busCount; i++) {
+        Bus& bus = *m_buses[i];
+
+        // The frames of the ISO-TP links must get through whatever the host's filter.
+        std::array<uint32_t, IsoTp::s_linkCount> stdIds   = {};
+        std::array<uint32_t, IsoTp::s_linkCount> extIds   = {};
+        size_t                                   stdCount = m_isoTp.rxIds(bus.channel, false, stdIds.data());
+        size_t                                   extCount = m_isoTp.rxIds(bus.channel, true, extIds.data());
+        bus.usbFilter.program(bus.can,
+                              bus.firstFreeStdFilter,
+                              GS_IsStarted(bus.channel),
+                              bus.needsStdCatchAll,
+                              std::span(stdIds.data(), stdCount),
+                              std::span(extIds.data(), extCount));
+    }
+}
+
+void CanManager::setUsbFraming(SlCan::Framing framing)
+{
+    if (framing == SlCan::Framing::Invalid) {
+        LOGW(s_tag, "Invalid framing requested");
+        return;
+    }
+
+    m_usbParser.setFraming(framing);
+    m_usbFraming = framing;
+    LOGI(s_tag, "USB framing: %s", SlCan::framingToStr(framing));
+}
+
+void CanManager::setUsbTimestampMode(SlCan::TimestampMode mode)
+{
+    if (mode == SlCan::TimestampMode::Invalid) {
+        LOGW(s_tag, "Invalid timestamp mode requested");
         return;
     }
 
-    auto header = packet.toFDCANTxHeader();
-    if (!header.has_value()) { LOGE(s_tag, "Unable to convert packet to TX header!"); }
+    m_usbTimestampMode = mode;
+    LOGI(s_tag, "USB timestamps: %s", SlCan::timestampModeToStr(mode));
+}
+
+void CanManager::transmitPacketOverUsb(const RxPacket& packet)
+{
+    if (!CDC_IsConnected(m_usb)) { return; }
+
+    // Frames can't overtake the ones that are held, they go at the back of the line.
+    if (uxQueueMessagesWaiting(m_usbBacklog) == 0 && writePacketToUsb(packet)) { return; }
+
+    // Never block, the RX task must keep up with the bus. It sends the backlog once the host took some data.
+    if (m_usbOverflowPolicy == UsbOverflowPolicy::Drop || xQueueSend(m_usbBacklog, &packet, 0) != pdPASS) {
+        ++m_hostTxDropped[static_cast<size_t>(HostSource::Usb)];
+        return;
+    }
+    raiseHighWater(m_usbBacklogHighWater, uxQueueMessagesWaiting(m_usbBacklog));
+
+    // A transfer could have completed before the frame was in the backlog, the RX task has to check for itself.
+    if (xTaskGetCurrentTaskHandle() != m_rxTask) { xTaskNotify(m_rxTask, s_notifyUsbRoom, eSetBits); }
+}
+
+bool CanManager::writePacketToUsb(const RxPacket& rxPacket)
+{
+    const auto& packet        = rxPacket.packet;
+    bool        binary        = m_usbFraming == SlCan::Framing::Binary;
+    auto        timestampMode = m_usbTimestampMode.load();
+    size_t len = binary ? packet.sizeOfBinaryPacket(timestampMode) : packet.sizeOfSerialPacket(timestampMode);
+    if (len == 0) {
+        // Can't be sent anyways.
+        return true;
+    }
+
+    // The frame is serialized straight into the USB TX buffer.
+    CDC_Reservation reservation;
+    if (!CDC_Reserve(m_usb, len, &reservation)) { return false; }
+
+    if (binary) { packet.toBinary(reservation.data, reservation.len, timestampMode); }
     else {
-        // If there's no room in the FIFO, block until there is. The Tx complete IRQ will free us.
-        if (HAL_FDCAN_GetTxFifoFreeLevel(m_can) == 0) {
-            if (isFromRxTask) { m_rxTaskWaitingForTxRoom = true; }
-            else {
-                m_txTaskWaitingForTxRoom = true;
-            }
-            if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1)) != 1) {
-                // Timed out, drop the packet.
-                ++m_droppedCanPackets;
-                return;
-            }
+        packet.toSerial(reservation.data, reservation.len, timestampMode);
+    }
+    CDC_Commit(m_usb, &reservation);
+
+    auto index = static_cast<size_t>(HostSource::Usb);
+    ++m_hostTxFrames[index];
+    if (rxPacket.origin == Origin::Can) {
+        m_latencyToHost[index].recordSince(rxPacket.rxCycles);
+        m_traceLatency[static_cast<size_t>(TraceStage::TaskToUsb)].recordSince(rxPacket.dequeuedCycles);
+    }
+    return true;
+}
+
+void CanManager::drainUsbBacklog()
+{
+    RxPacket packet;
+    while (xQueuePeek(m_usbBacklog, &packet, 0) == pdTRUE) {
+        if (!CDC_IsConnected(m_usb)) {
+            // Nobody's listening anymore.
+            ++m_hostTxDropped[static_cast<size_t>(HostSource::Usb)];
+        }
+        else if (!writePacketToUsb(packet)) {
+            // Still full, the next transfer complete will bring us back.
+            return;
         }
+        xQueueReceive(m_usbBacklog, &packet, 0);
+    }
+}
 
-        HAL_FDCAN_AddMessageToTxFifoQ(m_can, &header.value(), &packet.data.packetData.data[0]);
+void CanManager::drainIsoTpToUsb()
+{
+    // The lines are made as they go, from the PDUs kept by the links.
+    while (const SlCan::Packet* packet = m_isoTp.peekHostPacket()) {
+        if (CDC_IsConnected(m_usb) && !writePacketToUsb({.packet = *packet})) {
+            // Still full, the next transfer complete will bring us back.
+            return;
+        }
+        m_isoTp.popHostPacket();
     }
 }
 
+void CanManager::transmitPacketOverGsUsb(const RxPacket& packet)
+{
+    // The gs_usb channels only advertise classic CAN.
+    if (!GS_IsStarted(packet.packet.channel) || packet.packet.data.packetData.isFd) { return; }
+
+    auto         index = static_cast<size_t>(HostSource::GsUsb);
+    GS_HostFrame frame = gsFrameFromPacket(packet.packet, packet.echoId);
+    if (!GS_Queue(&frame)) {
+        ++m_hostTxDropped[index];
+        return;
+    }
+
+    ++m_hostTxFrames[index];
+    if (packet.origin == Origin::Can) {
+        m_latencyToHost[index].recordSince(packet.rxCycles);
+        m_traceLatency[static_cast<size_t>(TraceStage::TaskToGsUsb)].recordSince(packet.dequeuedCycles);
+    }
+}
+
+bool CanManager::transmitPacketOverCan(const SlCan::Packet& packet, bool isFromRxTask)
+{
+    Bus* bus = busFromChannel(packet.channel);
+    if (bus == nullptr) {
+        LOGW(s_tag, "No bus on channel %d", packet.channel);
+        return false;
+    }
+
+    if (bus->droppedCanPackets > s_maxDroppedCanPackets) {
+        ++bus->droppedCanPackets;
+        ++bus->stats.txSkipped;
+        return false;
+    }
+
+    if (!commandIsTransmit(packet.command)) {
+        LOGE(s_tag, "Unable to convert packet to TX header!");
+        return false;
+    }
+
+    // The scheduler sends the frame right away if one of the TX buffers is free, otherwise it waits for its turn.
+    // While the bus is off, the frames in the scheduler wait for it to come back. Waiting for room is pointless.
+    BusState state = bus->stats.state;
+    bool     isOff = state == BusState::BusOff || state == BusState::Recovering;
+    while (!bus->txScheduler.push(packet)) {
+        if (isOff) {
+            ++bus->stats.txSkipped;
+            return false;
+        }
+        if (!waitForTxRoom(*bus, isFromRxTask)) {
+            // Timed out, drop the packet.
+            ++bus->droppedCanPackets;
+            ++bus->stats.txTimeouts;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CanManager::waitForTxRoom(Bus& bus, bool isFromRxTask)
+{
+    if (bus.txScheduler.hasRoom()) { return true; }
+
+    // If there's no room in the scheduler, block until there is. The Tx complete IRQ will free us.
+    // Only the TX room bit is consumed, an RX notification received in the mean time stays pending.
+    bool& waiting = isFromRxTask ? m_rxTaskWaitingForTxRoom : m_txTaskWaitingForTxRoom;
+    xTaskNotifyWait(s_notifyTxRoom, 0, nullptr, 0);    // Clear a stale notification.
+    waiting = true;
+
+    // Any notification wakes us up, so keep waiting until there's room or the deadline is reached.
+    // Checking the level first also covers a TX that completed before the flag was set.
+    constexpr TickType_t timeout = pdMS_TO_TICKS(1);
+    TickType_t           start   = xTaskGetTickCount();
+    while (!bus.txScheduler.hasRoom()) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) { break; }
+        xTaskNotifyWait(0, s_notifyTxRoom, nullptr, timeout - elapsed);
+    }
+
+    waiting = false;
+    return bus.txScheduler.hasRoom();
+}
+
 [[noreturn]] void CanManager::txTask(void* args)
 {
     configASSERT(args != nullptr);
@@ -240,9 +803,12 @@ void CanManager::transmitPacketOverCan(const SlCan::Packet& packet, bool isFromR
         SlCan::Packet packet;
         if (xQueueReceive(that.m_txQueue, &packet, portMAX_DELAY) == pdTRUE) {
             if (commandIsTransmit(packet.command)) {
+                packet.data.packetData.timestamp = Timestamp::nowUs();
                 // Send on CAN and USB.
                 that.transmitPacketOverCan(packet, false);
-                that.transmitPacketOverUsb(packet);
+                RxPacket toHost = {.packet = packet};
+                that.transmitPacketOverUsb(toHost);
+                that.transmitPacketOverGsUsb(toHost);
             }
         }
     }
@@ -258,56 +824,348 @@ void CanManager::transmitPacketOverCan(const SlCan::Packet& packet, bool isFromR
 
     LOGD(s_tag, "RX task started");
 
-    volatile bool t = true;
+    TickType_t    isoTpTicks = portMAX_DELAY;
+    volatile bool t          = true;
     while (t) {
-        RxPacket packet;
-        if (xQueueReceive(that.m_rxQueue, &packet, portMAX_DELAY) == pdTRUE) {
-            if (commandIsTransmit(packet.packet.command)) {
+        // The TX room bit belongs to waitForTxRoom, the others are consumed here.
+        // While frames are held for USB, wake up now and then in case the host left without a word. Otherwise, wake
+        // up at least as often as the bus load must be sampled, and when a bus is due for its recovery or an ISO-TP
+        // link has something to do.
+        uint32_t   notification = 0;
+        TickType_t timeout = uxQueueMessagesWaiting(that.m_usbBacklog) != 0 ? s_usbBacklogRetry : s_loadSamplePeriod;
+        timeout            = std::min({timeout, that.ticksUntilRecovery(), isoTpTicks});
+        xTaskNotifyWait(0,
+                        s_notifyRxPending | s_notifyFilters | s_notifyUsbRoom | s_notifyBusOff | s_notifyIsoTp,
+                        &notification,
+                        timeout);
+        if ((notification & s_notifyFilters) != 0) { that.updateHardwareFilters(); }
+        that.recoverBuses();
+        that.sampleBusLoad();
+
+        // Keep going until the rings are empty, packets can be pushed while we're draining them.
+        // The held frames go first each time, they're older than anything in the rings. The ISO-TP links answer the
+        // frames of each pass right away, the flow controls go out without waiting for the next wake up.
+        do {
+            isoTpTicks = that.m_isoTp.service();
+            that.drainUsbBacklog();
+            that.drainIsoTpToUsb();
+        } while (that.drainRxRings() != 0);
+    }
+
+    vTaskDelete(nullptr);
+    std::unreachable();
+}
+
+void CanManager::handleRxPacket(RxPacket packet)
+{
+    packet.dequeuedCycles = LatencyHistogram::nowCycles();
+
+    // The filter commands are applied in order with the frames that surround them.
+    if (packet.origin == Origin::Usb && commandIsFilter(packet.packet.command)) {
+        applyUsbFilter(packet.packet);
+        return;
+    }
+    if (packet.origin == Origin::Usb && packet.packet.command == SlCan::Command::SetBusStatusPeriod) {
+        // Applies to every bus, whichever channel it was sent for.
+        uint8_t period = packet.packet.data.busStatusPeriod;
+        if (period > 0x0F) { return; }
+        m_busStatusPeriod = period;
+        m_lastBusStatus   = xTaskGetTickCount();
+        return;
+    }
+    if (packet.origin == Origin::Usb && (packet.packet.command == SlCan::Command::SetPeriodicFrame ||
+                                         packet.packet.command == SlCan::Command::SetPeriodicTiming)) {
+        applyPeriodicCommand(packet.packet);
+        return;
+    }
+    if (packet.origin == Origin::Usb && (packet.packet.command == SlCan::Command::SetIsoTpLink ||
+                                         packet.packet.command == SlCan::Command::TransferIsoTpData)) {
+        applyIsoTpCommand(packet.packet);
+        return;
+    }
+    if (!commandIsTransmit(packet.packet.command)) { return; }
+    if (packet.origin == Origin::Usb || packet.origin == Origin::GsUsb) {
+        auto host = packet.origin == Origin::Usb ? HostSource::Usb : HostSource::GsUsb;
+        ++m_hostStats[static_cast<size_t>(host)].rxFrames;
+        m_traceLatency[static_cast<size_t>(TraceStage::HostToTask)].recordSince(packet.rxCycles);
+    }
+    else if (packet.origin == Origin::Can) {
+        m_traceLatency[static_cast<size_t>(TraceStage::CanRxToTask)].recordSince(packet.rxCycles);
+    }
+
 #define X(field) packet.packet.data.packetData.field
-                //                LOGD(s_tag,
-                //                     "Received packet on %s. ID: %#x, isExt: %d, isRem: %d, DLC: %d",
-                //                     originToStr(packet.origin),
-                //                     X(id),
-                //                     X(isExtended),
-                //                     X(isRemote),
-                //                     X(dataLen));
-                //                LOG_BUFFER_HEXDUMP_LEVEL(s_tag, Logging::Level::trace, &X(data[0]), X(dataLen));
-
-                if (packet.origin == Origin::Usb) {
-                    // Retransmit on CAN.
-                    that.transmitPacketOverCan(packet.packet, true);
-                }
-                else if (packet.origin == Origin::Can) {
-                    if (that.m_droppedCanPackets > 0) {
-                        LOGD(s_tag, "Dropped %d messages since last reception", that.m_droppedCanPackets);
-                        that.m_droppedCanPackets = 0;
-                    }
-                    that.transmitPacketOverUsb(packet.packet);
-                }
+    //                LOGD(s_tag,
+    //                     "Received packet on %s. ID: %#x, isExt: %d, isRem: %d, DLC: %d",
+    //                     originToStr(packet.origin),
+    //                     X(id),
+    //                     X(isExtended),
+    //                     X(isRemote),
+    //                     X(dataLen));
+    //                LOG_BUFFER_HEXDUMP_LEVEL(s_tag, Logging::Level::trace, &X(data[0]), X(dataLen));
+
+    auto& toScheduler = m_traceLatency[static_cast<size_t>(TraceStage::TaskToScheduler)];
+    if (packet.origin == Origin::Usb) {
+        // Retransmit on CAN.
+        if (transmitPacketOverCan(packet.packet, true)) { toScheduler.recordSince(packet.dequeuedCycles); }
+    }
+    else if (packet.origin == Origin::GsUsb) {
+        if (transmitPacketOverCan(packet.packet, true)) { toScheduler.recordSince(packet.dequeuedCycles); }
+        // The host holds on to the frame until it gets its echo, even if it got dropped on the way.
+        // The echo is dated when the frame got handed to the scheduler.
+        RxPacket echo                         = packet;
+        echo.packet.data.packetData.timestamp = Timestamp::nowUs();
+        transmitPacketOverGsUsb(echo);
+    }
+    else if (packet.origin == Origin::Can) {
+        Bus& bus = *m_buses[packet.packet.channel];
+        if (bus.droppedCanPackets > 0) {
+            LOGD(s_tag, "Bus %d: dropped %d messages since last reception", bus.channel, bus.droppedCanPackets);
+            bus.droppedCanPackets = 0;
+        }
+        // The filter only concerns the SLCAN host, the hardware might have let more frames through for the others.
+        // The frames of an ISO-TP link reach the SLCAN host as whole PDUs instead.
+        const auto& frame = packet.packet.data.packetData;
+        if (!m_isoTp.onFrame(packet.packet) && bus.usbFilter.accepts(frame.isExtended, frame.id)) {
+            transmitPacketOverUsb(packet);
+        }
+        transmitPacketOverGsUsb(packet);
+    }
 #undef X
-                void prv_read_can_received_msg(const SlCan::Packet& packet);
-                prv_read_can_received_msg(packet.packet);
-            }
+    // CANopen only lives on the first bus.
+    if (packet.packet.channel != 0) { return; }
+    void prv_read_can_received_msg(const SlCan::Packet& packet, uint8_t filterIndex);
+    prv_read_can_received_msg(packet.packet, packet.filterIndex);
+}
+
+uint32_t CanManager::readErrorCounters(Bus& bus)
+{
+    // Reading ECR clears CEL, which is why every read must accumulate it.
+    // Called from the tasks and from the error interrupt, this critical section works for both.
+    UBaseType_t mask   = taskENTER_CRITICAL_FROM_ISR();
+    uint32_t    ecr    = bus.can->Instance->ECR;
+    uint32_t    errors = (ecr & FDCAN_ECR_CEL_Msk) >> FDCAN_ECR_CEL_Pos;
+    bus.stats.busErrors += errors;
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+
+    bus.loadMeter.recordErrors(errors);
+    return ecr;
+}
+
+void CanManager::sampleBusLoad()
+{
+    TickType_t now = xTaskGetTickCount();
+    if (now - m_lastLoadSample < s_loadSamplePeriod) { return; }
+    m_lastLoadSample = now;
+
+    for (size_t i = 0; i < m_busCount; i++) {
+        readErrorCounters(*m_buses[i]);
+    }
+
+    uint8_t period = m_busStatusPeriod;
+    if (period == 0 || now - m_lastBusStatus < period * configTICK_RATE_HZ) { return; }
+    m_lastBusStatus = now;
+    transmitBusStatus();
+}
+
+void CanManager::transmitBusStatus()
+{
+    auto saturate = [](uint32_t value) { return static_cast<uint16_t>(std::min<uint32_t>(value, UINT16_MAX)); };
+    for (size_t i = 0; i < m_busCount; i++) {
+        auto load = m_buses[i]->loadMeter.measure();
+        transmitPacketOverUsb({.packet = SlCan::Packet::busStatus(static_cast<uint8_t>(i),
+                                                                   saturate(load.busyPermille),
+                                                                   saturate(load.framesPerSecond),
+                                                                   saturate(load.errorsPerSecond))});
+    }
+}
 
-            // Handle the packet.
+void CanManager::applyPeriodicCommand(const SlCan::Packet& packet)
+{
+    if (busFromChannel(packet.channel) == nullptr) {
+        LOGW(s_tag, "No bus on channel %d", packet.channel);
+        return;
+    }
+
+    bool applied = true;
+    if (packet.command == SlCan::Command::SetPeriodicFrame) {
+        // The table holds the frame as it will be sent.
+        const auto&   data  = packet.data.packetData;
+        SlCan::Packet frame = packet;
+        frame.command = SlCan::commandFromFrame(data.isExtended, data.isRemote, data.isFd, data.bitRateSwitch);
+        applied       = m_periodic.setFrame(frame);
+    }
+    else {
+        const auto& timing = packet.data.periodicTiming;
+        if (timing.clear) { m_periodic.clear(packet.channel); }
+        else if (timing.remove) {
+            applied = m_periodic.remove(packet.channel, timing.id, timing.isExtended);
+        }
+        else {
+            applied = m_periodic.setTiming(
+              packet.channel, timing.id, timing.isExtended, timing.periodUs, timing.phaseUs, timing.count);
         }
     }
 
-    vTaskDelete(nullptr);
-    std::unreachable();
+    if (!applied) { LOGW(s_tag, "Unable to apply periodic command '%c'", SlCan::commandToChar(packet.command)); }
+}
+
+bool CanManager::transmitPeriodicFromIrq(const SlCan::Packet& frame)
+{
+    Bus* bus = busFromChannel(frame.channel);
+    if (bus == nullptr) { return false; }
+
+    // While the bus is off, the frames would only pile up in the scheduler and go out late.
+    BusState state = bus->stats.state;
+    if (state == BusState::BusOff || state == BusState::Recovering) { return false; }
+    return bus->txScheduler.pushFromIrq(frame);
 }
 
-void CanManager::handleCanError()
+void CanManager::applyIsoTpCommand(const SlCan::Packet& packet)
 {
-    m_attemptsForCanPacket++;
-    if (m_attemptsForCanPacket >= s_maxAttemptsPerCanPacket) {
-        m_droppedCanPackets++;
-        // Figure out which buffer is currently the one being sent.
-        auto currBuffer = (m_can->Instance->TXFQS & FDCAN_TXFQS_TFGI_Msk) >> FDCAN_TXFQS_TFGI_Pos;
-        if (currBuffer == 0) {
-            // Can't figure out which specific mailbox causes issues, so fuck them all.
-            currBuffer = FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2;
+    if (busFromChannel(packet.channel) == nullptr) {
+        LOGW(s_tag, "No bus on channel %d", packet.channel);
+        return;
+    }
+
+    m_isoTp.handleHostCommand(packet);
+}
+
+bool CanManager::transmitIsoTpFrame(const SlCan::Packet& frame)
+{
+    Bus* bus = busFromChannel(frame.channel);
+    if (bus == nullptr) { return false; }
+
+    // The links can fill the scheduler in a single pass, half of it is left to the hosts. While the bus is off, the
+    // frames are refused until the link times out.
+    BusState state = bus->stats.state;
+    if (state == BusState::BusOff || state == BusState::Recovering ||
+        bus->txScheduler.pending() >= CanTxScheduler::s_capacity / 2) {
+        return false;
+    }
+    return bus->txScheduler.push(frame);
+}
+
+void CanManager::handleCanError(Bus& bus)
+{
+    // Only the errors of our own frames raise the transmit error counter, those of the other nodes aren't a reason to
+    // abort anything.
+    uint32_t ecr         = readErrorCounters(bus);
+    auto     tec         = static_cast<uint8_t>((ecr & FDCAN_ECR_TEC_Msk) >> FDCAN_ECR_TEC_Pos);
+    bool     isOwnError  = tec > bus.lastTxErrorCount;
+    bus.lastTxErrorCount = tec;
+    if (!isOwnError) { return; }
+
+    bus.attemptsForCanPacket++;
+    if (bus.attemptsForCanPacket >= s_maxAttemptsPerCanPacket) { abortActiveBufferFromIrq(bus); }
+}
+
+void CanManager::abortActiveBufferFromIrq(Bus& bus)
+{
+    bus.attemptsForCanPacket = 0;
+
+    // Only the frame being sent goes, the others are sent once it's out of the way. If it can't be figured out, the
+    // errors aren't from one of our frames and there's nothing to abort.
+    uint32_t active = bus.txScheduler.activeBufferFromIrq();
+    if (active == 0) { return; }
+
+    bus.droppedCanPackets++;
+    bus.stats.txAborted++;
+    HAL_FDCAN_AbortTxRequest(bus.can, active);
+}
+
+void CanManager::updateBusStateFromIrq(Bus& bus)
+{
+    uint32_t psr   = bus.can->Instance->PSR;
+    BusState state = BusState::ErrorActive;
+    if ((psr & FDCAN_PSR_BO) != 0) { state = BusState::BusOff; }
+    else if ((psr & FDCAN_PSR_EP) != 0) {
+        state = BusState::ErrorPassive;
+    }
+    else if ((psr & FDCAN_PSR_EW) != 0) {
+        state = BusState::ErrorWarning;
+    }
+
+    UBaseType_t mask    = taskENTER_CRITICAL_FROM_ISR();
+    BusState    current = bus.stats.state;
+    // The peripheral says it's off until the end of the recovery.
+    bool isOff = current == BusState::BusOff || current == BusState::Recovering;
+    if (state == current || (isOff && state == BusState::BusOff)) {
+        taskEXIT_CRITICAL_FROM_ISR(mask);
+        return;
+    }
+
+    if (state == BusState::BusOff) {
+        // The peripheral stopped by itself and stays stopped until the RX task starts the recovery. Each bus off that
+        // follows another without a frame getting through in between waits twice as long.
+        // The count is capped to keep the shift in range, the delay reaches its maximum well before.
+        bus.busOffTick    = xTaskGetTickCountFromISR();
+        bus.recoveryDelay = bus.busOffCount == 0
+                              ? 0
+                              : std::min<TickType_t>(s_busOffBackoffMin << (bus.busOffCount - 1), s_busOffBackoffMax);
+        if (bus.busOffCount < 16) { ++bus.busOffCount; }
+    }
+    setBusState(bus, state);
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+
+    if (state == BusState::BusOff) {
+        // The frame being sent is the one that failed, the others stay queued for when the bus is back.
+        abortActiveBufferFromIrq(bus);
+
+        BaseType_t woken = pdFALSE;
+        xTaskNotifyFromISR(m_rxTask, s_notifyBusOff, eSetBits, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+}
+
+void CanManager::setBusState(Bus& bus, BusState state)
+{
+    bus.stats.state = state;
+    ++bus.stats.transitions[static_cast<size_t>(state)];
+}
+
+void CanManager::recoverBuses()
+{
+    for (size_t i = 0; i < m_busCount; i++) {
+        Bus& bus = *m_buses[i];
+
+        taskENTER_CRITICAL();
+        bool isDue =
+          bus.stats.state == BusState::BusOff && xTaskGetTickCount() - bus.busOffTick >= bus.recoveryDelay;
+        if (isDue) {
+            // Clearing INIT makes the peripheral wait for 128 sequences of 11 recessive bits, after which it's back
+            // to error active with its counters cleared. The bus off interrupt tells when that happens.
+            setBusState(bus, BusState::Recovering);
+            bus.lastTxErrorCount = 0;
+            CLEAR_BIT(bus.can->Instance->CCCR, FDCAN_CCCR_INIT);
+        }
+        uint8_t    count = bus.busOffCount;
+        TickType_t delay = bus.recoveryDelay;
+        taskEXIT_CRITICAL();
+
+        if (isDue) {
+            LOGW(s_tag,
+                 "Bus %d: recovering from bus off #%d, after %lu ms",
+                 bus.channel,
+                 count,
+                 static_cast<unsigned long>(delay * portTICK_PERIOD_MS));
         }
-        HAL_FDCAN_AbortTxRequest(m_can, currBuffer);
     }
 }
+
+TickType_t CanManager::ticksUntilRecovery() const
+{
+    TickType_t ticks = portMAX_DELAY;
+    for (size_t i = 0; i < m_busCount; i++) {
+        const Bus& bus = *m_buses[i];
+
+        taskENTER_CRITICAL();
+        bool       isOff   = bus.stats.state == BusState::BusOff;
+        TickType_t elapsed = xTaskGetTickCount() - bus.busOffTick;
+        TickType_t delay   = bus.recoveryDelay;
+        taskEXIT_CRITICAL();
+
+        if (isOff) { ticks = std::min(ticks, elapsed >= delay ? 0 : delay - elapsed); }
+    }
+
+    return ticks;
+}
@@ -19,9 +19,18 @@
 #ifndef CEP_CAN_MANAGER_H
 #define CEP_CAN_MANAGER_H
 
+#include "acceptance_filter.h"
+#include "bus_load_meter.h"
+#include "can_tx_scheduler.h"
 #include "fdcan.h"
+#include "iso_tp.h"
+#include "latency_histogram.h"
+#include "periodic_transmitter.h"
+#include "slcan/parser.h"
 #include "slcan/slcan.h"
+#include "spsc_ring.h"
 #include "usbd_cdc_if.h"
+#include "usbd_gs_if.h"
 
 #include <logging/logger.h>
 
@@ -29,65 +38,354 @@
 #include <queue.h>
 #include <task.h>
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <initializer_list>
+#include <optional>
 
 
 class CanManager {
     static CanManager* s_instance;
-    struct [[gnu::packed]] RxPacket;
+
+    enum class Origin : uint8_t { Can = 0, Usb, GsUsb, Unknown };
+    static constexpr const char* originToStr(Origin origin)
+    {
+        switch (origin) {
+            case Origin::Can: return "CAN";
+            case Origin::Usb: return "USB";
+            case Origin::GsUsb: return "gs_usb";
+            case Origin::Unknown:
+            default: return "Unknown";
+        }
+    }
+
+    struct [[gnu::packed]] RxPacket {
+        SlCan::Packet packet;
+        Origin        origin         = Origin::Unknown;
+        uint8_t       filterIndex    = s_filterUnknown;    //!< Hardware filter that accepted the frame.
+        uint32_t      echoId         = GS_ECHO_ID_RX;      //!< Given by the gs_usb host, sent back with the frame.
+        uint32_t      rxCycles       = 0;    //!< Cycle count when the frame was read from the FDCAN or the USB.
+        uint32_t      dequeuedCycles = 0;    //!< Cycle count when the RX task took the packet out of its ring.
+    };
 
 public:
-    static bool        init(CDC_DeviceInfo* usb, FDCAN_HandleTypeDef* hcan);
+    //! Producers of the packets received from the hosts. Each of them has its own ring, so that every ring has a
+    //! single producer. Each bus has its own ring as well.
+    enum class HostSource : uint8_t { Usb = 0, GsUsb, Count };
+
+    //! Special values of the filter index that comes with the frames given to the CANopen stack.
+    static constexpr uint8_t s_filterNoMatch = 0xFE;    //!< Received on CAN, no hardware filter accepted it.
+    static constexpr uint8_t s_filterUnknown = 0xFF;    //!< Didn't go through the hardware filters.
+
+    //! What happens to the frames forwarded to the SLCAN host while the USB TX buffers are full.
+    enum class UsbOverflowPolicy : uint8_t {
+        Drop = 0,    //!< Dropped right away.
+        Hold,        //!< Held in a backlog until the host catches up, dropped once the backlog is full.
+    };
+
+    //! Legs of the path of a frame through the bridge, each with its own latency histogram. See getTraceLatency.
+    enum class TraceStage : uint8_t {
+        CanRxToTask = 0,     //!< FDCAN RX interrupt to the RX task.
+        TaskToUsb,           //!< RX task to the SLCAN TX buffer, including the time held in the backlog.
+        UsbToHost,           //!< SLCAN TX buffer to the end of its IN transfer, for the oldest data of each transfer.
+        TaskToGsUsb,         //!< RX task to the gs_usb TX queue.
+        GsUsbToHost,         //!< gs_usb TX queue to the end of the IN transfer, for every frame including echoes.
+        HostToTask,          //!< Reception over USB to the RX task, from both hosts.
+        TaskToScheduler,     //!< RX task to the TX scheduler, including the wait for room in it.
+        SchedulerToBus,      //!< TX scheduler to the end of the transmission on the bus, from every source.
+        Count
+    };
+
+    //! Fault confinement state of a bus, as seen by the peripheral, plus the steps of the recovery from bus off.
+    enum class BusState : uint8_t {
+        ErrorActive = 0,    //!< Both error counters below 96.
+        ErrorWarning,       //!< One of the error counters reached 96.
+        ErrorPassive,       //!< One of the error counters reached 128, error frames are recessive.
+        BusOff,             //!< The transmit error counter reached 256, waiting before starting the recovery.
+        Recovering,         //!< Waiting for the 128 sequences of 11 recessive bits before joining the bus again.
+        Count
+    };
+    static constexpr const char* busStateToStr(BusState state)
+    {
+        switch (state) {
+            case BusState::ErrorActive: return "active";
+            case BusState::ErrorWarning: return "warning";
+            case BusState::ErrorPassive: return "passive";
+            case BusState::BusOff: return "bus off";
+            case BusState::Recovering: return "recovering";
+            case BusState::Count:
+            default: return "Unknown";
+        }
+    }
+    static constexpr size_t s_busStateCount = static_cast<size_t>(BusState::Count);
+
+    //! Number of FDCAN peripherals that can be managed, one per gs_usb channel.
+    static constexpr size_t s_maxBusCount = GS_MAX_CHANNELS;
+
+    //! Counters of a bus since boot, and high-water marks since the last resetStats.
+    struct BusStats {
+        size_t rxFrames        = 0;    //!< Frames read from the FDCAN RX FIFO.
+        size_t txFrames        = 0;    //!< Frames sent on the bus.
+        size_t rxRingOverflows = 0;    //!< Frames dropped because the RX task didn't keep up.
+        size_t rxFifoOverruns  = 0;    //!< Frames overwritten in the FDCAN RX FIFO.
+        size_t txTimeouts      = 0;    //!< Frames dropped after waiting too long for room in the TX scheduler.
+        size_t txAborted       = 0;    //!< Frames aborted after failing too many times, or causing a bus off.
+        size_t txSkipped       = 0;    //!< Frames dropped right away, because the bus is off or the previous ones
+                                       //!< kept failing.
+        size_t txInvalid       = 0;    //!< Frames dropped by the TX scheduler because they have no valid header.
+        size_t busErrors       = 0;    //!< Protocol errors seen by the peripheral, from ECR.CEL.
+
+        size_t rxRingHighWater      = 0;    //!< Out of s_busRxRingSize.
+        size_t txSchedulerHighWater = 0;    //!< Out of CanTxScheduler::s_capacity.
+
+        BusState                            state       = BusState::ErrorActive;
+        std::array<size_t, s_busStateCount> transitions = {};    //!< Number of times each state was entered.
+
+        // State of the peripheral when the stats were taken, from ECR and PSR.
+        uint8_t txErrorCount  = 0;
+        uint8_t rxErrorCount  = 0;
+        uint8_t lastErrorCode = 0;    //!< FDCAN_PROTOCOL_ERROR_*.
+        bool    errorWarning  = false;
+        bool    errorPassive  = false;
+        bool    busOff        = false;
+    };
+
+    //! Same as BusStats, for the frames exchanged with a host.
+    struct HostStats {
+        size_t rxFrames        = 0;    //!< Frames received from the host.
+        size_t txFrames        = 0;    //!< Frames queued for the host.
+        size_t rxRingOverflows = 0;    //!< Packets dropped because the RX task didn't keep up.
+        size_t txDropped       = 0;    //!< Frames that didn't fit in the USB TX buffers or queue.
+        size_t rxRingHighWater = 0;    //!< Out of s_rxRingSize.
+    };
+
+    //! High-water marks of the queues that aren't tied to a bus or host, since the last resetStats.
+    struct QueueStats {
+        size_t txQueueHighWater    = 0;    //!< Out of s_txQueueSize.
+        size_t usbBacklogHighWater = 0;    //!< Out of s_usbBacklogSize.
+    };
+
+    static constexpr size_t s_txQueueSize     = 15;
+    static constexpr size_t s_usbBacklogSize  = 32;    //!< Frames held for the SLCAN host, see UsbOverflowPolicy.
+    static constexpr size_t s_rxRingSize      = 64;    //!< 96 bytes per item, must be a power of two.
+    static constexpr size_t s_busRxRingSize   = 64;    //!< Same, for each bus.
+    static constexpr size_t s_hostSourceCount = static_cast<size_t>(HostSource::Count);
+    static constexpr size_t s_traceStageCount = static_cast<size_t>(TraceStage::Count);
+
+    /**
+     * Creates the instance.
+     * @param usb The SLCAN interface.
+     * @param buses The FDCAN peripherals, the first one is channel 0 and belongs to CANopen.
+     */
+    static bool        init(CDC_DeviceInfo* usb, std::initializer_list<FDCAN_HandleTypeDef*> buses);
     static CanManager& get() { return *s_instance; }
 
-    // Sends on both CAN and USB.
+    // Sends on both CAN and USB, on the bus of the packet's channel.
     void transmit(const SlCan::Packet& packet);
     void transmitFromIrq(const SlCan::Packet& packet);
 
+    /**
+     * Starts a bus that isn't driven by CANopen: everything it receives goes to the hosts.
+     * @param channel Index of the bus, as given to init.
+     * @returns False if there's no such bus or the peripheral refused to start.
+     */
+    bool startBus(size_t channel);
+
+    [[nodiscard]] size_t busCount() const { return m_busCount; }
+    CanTxScheduler&      getTxScheduler(size_t channel = 0);
+
+    [[nodiscard]] BusStats           getBusStats(size_t channel);
+    [[nodiscard]] HostStats          getHostStats(HostSource host) const;
+    [[nodiscard]] QueueStats         getQueueStats() const;
+    //! Occupancy of a bus over the last second, by the frames it carried and the error frames.
+    [[nodiscard]] BusLoadMeter::Load getBusLoad(size_t channel);
+    //! Time from the FDCAN RX interrupt to the frame being queued for a host.
+    [[nodiscard]] const LatencyHistogram& getLatencyToHost(HostSource host) const
+    {
+        return m_latencyToHost[static_cast<size_t>(host)];
+    }
+    //! Frames sent on their own, set with 'p' and 'P'.
+    [[nodiscard]] PeriodicTransmitter::Stats getPeriodicStats() const { return m_periodic.getStats(); }
+    //! Time spent by the frames in a leg of their path, aggregated over every bus.
+    [[nodiscard]] const LatencyHistogram& getTraceLatency(TraceStage stage) const
+    {
+        return m_traceLatency[static_cast<size_t>(stage)];
+    }
+    //! Clears the high-water marks and the latency histograms, the counters keep going.
+    void resetStats();
+
+    void setUsbOverflowPolicy(UsbOverflowPolicy policy) { m_usbOverflowPolicy = policy; }
+    //! Frames that couldn't be forwarded to the SLCAN host since boot.
+    [[nodiscard]] size_t getUsbDroppedFrames() const { return m_hostTxDropped[static_cast<size_t>(HostSource::Usb)]; }
+
+    /**
+     * To be called once a peripheral is started, so that the USB acceptance filter gets programmed in it.
+     * @param hcan The peripheral.
+     * @param firstFreeStdFilter Standard filter elements before this one belong to the caller.
+     * @param needsStdCatchAll The caller wants the standard frames that match none of its elements, the USB filter
+     * must then leave them alone.
+     */
+    void onCanStarted(FDCAN_HandleTypeDef* hcan, uint32_t firstFreeStdFilter, bool needsStdCatchAll = false);
+
 private:
-    explicit CanManager(CDC_DeviceInfo* usb, FDCAN_HandleTypeDef* hcan);
+    //! Everything that belongs to a single FDCAN peripheral.
+    struct Bus {
+        Bus(FDCAN_HandleTypeDef* hcan, uint8_t channel);
+
+        FDCAN_HandleTypeDef* can           = nullptr;
+        uint8_t              channel       = 0;
+        uint32_t             bitTimeNs     = 0;    //!< Duration of a tick of the FDCAN timestamp counter.
+        uint32_t             dataBitTimeNs = 0;    //!< Duration of a bit in the data phase of the FD frames.
+
+        CanTxScheduler   txScheduler;    //!< Frames waiting for a TX buffer, ordered by priority.
+        AcceptanceFilter usbFilter;      //!< Frames forwarded to the SLCAN host, set with 'M', 'm' and 'f'.
+        BusLoadMeter     loadMeter;      //!< Fed by the RX interrupts, the scheduler and readErrorCounters.
+        std::atomic<uint32_t> firstFreeStdFilter = AcceptanceFilter::s_stdFilterCount;    //!< Given by onCanStarted.
+        std::atomic<bool>     needsStdCatchAll   = false;                                 //!< Given by onCanStarted.
+
+        //! Every frame goes through FIFO0, so that the hosts get them in the order of the bus.
+        SpscRing<RxPacket, s_busRxRingSize> rxRing;
+        size_t                              rxRingOverflows    = 0;    //!< Reset by the RX task.
+        size_t                              rxFifoMessagesLost = 0;    //!< Reset by the RX task.
+
+        size_t  droppedCanPackets    = 0;
+        uint8_t attemptsForCanPacket = 0;
+        uint8_t lastTxErrorCount     = 0;    //!< TEC when the last error was handled.
+
+        // The current state is in stats, with the number of times each state was entered.
+        uint8_t    busOffCount   = 0;    //!< Consecutive bus offs, reset once a frame gets through.
+        TickType_t busOffTick    = 0;    //!< When the bus went off.
+        TickType_t recoveryDelay = 0;    //!< How long to wait after busOffTick before starting the recovery.
+
+        BusStats stats;
+    };
+
+    explicit CanManager(CDC_DeviceInfo* usb, std::initializer_list<FDCAN_HandleTypeDef*> buses);
+
+    Bus* busFromHandle(const FDCAN_HandleTypeDef* hcan);
+    Bus* busFromChannel(size_t channel);
 
     friend void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef* hfdcan, uint32_t RxFifo0ITs);
-    friend void HAL_FDCAN_RxFifo1Callback(FDCAN_HandleTypeDef* hfdcan, uint32_t RxFifo1ITs);
     friend void HAL_FDCAN_TxBufferCompleteCallback(FDCAN_HandleTypeDef* hfdcan, uint32_t BufferIndexes);
+    friend void HAL_FDCAN_TxBufferAbortCallback(FDCAN_HandleTypeDef* hfdcan, uint32_t BufferIndexes);
     friend void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs);
     friend void HAL_FDCAN_ErrorCallback(FDCAN_HandleTypeDef* hfdcan);
-    void        receiveFromIrq(const RxPacket& packet);
+    void        enqueueRxPacket(HostSource source, const RxPacket& packet);
+    size_t      drainRxFifoFromIrq(Bus& bus);
+    void        notifyRxTaskFromIrq();
+    size_t      drainRxRings();
+    void        handleRxPacket(RxPacket packet);
+    uint32_t    readErrorCounters(Bus& bus);
+    void        sampleBusLoad();
+    void        transmitBusStatus();
+    void        applyPeriodicCommand(const SlCan::Packet& packet);
+    bool        transmitPeriodicFromIrq(const SlCan::Packet& frame);
+    void        applyIsoTpCommand(const SlCan::Packet& packet);
+    bool        transmitIsoTpFrame(const SlCan::Packet& frame);
+    void        updateBusStateFromIrq(Bus& bus);
+    void        setBusState(Bus& bus, BusState state);
+    void        recoverBuses();
+    TickType_t  ticksUntilRecovery() const;
 
-    void transmitPacketOverUsb(const SlCan::Packet& packet);
-    void transmitPacketOverCan(const SlCan::Packet& packet, bool isFromRxTask);
+    bool handleUsbCommand(const SlCan::Packet& packet);
+    void applyUsbFilter(const SlCan::Packet& packet);
+    void updateHardwareFilters();
+    void setUsbFraming(SlCan::Framing framing);
+    void setUsbTimestampMode(SlCan::TimestampMode mode);
+    [[nodiscard]] static uint32_t rxTimestampFromIrq(const Bus& bus,
+                                                     uint32_t   rxTimestamp,
+                                                     uint32_t   counter,
+                                                     uint32_t   now);
+    void transmitPacketOverUsb(const RxPacket& packet);
+    bool writePacketToUsb(const RxPacket& packet);
+    void drainUsbBacklog();
+    void drainIsoTpToUsb();
+    void transmitPacketOverGsUsb(const RxPacket& packet);
+    bool transmitPacketOverCan(const SlCan::Packet& packet, bool isFromRxTask);
+    bool waitForTxRoom(Bus& bus, bool isFromRxTask);
+    void notifyTxRoomFromIrq();
 
     [[noreturn]] static void txTask(void* args);
     [[noreturn]] static void rxTask(void* args);
 
-    void handleCanError();
+    void handleCanError(Bus& bus);
+    void abortActiveBufferFromIrq(Bus& bus);
 
 private:
     static constexpr const char*    s_tag   = "CAN";
     static constexpr Logging::Level s_level = Logging::Level::info;
 
 
-    CDC_DeviceInfo*      m_usb = nullptr;
-    FDCAN_HandleTypeDef* m_can = nullptr;
+    CDC_DeviceInfo* m_usb = nullptr;
+
+    std::array<std::optional<Bus>, s_maxBusCount> m_buses    = {};
+    size_t                                        m_busCount = 0;
+
+    PeriodicTransmitter m_periodic;    //!< Frames sent from the alarm of the microsecond clock, on any bus.
+    IsoTp               m_isoTp;       //!< Links opened by the SLCAN host, run by the RX task.
+
+    SlCan::Parser  m_usbParser;      //!< Reassembles the SLCAN lines received over USB.
+    //! How the frames are sent over USB, follows the framing of the parser.
+    std::atomic<SlCan::Framing> m_usbFraming = SlCan::Framing::Ascii;
+    //! Timestamps appended to the frames sent over USB, set with 'Z'.
+    std::atomic<SlCan::TimestampMode> m_usbTimestampMode = SlCan::TimestampMode::Disabled;
 
     static constexpr size_t s_txTaskStackSize = 384;
     static constexpr size_t s_txTaskPriority  = 7;
     TaskHandle_t            m_txTask          = nullptr;
-    static constexpr size_t s_txQueueSize     = 15;
     QueueHandle_t           m_txQueue         = nullptr;
 
     static constexpr size_t s_rxTaskStackSize = 512;
     static constexpr size_t s_rxTaskPriority  = 7;
     TaskHandle_t            m_rxTask          = nullptr;
-    static constexpr size_t s_rxQueueSize     = 150;    //!< 24 bytes per item, 18 bytes when gnu::packed.
-    QueueHandle_t           m_rxQueue         = nullptr;
 
-    static constexpr size_t s_maxDroppedCanPackets = 5;
-    size_t                  m_droppedCanPackets    = 0;
+    //! Bits used in the tasks' notification value.
+    static constexpr uint32_t s_notifyRxPending = 1UL << 0;    //!< At least one of the rx rings has data.
+    static constexpr uint32_t s_notifyTxRoom    = 1UL << 1;    //!< A TX buffer got freed.
+    static constexpr uint32_t s_notifyFilters   = 1UL << 2;    //!< The hardware filters must be programmed again.
+    static constexpr uint32_t s_notifyUsbRoom   = 1UL << 3;    //!< A USB TX buffer got freed.
+    static constexpr uint32_t s_notifyBusOff    = 1UL << 4;    //!< A bus went off, its recovery must be scheduled.
+    static constexpr uint32_t s_notifyIsoTp     = 1UL << 5;    //!< A TX buffer got freed while ISO-TP waits for one.
+
+    //! Frames waiting for room in the USB TX buffers, only drained by the RX task.
+    QueueHandle_t m_usbBacklog = nullptr;
+    //! How long the RX task waits for a USB TX buffer before checking on the host, in case it left.
+    static constexpr TickType_t s_usbBacklogRetry = pdMS_TO_TICKS(5);
+
+    //! How often the RX task reads the error counters, which saturate at 255 errors, for the bus load.
+    static constexpr TickType_t s_loadSamplePeriod = pdMS_TO_TICKS(100);
+    TickType_t                  m_lastLoadSample   = 0;
+    //! Seconds between two bus status lines sent to the SLCAN host, set with 'u'. 0 if they are disabled.
+    uint8_t    m_busStatusPeriod = 0;
+    TickType_t m_lastBusStatus   = 0;
 
+    std::atomic<UsbOverflowPolicy> m_usbOverflowPolicy        = UsbOverflowPolicy::Hold;
+    size_t                         m_usbDroppedFramesReported = 0;    //!< Last value logged by the RX task.
+
+    using HostRxRing = SpscRing<RxPacket, s_rxRingSize>;
+    std::array<HostRxRing, s_hostSourceCount> m_rxRings         = {};
+    std::array<size_t, s_hostSourceCount>     m_rxRingOverflows = {};    //!< Packets dropped because the ring was full.
+
+    //! Written by the RX task, and by the producers of the rings for the high-water marks.
+    std::array<HostStats, s_hostSourceCount> m_hostStats = {};
+    //! Written by both tasks.
+    std::array<std::atomic<size_t>, s_hostSourceCount> m_hostTxFrames  = {};
+    std::array<std::atomic<size_t>, s_hostSourceCount> m_hostTxDropped = {};
+    std::array<LatencyHistogram, s_hostSourceCount>    m_latencyToHost = {};
+    std::array<LatencyHistogram, s_traceStageCount>    m_traceLatency  = {};
+
+    std::atomic<size_t> m_txQueueHighWater    = 0;
+    std::atomic<size_t> m_usbBacklogHighWater = 0;
+
+    static constexpr size_t  s_maxDroppedCanPackets    = 5;
     static constexpr uint8_t s_maxAttemptsPerCanPacket = 5;
-    uint8_t                  m_attemptsForCanPacket    = 0;
+
+    //! Wait before recovering from the second bus off in a row, doubled at each of the next ones. The first recovery
+    //! starts right away, the peripheral already waits for the bus to be idle long enough.
+    static constexpr TickType_t s_busOffBackoffMin = pdMS_TO_TICKS(10);
+    static constexpr TickType_t s_busOffBackoffMax = pdMS_TO_TICKS(1000);
 
     bool m_rxTaskWaitingForTxRoom = false;
     bool m_txTaskWaitingForTxRoom = false;
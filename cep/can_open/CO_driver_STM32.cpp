@@ -30,9 +30,12 @@
  */
 #include "301/CO_driver.h"
 #include "CO_app_STM32.h"
+#include "CO_rxIndex.h"
 
 #include "can_manager.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 
 #pragma clang diagnostic push
@@ -48,6 +51,30 @@ static CO_CANmodule_t* CANModule_local = nullptr; /* Local instance of global CA
 #define CANID_MASK 0x07FF /*!< CAN standard ID mask */
 #define FLAG_RTR   0x8000 /*!< RTR flag, part of identifier */
 
+/* Number of standard filter elements. Receive buffer N uses filter element N, the ones past that are matched in
+ * software. */
+#define STD_FILTER_COUNT 28U
+
+/* Index of the receive buffers, so that messages are dispatched in constant time. It is only touched by the RX task,
+ * which rebuilds it before its next look up once a buffer changed, so that the receive buffers can be configured
+ * without locking the index. */
+static CO_rxIndex_t      rxIndex      = {};
+static std::atomic<bool> rxIndexStale = true;
+
+/**
+ * \brief           Find the receive buffer of a message, rebuilding the index first if a buffer changed
+ * \param[in]       CANmodule: CAN module instance
+ * \param[in]       ident: Identifier of the message, including the RTR flag
+ */
+static CO_CANrx_t* prvFindRxBuffer(CO_CANmodule_t* CANmodule, uint32_t ident)
+{
+    /* A buffer changing while the index is rebuilt marks it stale again, it is then rebuilt on the next look up */
+    if (rxIndexStale.exchange(false, std::memory_order_acquire)) {
+        CO_rxIndexBuild(&rxIndex, CANmodule->rxArray, CANmodule->rxSize);
+    }
+    return CO_rxIndexFind(&rxIndex, CANmodule->rxArray, CANmodule->rxSize, ident);
+}
+
 
 void* CO_alloc(size_t num, size_t size)
 {
@@ -77,6 +104,11 @@ void CO_CANsetNormalMode(CO_CANmodule_t* CANmodule)
     if (CANmodule->CANptr != nullptr) {
         if (HAL_FDCAN_Start(static_cast<CanopenNodeStm32*>(CANmodule->CANptr)->canHandle) == HAL_OK) {
             CANmodule->CANnormal = true;
+            /* The filter elements past our receive buffers are free for the USB acceptance filter. The receive buffers
+             * past the last element rely on the global filter accepting the frames no element matched. */
+            CanManager::get().onCanStarted(static_cast<CanopenNodeStm32*>(CANmodule->CANptr)->canHandle,
+                                           std::min<uint32_t>(CANmodule->rxSize, STD_FILTER_COUNT),
+                                           CANmodule->rxSize > STD_FILTER_COUNT);
         }
     }
 }
@@ -107,7 +139,7 @@ CO_ReturnError_t CO_CANmodule_init(CO_CANmodule_t* CANmodule,
     CANmodule->txSize            = txSize;
     CANmodule->CANerrorStatus    = 0;
     CANmodule->CANnormal         = false;
-    CANmodule->useCANrxFilters   = false; /* Do not use HW filters */
+    CANmodule->useCANrxFilters   = true; /* Configured in CO_CANrxBufferInit */
     CANmodule->bufferInhibitFlag = false;
     CANmodule->firstCANtxMessage = true;
     CANmodule->CANtxCount        = 0U;
@@ -123,24 +155,36 @@ CO_ReturnError_t CO_CANmodule_init(CO_CANmodule_t* CANmodule,
     for (uint16_t i = 0U; i < txSize; i++) {
         txArray[i].bufferFull = false;
     }
+    rxIndexStale.store(true, std::memory_order_release);
 
     /***************************************/
     /* STM32 related configuration */
     /***************************************/
     static_cast<CanopenNodeStm32*>(CANptr)->hwInitFunction();
 
+    /* Disable the filters of the previous configuration, the receive buffers will enable theirs */
+    for (uint32_t i = 0U; i < STD_FILTER_COUNT; i++) {
+        FDCAN_FilterTypeDef filter = {};
+        filter.IdType              = FDCAN_STANDARD_ID;
+        filter.FilterIndex         = i;
+        filter.FilterType          = FDCAN_FILTER_MASK;
+        filter.FilterConfig        = FDCAN_FILTER_DISABLE;
+        if (HAL_FDCAN_ConfigFilter(static_cast<CanopenNodeStm32*>(CANptr)->canHandle, &filter) != HAL_OK) {
+            return CO_ERROR_ILLEGAL_ARGUMENT;
+        }
+    }
+
     /*
      * Configure global filter that is used as last check if message did not pass any of other filters:
      *
-     * We do not rely on hardware filters in this example
-     * and are performing software filters instead
-     *
-     * Accept non-matching standard ID messages
-     * Reject non-matching extended ID messages
+     * Messages for our receive buffers are stored in FIFO0 by their filter, which tells which buffer they are for.
+     * Everything else still has to be forwarded over USB, so it is accepted in FIFO0 as well: a single FIFO keeps the
+     * frames in the order of the bus. Those only have to be matched against the receive buffers that didn't get a
+     * filter.
      */
     if (HAL_FDCAN_ConfigGlobalFilter(static_cast<CanopenNodeStm32*>(CANptr)->canHandle,
                                      FDCAN_ACCEPT_IN_RX_FIFO0,
-                                     FDCAN_ACCEPT_IN_RX_FIFO1,
+                                     FDCAN_ACCEPT_IN_RX_FIFO0,
                                      FDCAN_FILTER_REMOTE,
                                      FDCAN_FILTER_REMOTE) != HAL_OK) {
         return CO_ERROR_ILLEGAL_ARGUMENT;
@@ -148,8 +192,10 @@ CO_ReturnError_t CO_CANmodule_init(CO_CANmodule_t* CANmodule,
     /* Enable notifications */
     /* Activate the CAN notification interrupts */
     if (HAL_FDCAN_ActivateNotification(static_cast<CanopenNodeStm32*>(CANptr)->canHandle,
-                                       0 | FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO1_NEW_MESSAGE |
-                                         FDCAN_IT_TX_COMPLETE | FDCAN_IT_TX_FIFO_EMPTY | FDCAN_IT_BUS_OFF |
+                                       0 | FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO0_FULL |
+                                         FDCAN_IT_RX_FIFO0_MESSAGE_LOST |
+                                         FDCAN_IT_TX_COMPLETE | FDCAN_IT_TX_ABORT_COMPLETE | FDCAN_IT_TX_FIFO_EMPTY |
+                                         FDCAN_IT_BUS_OFF |
                                          FDCAN_IT_ARB_PROTOCOL_ERROR | FDCAN_IT_DATA_PROTOCOL_ERROR |
                                          FDCAN_IT_ERROR_PASSIVE | FDCAN_IT_ERROR_WARNING,
                                        FDCAN_TX_BUFFER0 | FDCAN_TX_BUFFER1 | FDCAN_TX_BUFFER2) != HAL_OK) {
@@ -194,7 +240,22 @@ CO_ReturnError_t CO_CANrxBufferInit(CO_CANmodule_t* CANmodule,
         buffer->mask  = (mask & CANID_MASK) | FLAG_RTR;
 
         /* Set CAN hardware module filter and mask. */
-        if (CANmodule->useCANrxFilters) { __NOP(); }
+        if (CANmodule->useCANrxFilters && index < STD_FILTER_COUNT) {
+            /* RTR can't be filtered in hardware, it is checked once the message is received */
+            FDCAN_FilterTypeDef filter = {};
+            filter.IdType              = FDCAN_STANDARD_ID;
+            filter.FilterIndex         = index;
+            filter.FilterType          = FDCAN_FILTER_MASK;
+            filter.FilterConfig        = FDCAN_FILTER_TO_RXFIFO0;
+            filter.FilterID1           = ident & CANID_MASK;
+            filter.FilterID2           = mask & CANID_MASK;
+            if (HAL_FDCAN_ConfigFilter(static_cast<CanopenNodeStm32*>(CANmodule->CANptr)->canHandle, &filter) !=
+                HAL_OK) {
+                ret = CO_ERROR_ILLEGAL_ARGUMENT;
+            }
+        }
+
+        rxIndexStale.store(true, std::memory_order_release);
     }
     else {
         ret = CO_ERROR_ILLEGAL_ARGUMENT;
@@ -316,7 +377,7 @@ void CO_CANmodule_process(CO_CANmodule_t* CANmodule)
 
         if (err & FDCAN_PSR_BO) {
             status |= CO_CAN_ERRTX_BUS_OFF;
-            // In this driver we expect that the controller is automatically handling the protocol exceptions.
+            // The peripheral doesn't recover by itself, CanManager restarts it once its back-off delay is over.
         }
         else {
             /* recalculate CANerrorStatus, first clear some flags */
@@ -340,40 +401,37 @@ void CO_CANmodule_process(CO_CANmodule_t* CANmodule)
  * \brief           Read message from RX FIFO
  * \param           hfdcan: pointer to an FDCAN_HandleTypeDef structure that contains
  *                      the configuration information for the specified FDCAN.
- * \param[in]       fifo: Fifo number to use for read
- * \param[in]       fifo_isrs: List of interrupts for respected FIFO
+ * \param[in]       packet: The received message
+ * \param[in]       filterIndex: Hardware filter that accepted the message, CanManager::s_filterNoMatch or
+ *                      CanManager::s_filterUnknown
  */
-void prv_read_can_received_msg(const SlCan::Packet& packet)
+void prv_read_can_received_msg(const SlCan::Packet& packet, uint8_t filterIndex)
 {
     CO_CANrxMsg_t rcvMsg;
     CO_CANrx_t*   buffer       = nullptr; /* receive message buffer from CO_CANmodule_t object. */
-    uint16_t      index        = 0;       /* index of received message */
     uint32_t      rcvMsgIdent  = 0;       /* identifier of the received message */
     uint8_t       messageFound = 0;
 
+    /* The stack only speaks classic CAN */
+    if (packet.data.packetData.isFd) { return; }
+
     /* Setup identifier (with RTR) and length */
     rcvMsg.ident = packet.data.packetData.id | (packet.data.packetData.isRemote ? FLAG_RTR : 0x00);
     rcvMsg.dlc   = packet.data.packetData.dataLen;
     memcpy(&rcvMsg.data[0], &packet.data.packetData.data[0], rcvMsg.dlc);
     rcvMsgIdent = rcvMsg.ident;
 
-    /*
-     * Hardware filters are not used for the moment
-     * \todo: Implement hardware filters...
-     */
-    if (CANModule_local->useCANrxFilters) { __BKPT(0); }
-    else {
-        /*
-         * We are not using hardware filters, hence it is necessary
-         * to manually match received message ID with all buffers
-         */
-        buffer = CANModule_local->rxArray;
-        for (index = CANModule_local->rxSize; index > 0U; --index, ++buffer) {
-            if (((rcvMsgIdent ^ buffer->ident) & buffer->mask) == 0U) {
-                messageFound = 1;
-                break;
-            }
-        }
+    if (CANModule_local->useCANrxFilters && filterIndex < STD_FILTER_COUNT &&
+        filterIndex < CANModule_local->rxSize) {
+        /* Filter N belongs to receive buffer N, only the RTR flag is left to be checked */
+        buffer = &CANModule_local->rxArray[filterIndex];
+        if (((rcvMsgIdent ^ buffer->ident) & buffer->mask) == 0U) { messageFound = 1; }
+    }
+
+    if (messageFound == 0U) {
+        /* Either no filter accepted the message, or it didn't go through the filters */
+        buffer       = prvFindRxBuffer(CANModule_local, rcvMsgIdent);
+        messageFound = buffer != nullptr ? 1U : 0U;
     }
 
     /* Call specific function, which will process the message */
@@ -0,0 +1,81 @@
+/**
+ * @file    CO_rxIndex.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Index of the CANopen receive buffers by identifier, so that messages are dispatched in constant time.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "CO_rxIndex.h"
+
+#include <cstring>
+
+/* CAN masks for identifiers */
+#define CANID_MASK 0x07FF /*!< CAN standard ID mask */
+
+extern "C" {
+
+void CO_rxIndexBuild(CO_rxIndex_t* index, const CO_CANrx_t* rxArray, uint16_t rxSize)
+{
+    memset(&index->byId[0], CO_RX_INDEX_NONE, sizeof(index->byId));
+    index->maskedCount = 0U;
+    index->incomplete  = rxSize >= CO_RX_INDEX_NONE;
+
+    for (uint16_t i = 0U; i < rxSize && !index->incomplete; ++i) {
+        const CO_CANrx_t* buffer = &rxArray[i];
+        if (buffer->CANrx_callback == nullptr) { continue; }
+
+        if ((buffer->mask & CANID_MASK) == CANID_MASK) {
+            /* Keep the first buffer for an identifier, like the linear scan would */
+            uint8_t* entry = &index->byId[buffer->ident & CANID_MASK];
+            if (*entry == CO_RX_INDEX_NONE) { *entry = static_cast<uint8_t>(i); }
+        }
+        else if (index->maskedCount < CO_RX_INDEX_MASKED_MAX) {
+            index->masked[index->maskedCount++] = static_cast<uint8_t>(i);
+        }
+        else {
+            index->incomplete = true;
+        }
+    }
+}
+
+CO_CANrx_t* CO_rxIndexScan(CO_CANrx_t* rxArray, uint16_t rxSize, uint32_t ident)
+{
+    for (uint16_t i = 0U; i < rxSize; ++i) {
+        CO_CANrx_t* buffer = &rxArray[i];
+        if (buffer->CANrx_callback != nullptr && ((ident ^ buffer->ident) & buffer->mask) == 0U) { return buffer; }
+    }
+    return nullptr;
+}
+
+CO_CANrx_t* CO_rxIndexFind(const CO_rxIndex_t* index, CO_CANrx_t* rxArray, uint16_t rxSize, uint32_t ident)
+{
+    if (index->incomplete) { return CO_rxIndexScan(rxArray, rxSize, ident); }
+
+    /* A buffer with a mask wins if it comes before the one matching the exact identifier */
+    uint8_t found = index->byId[ident & CANID_MASK];
+    for (uint8_t i = 0U; i < index->maskedCount && index->masked[i] < found; ++i) {
+        const CO_CANrx_t* buffer = &rxArray[index->masked[i]];
+        if (((ident ^ buffer->ident) & buffer->mask) == 0U) {
+            found = index->masked[i];
+            break;
+        }
+    }
+    if (found == CO_RX_INDEX_NONE || found >= rxSize) { return nullptr; }
+
+    CO_CANrx_t* buffer = &rxArray[found];
+    if (((ident ^ buffer->ident) & buffer->mask) != 0U) {
+        /* Only the RTR flag differs, or the buffer changed since the index was built, another one could still match */
+        return CO_rxIndexScan(rxArray, rxSize, ident);
+    }
+    return buffer;
+}
+}
@@ -0,0 +1,76 @@
+/**
+ * @file    CO_rxIndex.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Index of the CANopen receive buffers by identifier, so that messages are dispatched in constant time.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_CAN_OPEN_CO_RX_INDEX_H
+#define CEP_CAN_OPEN_CO_RX_INDEX_H
+
+#include "CO_driver_target.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CO_RX_INDEX_NONE       0xFFU   /*!< No receive buffer for that identifier */
+#define CO_RX_INDEX_MASKED_MAX 16U     /*!< Maximum number of receive buffers that match more than one identifier */
+#define CO_RX_INDEX_ID_COUNT   0x800U  /*!< Number of standard identifiers */
+
+/**
+ * \brief           Receive buffers that can match each standard identifier
+ *
+ * Gives the same result as matching the receive buffers one by one in order, the first match winning. When it can't
+ * hold every buffer, it is marked incomplete and the look up falls back on that linear scan.
+ */
+typedef struct {
+    uint8_t byId[CO_RX_INDEX_ID_COUNT];     /*!< Buffer matching exactly that identifier */
+    uint8_t masked[CO_RX_INDEX_MASKED_MAX]; /*!< Buffers with a mask, in increasing order */
+    uint8_t maskedCount;                    /*!< Number of buffers in masked */
+    bool_t  incomplete;                     /*!< Fall back on a linear scan if the index can't hold everything */
+} CO_rxIndex_t;
+
+/**
+ * \brief           Build the index of the receive buffers
+ * \param[out]      index: Index to build
+ * \param[in]       rxArray: Receive buffers, the ones without a callback are ignored
+ * \param[in]       rxSize: Number of receive buffers
+ */
+void CO_rxIndexBuild(CO_rxIndex_t* index, const CO_CANrx_t* rxArray, uint16_t rxSize);
+
+/**
+ * \brief           Linearly match a message with the receive buffers, the first match wins
+ * \param[in]       rxArray: Receive buffers
+ * \param[in]       rxSize: Number of receive buffers
+ * \param[in]       ident: Identifier of the message, including the RTR flag
+ * \return          The receive buffer, NULL if none matches
+ */
+CO_CANrx_t* CO_rxIndexScan(CO_CANrx_t* rxArray, uint16_t rxSize, uint32_t ident);
+
+/**
+ * \brief           Find the receive buffer of a message, gives the same result as CO_rxIndexScan
+ * \param[in]       index: Index built from the receive buffers
+ * \param[in]       rxArray: Receive buffers
+ * \param[in]       rxSize: Number of receive buffers
+ * \param[in]       ident: Identifier of the message, including the RTR flag
+ * \return          The receive buffer, NULL if none matches
+ */
+CO_CANrx_t* CO_rxIndexFind(const CO_rxIndex_t* index, CO_CANrx_t* rxArray, uint16_t rxSize, uint32_t ident);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CEP_CAN_OPEN_CO_RX_INDEX_H */
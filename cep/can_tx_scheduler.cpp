@@ -0,0 +1,212 @@
+/**
+ * @file    can_tx_scheduler.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-17
+ * @brief   Orders the frames waiting to be sent on CAN by priority.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "can_tx_scheduler.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+CanTxScheduler::CanTxScheduler(FDCAN_HandleTypeDef* hcan) : m_can(hcan)
+{
+    configASSERT(hcan != nullptr);
+    configASSERT(hcan->Init.TxFifoQueueMode == FDCAN_TX_QUEUE_OPERATION && "Priorities need the TX queue mode");
+
+    // The cycle counter is used to timestamp the frames.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+bool CanTxScheduler::push(const SlCan::Packet& packet)
+{
+    taskENTER_CRITICAL();
+    bool pushed = insert(packet);
+    taskEXIT_CRITICAL();
+    return pushed;
+}
+
+bool CanTxScheduler::pushFromIrq(const SlCan::Packet& packet)
+{
+    UBaseType_t mask   = taskENTER_CRITICAL_FROM_ISR();
+    bool        pushed = insert(packet);
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+    return pushed;
+}
+
+void CanTxScheduler::onTxDoneFromIrq(uint32_t bufferIndexes, bool sent)
+{
+    // The tasks write m_inFlight when they refill the buffers, it can't be read outside of the critical section.
+    UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+    if (sent) {
+        uint32_t timestamp   = now();
+        uint32_t cyclesPerUs = SystemCoreClock / 1'000'000;
+        for (size_t i = 0; i < s_bufferCount; i++) {
+            if ((bufferIndexes & (1UL << i)) == 0) { continue; }
+
+            auto& stats   = m_latency[priorityClass(m_inFlight[i].key)];
+            auto  latency = (timestamp - m_inFlight[i].enqueuedAt) / cyclesPerUs;
+            ++stats.count;
+            stats.totalUs += latency;
+            if (latency > stats.maxUs) { stats.maxUs = latency; }
+            if (m_histogram != nullptr) { m_histogram->record(latency); }
+            if (m_loadMeter != nullptr) { m_loadMeter->recordFrame(m_inFlight[i].bits); }
+        }
+    }
+
+    refill();
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
+uint32_t CanTxScheduler::activeBufferFromIrq() const
+{
+    uint32_t pending = m_can->Instance->TXBRP;
+    uint32_t active  = 0;
+    uint32_t bestKey = UINT32_MAX;
+    for (size_t i = 0; i < s_bufferCount; i++) {
+        // With equal identifiers, the hardware sends the lowest buffer first.
+        if ((pending & (1UL << i)) != 0 && m_inFlight[i].key < bestKey) {
+            bestKey = m_inFlight[i].key;
+            active  = 1UL << i;
+        }
+    }
+
+    return active;
+}
+
+CanTxScheduler::LatencyStats CanTxScheduler::getLatencyStats(size_t priorityClass) const
+{
+    configASSERT(priorityClass < s_priorityClassCount);
+    taskENTER_CRITICAL();
+    LatencyStats stats = m_latency[priorityClass];
+    taskEXIT_CRITICAL();
+    return stats;
+}
+
+void CanTxScheduler::resetLatencyStats()
+{
+    taskENTER_CRITICAL();
+    m_latency = {};
+    taskEXIT_CRITICAL();
+}
+
+uint32_t CanTxScheduler::arbitrationKey(const SlCan::Packet& packet)
+{
+    // Same order as the bits on the wire: base identifier, IDE (standard frames win), then the extension.
+    const auto& frame = packet.data.packetData;
+    if (!frame.isExtended) { return (frame.id & 0x7FFUL) << 19; }
+    return ((frame.id >> 18) & 0x7FFUL) << 19 | 1UL << 18 | (frame.id & 0x3FFFFUL);
+}
+
+size_t CanTxScheduler::priorityClass(uint32_t key)
+{
+    return key >> 28;
+}
+
+bool CanTxScheduler::isBefore(const Entry& a, const Entry& b)
+{
+    if (a.key != b.key) { return a.key < b.key; }
+    // Handles the wrap-around of the sequence.
+    return static_cast<int32_t>(a.sequence - b.sequence) < 0;
+}
+
+uint32_t CanTxScheduler::now()
+{
+    return DWT->CYCCNT;
+}
+
+bool CanTxScheduler::insert(const SlCan::Packet& packet)
+{
+    if (m_count == s_capacity) { return false; }
+
+    Entry entry = {
+      .key        = arbitrationKey(packet),
+      .sequence   = m_sequence++,
+      .enqueuedAt = now(),
+      .packet     = packet,
+    };
+
+    // Sift up.
+    size_t i = m_count++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!isBefore(entry, m_heap[parent])) { break; }
+        m_heap[i] = m_heap[parent];
+        i         = parent;
+    }
+    m_heap[i] = entry;
+
+    refill();
+    if (m_count > m_highWater) { m_highWater = m_count; }
+    return true;
+}
+
+void CanTxScheduler::refill()
+{
+    while (m_count != 0 && (m_can->Instance->TXFQS & FDCAN_TXFQS_TFQF) == 0) {
+        const Entry& top = m_heap[0];
+        // In queue mode, the hardware doesn't know in which order frames with the same identifier were written.
+        // Wait for the previous one to be sent, it has the highest priority of the buffers anyways.
+        if (isKeyInFlight(top.key)) { break; }
+
+        auto header = top.packet.toFDCANTxHeader();
+        if (!header.has_value()) {
+            // Will never be sendable.
+            ++m_invalidFrames;
+            popTop();
+            continue;
+        }
+        if (HAL_FDCAN_AddMessageToTxFifoQ(m_can, &header.value(), &top.packet.data.packetData.data[0]) != HAL_OK) {
+            // The peripheral is busy, leave the frame queued and try again once a buffer frees up.
+            break;
+        }
+
+        uint32_t buffer   = HAL_FDCAN_GetLatestTxFifoQRequestBuffer(m_can);
+        auto     index    = static_cast<size_t>(__builtin_ctz(buffer));
+        m_inFlight[index] = {
+          .key        = top.key,
+          .enqueuedAt = top.enqueuedAt,
+          .bits       = BusLoadMeter::frameBits(top.packet),
+        };
+        popTop();
+    }
+}
+
+bool CanTxScheduler::isKeyInFlight(uint32_t key) const
+{
+    uint32_t pending = m_can->Instance->TXBRP;
+    for (size_t i = 0; i < s_bufferCount; i++) {
+        if ((pending & (1UL << i)) != 0 && m_inFlight[i].key == key) { return true; }
+    }
+
+    return false;
+}
+
+void CanTxScheduler::popTop()
+{
+    Entry last = m_heap[--m_count];
+    if (m_count == 0) { return; }
+
+    // Sift down.
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= m_count) { break; }
+        if (child + 1 < m_count && isBefore(m_heap[child + 1], m_heap[child])) { ++child; }
+        if (!isBefore(m_heap[child], last)) { break; }
+        m_heap[i] = m_heap[child];
+        i         = child;
+    }
+    m_heap[i] = last;
+}
@@ -0,0 +1,140 @@
+/**
+ * @file    can_tx_scheduler.h
+ * @author  Samuel Martel
+ * @date    2024-04-17
+ * @brief   Orders the frames waiting to be sent on CAN by priority.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_CAN_TX_SCHEDULER_H
+#define CEP_CAN_TX_SCHEDULER_H
+
+#include "bus_load_meter.h"
+#include "fdcan.h"
+#include "latency_histogram.h"
+#include "slcan/slcan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Keeps the frames that don't fit in the FDCAN's TX buffers in a binary heap, ordered like they would be by the bus'
+ * arbitration, and moves the most important ones to the hardware every time a buffer frees up.
+ *
+ * The peripheral must be configured in TX queue mode, so that it also sends the content of its TX buffers by
+ * priority instead of by order of arrival. Frames with the same identifier are always sent in the order they were
+ * pushed.
+ *
+ * The heap is shared by the tasks and the interrupts, it is only touched inside of critical sections.
+ */
+class CanTxScheduler {
+public:
+    //! Frames are grouped by the two most significant bits of their 11-bit base identifier.
+    static constexpr size_t s_priorityClassCount = 4;
+    static constexpr size_t s_capacity           = 32;    //!< Frames that can wait for a TX buffer.
+
+    struct LatencyStats {
+        uint32_t count   = 0;    //!< Number of frames that were sent.
+        uint32_t maxUs   = 0;    //!< Longest time between push and the end of the transmission.
+        uint64_t totalUs = 0;    //!< Sum of the latencies, to compute the average.
+    };
+
+    explicit CanTxScheduler(FDCAN_HandleTypeDef* hcan);
+
+    /**
+     * Queues a frame, then sends it right away if there's room in the TX buffers.
+     * @param packet The frame, must be a Transmit* command.
+     * @returns False if there's no room for it.
+     */
+    bool push(const SlCan::Packet& packet);
+    //! Same as push, from an interrupt.
+    bool pushFromIrq(const SlCan::Packet& packet);
+
+    /**
+     * To be called when the transmission of frames completed or got aborted, refills the TX buffers.
+     * @param bufferIndexes Mask of the TX buffers that are now free.
+     * @param sent True if the frames were sent, false if they were aborted.
+     */
+    void onTxDoneFromIrq(uint32_t bufferIndexes, bool sent);
+
+    /**
+     * Gets the TX buffer that the peripheral is currently trying to send.
+     * @returns Mask of that buffer, 0 if none are pending.
+     */
+    [[nodiscard]] uint32_t activeBufferFromIrq() const;
+
+    [[nodiscard]] bool   hasRoom() const { return m_count < s_capacity; }
+    [[nodiscard]] size_t pending() const { return m_count; }
+    //! Frames dropped because they can't be turned into a TX header.
+    [[nodiscard]] size_t invalidFrames() const { return m_invalidFrames; }
+
+    //! Most frames that waited for a TX buffer at once, out of s_capacity.
+    [[nodiscard]] size_t highWater() const { return m_highWater; }
+    void                 resetHighWater() { m_highWater = m_count; }
+
+    /**
+     * Gets a copy of the latency counters of a priority class.
+     * @param priorityClass Class, between 0 (highest priority) and s_priorityClassCount - 1.
+     */
+    [[nodiscard]] LatencyStats getLatencyStats(size_t priorityClass) const;
+    void                       resetLatencyStats();
+
+    //! Also records the latency of every frame sent in a histogram, which can be shared by several schedulers.
+    void setLatencyHistogram(LatencyHistogram* histogram) { m_histogram = histogram; }
+    //! Adds the frames sent to the load of the bus.
+    void setBusLoadMeter(BusLoadMeter* meter) { m_loadMeter = meter; }
+
+private:
+    struct Entry {
+        uint32_t      key;           //!< Arbitration order, lower goes first.
+        uint32_t      sequence;      //!< Order of arrival, for frames with the same key.
+        uint32_t      enqueuedAt;    //!< Cycle count at the time of push.
+        SlCan::Packet packet;
+    };
+
+    struct InFlight {
+        uint32_t                key;
+        uint32_t                enqueuedAt;
+        BusLoadMeter::FrameBits bits;
+    };
+
+    static uint32_t arbitrationKey(const SlCan::Packet& packet);
+    static size_t   priorityClass(uint32_t key);
+    static bool     isBefore(const Entry& a, const Entry& b);
+    static uint32_t now();
+
+    //! Must be called inside of a critical section.
+    bool insert(const SlCan::Packet& packet);
+    void refill();
+    bool isKeyInFlight(uint32_t key) const;
+    void popTop();
+
+private:
+    static constexpr size_t s_bufferCount = 3;    //!< Number of TX buffers of the peripheral.
+
+    FDCAN_HandleTypeDef* m_can = nullptr;
+
+    std::array<Entry, s_capacity> m_heap          = {};
+    size_t                        m_count         = 0;
+    size_t                        m_highWater     = 0;
+    uint32_t                      m_sequence      = 0;
+    size_t                        m_invalidFrames = 0;
+
+    std::array<InFlight, s_bufferCount>            m_inFlight  = {};    //!< What was written in each TX buffer.
+    std::array<LatencyStats, s_priorityClassCount> m_latency   = {};
+    LatencyHistogram*                              m_histogram = nullptr;
+    BusLoadMeter*                                  m_loadMeter = nullptr;
+};
+
+#endif    // CEP_CAN_TX_SCHEDULER_H
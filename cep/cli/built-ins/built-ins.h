@@ -19,6 +19,9 @@
 #ifndef CEP_CLI_BUILT_INS_BUILT_INS_H
 #define CEP_CLI_BUILT_INS_BUILT_INS_H
 
+#include "can_load.h"
+#include "can_stats.h"
+#include "can_trace.h"
 #include "runtime_stats.h"
 #include "tasks.h"
 
@@ -28,6 +31,9 @@ namespace cli {
 constexpr std::array s_builtInCommands = {
   s_runtimeStats,
   s_tasks,
+  s_canStats,
+  s_canTrace,
+  s_canLoad,
 };
 }
 
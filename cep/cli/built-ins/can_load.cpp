@@ -0,0 +1,50 @@
+/**
+ * @file    can_load.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "can_load.h"
+
+#include "can_manager.h"
+
+#include <cstdio>
+
+namespace cli {
+namespace {
+// Every call of the command writes the line of a bus.
+size_t bus = 0;
+}    // namespace
+
+BaseType_t canLoadCommand(char* writeBuffer, size_t writeBufferLen, [[maybe_unused]] const char* commandStr)
+{
+    auto& manager = CanManager::get();
+    auto  load    = manager.getBusLoad(bus);
+    std::snprintf(writeBuffer,
+                  writeBufferLen,
+                  "Bus %u: load %lu.%lu%%, %lu frames/s, %lu error frames/s, over %lu ms\r\n",
+                  static_cast<unsigned>(bus),
+                  static_cast<unsigned long>(load.busyPermille / 10),
+                  static_cast<unsigned long>(load.busyPermille % 10),
+                  static_cast<unsigned long>(load.framesPerSecond),
+                  static_cast<unsigned long>(load.errorsPerSecond),
+                  static_cast<unsigned long>(load.windowUs / 1000));
+
+    if (++bus >= manager.busCount()) {
+        bus = 0;
+        return pdFALSE;
+    }
+    return pdTRUE;
+}
+}    // namespace cli
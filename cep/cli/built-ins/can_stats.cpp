@@ -0,0 +1,219 @@
+/**
+ * @file    can_stats.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "can_stats.h"
+
+#include "can_manager.h"
+#include "histogram_text.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace cli {
+namespace {
+using HostSource = CanManager::HostSource;
+
+constexpr std::array<const char*, CanManager::s_hostSourceCount> s_hostNames = {"SLCAN", "gs_usb"};
+
+// Every call of the command writes one section, they must each fit in the output buffer.
+constexpr size_t s_sectionsPerBus  = 2;
+constexpr size_t s_sectionsPerHost = 3;    // Traffic, then each half of the latency histogram.
+
+struct Counts {
+    size_t rx = 0;
+    size_t tx = 0;
+};
+
+// The rates are computed over the time since the previous call of the command.
+size_t                                            section        = 0;
+TickType_t                                        lastTick       = 0;
+TickType_t                                        elapsedTicks   = 0;
+std::array<Counts, CanManager::s_maxBusCount>     lastBusCounts  = {};
+std::array<Counts, CanManager::s_hostSourceCount> lastHostCounts = {};
+
+unsigned perSecond(size_t count, size_t& last)
+{
+    size_t delta = count - last;
+    last         = count;
+    if (elapsedTicks == 0) { return 0; }
+    return static_cast<unsigned>(static_cast<uint64_t>(delta) * configTICK_RATE_HZ / elapsedTicks);
+}
+
+int writeHeader(char* buf, size_t len)
+{
+    TickType_t now = xTaskGetTickCount();
+    elapsedTicks   = now - lastTick;
+    lastTick       = now;
+
+    auto queues   = CanManager::get().getQueueStats();
+    auto periodic = CanManager::get().getPeriodicStats();
+    return std::snprintf(buf,
+                         len,
+                         "Rates over the last %lu ms\r\nHigh-water: TX queue %u/%u, USB backlog %u/%u\r\n"
+                         "Periodic frames: sent %u, missed %u\r\n",
+                         static_cast<unsigned long>(elapsedTicks * portTICK_PERIOD_MS),
+                         static_cast<unsigned>(queues.txQueueHighWater),
+                         static_cast<unsigned>(CanManager::s_txQueueSize),
+                         static_cast<unsigned>(queues.usbBacklogHighWater),
+                         static_cast<unsigned>(CanManager::s_usbBacklogSize),
+                         static_cast<unsigned>(periodic.sent),
+                         static_cast<unsigned>(periodic.missed));
+}
+
+int writeBusTraffic(char* buf, size_t len, size_t channel)
+{
+    auto  stats = CanManager::get().getBusStats(channel);
+    auto& last  = lastBusCounts[channel];
+    return std::snprintf(
+      buf,
+      len,
+      "Bus %u: rx %u (%u/s), tx %u (%u/s)\r\n"
+      "  drops: rx ring %u, rx FIFO %u, tx timeout %u, tx aborted %u, tx skipped %u, tx invalid %u\r\n"
+      "  high-water: rx ring %u/%u, scheduler %u/%u\r\n",
+      static_cast<unsigned>(channel),
+      static_cast<unsigned>(stats.rxFrames),
+      perSecond(stats.rxFrames, last.rx),
+      static_cast<unsigned>(stats.txFrames),
+      perSecond(stats.txFrames, last.tx),
+      static_cast<unsigned>(stats.rxRingOverflows),
+      static_cast<unsigned>(stats.rxFifoOverruns),
+      static_cast<unsigned>(stats.txTimeouts),
+      static_cast<unsigned>(stats.txAborted),
+      static_cast<unsigned>(stats.txSkipped),
+      static_cast<unsigned>(stats.txInvalid),
+      static_cast<unsigned>(stats.rxRingHighWater),
+      static_cast<unsigned>(CanManager::s_busRxRingSize),
+      static_cast<unsigned>(stats.txSchedulerHighWater),
+      static_cast<unsigned>(CanTxScheduler::s_capacity));
+}
+
+int writeBusErrors(char* buf, size_t len, size_t channel)
+{
+    using BusState = CanManager::BusState;
+    auto stats     = CanManager::get().getBusStats(channel);
+    auto entered   = [&stats](BusState state) {
+        return static_cast<unsigned>(stats.transitions[static_cast<size_t>(state)]);
+    };
+    return std::snprintf(buf,
+                         len,
+                         "  errors: %u, TEC %u, REC %u, last %u%s%s%s\r\n"
+                         "  state: %s, entered warning %u, passive %u, bus off %u, recovering %u, active %u\r\n",
+                         static_cast<unsigned>(stats.busErrors),
+                         stats.txErrorCount,
+                         stats.rxErrorCount,
+                         stats.lastErrorCode,
+                         stats.errorWarning ? ", warning" : "",
+                         stats.errorPassive ? ", passive" : "",
+                         stats.busOff ? ", BUS OFF" : "",
+                         CanManager::busStateToStr(stats.state),
+                         entered(BusState::ErrorWarning),
+                         entered(BusState::ErrorPassive),
+                         entered(BusState::BusOff),
+                         entered(BusState::Recovering),
+                         entered(BusState::ErrorActive));
+}
+
+int writeHostTraffic(char* buf, size_t len, size_t host)
+{
+    auto  stats = CanManager::get().getHostStats(static_cast<HostSource>(host));
+    auto& last  = lastHostCounts[host];
+    return std::snprintf(buf,
+                         len,
+                         "%s: rx %u (%u/s), tx %u (%u/s)\r\n"
+                         "  drops: rx ring %u, tx %u\r\n"
+                         "  high-water: rx ring %u/%u\r\n",
+                         s_hostNames[host],
+                         static_cast<unsigned>(stats.rxFrames),
+                         perSecond(stats.rxFrames, last.rx),
+                         static_cast<unsigned>(stats.txFrames),
+                         perSecond(stats.txFrames, last.tx),
+                         static_cast<unsigned>(stats.rxRingOverflows),
+                         static_cast<unsigned>(stats.txDropped),
+                         static_cast<unsigned>(stats.rxRingHighWater),
+                         static_cast<unsigned>(CanManager::s_rxRingSize));
+}
+
+int writeHostLatency(char* buf, size_t len, size_t host, bool upperHalf)
+{
+    auto histogram = CanManager::get().getLatencyToHost(static_cast<HostSource>(host)).snapshot();
+
+    int written = 0;
+    if (!upperHalf) {
+        written = std::snprintf(buf,
+                                len,
+                                "  CAN to %s latency (us): %lu frames, max %lu\r\n",
+                                s_hostNames[host],
+                                static_cast<unsigned long>(histogram.count),
+                                static_cast<unsigned long>(histogram.maxUs));
+    }
+
+    if (static_cast<size_t>(written) < len) {
+        written += writeHistogramHalf(buf + written, len - written, histogram, upperHalf);
+    }
+
+    return written;
+}
+}    // namespace
+
+BaseType_t canStatsCommand(char* writeBuffer, size_t writeBufferLen, const char* commandStr)
+{
+    auto& manager = CanManager::get();
+
+    BaseType_t  paramLen = 0;
+    const char* param    = FreeRTOS_CLIGetParameter(commandStr, 1, &paramLen);
+    if (section == 0 && param != nullptr) {
+        if (paramLen == 5 && std::strncmp(param, "reset", 5) == 0) {
+            manager.resetStats();
+            std::snprintf(writeBuffer, writeBufferLen, "High-water marks and latencies cleared\r\n");
+        }
+        else {
+            std::snprintf(writeBuffer, writeBufferLen, "Unknown argument, expected 'reset'\r\n");
+        }
+        return pdFALSE;
+    }
+
+    size_t busSections  = manager.busCount() * s_sectionsPerBus;
+    size_t hostSections = CanManager::s_hostSourceCount * s_sectionsPerHost;
+    if (section == 0) { writeHeader(writeBuffer, writeBufferLen); }
+    else if (section <= busSections) {
+        size_t index   = section - 1;
+        size_t channel = index / s_sectionsPerBus;
+        if (index % s_sectionsPerBus == 0) { writeBusTraffic(writeBuffer, writeBufferLen, channel); }
+        else {
+            writeBusErrors(writeBuffer, writeBufferLen, channel);
+        }
+    }
+    else {
+        size_t index = section - 1 - busSections;
+        size_t host  = index / s_sectionsPerHost;
+        size_t part  = index % s_sectionsPerHost;
+        if (part == 0) { writeHostTraffic(writeBuffer, writeBufferLen, host); }
+        else {
+            writeHostLatency(writeBuffer, writeBufferLen, host, part == 2);
+        }
+    }
+
+    if (++section > busSections + hostSections) {
+        section = 0;
+        return pdFALSE;
+    }
+    return pdTRUE;
+}
+}    // namespace cli
@@ -0,0 +1,89 @@
+/**
+ * @file    can_trace.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "can_trace.h"
+
+#include "can_manager.h"
+#include "histogram_text.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+
+namespace cli {
+namespace {
+using TraceStage = CanManager::TraceStage;
+
+constexpr std::array<const char*, CanManager::s_traceStageCount> s_stageNames = {
+  "CAN RX IRQ -> RX task",
+  "RX task -> SLCAN buffer",
+  "SLCAN buffer -> host",
+  "RX task -> gs_usb queue",
+  "gs_usb queue -> host",
+  "host -> RX task",
+  "RX task -> TX scheduler",
+  "TX scheduler -> bus",
+};
+
+// Every call of the command writes one half of the histogram of a stage, they must each fit in the output buffer.
+size_t section = 0;
+
+int writeStage(char* buf, size_t len, size_t stage, bool upperHalf)
+{
+    auto histogram = CanManager::get().getTraceLatency(static_cast<TraceStage>(stage)).snapshot();
+
+    int written = 0;
+    if (!upperHalf) {
+        written = std::snprintf(buf,
+                                len,
+                                "%s (us): %lu frames, max %lu\r\n",
+                                s_stageNames[stage],
+                                static_cast<unsigned long>(histogram.count),
+                                static_cast<unsigned long>(histogram.maxUs));
+    }
+    if (static_cast<size_t>(written) < len) {
+        written += writeHistogramHalf(buf + written, len - written, histogram, upperHalf);
+    }
+
+    return written;
+}
+}    // namespace
+
+BaseType_t canTraceCommand(char* writeBuffer, size_t writeBufferLen, const char* commandStr)
+{
+    BaseType_t  paramLen = 0;
+    const char* param    = FreeRTOS_CLIGetParameter(commandStr, 1, &paramLen);
+    if (section == 0 && param != nullptr) {
+        if (paramLen == 5 && std::strncmp(param, "reset", 5) == 0) {
+            CanManager::get().resetStats();
+            std::snprintf(writeBuffer, writeBufferLen, "High-water marks and latencies cleared\r\n");
+        }
+        else {
+            std::snprintf(writeBuffer, writeBufferLen, "Unknown argument, expected 'reset'\r\n");
+        }
+        return pdFALSE;
+    }
+
+    writeStage(writeBuffer, writeBufferLen, section / 2, section % 2 != 0);
+
+    if (++section == CanManager::s_traceStageCount * 2) {
+        section = 0;
+        return pdFALSE;
+    }
+    return pdTRUE;
+}
+}    // namespace cli
@@ -0,0 +1,41 @@
+/**
+ * @file    can_trace.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_CLI_BUILT_INS_CAN_TRACE_H
+#define CEP_CLI_BUILT_INS_CAN_TRACE_H
+
+#include <FreeRTOS.h>
+#include <FreeRTOS_CLI.h>
+
+#include <cstddef>
+
+namespace cli {
+BaseType_t canTraceCommand(char* writeBuffer, size_t writeBufferLen, const char* commandStr);
+
+constexpr CLI_Command_Definition_t s_canTrace = {
+  "cantrace", /* The command string to type. */
+  "\r\ncantrace [reset]:\r\n Displays the latency of each leg of the path of the frames through the CAN bridge,\r\n"
+  " from the FDCAN interrupt to the end of the USB transfer and back.\r\n"
+  " 'reset' clears the high-water marks and the latencies\r\n\r\n",
+  canTraceCommand, /* The function to run. */
+  -1               /* The parameter is optional. */
+};
+}    // namespace cli
+
+#endif    // CEP_CLI_BUILT_INS_CAN_TRACE_H
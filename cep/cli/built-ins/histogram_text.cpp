@@ -0,0 +1,42 @@
+/**
+ * @file    histogram_text.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Prints latency histograms in the output of the commands.
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "histogram_text.h"
+
+#include <cstdio>
+
+namespace cli {
+int writeHistogramHalf(char* buf, size_t len, const LatencyHistogram::Snapshot& histogram, bool upperHalf)
+{
+    constexpr size_t half    = LatencyHistogram::s_bucketCount / 2;
+    size_t           first   = upperHalf ? half : 0;
+    int              written = 0;
+    bool             any     = false;
+    for (size_t i = first; i < first + half && static_cast<size_t>(written) < len; i++) {
+        if (histogram.buckets[i] == 0) { continue; }
+        written += std::snprintf(buf + written,
+                                 len - written,
+                                 " %lu+:%lu",
+                                 static_cast<unsigned long>(LatencyHistogram::bucketFloorUs(i)),
+                                 static_cast<unsigned long>(histogram.buckets[i]));
+        any = true;
+    }
+    if (any && static_cast<size_t>(written) < len) { written += std::snprintf(buf + written, len - written, "\r\n"); }
+
+    return written;
+}
+}    // namespace cli
@@ -0,0 +1,36 @@
+/**
+ * @file    histogram_text.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Prints latency histograms in the output of the commands.
+ *
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_CLI_BUILT_INS_HISTOGRAM_TEXT_H
+#define CEP_CLI_BUILT_INS_HISTOGRAM_TEXT_H
+
+#include "latency_histogram.h"
+
+#include <cstddef>
+
+namespace cli {
+/**
+ * Writes the buckets that were hit in one half of a histogram, as "floor+:count", followed by a new line if any was.
+ * A whole histogram doesn't fit in the output buffer of a single call, hence the halves.
+ * @returns Number of characters written.
+ */
+int writeHistogramHalf(char* buf, size_t len, const LatencyHistogram::Snapshot& histogram, bool upperHalf);
+}    // namespace cli
+
+#endif    // CEP_CLI_BUILT_INS_HISTOGRAM_TEXT_H
@@ -56,7 +56,7 @@ CLI::~CLI()
 void CLI::onReceive(CDC_DeviceInfo* device, void* userData, const uint8_t* data, size_t len)
 {
     auto& that = *reinterpret_cast<CLI*>(userData);
-    xStreamBufferSendFromISR(that.m_streamBuff, data, len, nullptr);
+    xStreamBufferSend(that.m_streamBuff, data, len, 0);
 }
 
 [[noreturn]] void CLI::cliTask(void* args)
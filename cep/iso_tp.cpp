@@ -0,0 +1,552 @@
+/**
+ * @file    iso_tp.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   ISO 15765-2 transport protocol, segments and reassembles the PDUs exchanged with the SLCAN host.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "iso_tp.h"
+
+#include <portable.h>
+#include <task.h>
+
+#include <algorithm>
+
+namespace {
+// Frame types, in the high nibble of the first byte.
+constexpr uint8_t s_singleFrame      = 0x00;
+constexpr uint8_t s_firstFrame       = 0x10;
+constexpr uint8_t s_consecutiveFrame = 0x20;
+constexpr uint8_t s_flowControl      = 0x30;
+
+// Flow statuses, in the low nibble of the first byte of the flow controls.
+constexpr uint8_t s_flowContinue = 0;
+constexpr uint8_t s_flowWait     = 1;
+constexpr uint8_t s_flowOverflow = 2;
+
+constexpr size_t s_frameLen       = SlCan::s_maxClassicDataLen;
+constexpr size_t s_singleMaxLen   = s_frameLen - 1;
+constexpr size_t s_firstDataLen   = s_frameLen - 2;
+constexpr size_t s_consecutiveLen = s_frameLen - 1;
+
+bool isDue(TickType_t tick, TickType_t now)
+{
+    // Handles the wrap-around of the tick count.
+    return static_cast<int32_t>(now - tick) >= 0;
+}
+}    // namespace
+
+IsoTp::IsoTp(Sender sender, LinksChanged onLinksChanged, void* userData)
+: m_sender(sender), m_onLinksChanged(onLinksChanged), m_userData(userData)
+{
+    configASSERT(sender != nullptr);
+}
+
+void IsoTp::handleHostCommand(const SlCan::Packet& packet)
+{
+    if (packet.command == SlCan::Command::TransferIsoTpData) {
+        addSegment(packet);
+        return;
+    }
+    configASSERT(packet.command == SlCan::Command::SetIsoTpLink);
+
+    const auto& params = packet.data.isoTpLink;
+    if (params.closeAll) {
+        for (auto& link : m_links) {
+            if (link.isUsed && link.channel == packet.channel) { closeLink(link); }
+        }
+    }
+    else if (params.close) {
+        Link* link = findByTxId(packet.channel, params.txId, params.isExtended);
+        if (link != nullptr) { closeLink(*link); }
+        else {
+            report(packet.channel, params.txId, params.isExtended, Status::Rejected);
+        }
+    }
+    else {
+        openLink(packet);
+    }
+}
+
+bool IsoTp::onFrame(const SlCan::Packet& frame)
+{
+    if (!SlCan::commandIsTransmit(frame.command)) { return false; }
+    const auto& data = frame.data.packetData;
+    if (data.isRemote || data.isFd) { return false; }
+    Link* link = findByRxId(frame.channel, data.id, data.isExtended);
+    if (link == nullptr) { return false; }
+    if (data.dataLen == 0) { return true; }
+
+    const uint8_t* bytes = &data.data[0];
+    size_t         len   = data.dataLen;
+    switch (bytes[0] & 0xF0) {
+        case s_singleFrame: {
+            // A new PDU replaces the one being received. There's no flow control to refuse it, it's dropped if the
+            // previous one is still going to the host.
+            size_t pduLen = bytes[0] & 0x0F;
+            if (pduLen == 0 || pduLen > len - 1 || link->isDelivering) { break; }
+            startReception(*link, pduLen, &bytes[1], pduLen);
+            break;
+        }
+        case s_firstFrame: {
+            size_t pduLen = (bytes[0] & 0x0FUL) << 8 | bytes[1];
+            if (len < s_frameLen || pduLen <= s_singleMaxLen) { break; }
+            if (link->isDelivering) {
+                link->isFlowPending = true;
+                link->flowStatus    = s_flowOverflow;
+                break;
+            }
+            startReception(*link, pduLen, &bytes[2], s_firstDataLen);
+            break;
+        }
+        case s_consecutiveFrame: onConsecutiveFrame(*link, bytes, len); break;
+        case s_flowControl: onFlowControl(*link, bytes, len); break;
+        default: break;
+    }
+
+    return true;
+}
+
+TickType_t IsoTp::service()
+{
+    // Set again by any frame refused below.
+    m_wantsTxRoom = false;
+
+    TickType_t now   = xTaskGetTickCount();
+    TickType_t ticks = portMAX_DELAY;
+    auto       until = [&now, &ticks](TickType_t tick) { ticks = std::min(ticks, isDue(tick, now) ? 0 : tick - now); };
+    for (auto& link : m_links) {
+        if (!link.isUsed) { continue; }
+
+        if (link.isFlowPending) { sendFlowControl(link); }
+        if (link.isReceiving) {
+            if (isDue(link.rxDeadline, now)) { endReception(link, Status::RxTimeout); }
+            else {
+                until(link.rxDeadline);
+            }
+        }
+
+        if (link.txState == TxState::Collecting) {
+            if (isDue(link.txDeadline, now)) { endTransmission(link, Status::TxTimeout); }
+            else {
+                until(link.txDeadline);
+            }
+        }
+
+        // As many frames as the separation time allows, all of them if the peer didn't ask for one.
+        while (link.txState == TxState::Starting ||
+               (link.txState == TxState::Sending && isDue(link.txNextTick, xTaskGetTickCount()))) {
+            link.isTxStalled = !sendNextFrame(link);
+            if (link.isTxStalled) { break; }
+        }
+
+        if (link.txState == TxState::Starting || link.txState == TxState::WaitingFlow ||
+            link.txState == TxState::Sending) {
+            if (isDue(link.txDeadline, now)) {
+                endTransmission(link, Status::TxTimeout);
+                continue;
+            }
+            until(link.txDeadline);
+            // A refused frame is sent again once there's room, see wantsTxRoom.
+            if (link.txState == TxState::Sending && !link.isTxStalled) { until(link.txNextTick); }
+        }
+    }
+
+    return ticks;
+}
+
+size_t IsoTp::rxIds(uint8_t channel, bool isExtended, uint32_t* ids) const
+{
+    size_t count = 0;
+    for (const auto& link : m_links) {
+        if (link.isUsed && link.channel == channel && link.isExtended == isExtended) { ids[count++] = link.rxId; }
+    }
+
+    return count;
+}
+
+const SlCan::Packet* IsoTp::peekHostPacket()
+{
+    // The statuses go first, they're short and the host might be waiting on them to send its next PDU.
+    if (m_statusCount != 0) {
+        const auto& pending = m_statuses[m_statusHead];
+        m_hostPacket        = SlCan::Packet::isoTpStatus(
+          pending.channel, pending.txId, pending.isExtended, static_cast<uint8_t>(pending.status));
+        return &m_hostPacket;
+    }
+
+    Link* link = findDelivering();
+    if (link == nullptr) { return nullptr; }
+
+    size_t len                             = std::min(link->rxLen - link->rxOffset, SlCan::Packet::s_isoTpSegmentLen);
+    m_hostPacket                           = {};
+    m_hostPacket.command                   = SlCan::Command::TransferIsoTpData;
+    m_hostPacket.channel                   = link->channel;
+    m_hostPacket.data.isoTpData.id         = link->rxId;
+    m_hostPacket.data.isoTpData.isExtended = link->isExtended;
+    m_hostPacket.data.isoTpData.isLast     = link->rxOffset + len == link->rxLen;
+    m_hostPacket.data.isoTpData.len        = static_cast<uint8_t>(len);
+    std::copy(
+      &link->rxBuffer[link->rxOffset], &link->rxBuffer[link->rxOffset + len], &m_hostPacket.data.isoTpData.data[0]);
+    return &m_hostPacket;
+}
+
+void IsoTp::popHostPacket()
+{
+    // Nothing can change between the peek and the pop, both are called from the same task. The same choice is made.
+    if (m_statusCount != 0) {
+        m_statusHead = (m_statusHead + 1) % s_statusQueueSize;
+        --m_statusCount;
+    }
+    else if (Link* link = findDelivering(); link != nullptr) {
+        link->rxOffset += std::min(link->rxLen - link->rxOffset, SlCan::Packet::s_isoTpSegmentLen);
+        if (link->rxOffset == link->rxLen) { resetReception(*link); }
+    }
+
+    updateHostOutput();
+}
+
+void IsoTp::openLink(const SlCan::Packet& packet)
+{
+    const auto& params = packet.data.isoTpLink;
+    uint32_t    maxId  = params.isExtended ? 0x1FFFFFFFUL : 0x7FFUL;
+    Link*       link   = findByTxId(packet.channel, params.txId, params.isExtended);
+    Link*       other  = findByRxId(packet.channel, params.rxId, params.isExtended);
+    bool isValid = params.txId <= maxId && params.rxId <= maxId && params.txId != params.rxId &&
+                   (other == nullptr || other == link);
+    if (isValid && link == nullptr) {
+        auto free = std::find_if(m_links.begin(), m_links.end(), [](const Link& candidate) {
+            return !candidate.isUsed;
+        });
+        if (free != m_links.end()) {
+            link = &*free;
+            *link = {
+              .isUsed     = true,
+              .channel    = packet.channel,
+              .txId       = params.txId,
+              .rxId       = params.rxId,
+              .isExtended = params.isExtended,
+            };
+            notifyLinksChanged();
+        }
+    }
+    if (!isValid || link == nullptr) {
+        report(packet.channel, params.txId, params.isExtended, Status::Rejected);
+        return;
+    }
+
+    // The PDU being sent keeps going, the one being received was addressed to the previous identifier.
+    if (link->rxId != params.rxId) {
+        resetReception(*link);
+        link->rxId = params.rxId;
+        notifyLinksChanged();
+    }
+    link->blockSize = params.blockSize;
+    link->stMin     = params.stMin;
+}
+
+void IsoTp::closeLink(Link& link)
+{
+    resetReception(link);
+    vPortFree(link.txBuffer);
+    link = {};
+    notifyLinksChanged();
+}
+
+void IsoTp::addSegment(const SlCan::Packet& packet)
+{
+    const auto& segment = packet.data.isoTpData;
+    Link*       link    = findByTxId(packet.channel, segment.id, segment.isExtended);
+    if (link == nullptr) {
+        // Reported once per PDU.
+        if (segment.isLast) { report(packet.channel, segment.id, segment.isExtended, Status::Rejected); }
+        return;
+    }
+
+    if (link->isDropping) {
+        link->isDropping = !segment.isLast;
+        return;
+    }
+    if (link->txState != TxState::Idle && link->txState != TxState::Collecting) {
+        report(*link, Status::Busy);
+        link->isDropping = !segment.isLast;
+        return;
+    }
+
+    if (link->txState == TxState::Idle) {
+        // The length of the PDU is only known once it's whole.
+        link->txBuffer = static_cast<uint8_t*>(pvPortMalloc(s_maxPduLen));
+        if (link->txBuffer == nullptr) {
+            report(*link, Status::Rejected);
+            link->isDropping = !segment.isLast;
+            return;
+        }
+        link->txState = TxState::Collecting;
+        link->txLen   = 0;
+    }
+
+    if (link->txLen + segment.len > s_maxPduLen) {
+        endTransmission(*link, Status::Rejected);
+        link->isDropping = !segment.isLast;
+        return;
+    }
+    std::copy(&segment.data[0], &segment.data[segment.len], &link->txBuffer[link->txLen]);
+    link->txLen += segment.len;
+    if (!segment.isLast) {
+        // The buffer is given back if the host doesn't finish the PDU.
+        link->txDeadline = xTaskGetTickCount() + s_timeout;
+        return;
+    }
+
+    if (link->txLen == 0) {
+        endTransmission(*link, Status::Rejected);
+        return;
+    }
+    // Sent by the next call of service.
+    link->txState    = TxState::Starting;
+    link->txOffset   = 0;
+    link->txDeadline = xTaskGetTickCount() + s_timeout;
+}
+
+void IsoTp::onConsecutiveFrame(Link& link, const uint8_t* data, size_t len)
+{
+    // Late frames of a PDU that was dropped are ignored.
+    if (!link.isReceiving) { return; }
+    if ((data[0] & 0x0F) != link.rxSequence) {
+        endReception(link, Status::WrongSequence);
+        return;
+    }
+
+    size_t count = std::min(len - 1, link.rxLen - link.rxOffset);
+    std::copy(&data[1], &data[1 + count], &link.rxBuffer[link.rxOffset]);
+    link.rxOffset += count;
+    link.rxSequence = (link.rxSequence + 1) & 0x0F;
+    if (link.rxOffset == link.rxLen) {
+        link.isReceiving  = false;
+        link.isDelivering = true;
+        link.rxOffset     = 0;
+        updateHostOutput();
+        return;
+    }
+
+    link.rxDeadline = xTaskGetTickCount() + s_timeout;
+    if (link.blockSize != 0 && --link.rxBlockLeft == 0) {
+        link.rxBlockLeft   = link.blockSize;
+        link.isFlowPending = true;
+        link.flowStatus    = s_flowContinue;
+    }
+}
+
+void IsoTp::onFlowControl(Link& link, const uint8_t* data, size_t len)
+{
+    if (link.txState != TxState::WaitingFlow || len < 3) { return; }
+
+    TickType_t now = xTaskGetTickCount();
+    switch (data[0] & 0x0F) {
+        case s_flowContinue:
+            link.txState      = TxState::Sending;
+            link.txBlockLeft  = data[1];
+            link.txSeparation = separationTicks(data[2]);
+            link.txNextTick   = now;
+            link.txDeadline   = now + s_timeout;
+            break;
+        case s_flowWait: link.txDeadline = now + s_timeout; break;
+        case s_flowOverflow: endTransmission(link, Status::Overflow); break;
+        default: endTransmission(link, Status::InvalidFlow); break;
+    }
+}
+
+void IsoTp::startReception(Link& link, size_t len, const uint8_t* data, size_t dataLen)
+{
+    resetReception(link);
+    link.rxBuffer = static_cast<uint8_t*>(pvPortMalloc(len));
+    if (link.rxBuffer == nullptr) {
+        // A peer that waits for a flow control is told to give up.
+        if (len > s_singleMaxLen) {
+            link.isFlowPending = true;
+            link.flowStatus    = s_flowOverflow;
+        }
+        return;
+    }
+
+    std::copy(&data[0], &data[dataLen], &link.rxBuffer[0]);
+    link.rxLen = len;
+    if (dataLen == len) {
+        link.isDelivering = true;
+        link.rxOffset     = 0;
+        updateHostOutput();
+        return;
+    }
+
+    link.isReceiving   = true;
+    link.rxOffset      = dataLen;
+    link.rxSequence    = 1;
+    link.rxBlockLeft   = link.blockSize;
+    link.rxDeadline    = xTaskGetTickCount() + s_timeout;
+    link.isFlowPending = true;
+    link.flowStatus    = s_flowContinue;
+}
+
+void IsoTp::resetReception(Link& link)
+{
+    vPortFree(link.rxBuffer);
+    link.rxBuffer      = nullptr;
+    link.isReceiving   = false;
+    link.isDelivering  = false;
+    link.isFlowPending = false;
+    updateHostOutput();
+}
+
+void IsoTp::endReception(Link& link, Status status)
+{
+    resetReception(link);
+    report(link, status);
+}
+
+void IsoTp::endTransmission(Link& link, Status status)
+{
+    vPortFree(link.txBuffer);
+    link.txBuffer    = nullptr;
+    link.txState     = TxState::Idle;
+    link.isTxStalled = false;
+    report(link, status);
+}
+
+void IsoTp::report(uint8_t channel, uint32_t txId, bool isExtended, Status status)
+{
+    if (m_statusCount == s_statusQueueSize) {
+        m_statusHead = (m_statusHead + 1) % s_statusQueueSize;
+        --m_statusCount;
+    }
+    m_statuses[(m_statusHead + m_statusCount++) % s_statusQueueSize] = {
+      .channel    = channel,
+      .txId       = txId,
+      .isExtended = isExtended,
+      .status     = status,
+    };
+    updateHostOutput();
+}
+
+void IsoTp::updateHostOutput()
+{
+    m_hasHostOutput = m_statusCount != 0 || findDelivering() != nullptr;
+}
+
+void IsoTp::notifyLinksChanged() const
+{
+    if (m_onLinksChanged != nullptr) { m_onLinksChanged(m_userData); }
+}
+
+bool IsoTp::sendFlowControl(Link& link)
+{
+    const uint8_t pci[] = {static_cast<uint8_t>(s_flowControl | link.flowStatus), link.blockSize, link.stMin};
+    if (!send(link, &pci[0], sizeof(pci), nullptr, 0)) { return false; }
+    link.isFlowPending = false;
+    return true;
+}
+
+bool IsoTp::sendNextFrame(Link& link)
+{
+    TickType_t now = xTaskGetTickCount();
+    if (link.txState == TxState::Starting && link.txLen <= s_singleMaxLen) {
+        const uint8_t pci[] = {static_cast<uint8_t>(s_singleFrame | link.txLen)};
+        if (!send(link, &pci[0], sizeof(pci), &link.txBuffer[0], link.txLen)) { return false; }
+        endTransmission(link, Status::Sent);
+        return true;
+    }
+
+    if (link.txState == TxState::Starting) {
+        const uint8_t pci[] = {static_cast<uint8_t>(s_firstFrame | link.txLen >> 8),
+                               static_cast<uint8_t>(link.txLen & 0xFF)};
+        if (!send(link, &pci[0], sizeof(pci), &link.txBuffer[0], s_firstDataLen)) { return false; }
+        link.txState    = TxState::WaitingFlow;
+        link.txOffset   = s_firstDataLen;
+        link.txSequence = 1;
+        link.txDeadline = now + s_timeout;
+        return true;
+    }
+
+    size_t        count = std::min(link.txLen - link.txOffset, s_consecutiveLen);
+    const uint8_t pci[] = {static_cast<uint8_t>(s_consecutiveFrame | link.txSequence)};
+    if (!send(link, &pci[0], sizeof(pci), &link.txBuffer[link.txOffset], count)) { return false; }
+    link.txOffset += count;
+    link.txSequence = (link.txSequence + 1) & 0x0F;
+    if (link.txOffset == link.txLen) {
+        endTransmission(link, Status::Sent);
+        return true;
+    }
+
+    // A block size of 0 means that the peer never sends another flow control.
+    link.txDeadline = now + s_timeout;
+    if (link.txBlockLeft != 0 && --link.txBlockLeft == 0) { link.txState = TxState::WaitingFlow; }
+    else {
+        link.txNextTick = now + link.txSeparation;
+    }
+    return true;
+}
+
+bool IsoTp::send(const Link& link, const uint8_t* pci, size_t pciLen, const uint8_t* data, size_t len)
+{
+    uint8_t bytes[s_frameLen];
+    std::fill(std::begin(bytes), std::end(bytes), s_padding);
+    std::copy(&pci[0], &pci[pciLen], &bytes[0]);
+    if (len != 0) { std::copy(&data[0], &data[len], &bytes[pciLen]); }
+
+    SlCan::Packet frame {link.txId, link.isExtended, &bytes[0], s_frameLen};
+    frame.channel = link.channel;
+    bool isSent   = m_sender(m_userData, frame);
+    if (!isSent) { m_wantsTxRoom = true; }
+    return isSent;
+}
+
+IsoTp::Link* IsoTp::findByTxId(uint8_t channel, uint32_t txId, bool isExtended)
+{
+    for (auto& link : m_links) {
+        if (link.isUsed && link.channel == channel && link.txId == txId && link.isExtended == isExtended) {
+            return &link;
+        }
+    }
+
+    return nullptr;
+}
+
+IsoTp::Link* IsoTp::findByRxId(uint8_t channel, uint32_t rxId, bool isExtended)
+{
+    for (auto& link : m_links) {
+        if (link.isUsed && link.channel == channel && link.rxId == rxId && link.isExtended == isExtended) {
+            return &link;
+        }
+    }
+
+    return nullptr;
+}
+
+IsoTp::Link* IsoTp::findDelivering()
+{
+    for (auto& link : m_links) {
+        if (link.isUsed && link.isDelivering) { return &link; }
+    }
+
+    return nullptr;
+}
+
+TickType_t IsoTp::separationTicks(uint8_t stMin)
+{
+    // 0xF1 to 0xF9 are 100 to 900 us, the tick is the shortest wait the task can do. The reserved values mean the
+    // longest separation. One more tick is waited, since the current one might be about to end.
+    uint32_t ms = stMin;
+    if (stMin >= 0xF1 && stMin <= 0xF9) { ms = 1; }
+    else if (stMin > 0x7F) {
+        ms = 0x7F;
+    }
+    return ms == 0 ? 0 : pdMS_TO_TICKS(ms) + 1;
+}
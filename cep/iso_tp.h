@@ -0,0 +1,215 @@
+/**
+ * @file    iso_tp.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   ISO 15765-2 transport protocol, segments and reassembles the PDUs exchanged with the SLCAN host.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_ISO_TP_H
+#define CEP_ISO_TP_H
+
+#include "slcan/slcan.h"
+
+#include <FreeRTOS.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Runs the ISO-TP links opened by the SLCAN host, so that the flow control doesn't have to go through USB.
+ *
+ * A link is a pair of identifiers on a bus: the device sends on the transmit identifier and receives on the other.
+ * The host opens it with 'I', then sends its PDUs in 'i' lines of up to 64 bytes, the last one flagged as such. The
+ * PDUs received from the peer come back the same way, with the receive identifier, and the outcome of each PDU sent
+ * comes back as a status line.
+ *
+ * Only classic CAN frames are used, padded to 8 bytes. The frames of the peer are consumed by the link, they aren't
+ * forwarded to the SLCAN host on their own. The hardware filters must let them through whatever the acceptance filter
+ * of the host, see rxIds.
+ *
+ * Everything runs in a single task, the RX task of CanManager: the frames of the peer are handed to onFrame as they
+ * are read, and service sends the frames that are due.
+ */
+class IsoTp {
+public:
+    static constexpr size_t     s_linkCount = 4;
+    static constexpr size_t     s_maxPduLen = 4095;
+    //! Longest wait for a flow control or a consecutive frame from the peer, N_Bs and N_Cr, or for the next segment
+    //! of a PDU from the host.
+    static constexpr TickType_t s_timeout   = pdMS_TO_TICKS(1000);
+    static constexpr uint8_t    s_padding   = 0xCC;
+
+    //! Sent to the host in 'I' lines, with the transmit identifier of the link.
+    enum class Status : uint8_t {
+        Sent = 0,         //!< The last frame of the PDU from the host was handed to the bus.
+        TxTimeout,        //!< The peer didn't send a flow control in time, the bus didn't take the frames, or the
+                          //!< host didn't send the rest of its PDU.
+        RxTimeout,        //!< The peer didn't send the next consecutive frame in time, its PDU is dropped.
+        Overflow,         //!< The peer has no room for the PDU from the host.
+        WrongSequence,    //!< A consecutive frame from the peer was lost, its PDU is dropped.
+        InvalidFlow,      //!< The peer sent an invalid flow control, the PDU from the host is dropped.
+        Busy,             //!< The host sent a PDU while the previous one was still going out, it's dropped.
+        Rejected,         //!< The host's PDU or link is invalid, or there's no memory for it.
+    };
+
+    /**
+     * Function that queues a frame on a bus, from the task.
+     *
+     * void*: User Data.
+     * const SlCan::Packet&: The frame, with the channel it goes on.
+     * Returns false if there's no room for it, it is tried again once wantsTxRoom is notified.
+     */
+    using Sender = bool (*)(void*, const SlCan::Packet&);
+
+    /**
+     * Function called from the task when a link is opened, closed or gets another receive identifier.
+     *
+     * void*: User Data.
+     */
+    using LinksChanged = void (*)(void*);
+
+    //! onLinksChanged can be nullptr, both get the same user data.
+    IsoTp(Sender sender, LinksChanged onLinksChanged, void* userData);
+
+    //! Applies a 'I' or 'i' line from the host.
+    void handleHostCommand(const SlCan::Packet& packet);
+
+    /**
+     * Gives a frame received on a bus to the link it belongs to.
+     * @returns True if the frame was consumed.
+     */
+    bool onFrame(const SlCan::Packet& frame);
+
+    /**
+     * Sends the frames that are due and enforces the timeouts.
+     * @returns Ticks until it must be called again, portMAX_DELAY if nothing is going on.
+     */
+    TickType_t service();
+
+    /**
+     * Gets the next line for the host, a status or a segment of a PDU from a peer.
+     * @returns nullptr if there's nothing to send.
+     */
+    const SlCan::Packet* peekHostPacket();
+    //! To be called once the line given by peekHostPacket was sent.
+    void                 popHostPacket();
+
+    /**
+     * Gets the receive identifiers of the links open on a bus.
+     * @param ids Filled with up to s_linkCount identifiers.
+     * @returns The number of identifiers written to ids.
+     */
+    size_t rxIds(uint8_t channel, bool isExtended, uint32_t* ids) const;
+
+    //! Readable from any context, to know when to call the functions above.
+    [[nodiscard]] bool hasHostOutput() const { return m_hasHostOutput.load(std::memory_order_relaxed); }
+    [[nodiscard]] bool wantsTxRoom() const { return m_wantsTxRoom.load(std::memory_order_relaxed); }
+
+private:
+    enum class TxState : uint8_t {
+        Idle = 0,
+        Collecting,    //!< Getting the segments of the PDU from the host.
+        Starting,      //!< The single or first frame must be sent.
+        WaitingFlow,
+        Sending,       //!< Sending the consecutive frames.
+    };
+
+    struct Link {
+        bool     isUsed     = false;
+        uint8_t  channel    = 0;
+        uint32_t txId       = 0;
+        uint32_t rxId       = 0;
+        bool     isExtended = false;
+        uint8_t  blockSize  = 0;    //!< Given to the peer.
+        uint8_t  stMin      = 0;    //!< Given to the peer.
+
+        // PDU from the host.
+        TxState    txState      = TxState::Idle;
+        bool       isDropping   = false;    //!< The segments are ignored until the last one.
+        bool       isTxStalled  = false;    //!< The sender refused the last frame.
+        uint8_t*   txBuffer     = nullptr;
+        size_t     txLen        = 0;
+        size_t     txOffset     = 0;
+        uint8_t    txSequence   = 0;
+        uint8_t    txBlockLeft  = 0;    //!< Consecutive frames before the next flow control, 0 for no limit.
+        TickType_t txSeparation = 0;
+        TickType_t txNextTick   = 0;    //!< When the next consecutive frame can go.
+        TickType_t txDeadline   = 0;
+
+        // PDU from the peer.
+        bool       isReceiving   = false;
+        bool       isDelivering  = false;    //!< Complete, being sent to the host from rxOffset on.
+        bool       isFlowPending = false;    //!< A flow control with flowStatus must be sent.
+        uint8_t    flowStatus    = 0;
+        uint8_t*   rxBuffer      = nullptr;
+        size_t     rxLen         = 0;
+        size_t     rxOffset      = 0;
+        uint8_t    rxSequence    = 0;
+        uint8_t    rxBlockLeft   = 0;
+        TickType_t rxDeadline    = 0;
+    };
+
+    struct PendingStatus {
+        uint8_t  channel    = 0;
+        uint32_t txId       = 0;
+        bool     isExtended = false;
+        Status   status     = Status::Sent;
+    };
+
+    void openLink(const SlCan::Packet& packet);
+    void closeLink(Link& link);
+    void addSegment(const SlCan::Packet& packet);
+    void onConsecutiveFrame(Link& link, const uint8_t* data, size_t len);
+    void onFlowControl(Link& link, const uint8_t* data, size_t len);
+    void startReception(Link& link, size_t len, const uint8_t* data, size_t dataLen);
+    void resetReception(Link& link);
+    void endReception(Link& link, Status status);
+    void endTransmission(Link& link, Status status);
+    void report(const Link& link, Status status) { report(link.channel, link.txId, link.isExtended, status); }
+    void report(uint8_t channel, uint32_t txId, bool isExtended, Status status);
+    void updateHostOutput();
+    void notifyLinksChanged() const;
+
+    //! Each returns false if the sender refused the frame.
+    bool sendFlowControl(Link& link);
+    bool sendNextFrame(Link& link);
+    bool send(const Link& link, const uint8_t* pci, size_t pciLen, const uint8_t* data, size_t len);
+
+    Link*             findByTxId(uint8_t channel, uint32_t txId, bool isExtended);
+    Link*             findByRxId(uint8_t channel, uint32_t rxId, bool isExtended);
+    Link*             findDelivering();
+    static TickType_t separationTicks(uint8_t stMin);
+
+private:
+    static constexpr size_t s_statusQueueSize = 8;
+
+    Sender       m_sender         = nullptr;
+    LinksChanged m_onLinksChanged = nullptr;
+    void*        m_userData       = nullptr;
+
+    std::array<Link, s_linkCount> m_links = {};
+
+    //! Statuses waiting for the host, the oldest are overwritten if it doesn't keep up.
+    std::array<PendingStatus, s_statusQueueSize> m_statuses    = {};
+    size_t                                       m_statusHead  = 0;
+    size_t                                       m_statusCount = 0;
+    SlCan::Packet                                m_hostPacket;    //!< Built by peekHostPacket.
+
+    std::atomic<bool> m_hasHostOutput = false;
+    std::atomic<bool> m_wantsTxRoom   = false;
+};
+
+#endif    // CEP_ISO_TP_H
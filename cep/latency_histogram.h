@@ -0,0 +1,95 @@
+/**
+ * @file    latency_histogram.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Distribution of latencies in power of two buckets.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_LATENCY_HISTOGRAM_H
+#define CEP_LATENCY_HISTOGRAM_H
+
+#include "stm32g4xx_hal.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Counts latencies in buckets that double in width, so that both the common case and the outliers are visible at a
+ * constant cost.
+ *
+ * Latencies are measured with the DWT cycle counter, which must be running. Recording is lock-free and can be done
+ * from any context.
+ */
+class LatencyHistogram {
+public:
+    //! Bucket i holds the latencies in [2^i, 2^(i+1)) µs. The first one also holds 0 µs, the last one everything above.
+    static constexpr size_t s_bucketCount = 16;
+
+    struct Snapshot {
+        std::array<uint32_t, s_bucketCount> buckets = {};
+        uint32_t                            count   = 0;
+        uint32_t                            maxUs   = 0;
+    };
+
+    [[nodiscard]] static uint32_t nowCycles() { return DWT->CYCCNT; }
+
+    //! Lowest latency that lands in a bucket.
+    [[nodiscard]] static constexpr uint32_t bucketFloorUs(size_t bucket) { return bucket == 0 ? 0 : 1UL << bucket; }
+
+    void record(uint32_t latencyUs)
+    {
+        size_t bucket = latencyUs == 0 ? 0 : static_cast<size_t>(31 - __builtin_clz(latencyUs));
+        if (bucket >= s_bucketCount) { bucket = s_bucketCount - 1; }
+
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        uint32_t max = m_maxUs.load(std::memory_order_relaxed);
+        while (latencyUs > max && !m_maxUs.compare_exchange_weak(max, latencyUs, std::memory_order_relaxed)) {}
+    }
+
+    /**
+     * Records the time elapsed since a point in time.
+     * @param startCycles Value of nowCycles() at that point.
+     */
+    void recordSince(uint32_t startCycles) { record((nowCycles() - startCycles) / (SystemCoreClock / 1'000'000)); }
+
+    [[nodiscard]] Snapshot snapshot() const
+    {
+        Snapshot snapshot;
+        for (size_t i = 0; i < s_bucketCount; i++) {
+            snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+        }
+        snapshot.count = m_count.load(std::memory_order_relaxed);
+        snapshot.maxUs = m_maxUs.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+    void reset()
+    {
+        for (auto& bucket : m_buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_maxUs.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint32_t>, s_bucketCount> m_buckets = {};
+    std::atomic<uint32_t>                            m_count   = 0;
+    std::atomic<uint32_t>                            m_maxUs   = 0;
+};
+
+#endif    // CEP_LATENCY_HISTOGRAM_H
@@ -27,6 +27,7 @@
 #include "usart.h"
 #include "usb_device.h"
 #include "usbd_cdc_if.h"
+#include "usbd_gs_if.h"
 
 #include <cm_backtrace.h>
 #include <logging/logger.h>
@@ -51,8 +52,22 @@ extern "C" void StartDefaultTask(void* args)
 
     ROOT_LOGI("\n\n\n\rLogger Initialized.");
 
+    CDC_StartRxTask();
     CLI cli {&g_usbDebug};
-    CanManager::init(&g_usbFrasy, &hfdcan1);
+    CanManager::init(&g_usbFrasy,
+                     {
+                       &hfdcan1,
+#if CEP_FDCAN2
+                       &hfdcan2,
+#endif
+#if CEP_FDCAN3
+                       &hfdcan3,
+#endif
+                     });
+    // The first bus is started by CANopen, the others only bridge to the hosts.
+    for (size_t channel = 1; channel < CanManager::get().busCount(); channel++) {
+        CanManager::get().startBus(channel);
+    }
 
     CanopenNodeStm32 canOpenNodeSTM32 {};
     canOpenNodeSTM32.canHandle      = &hfdcan1;
@@ -122,6 +137,8 @@ int main()
     SystemClock_Config();
 
     /* USER CODE BEGIN SysInit */
+    // The host reads the number of gs_usb channels as soon as it enumerates the device.
+    GS_SetChannelCount(CEP_FDCAN_COUNT);
 
     /* USER CODE END SysInit */
 
@@ -130,6 +147,12 @@ int main()
     MX_RNG_Init();
     MX_USART1_UART_Init();
     MX_FDCAN1_Init();
+#if CEP_FDCAN2
+    MX_FDCAN2_Init();
+#endif
+#if CEP_FDCAN3
+    MX_FDCAN3_Init();
+#endif
     MX_TIM7_Init();
     MX_TIM16_Init();
     MX_USB_Device_Init();
@@ -0,0 +1,163 @@
+/**
+ * @file    periodic_transmitter.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Table of frames sent at a fixed rate, timed by the microsecond clock.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "periodic_transmitter.h"
+
+#include "timestamp.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+PeriodicTransmitter::PeriodicTransmitter(Sender sender, void* userData) : m_sender(sender), m_userData(userData)
+{
+    configASSERT(sender != nullptr);
+
+    Timestamp::init();
+    Timestamp::setAlarmHandler(&onAlarm, this);
+}
+
+bool PeriodicTransmitter::setFrame(const SlCan::Packet& frame)
+{
+    configASSERT(SlCan::commandIsTransmit(frame.command));
+    const auto& data = frame.data.packetData;
+
+    // The alarm can't go off in the middle of the copy, the next transmission gets the whole change.
+    taskENTER_CRITICAL();
+    Entry* entry = find(frame.channel, data.id, data.isExtended);
+    if (entry != nullptr) { entry->frame = frame; }
+    else {
+        for (auto& candidate : m_entries) {
+            if (!candidate.isUsed) {
+                entry = &candidate;
+                *entry = {.frame = frame, .isUsed = true};
+                break;
+            }
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return entry != nullptr;
+}
+
+bool PeriodicTransmitter::setTiming(
+  uint8_t channel, uint32_t id, bool isExtended, uint32_t periodUs, uint32_t phaseUs, uint16_t count)
+{
+    if (periodUs < s_minPeriodUs || periodUs > s_maxPeriodUs || phaseUs >= periodUs) { return false; }
+
+    taskENTER_CRITICAL();
+    Entry* entry = find(channel, id, isExtended);
+    if (entry != nullptr) {
+        // The first transmission is at the next multiple of the period, plus the phase.
+        uint32_t now  = Timestamp::nowUs();
+        uint32_t next = now - now % periodUs + phaseUs;
+        if (static_cast<int32_t>(next - now) <= 0) { next += periodUs; }
+
+        entry->periodUs  = periodUs;
+        entry->nextUs    = next;
+        entry->remaining = count;
+        armAlarm();
+    }
+    taskEXIT_CRITICAL();
+
+    return entry != nullptr;
+}
+
+bool PeriodicTransmitter::remove(uint8_t channel, uint32_t id, bool isExtended)
+{
+    taskENTER_CRITICAL();
+    Entry* entry = find(channel, id, isExtended);
+    if (entry != nullptr) {
+        *entry = {};
+        armAlarm();
+    }
+    taskEXIT_CRITICAL();
+
+    return entry != nullptr;
+}
+
+void PeriodicTransmitter::clear(uint8_t channel)
+{
+    taskENTER_CRITICAL();
+    for (auto& entry : m_entries) {
+        if (entry.isUsed && entry.frame.channel == channel) { entry = {}; }
+    }
+    armAlarm();
+    taskEXIT_CRITICAL();
+}
+
+PeriodicTransmitter::Stats PeriodicTransmitter::getStats() const
+{
+    taskENTER_CRITICAL();
+    Stats stats = m_stats;
+    taskEXIT_CRITICAL();
+    return stats;
+}
+
+void PeriodicTransmitter::onAlarm(void* userData)
+{
+    static_cast<PeriodicTransmitter*>(userData)->sendDueFrames();
+}
+
+void PeriodicTransmitter::sendDueFrames()
+{
+    uint32_t now = Timestamp::nowUs();
+    for (auto& entry : m_entries) {
+        if (entry.periodUs == 0 || static_cast<int32_t>(now - entry.nextUs) < 0) { continue; }
+
+        if (m_sender(m_userData, entry.frame)) { ++m_stats.sent; }
+        else {
+            ++m_stats.missed;
+        }
+
+        // If the alarm came more than a period late, the transmissions in between are lost. The next ones stay
+        // aligned on the period.
+        uint32_t periods = (now - entry.nextUs) / entry.periodUs + 1;
+        m_stats.missed += periods - 1;
+        entry.nextUs += periods * entry.periodUs;
+        if (entry.remaining != 0 && --entry.remaining == 0) { entry.periodUs = 0; }
+    }
+
+    armAlarm();
+}
+
+void PeriodicTransmitter::armAlarm()
+{
+    // The alarm goes off for the earliest of the running frames.
+    uint32_t     now      = Timestamp::nowUs();
+    const Entry* earliest = nullptr;
+    for (const auto& entry : m_entries) {
+        if (entry.periodUs == 0) { continue; }
+        if (earliest == nullptr || static_cast<int32_t>(entry.nextUs - earliest->nextUs) < 0) { earliest = &entry; }
+    }
+
+    if (earliest == nullptr) {
+        Timestamp::cancelAlarm();
+        return;
+    }
+    Timestamp::setAlarm(earliest->nextUs);
+}
+
+PeriodicTransmitter::Entry* PeriodicTransmitter::find(uint8_t channel, uint32_t id, bool isExtended)
+{
+    for (auto& entry : m_entries) {
+        const auto& data = entry.frame.data.packetData;
+        if (entry.isUsed && entry.frame.channel == channel && data.id == id && data.isExtended == isExtended) {
+            return &entry;
+        }
+    }
+
+    return nullptr;
+}
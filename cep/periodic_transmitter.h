@@ -0,0 +1,105 @@
+/**
+ * @file    periodic_transmitter.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Table of frames sent at a fixed rate, timed by the microsecond clock.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_PERIODIC_TRANSMITTER_H
+#define CEP_PERIODIC_TRANSMITTER_H
+
+#include "slcan/slcan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Sends frames on their own, at the rate given by the host, so that it doesn't have to send each of them over USB.
+ *
+ * A frame is identified by its channel and identifier. It is first added with its content, stopped, then started by
+ * giving it a period. Its content can be changed at any time, the change applies from the next transmission on.
+ *
+ * The transmissions are aligned on the multiples of the period on the microsecond clock, plus a phase. Two frames
+ * with the same period and phases thus keep the same offset between them, whenever they were started.
+ *
+ * The frames are handed to the sender from the alarm of the microsecond clock, which this class owns. The table is
+ * changed from a task.
+ */
+class PeriodicTransmitter {
+public:
+    static constexpr size_t   s_capacity    = 32;
+    static constexpr uint32_t s_minPeriodUs = 100;
+    static constexpr uint32_t s_maxPeriodUs = 60'000'000;
+
+    /**
+     * Function called from the alarm interrupt for each frame that is due.
+     *
+     * void*: User Data.
+     * const SlCan::Packet&: The frame, with the channel it goes on.
+     * Returns false if the frame couldn't be queued, it counts as missed.
+     */
+    using Sender = bool (*)(void*, const SlCan::Packet&);
+
+    struct Stats {
+        size_t sent   = 0;    //!< Frames handed to the sender.
+        size_t missed = 0;    //!< Frames refused by the sender, or skipped because the alarm came too late.
+    };
+
+    PeriodicTransmitter(Sender sender, void* userData);
+
+    /**
+     * Adds a frame, stopped, or changes the content of the one with the same channel and identifier.
+     * @param frame Any of the transmit commands.
+     * @returns False if the table is full.
+     */
+    bool setFrame(const SlCan::Packet& frame);
+
+    /**
+     * Starts a frame, or changes its timing.
+     * @param periodUs Between s_minPeriodUs and s_maxPeriodUs.
+     * @param phaseUs Less than the period.
+     * @param count Number of transmissions, after which the frame stops. 0 for no limit.
+     * @returns False if there's no such frame or the timing is out of range.
+     */
+    bool setTiming(uint8_t channel, uint32_t id, bool isExtended, uint32_t periodUs, uint32_t phaseUs, uint16_t count);
+
+    bool remove(uint8_t channel, uint32_t id, bool isExtended);
+    void clear(uint8_t channel);
+
+    [[nodiscard]] Stats getStats() const;
+
+private:
+    struct Entry {
+        SlCan::Packet frame;
+        bool          isUsed    = false;
+        uint32_t      periodUs  = 0;    //!< 0 while the frame is stopped.
+        uint32_t      nextUs    = 0;    //!< Time of the next transmission.
+        uint16_t      remaining = 0;    //!< Transmissions left, 0 for no limit.
+    };
+
+    static void onAlarm(void* userData);
+    void        sendDueFrames();
+    void        armAlarm();
+    Entry*      find(uint8_t channel, uint32_t id, bool isExtended);
+
+private:
+    Sender m_sender   = nullptr;
+    void*  m_userData = nullptr;
+
+    std::array<Entry, s_capacity> m_entries = {};
+    Stats                         m_stats;
+};
+
+#endif    // CEP_PERIODIC_TRANSMITTER_H
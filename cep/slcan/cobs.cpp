@@ -0,0 +1,62 @@
+/**
+ * @file    cobs.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-22
+ * @brief   Consistent Overhead Byte Stuffing.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "cobs.h"
+
+namespace SlCan::Cobs {
+size_t encode(const uint8_t* in, size_t len, uint8_t* out)
+{
+    // Each group starts with a code byte: the distance to the next zero, or 0xFF for a full group without one.
+    uint8_t* code     = out;
+    uint8_t* ptr      = out + 1;
+    uint8_t  distance = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] != s_delimiter) {
+            *ptr++ = in[i];
+            ++distance;
+        }
+        if (in[i] == s_delimiter || distance == 0xFF) {
+            *code    = distance;
+            code     = ptr++;
+            distance = 1;
+        }
+    }
+    *code = distance;
+
+    return static_cast<size_t>(ptr - out);
+}
+
+size_t decode(const uint8_t* in, size_t len, uint8_t* out)
+{
+    const uint8_t* const end = in + len;
+    uint8_t*             ptr = out;
+
+    while (in != end) {
+        uint8_t distance = *in++;
+        if (distance == s_delimiter || distance - 1 > end - in) { return 0; }
+
+        for (uint8_t i = 1; i < distance; i++) {
+            if (*in == s_delimiter) { return 0; }
+            *ptr++ = *in++;
+        }
+        // A full group isn't followed by an implicit zero, neither is the last group.
+        if (distance != 0xFF && in != end) { *ptr++ = s_delimiter; }
+    }
+
+    return static_cast<size_t>(ptr - out);
+}
+}    // namespace SlCan::Cobs
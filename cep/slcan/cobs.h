@@ -0,0 +1,56 @@
+/**
+ * @file    cobs.h
+ * @author  Samuel Martel
+ * @date    2024-04-22
+ * @brief   Consistent Overhead Byte Stuffing.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SLCAN_COBS_H
+#define CEP_SLCAN_COBS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Removes every 0x00 from a block of bytes, so that 0x00 can be used to delimit the blocks in a stream.
+ * Costs one byte per block, plus one every 254 bytes.
+ */
+namespace SlCan::Cobs {
+constexpr uint8_t s_delimiter = 0x00;
+
+constexpr size_t maxEncodedSize(size_t len)
+{
+    return len + len / 254 + 1;
+}
+
+/**
+ * Encodes a block, without adding the delimiter.
+ * @param in The bytes to encode.
+ * @param len Number of bytes in the block.
+ * @param out Where to write the encoded block, must hold at least maxEncodedSize(len) bytes.
+ * @returns Number of bytes written to out.
+ */
+size_t encode(const uint8_t* in, size_t len, uint8_t* out);
+
+/**
+ * Decodes a block.
+ * @param in The encoded block, without its delimiter.
+ * @param len Number of bytes in the encoded block.
+ * @param out Where to write the decoded bytes, must hold at least len bytes.
+ * @returns Number of bytes written to out, 0 if the block is malformed.
+ */
+size_t decode(const uint8_t* in, size_t len, uint8_t* out);
+}    // namespace SlCan::Cobs
+
+#endif    // CEP_SLCAN_COBS_H
@@ -0,0 +1,64 @@
+/**
+ * @file    dlc.h
+ * @author  Samuel Martel
+ * @date    2024-04-23
+ * @brief   Mapping between the DLC of the frames and their number of data bytes.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SLCAN_DLC_H
+#define CEP_SLCAN_DLC_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace SlCan {
+static constexpr size_t s_maxClassicDataLen = 8;
+static constexpr size_t s_maxFdDataLen      = 64;
+
+/**
+ * Gets the number of data bytes of a frame from its 4-bit DLC.
+ * Classic frames can't use the codes above 8.
+ */
+constexpr uint8_t dlcToLen(uint8_t dlc)
+{
+    constexpr std::array<uint8_t, 16> lengths = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+    return lengths[dlc & 0x0F];
+}
+
+/**
+ * Gets the smallest DLC that holds len bytes. The frame gets padded if len isn't one of the FD lengths.
+ */
+constexpr uint8_t lenToDlc(size_t len)
+{
+    uint8_t dlc = 0;
+    while (dlc < 0x0F && dlcToLen(dlc) < len) {
+        ++dlc;
+    }
+    return dlc;
+}
+
+/**
+ * Checks that a frame can carry exactly len bytes, without padding.
+ */
+constexpr bool isValidDataLen(size_t len, bool isFd)
+{
+    if (!isFd) { return len <= s_maxClassicDataLen; }
+    return len <= s_maxFdDataLen && dlcToLen(lenToDlc(len)) == len;
+}
+
+static_assert(lenToDlc(12) == 9 && lenToDlc(13) == 10 && lenToDlc(64) == 15);
+}    // namespace SlCan
+
+#endif    // CEP_SLCAN_DLC_H
@@ -26,14 +26,33 @@ enum class Command : uint8_t {
     OpenChannel            = 'O',
     CloseChannel           = 'C',
     SetBitRate             = 'S',
-    SetMode                = 'M',
+    SetMode                = 'M',    //!< Single digit.
+    //! 'M' followed by 8 digits on the wire, see commandToChar.
+    SetAcceptanceCode      = 'M' | 0x80,
+    SetAcceptanceMask      = 'm',
+    SetFilterRange         = 'f',    //!< Identifier range that is forwarded to the host.
     SetAutoRetry           = 'A',
+    SetFraming             = 'K',
+    SetTimestamp           = 'Z',
+    SetBusStatusPeriod     = 'u',    //!< Single digit, seconds between two ReportBusStatus. 0 stops them.
+    //! 'u' followed by 12 digits on the wire, sent by the device. See commandToChar.
+    ReportBusStatus        = 'u' | 0x80,
+    SetPeriodicFrame       = 'p',    //!< Followed by a frame, in the form of its own line. See PeriodicTransmitter.
+    SetPeriodicTiming      = 'P',    //!< Identifier, period, phase and count of a frame set with 'p'.
+    SetIsoTpLink           = 'I',    //!< Opens or closes an ISO-TP link, see IsoTp.
+    //! 'I' followed by the transmit identifier and a single digit on the wire, sent by the device. See commandToChar.
+    ReportIsoTpStatus      = 'I' | 0x80,
+    TransferIsoTpData      = 'i',    //!< Segment of an ISO-TP PDU, in both directions.
     GetVersion             = 'V',
     ReportError            = 'E',
     TransmitDataFrame      = 't',
     TransmitExtDataFrame   = 'T',
     TransmitRemoteFrame    = 'r',
     TransmitExtRemoteFrame = 'R',
+    TransmitFdFrame        = 'd',    //!< FD frame, without bit rate switching.
+    TransmitExtFdFrame     = 'D',
+    TransmitFdBrsFrame     = 'b',    //!< FD frame, with the data phase at the data bit rate.
+    TransmitExtFdBrsFrame  = 'B',
     Invalid                = '\0'
 };
 
@@ -44,18 +63,38 @@ constexpr const char* commandToStr(Command cmd)
         case Command::CloseChannel: return "Close Channel";
         case Command::SetBitRate: return "Set Bit Rate";
         case Command::SetMode: return "Set Mode";
+        case Command::SetAcceptanceCode: return "Set Acceptance Code";
+        case Command::SetAcceptanceMask: return "Set Acceptance Mask";
+        case Command::SetFilterRange: return "Set Filter Range";
         case Command::SetAutoRetry: return "Set Auto Retry";
+        case Command::SetFraming: return "Set Framing";
+        case Command::SetTimestamp: return "Set Timestamp";
+        case Command::SetBusStatusPeriod: return "Set Bus Status Period";
+        case Command::ReportBusStatus: return "Report Bus Status";
+        case Command::SetPeriodicFrame: return "Set Periodic Frame";
+        case Command::SetPeriodicTiming: return "Set Periodic Timing";
+        case Command::SetIsoTpLink: return "Set ISO-TP Link";
+        case Command::ReportIsoTpStatus: return "Report ISO-TP Status";
+        case Command::TransferIsoTpData: return "Transfer ISO-TP Data";
         case Command::GetVersion: return "Get Version";
         case Command::ReportError: return "Report Error";
         case Command::TransmitDataFrame: return "Transmit Data Frame";
         case Command::TransmitExtDataFrame: return "Transmit Extended Data Frame";
         case Command::TransmitRemoteFrame: return "Transmit Remote Frame";
         case Command::TransmitExtRemoteFrame: return "Transmit Extended Remote Frame";
+        case Command::TransmitFdFrame: return "Transmit FD Frame";
+        case Command::TransmitExtFdFrame: return "Transmit Extended FD Frame";
+        case Command::TransmitFdBrsFrame: return "Transmit FD Frame with BRS";
+        case Command::TransmitExtFdBrsFrame: return "Transmit Extended FD Frame with BRS";
         case Command::Invalid:
         default: return "Invalid";
     }
 }
 
+/**
+ * Gets the command of a line from its first character.
+ * Command::SetAcceptanceCode shares its character with Command::SetMode, it is told apart by the length of the line.
+ */
 constexpr Command commandFromChar(uint8_t val)
 {
     Command cmd = static_cast<Command>(val);
@@ -64,13 +103,26 @@ constexpr Command commandFromChar(uint8_t val)
         case Command::CloseChannel:
         case Command::SetBitRate:
         case Command::SetMode:
+        case Command::SetAcceptanceMask:
+        case Command::SetFilterRange:
         case Command::SetAutoRetry:
+        case Command::SetFraming:
+        case Command::SetTimestamp:
+        case Command::SetBusStatusPeriod:
+        case Command::SetPeriodicFrame:
+        case Command::SetPeriodicTiming:
+        case Command::SetIsoTpLink:
+        case Command::TransferIsoTpData:
         case Command::GetVersion:
         case Command::ReportError:
         case Command::TransmitDataFrame:
         case Command::TransmitExtDataFrame:
         case Command::TransmitRemoteFrame:
-        case Command::TransmitExtRemoteFrame: return cmd;
+        case Command::TransmitExtRemoteFrame:
+        case Command::TransmitFdFrame:
+        case Command::TransmitExtFdFrame:
+        case Command::TransmitFdBrsFrame:
+        case Command::TransmitExtFdBrsFrame: return cmd;
         case Command::Invalid:
         default: return Command::Invalid;
     }
@@ -82,17 +134,84 @@ constexpr bool commandIsTransmit(Command cmd)
         case Command::TransmitDataFrame:
         case Command::TransmitExtDataFrame:
         case Command::TransmitRemoteFrame:
-        case Command::TransmitExtRemoteFrame: return true;
+        case Command::TransmitExtRemoteFrame:
+        case Command::TransmitFdFrame:
+        case Command::TransmitExtFdFrame:
+        case Command::TransmitFdBrsFrame:
+        case Command::TransmitExtFdBrsFrame: return true;
         case Command::OpenChannel:
         case Command::CloseChannel:
         case Command::SetBitRate:
         case Command::SetMode:
+        case Command::SetAcceptanceCode:
+        case Command::SetAcceptanceMask:
+        case Command::SetFilterRange:
         case Command::SetAutoRetry:
+        case Command::SetFraming:
+        case Command::SetTimestamp:
+        case Command::SetBusStatusPeriod:
+        case Command::ReportBusStatus:
+        case Command::SetPeriodicFrame:
+        case Command::SetPeriodicTiming:
+        case Command::SetIsoTpLink:
+        case Command::ReportIsoTpStatus:
+        case Command::TransferIsoTpData:
         case Command::GetVersion:
         case Command::ReportError:
         case Command::Invalid:
         default: return false;
     }
 }
+
+/**
+ * Gets the character that starts the lines of a command.
+ */
+constexpr uint8_t commandToChar(Command cmd)
+{
+    if (cmd == Command::SetAcceptanceCode) { return static_cast<uint8_t>(Command::SetMode); }
+    if (cmd == Command::ReportBusStatus) { return static_cast<uint8_t>(Command::SetBusStatusPeriod); }
+    if (cmd == Command::ReportIsoTpStatus) { return static_cast<uint8_t>(Command::SetIsoTpLink); }
+    return static_cast<uint8_t>(cmd);
+}
+
+constexpr bool commandIsFilter(Command cmd)
+{
+    return cmd == Command::SetAcceptanceCode || cmd == Command::SetAcceptanceMask || cmd == Command::SetFilterRange;
+}
+
+constexpr bool commandIsFd(Command cmd)
+{
+    switch (cmd) {
+        case Command::TransmitFdFrame:
+        case Command::TransmitExtFdFrame:
+        case Command::TransmitFdBrsFrame:
+        case Command::TransmitExtFdBrsFrame: return true;
+        default: return false;
+    }
+}
+
+constexpr bool commandIsExtended(Command cmd)
+{
+    switch (cmd) {
+        case Command::TransmitExtDataFrame:
+        case Command::TransmitExtRemoteFrame:
+        case Command::TransmitExtFdFrame:
+        case Command::TransmitExtFdBrsFrame: return true;
+        default: return false;
+    }
+}
+
+/**
+ * Gets the transmit command of a frame.
+ */
+constexpr Command commandFromFrame(bool isExtended, bool isRemote, bool isFd, bool bitRateSwitch)
+{
+    if (isFd) {
+        if (bitRateSwitch) { return isExtended ? Command::TransmitExtFdBrsFrame : Command::TransmitFdBrsFrame; }
+        return isExtended ? Command::TransmitExtFdFrame : Command::TransmitFdFrame;
+    }
+    if (isRemote) { return isExtended ? Command::TransmitExtRemoteFrame : Command::TransmitRemoteFrame; }
+    return isExtended ? Command::TransmitExtDataFrame : Command::TransmitDataFrame;
+}
 }    // namespace SlCan
 #endif    // CEP_SLCAN_ENUMS_COMMANDS_H
@@ -0,0 +1,52 @@
+/**
+ * @file    framing.h
+ * @author  Samuel Martel
+ * @date    2024-04-22
+ * @brief
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SLCAN_ENUMS_FRAMING_H
+#define CEP_SLCAN_ENUMS_FRAMING_H
+
+#include <cstdint>
+
+namespace SlCan {
+enum class Framing : uint8_t {
+    Ascii = 0,    //!< Lines of text terminated by '\r'.
+    Binary,       //!< COBS-encoded records terminated by 0x00.
+    Invalid
+};
+
+constexpr const char* framingToStr(Framing framing)
+{
+    switch (framing) {
+        case Framing::Ascii: return "ASCII";
+        case Framing::Binary: return "Binary";
+        case Framing::Invalid:
+        default: return "Invalid";
+    }
+}
+
+constexpr Framing framingFromStr(uint8_t val)
+{
+    Framing framing = static_cast<Framing>(val);
+    switch (framing) {
+        case Framing::Ascii:
+        case Framing::Binary: return framing;
+        case Framing::Invalid:
+        default: return Framing::Invalid;
+    }
+}
+}    // namespace SlCan
+#endif    // CEP_SLCAN_ENUMS_FRAMING_H
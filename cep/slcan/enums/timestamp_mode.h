@@ -0,0 +1,70 @@
+/**
+ * @file    timestamp_mode.h
+ * @author  Samuel Martel
+ * @date    2024-04-23
+ * @brief
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SLCAN_ENUMS_TIMESTAMP_MODE_H
+#define CEP_SLCAN_ENUMS_TIMESTAMP_MODE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace SlCan {
+enum class TimestampMode : uint8_t {
+    Disabled = 0,
+    Milliseconds,    //!< 16 bits, wraps around every minute, like the standard SLCAN 'Z' command.
+    Microseconds,    //!< 32 bits, wraps around every 71.6 minutes.
+    Invalid
+};
+
+constexpr const char* timestampModeToStr(TimestampMode mode)
+{
+    switch (mode) {
+        case TimestampMode::Disabled: return "Disabled";
+        case TimestampMode::Milliseconds: return "Milliseconds";
+        case TimestampMode::Microseconds: return "Microseconds";
+        case TimestampMode::Invalid:
+        default: return "Invalid";
+    }
+}
+
+constexpr TimestampMode timestampModeFromStr(uint8_t val)
+{
+    TimestampMode mode = static_cast<TimestampMode>(val);
+    switch (mode) {
+        case TimestampMode::Disabled:
+        case TimestampMode::Milliseconds:
+        case TimestampMode::Microseconds: return mode;
+        case TimestampMode::Invalid:
+        default: return TimestampMode::Invalid;
+    }
+}
+
+/**
+ * Number of bytes taken by the timestamp of a frame.
+ */
+constexpr size_t timestampModeSize(TimestampMode mode)
+{
+    switch (mode) {
+        case TimestampMode::Milliseconds: return sizeof(uint16_t);
+        case TimestampMode::Microseconds: return sizeof(uint32_t);
+        case TimestampMode::Disabled:
+        case TimestampMode::Invalid:
+        default: return 0;
+    }
+}
+}    // namespace SlCan
+#endif    // CEP_SLCAN_ENUMS_TIMESTAMP_MODE_H
@@ -0,0 +1,184 @@
+/**
+ * @file    hex.h
+ * @author  Samuel Martel
+ * @date    2024-04-23
+ * @brief   ASCII hex conversions of the SLCAN codec.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SLCAN_HEX_H
+#define CEP_SLCAN_HEX_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Conversions between values and upper case hex digits, most significant digit first.
+ *
+ * Encoding goes through lookup tables, a whole byte at a time. Decoding validates and converts four digits at once in
+ * a 32-bit word, falling back to a lookup table for the remaining digits.
+ */
+namespace SlCan::Hex {
+static constexpr uint8_t s_invalid = 0xFF;    //!< Value of the characters that aren't hex digits.
+
+static constexpr std::array<uint8_t, 16> s_digits = {
+  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+
+//! Value of each character, s_invalid for those that aren't hex digits.
+static constexpr std::array<uint8_t, 256> s_values = [] {
+    std::array<uint8_t, 256> values = {};
+    for (auto& value : values) {
+        value = s_invalid;
+    }
+    for (uint8_t i = 0; i < 10; i++) {
+        values['0' + i] = i;
+    }
+    for (uint8_t i = 0; i < 6; i++) {
+        values['A' + i] = 10 + i;
+        values['a' + i] = 10 + i;
+    }
+    return values;
+}();
+
+//! Both digits of each byte, in the order they are written.
+static constexpr std::array<std::array<uint8_t, 2>, 256> s_bytes = [] {
+    std::array<std::array<uint8_t, 2>, 256> bytes = {};
+    for (size_t i = 0; i < bytes.size(); i++) {
+        bytes[i] = {s_digits[i >> 4], s_digits[i & 0x0F]};
+    }
+    return bytes;
+}();
+
+/**
+ * Gets the value of a single digit.
+ * @returns The value, s_invalid if c isn't a hex digit.
+ */
+[[nodiscard]] constexpr uint8_t decodeDigit(uint8_t c)
+{
+    return s_values[c];
+}
+
+/**
+ * Writes the digits of the low bits of a value.
+ * @param digits Number of digits to write, at most 8.
+ * @returns A pointer past the last digit.
+ */
+inline uint8_t* encodeValue(uint8_t* out, uint32_t value, size_t digits)
+{
+    for (size_t i = digits; i > 0; i--) {
+        out[i - 1] = s_digits[value & 0x0F];
+        value >>= 4;
+    }
+    return out + digits;
+}
+
+/**
+ * Writes two digits per byte.
+ * @returns A pointer past the last digit.
+ */
+inline uint8_t* encodeBytes(uint8_t* out, const uint8_t* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        std::memcpy(out, s_bytes[data[i]].data(), 2);
+        out += 2;
+    }
+    return out;
+}
+
+namespace Detail {
+constexpr uint32_t s_ones = 0x01010101UL;
+
+/**
+ * Sets the high bit of every byte of x that is strictly between m and n.
+ * 0 <= m <= 127 and 0 <= n <= 128.
+ */
+constexpr uint32_t hasBetween(uint32_t x, uint32_t m, uint32_t n)
+{
+    uint32_t low = x & (s_ones * 127);
+    return ((s_ones * (127 + n) - low) & ~x & (low + s_ones * (127 - m))) & (s_ones * 128);
+}
+}    // namespace Detail
+
+/**
+ * Converts four digits at once.
+ * @param in The digits, no alignment required.
+ * @param out Value of the digits, only written if they're all valid.
+ * @returns False if one of the characters isn't a hex digit.
+ */
+inline bool decode4(const uint8_t* in, uint16_t& out)
+{
+    using namespace Detail;
+    uint32_t x;
+    std::memcpy(&x, in, sizeof(x));    // Little endian, the first digit is in the low byte.
+
+    // The case bit (0x20) is forced on so that both cases of the letters land in 0x61..0x66.
+    uint32_t isDigit  = hasBetween(x, '0' - 1, '9' + 1);
+    uint32_t isLetter = hasBetween(x | (s_ones * 0x20), 'a' - 1, 'f' + 1);
+    if ((isDigit | isLetter) != s_ones * 0x80) { return false; }
+
+    // '0'..'9' keep their low nibble, the letters have 0x40 set and a low nibble of 1..6: add 9.
+    uint32_t nibbles = (x & (s_ones * 0x0F)) + ((x >> 6) & s_ones) * 9;
+    // Pack the nibbles in pairs, then swap the two bytes to get the first digit in the high nibble.
+    uint32_t pairs = ((nibbles & 0x000F000FUL) << 4) | ((nibbles & 0x0F000F00UL) >> 8);
+    out            = static_cast<uint16_t>(((pairs & 0xFFUL) << 8) | ((pairs >> 16) & 0xFFUL));
+    return true;
+}
+
+/**
+ * Converts a value of up to 8 digits.
+ * @param out The value, only valid if true is returned.
+ * @returns False if one of the characters isn't a hex digit.
+ */
+inline bool decodeValue(const uint8_t* in, size_t digits, uint32_t& out)
+{
+    uint32_t value = 0;
+    for (; digits >= 4; digits -= 4, in += 4) {
+        uint16_t word;
+        if (!decode4(in, word)) { return false; }
+        value = (value << 16) | word;
+    }
+    for (; digits > 0; digits--, in++) {
+        uint8_t digit = decodeDigit(*in);
+        if (digit == s_invalid) { return false; }
+        value = (value << 4) | digit;
+    }
+    out = value;
+    return true;
+}
+
+/**
+ * Converts pairs of digits to bytes.
+ * @param in 2 * len digits.
+ * @returns False if one of the characters isn't a hex digit.
+ */
+inline bool decodeBytes(const uint8_t* in, size_t len, uint8_t* out)
+{
+    for (; len >= 2; len -= 2, in += 4, out += 2) {
+        uint16_t word;
+        if (!decode4(in, word)) { return false; }
+        out[0] = static_cast<uint8_t>(word >> 8);
+        out[1] = static_cast<uint8_t>(word);
+    }
+    if (len != 0) {
+        uint8_t high = decodeDigit(in[0]);
+        uint8_t low  = decodeDigit(in[1]);
+        if (high == s_invalid || low == s_invalid) { return false; }
+        *out = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+}
+}    // namespace SlCan::Hex
+
+#endif    // CEP_SLCAN_HEX_H
@@ -0,0 +1,107 @@
+/**
+ * @file    parser.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-15
+ * @brief   Incremental SLCAN tokenizer.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "parser.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace SlCan {
+namespace {
+/**
+ * Hands a line to the user, skipping the line feeds left over by hosts that terminate their lines with "\r\n".
+ * @returns True if a line was emitted.
+ */
+bool emit(const uint8_t* line, size_t len, Framing framing, Parser::OnLine onLine, void* userData)
+{
+    while (framing == Framing::Ascii && len > 0 && *line == '\n') {
+        ++line;
+        --len;
+    }
+
+    // Needs at least two characters: command and \r, or COBS code and delimiter.
+    if (len < 2) { return false; }
+
+    onLine(userData, line, len);
+    return true;
+}
+}    // namespace
+
+size_t Parser::feed(const uint8_t* data, size_t len, OnLine onLine, void* userData)
+{
+    size_t               lines = 0;
+    const uint8_t* const end   = data + len;
+
+    while (data != end) {
+        // Looked up on every line, the callback can change the framing.
+        uint8_t     terminatorChar = m_framing == Framing::Binary ? s_binaryTerminator : s_terminator;
+        const auto* terminator =
+          static_cast<const uint8_t*>(std::memchr(data, terminatorChar, static_cast<size_t>(end - data)));
+        if (terminator == nullptr) {
+            // Partial line, keep it for the next transfer.
+            append(data, static_cast<size_t>(end - data));
+            break;
+        }
+
+        size_t chunkLen = static_cast<size_t>(terminator - data) + 1;
+        if (m_lineLen == 0 && !m_overflowed) {
+            // Nothing pending, the line can be used straight from the input buffer.
+            if (chunkLen > sizeof(m_line)) { ++m_droppedLines; }
+            else if (emit(data, chunkLen, m_framing, onLine, userData)) {
+                ++lines;
+            }
+        }
+        else {
+            append(data, chunkLen);
+            if (m_overflowed) { ++m_droppedLines; }
+            else if (emit(&m_line[0], m_lineLen, m_framing, onLine, userData)) {
+                ++lines;
+            }
+            reset();
+        }
+
+        data = terminator + 1;
+    }
+
+    return lines;
+}
+
+void Parser::reset()
+{
+    m_lineLen    = 0;
+    m_overflowed = false;
+}
+
+void Parser::setFraming(Framing framing)
+{
+    m_framing = framing;
+    reset();
+}
+
+void Parser::append(const uint8_t* data, size_t len)
+{
+    if (m_overflowed) { return; }
+
+    if (m_lineLen + len > sizeof(m_line)) {
+        // Can't be a valid frame, drop everything up to the next terminator.
+        m_overflowed = true;
+        return;
+    }
+
+    std::copy(data, data + len, &m_line[m_lineLen]);
+    m_lineLen += len;
+}
+}    // namespace SlCan
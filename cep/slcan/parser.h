@@ -0,0 +1,89 @@
+/**
+ * @file    parser.h
+ * @author  Samuel Martel
+ * @date    2024-04-15
+ * @brief   Incremental SLCAN tokenizer.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SLCAN_PARSER_H
+#define CEP_SLCAN_PARSER_H
+
+#include "slcan.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace SlCan {
+/**
+ * Splits a stream of bytes into SLCAN lines, or into binary records when the binary framing is selected.
+ *
+ * A USB transfer can contain any number of lines, and a line can be split across two transfers. Complete lines are
+ * handed to the callback straight from the input buffer, only the trailing partial line gets copied so that it can be
+ * completed by the next call to Parser::feed.
+ *
+ * Lines that are longer than Packet::s_mtu can't be a valid SLCAN frame, they are discarded up to their terminator.
+ *
+ * The framing can be changed from the callback, the rest of the chunk is then split with the new terminator.
+ */
+class Parser {
+public:
+    /**
+     * Function called for each complete line.
+     *
+     * void*: User Data.
+     * const uint8_t*: Pointer to the line, including its terminator.
+     * size_t: Length of the line, including its terminator.
+     */
+    using OnLine = void (*)(void*, const uint8_t*, size_t);
+
+    static constexpr uint8_t s_terminator       = '\r';
+    static constexpr uint8_t s_binaryTerminator = 0x00;    //!< COBS delimiter.
+
+    /**
+     * Feeds a chunk of the stream to the parser.
+     * @param data Pointer to the chunk.
+     * @param len Number of bytes in the chunk.
+     * @param onLine Function called for every line completed by this chunk.
+     * @param userData Passed as-is to onLine.
+     * @return Number of lines completed by this chunk.
+     */
+    size_t feed(const uint8_t* data, size_t len, OnLine onLine, void* userData);
+
+    /**
+     * Discards the partial line, if any.
+     */
+    void reset();
+
+    /**
+     * Selects how the following bytes are split, discarding the partial line.
+     */
+    void                  setFraming(Framing framing);
+    [[nodiscard]] Framing framing() const { return m_framing; }
+
+    [[nodiscard]] size_t pendingBytes() const { return m_lineLen; }
+    [[nodiscard]] size_t droppedLines() const { return m_droppedLines; }
+
+private:
+    void append(const uint8_t* data, size_t len);
+
+private:
+    Framing m_framing             = Framing::Ascii;
+    uint8_t m_line[Packet::s_mtu] = {};
+    size_t  m_lineLen             = 0;
+    bool    m_overflowed          = false;    //!< Set when the current line didn't fit in m_line.
+    size_t  m_droppedLines        = 0;
+};
+}    // namespace SlCan
+
+#endif    // CEP_SLCAN_PARSER_H
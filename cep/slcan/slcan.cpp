@@ -16,10 +16,15 @@
  */
 #include "slcan.h"
 
+#include "cobs.h"
+#include "hex.h"
+#include "timestamp.h"
+
 #include <logging/logger.h>
 
 #include <FreeRTOS.h>
 
+#include <algorithm>
 #include <cctype>
 #include <utility>
 
@@ -27,13 +32,32 @@ namespace SlCan {
 namespace {
 constexpr const char* s_tag = "SlCan";
 
-Command commandFromHeader(bool isExtended, bool isRemote)
+/**
+ * Reports the first character of a field that isn't a hex digit.
+ * @param line The line, without its command.
+ * @param offset Start of the field in the line.
+ * @param len Number of characters in the field.
+ */
+void logInvalidCharacter(const uint8_t* line, size_t offset, size_t len)
 {
-    if (!isExtended && !isRemote) { return Command::TransmitDataFrame; }
-    if (isExtended && !isRemote) { return Command::TransmitExtDataFrame; }
-    if (!isExtended && isRemote) { return Command::TransmitRemoteFrame; }
-    if (isExtended && isRemote) { return Command::TransmitExtRemoteFrame; }
-    std::unreachable();
+    for (size_t i = offset; i < offset + len; i++) {
+        if (Hex::decodeDigit(line[i]) == Hex::s_invalid) {
+            LOGE(s_tag,
+                 "Invalid character '%c' (%#02x) at position %d",
+                 std::isprint(line[i]) == 0 ? ' ' : line[i],
+                 line[i],
+                 i);
+            return;
+        }
+    }
+}
+
+/**
+ * Gets the value of a timestamp in the unit of the mode.
+ */
+uint32_t timestampValue(uint32_t timestampUs, TimestampMode mode)
+{
+    return mode == TimestampMode::Milliseconds ? Timestamp::toSlCanMs(timestampUs) : timestampUs;
 }
 }    // namespace
 
@@ -42,6 +66,13 @@ Packet::Packet(const uint8_t* data, size_t len)
     configASSERT(data != nullptr);
     configASSERT(len >= 2);    // Needs at least two characters: command and \r
 
+    // Lines for the other channels start with its number, none of the commands are digits.
+    if (data[0] >= '0' && data[0] <= '0' + s_maxChannel) {
+        channel = data[0] - '0';
+        data++;
+        len--;
+    }
+
     command = commandFromChar(data[0]);
     if (command == Command::Invalid) {
         LOGE(s_tag, "Invalid command ID %#02x", data[0]);
@@ -52,90 +83,280 @@ Packet::Packet(const uint8_t* data, size_t len)
     len--;                                   // Remove the command.
     if (data[len - 1] == '\r') { len--; }    // Remove the terminator, if present.
 
-    uint8_t workBuff[s_mtu];
-    // Convert from ASCII.
-    for (size_t i = 0; i < len; i++) {
-        if (data[i] >= 'a' && data[i] <= 'f') { workBuff[i] = data[i] - 'a' + 10; }
-        else if (data[i] >= 'A' && data[i] <= 'F') {
-            workBuff[i] = data[i] - 'A' + 10;
-        }
-        else if (data[i] >= '0' && data[i] <= '9') {
-            workBuff[i] = data[i] - '0';
+    if (command == Command::SetMode && len == s_acceptanceLen) { command = Command::SetAcceptanceCode; }
+    if (command == Command::SetBusStatusPeriod && len == 3 * s_busStatusLen) { command = Command::ReportBusStatus; }
+    if (command == Command::SetIsoTpLink && (len == s_stdIdLen + 1 || len == s_extIdLen + 1)) {
+        command = Command::ReportIsoTpStatus;
+    }
+
+    if (command == Command::SetAcceptanceCode || command == Command::SetAcceptanceMask) {
+        uint32_t value = 0;
+        if (len != s_acceptanceLen) {
+            LOGE(s_tag, "Expected %d digits, got %d", s_acceptanceLen, len);
+            command = Command::Invalid;
+            return;
         }
-        else {
-            // Invalid character!
-            LOGE(s_tag,
-                 "Invalid character '%c' (%#02x) at position %d",
-                 std::isprint(data[i]) == 0 ? ' ' : data[i],
-                 data[i],
-                 i);
+        if (!Hex::decodeValue(&data[0], len, value)) {
+            logInvalidCharacter(data, 0, len);
             command = Command::Invalid;
             return;
         }
+        this->data.acceptance = value;
+        return;
     }
 
-    if (command == Command::SetBitRate) { this->data.bitrate = bitRateFromChar(data[1]); }
-    else if (command == Command::SetMode) {
-        this->data.mode = modeFromStr(data[1]);
-    }
-    else if (command == Command::SetAutoRetry) {
-        this->data.autoRetransmit = autoRetransmitFromStr(data[1]);
+    if (command == Command::ReportBusStatus) {
+        uint32_t values[3] = {};
+        for (size_t i = 0; i < 3; i++) {
+            if (!Hex::decodeValue(&data[i * s_busStatusLen], s_busStatusLen, values[i])) {
+                logInvalidCharacter(data, 0, len);
+                command = Command::Invalid;
+                return;
+            }
+        }
+        this->data.busStatus = {
+          .loadPermille    = static_cast<uint16_t>(values[0]),
+          .framesPerSecond = static_cast<uint16_t>(values[1]),
+          .errorsPerSecond = static_cast<uint16_t>(values[2]),
+        };
+        return;
     }
-    else if (commandIsTransmit(command)) {
-        this->data.packetData.isExtended =
-          (command == Command::TransmitExtRemoteFrame) || (command == Command::TransmitExtDataFrame);
-        this->data.packetData.isRemote =
-          (command == Command::TransmitRemoteFrame) || (command == Command::TransmitExtRemoteFrame);
 
-        // Save the CAN ID based on the ID type.
-        size_t idLen = this->data.packetData.isExtended ? s_extIdLen : s_stdIdLen;
-
-        if (len < idLen) {
-            LOGE(s_tag, "Not enough data for header, need %d, got %d", idLen, len);
+    if (command == Command::SetFilterRange) {
+        // Either nothing, or the first and last identifiers of the range.
+        size_t idLen = len / 2;
+        if (len != 0 && len != 2 * s_stdIdLen && len != 2 * s_extIdLen) {
+            LOGE(s_tag, "Unexpected filter range length: %d", len);
+            command = Command::Invalid;
+            return;
+        }
+        uint32_t first = 0;
+        uint32_t last  = 0;
+        if (!Hex::decodeValue(&data[0], idLen, first) || !Hex::decodeValue(&data[idLen], idLen, last)) {
+            logInvalidCharacter(data, 0, len);
             command = Command::Invalid;
             return;
         }
+        this->data.filterRange = {
+          .first      = first,
+          .last       = last,
+          .isExtended = idLen == s_extIdLen,
+          .clear      = len == 0,
+        };
+        return;
+    }
 
-        uint8_t* ptr             = &workBuff[0];
-        this->data.packetData.id = 0;
-        for (size_t i = 0; i < idLen; i++, ptr++) {
-            this->data.packetData.id *= 16;
-            this->data.packetData.id += *ptr;
+    if (command == Command::SetPeriodicFrame) {
+        // The rest of the line is a frame, which goes on the channel of the whole line.
+        if (len < 2 || std::isdigit(data[0]) != 0) {
+            LOGE(s_tag, "Expected a frame after '%c'", commandToChar(command));
+            command = Command::Invalid;
+            return;
+        }
+        Packet frame {data, len};
+        if (!commandIsTransmit(frame.command)) {
+            command = Command::Invalid;
+            return;
         }
+        this->data.packetData = frame.data.packetData;
+        return;
+    }
 
-        len -= idLen;
-        if (!this->data.packetData.isRemote) {
-            if (len == 0) {
-                LOGE(s_tag, "DLC byte missing!");
+    if (command == Command::SetPeriodicTiming) {
+        // Either nothing, the identifier alone, or the identifier followed by the period, phase and count.
+        constexpr size_t timingLen = 2 * s_periodicTimeLen + s_periodicCountLen;
+        size_t           idLen     = len > timingLen ? len - timingLen : len;
+        if (len != 0 && idLen != s_stdIdLen && idLen != s_extIdLen) {
+            LOGE(s_tag, "Unexpected periodic timing length: %d", len);
+            command = Command::Invalid;
+            return;
+        }
+        uint32_t values[4]  = {};
+        size_t   lengths[4] = {idLen, s_periodicTimeLen, s_periodicTimeLen, s_periodicCountLen};
+        size_t   offset     = 0;
+        for (size_t i = 0; i < 4 && offset < len; i++) {
+            if (!Hex::decodeValue(&data[offset], lengths[i], values[i])) {
+                logInvalidCharacter(data, offset, lengths[i]);
                 command = Command::Invalid;
                 return;
             }
+            offset += lengths[i];
+        }
+        this->data.periodicTiming = {
+          .id         = values[0],
+          .isExtended = idLen == s_extIdLen,
+          .clear      = len == 0,
+          .remove     = len == idLen,
+          .periodUs   = values[1],
+          .phaseUs    = values[2],
+          .count      = static_cast<uint16_t>(values[3]),
+        };
+        return;
+    }
 
-            this->data.packetData.dataLen = *ptr;
-            ptr++;
-            len--;
-
-            if (this->data.packetData.dataLen > 8) {
-                LOGE(s_tag, "Indicated data length is too big! (DLC = %d, max is 8)", this->data.packetData.dataLen);
+    if (command == Command::SetIsoTpLink) {
+        // Either nothing, the transmit identifier alone, or both identifiers followed by the block size and STmin.
+        constexpr size_t paramsLen = 2 * s_isoTpParamLen;
+        size_t           idLen     = 0;
+        if (len == s_stdIdLen || len == 2 * s_stdIdLen + paramsLen) { idLen = s_stdIdLen; }
+        else if (len == s_extIdLen || len == 2 * s_extIdLen + paramsLen) {
+            idLen = s_extIdLen;
+        }
+        else if (len != 0) {
+            LOGE(s_tag, "Unexpected ISO-TP link length: %d", len);
+            command = Command::Invalid;
+            return;
+        }
+        uint32_t values[4]  = {};
+        size_t   lengths[4] = {idLen, idLen, s_isoTpParamLen, s_isoTpParamLen};
+        size_t   offset     = 0;
+        for (size_t i = 0; i < 4 && offset < len; i++) {
+            if (!Hex::decodeValue(&data[offset], lengths[i], values[i])) {
+                logInvalidCharacter(data, offset, lengths[i]);
                 command = Command::Invalid;
                 return;
             }
+            offset += lengths[i];
+        }
+        this->data.isoTpLink = {
+          .txId       = values[0],
+          .rxId       = values[1],
+          .isExtended = idLen == s_extIdLen,
+          .close      = len != 0 && len == idLen,
+          .closeAll   = len == 0,
+          .blockSize  = static_cast<uint8_t>(values[2]),
+          .stMin      = static_cast<uint8_t>(values[3]),
+        };
+        return;
+    }
 
-            if (this->data.packetData.dataLen * 2 > len) {
-                LOGE(s_tag,
-                     "Unexpected number of data bytes! Expected %d, got %d",
-                     this->data.packetData.dataLen * 2,
-                     len);
-                command = Command::Invalid;
-                return;
-            }
+    if (command == Command::ReportIsoTpStatus) {
+        size_t   idLen  = len - 1;
+        uint32_t txId   = 0;
+        uint8_t  status = Hex::decodeDigit(data[idLen]);
+        if (!Hex::decodeValue(&data[0], idLen, txId) || status == Hex::s_invalid) {
+            logInvalidCharacter(data, 0, len);
+            command = Command::Invalid;
+            return;
+        }
+        this->data.isoTpStatus = {
+          .txId       = txId,
+          .isExtended = idLen == s_extIdLen,
+          .status     = status,
+        };
+        return;
+    }
 
-            // Copy the packet data to the buffer.
-            for (size_t i = 0; i < this->data.packetData.dataLen; i++) {
-                this->data.packetData.data[i] = (ptr[0] << 4) | ptr[1];
-                ptr += 2;
-            }
+    if (command == Command::TransferIsoTpData) {
+        // The identifier, the last segment flag, then the bytes. The length of the identifier sets the parity.
+        size_t idLen = len % 2 == 0 ? s_stdIdLen : s_extIdLen;
+        if (len < idLen + 1 || len - idLen - 1 > 2 * s_isoTpSegmentLen) {
+            LOGE(s_tag, "Unexpected ISO-TP segment length: %d", len);
+            command = Command::Invalid;
+            return;
+        }
+        uint32_t id      = 0;
+        uint8_t  isLast  = Hex::decodeDigit(data[idLen]);
+        size_t   dataLen = (len - idLen - 1) / 2;
+        if (!Hex::decodeValue(&data[0], idLen, id) || isLast > 1 ||
+            !Hex::decodeBytes(&data[idLen + 1], dataLen, &this->data.isoTpData.data[0])) {
+            logInvalidCharacter(data, 0, len);
+            command = Command::Invalid;
+            return;
         }
+        this->data.isoTpData.id         = id;
+        this->data.isoTpData.isExtended = idLen == s_extIdLen;
+        this->data.isoTpData.isLast     = isLast == 1;
+        this->data.isoTpData.len        = static_cast<uint8_t>(dataLen);
+        return;
+    }
+
+    // The values are single hex digits, a value missing from the line decodes as invalid.
+    if (!commandIsTransmit(command)) {
+        uint8_t value = len == 0 ? Hex::s_invalid : Hex::decodeDigit(data[0]);
+        if (len != 0 && value == Hex::s_invalid) {
+            logInvalidCharacter(data, 0, len);
+            command = Command::Invalid;
+            return;
+        }
+
+        if (command == Command::SetBitRate) { this->data.bitrate = bitRateFromChar(value); }
+        else if (command == Command::SetMode) {
+            this->data.mode = modeFromStr(value);
+        }
+        else if (command == Command::SetAutoRetry) {
+            this->data.autoRetransmit = autoRetransmitFromStr(value);
+        }
+        else if (command == Command::SetFraming) {
+            this->data.framing = framingFromStr(value);
+        }
+        else if (command == Command::SetTimestamp) {
+            this->data.timestampMode = timestampModeFromStr(value);
+        }
+        else if (command == Command::SetBusStatusPeriod) {
+            this->data.busStatusPeriod = value;
+        }
+        return;
+    }
+
+    this->data.packetData.isExtended = commandIsExtended(command);
+    this->data.packetData.isRemote =
+      (command == Command::TransmitRemoteFrame) || (command == Command::TransmitExtRemoteFrame);
+    this->data.packetData.isFd = commandIsFd(command);
+    this->data.packetData.bitRateSwitch =
+      (command == Command::TransmitFdBrsFrame) || (command == Command::TransmitExtFdBrsFrame);
+
+    // Save the CAN ID based on the ID type.
+    size_t idLen = this->data.packetData.isExtended ? s_extIdLen : s_stdIdLen;
+
+    if (len < idLen) {
+        LOGE(s_tag, "Not enough data for header, need %d, got %d", idLen, len);
+        command = Command::Invalid;
+        return;
+    }
+
+    uint32_t id = 0;
+    if (!Hex::decodeValue(&data[0], idLen, id)) {
+        logInvalidCharacter(data, 0, idLen);
+        command = Command::Invalid;
+        return;
+    }
+    this->data.packetData.id = id;
+
+    if (this->data.packetData.isRemote) { return; }
+
+    if (len == idLen) {
+        LOGE(s_tag, "DLC byte missing!");
+        command = Command::Invalid;
+        return;
+    }
+
+    uint8_t dlc = Hex::decodeDigit(data[idLen]);
+    if (dlc == Hex::s_invalid) {
+        logInvalidCharacter(data, idLen, 1);
+        command = Command::Invalid;
+        return;
+    }
+    if (!this->data.packetData.isFd && dlc > s_maxClassicDataLen) {
+        LOGE(s_tag, "Indicated data length is too big! (DLC = %d, max is 8)", dlc);
+        command = Command::Invalid;
+        return;
+    }
+    this->data.packetData.dataLen = dlcToLen(dlc);
+
+    size_t dataOffset = idLen + 1;
+    size_t dataDigits = 2 * this->data.packetData.dataLen;
+    if (dataDigits > len - dataOffset) {
+        LOGE(s_tag, "Unexpected number of data bytes! Expected %d, got %d", dataDigits, len - dataOffset);
+        command = Command::Invalid;
+        return;
+    }
+
+    // Copy the packet data to the buffer.
+    if (!Hex::decodeBytes(&data[dataOffset], this->data.packetData.dataLen, &this->data.packetData.data[0])) {
+        logInvalidCharacter(data, dataOffset, dataDigits);
+        command = Command::Invalid;
+        return;
     }
 }
 
@@ -146,9 +367,12 @@ Packet::Packet(uint32_t id, bool extended)
       {
         .id         = id,
         .isExtended = extended,
-        .isRemote   = true,
-        .dataLen    = 0,
-        .data       = {},
+        .isRemote      = true,
+        .isFd          = false,
+        .bitRateSwitch = false,
+        .dataLen       = 0,
+        .data          = {},
+        .timestamp     = 0,
       },
   }
 {
@@ -161,107 +385,333 @@ Packet::Packet(uint32_t id, bool extended, const uint8_t* data, size_t len)
       {
         .id         = id,
         .isExtended = extended,
-        .isRemote   = false,
-        .dataLen    = static_cast<uint8_t>(len),
-        .data       = {},
+        .isRemote      = false,
+        .isFd          = false,
+        .bitRateSwitch = false,
+        .dataLen       = static_cast<uint8_t>(len),
+        .data          = {},
+        .timestamp     = 0,
       },
   }
 {
-    configASSERT(len <= 8 && "DLC can't be more than 8!");
+    configASSERT(len <= s_maxClassicDataLen && "DLC can't be more than 8!");
     std::copy(data, data + len, &this->data.packetData.data[0]);
 }
 
-Packet::Packet(const FDCAN_RxHeaderTypeDef& header, const uint8_t* data, size_t len)
-: command(commandFromHeader(header.IdType == FDCAN_EXTENDED_ID, header.RxFrameType == FDCAN_REMOTE_FRAME)),
-  data {
-    .packetData =
-      {
-        .id         = header.Identifier,
-        .isExtended = header.IdType == FDCAN_EXTENDED_ID,
-        .isRemote   = header.RxFrameType == FDCAN_REMOTE_FRAME,
-        .dataLen    = static_cast<uint8_t>(header.DataLength),
-        .data       = {},
-      },
-  }
+Packet Packet::fdFrame(uint32_t id, bool extended, const uint8_t* data, size_t len, bool bitRateSwitch)
 {
-    configASSERT(header.DataLength == len && "len provided doesn't match header's value");
-    configASSERT(len <= 8 && "DLC can't be more than 8!");
-    std::copy(data, data + len, &this->data.packetData.data[0]);
+    configASSERT(isValidDataLen(len, true) && "Not a length an FD frame can have!");
+
+    Packet packet;
+    packet.command         = commandFromFrame(extended, false, true, bitRateSwitch);
+    packet.data.packetData = {
+      .id            = id,
+      .isExtended    = extended,
+      .isRemote      = false,
+      .isFd          = true,
+      .bitRateSwitch = bitRateSwitch,
+      .dataLen       = static_cast<uint8_t>(len),
+      .data          = {},
+      .timestamp     = 0,
+    };
+    std::copy(data, data + len, &packet.data.packetData.data[0]);
+    return packet;
+}
+
+Packet::Packet(const FDCAN_RxHeaderTypeDef& header, const uint8_t* data) : data {.packetData = {}}
+{
+    setRxHeader(header);
+    if (this->data.packetData.isRemote) { return; }
+    std::copy(data, data + this->data.packetData.dataLen, &this->data.packetData.data[0]);
+}
+
+void Packet::setRxHeader(const FDCAN_RxHeaderTypeDef& header)
+{
+    bool isExtended = header.IdType == FDCAN_EXTENDED_ID;
+    bool isRemote   = header.RxFrameType == FDCAN_REMOTE_FRAME;
+    bool isFd       = header.FDFormat == FDCAN_FD_CAN;
+    bool brs        = header.BitRateSwitch == FDCAN_BRS_ON;
+
+    // The data bytes are left alone, they're already in place.
+    command                       = commandFromFrame(isExtended, isRemote, isFd, brs);
+    data.packetData.id            = header.Identifier;
+    data.packetData.isExtended    = isExtended;
+    data.packetData.isRemote      = isRemote;
+    data.packetData.isFd          = isFd;
+    data.packetData.bitRateSwitch = brs;
+    data.packetData.timestamp     = 0;
+    // Remote frames don't have data, their DLC is the length of the data they request.
+    data.packetData.dataLen = isRemote ? static_cast<uint8_t>(header.DataLength)
+                                       : dlcToLen(static_cast<uint8_t>(header.DataLength));
 }
 
-Packet::Packet(const FDCAN_TxHeaderTypeDef& header, const uint8_t* data, size_t len)
-: command(commandFromHeader(header.IdType == FDCAN_EXTENDED_ID, header.TxFrameType == FDCAN_REMOTE_FRAME)),
+Packet::Packet(const FDCAN_TxHeaderTypeDef& header, const uint8_t* data)
+: command(commandFromFrame(header.IdType == FDCAN_EXTENDED_ID,
+                           header.TxFrameType == FDCAN_REMOTE_FRAME,
+                           header.FDFormat == FDCAN_FD_CAN,
+                           header.BitRateSwitch == FDCAN_BRS_ON)),
   data {
     .packetData =
       {
-        .id         = header.Identifier,
-        .isExtended = header.IdType == FDCAN_EXTENDED_ID,
-        .isRemote   = header.TxFrameType == FDCAN_REMOTE_FRAME,
-        .dataLen    = static_cast<uint8_t>(header.DataLength),
-        .data       = {},
+        .id            = header.Identifier,
+        .isExtended    = header.IdType == FDCAN_EXTENDED_ID,
+        .isRemote      = header.TxFrameType == FDCAN_REMOTE_FRAME,
+        .isFd          = header.FDFormat == FDCAN_FD_CAN,
+        .bitRateSwitch = header.BitRateSwitch == FDCAN_BRS_ON,
+        .dataLen       = dlcToLen(static_cast<uint8_t>(header.DataLength)),
+        .data          = {},
+        .timestamp     = 0,
       },
   }
 {
-    configASSERT(header.DataLength == len && "len provided doesn't match header's value");
-    configASSERT(len <= 8 && "DLC can't be more than 8!");
-    std::copy(data, data + len, &this->data.packetData.data[0]);
+    if (this->data.packetData.isRemote) {
+        // Remote frames don't have data, their DLC is the length of the data they request.
+        this->data.packetData.dataLen = static_cast<uint8_t>(header.DataLength);
+        return;
+    }
+    std::copy(data, data + this->data.packetData.dataLen, &this->data.packetData.data[0]);
+}
+
+Packet Packet::fromBinary(const uint8_t* record, size_t len)
+{
+    configASSERT(record != nullptr);
+
+    Packet packet;
+    if (len != 0 && record[len - 1] == Cobs::s_delimiter) { len--; }    // Remove the delimiter, if present.
+    // One spare byte to terminate the control records.
+    uint8_t raw[s_mtu + 1];
+    if (len == 0 || len > s_mtu) {
+        LOGE(s_tag, "Invalid record length: %d", len);
+        return packet;
+    }
+
+    size_t rawLen = Cobs::decode(record, len, &raw[0]);
+    if (rawLen == 0) {
+        LOGE(s_tag, "Malformed COBS record");
+        return packet;
+    }
+
+    // The channel prefix is dropped, the rest is a regular record.
+    uint8_t channel = 0;
+    if ((raw[0] & 0xF0) == s_binaryChannel) {
+        channel = raw[0] & 0x0F;
+        std::copy(&raw[1], &raw[rawLen], &raw[0]);
+        if (--rawLen == 0 || channel > s_maxChannel) {
+            LOGE(s_tag, "Invalid channel prefix");
+            return packet;
+        }
+    }
+
+    uint8_t header = raw[0];
+    if ((header & s_binaryFd) == s_binaryControl) {
+        if (rawLen < 2) {
+            LOGE(s_tag, "Control record without a command");
+            return packet;
+        }
+        raw[rawLen] = '\r';
+        packet         = {&raw[1], rawLen};
+        packet.channel = channel;
+        return packet;
+    }
+
+    bool   isFd          = (header & s_binaryFd) == s_binaryFd;
+    bool   isExtended    = (header & s_binaryExtended) != 0;
+    bool   isRemote      = !isFd && (header & s_binaryRemote) != 0;
+    bool   bitRateSwitch = isFd && (header & s_binaryBrs) != 0;
+    size_t headerLen     = isFd ? 2 : 1;
+    if (rawLen < headerLen) {
+        LOGE(s_tag, "FD record without a DLC");
+        return packet;
+    }
+    uint8_t dlc        = isFd ? raw[1] : header & 0x0F;
+    size_t  dataLen    = isRemote ? 0 : dlcToLen(dlc);
+    size_t  idLen      = isExtended ? sizeof(uint32_t) : sizeof(uint16_t);
+    size_t  expected   = headerLen + idLen + dataLen;
+    // The timestamp can be in either unit.
+    bool isValidLen = (header & s_binaryTimestamp) != 0
+                        ? rawLen == expected + sizeof(uint16_t) || rawLen == expected + sizeof(uint32_t)
+                        : rawLen == expected;
+    if (dlc > (isFd ? 0x0F : s_maxClassicDataLen) || !isValidLen) {
+        LOGE(s_tag, "Unexpected record length! Expected %d, got %d (DLC = %d)", expected, rawLen, dlc);
+        return packet;
+    }
+
+    // Little endian.
+    uint32_t id = 0;
+    for (size_t i = idLen; i > 0; i--) {
+        id = (id << 8) | raw[headerLen + i - 1];
+    }
+    id &= isExtended ? 0x1FFFFFFFUL : 0x7FFUL;
+
+    // The timestamp of the frames coming from the host has no meaning for us.
+    const uint8_t* data = &raw[headerLen + idLen];
+    if (isFd) { packet = fdFrame(id, isExtended, data, dataLen, bitRateSwitch); }
+    else if (isRemote) {
+        packet                         = Packet {id, isExtended};
+        packet.data.packetData.dataLen = dlc;
+    }
+    else {
+        packet = Packet {id, isExtended, data, dataLen};
+    }
+    packet.channel = channel;
+    return packet;
+}
+
+int16_t Packet::toBinary(uint8_t* outBuff, size_t outBuffLen, TimestampMode timestampMode) const
+{
+    size_t size = sizeOfBinaryPacket(timestampMode);
+    if (size == 0 || outBuffLen < size) {
+        // Buffer not big enough!
+        return -1;
+    }
+
+    uint8_t raw[s_mtu];
+    size_t  rawLen = 0;
+    if (channel != 0) { raw[rawLen++] = s_binaryChannel | channel; }
+    if (commandIsTransmit(command)) {
+        const auto& frame         = data.packetData;
+        size_t      idLen         = frame.isExtended ? sizeof(uint32_t) : sizeof(uint16_t);
+        size_t      timestampSize = timestampModeSize(timestampMode);
+
+        uint8_t flags = (frame.isExtended ? s_binaryExtended : 0) | (timestampSize != 0 ? s_binaryTimestamp : 0);
+        if (frame.isFd) {
+            raw[rawLen++] = s_binaryFd | flags | (frame.bitRateSwitch ? s_binaryBrs : 0);
+            raw[rawLen++] = lenToDlc(frame.dataLen);
+        }
+        else {
+            raw[rawLen++] = flags | (frame.isRemote ? s_binaryRemote : 0) | (frame.dataLen & 0x0F);
+        }
+        for (size_t i = 0; i < idLen; i++) {
+            raw[rawLen++] = static_cast<uint8_t>(frame.id >> (8 * i));
+        }
+        if (!frame.isRemote) {
+            std::copy(&frame.data[0], &frame.data[frame.dataLen], &raw[rawLen]);
+            rawLen += frame.dataLen;
+        }
+        uint32_t timestamp = timestampValue(frame.timestamp, timestampMode);
+        for (size_t i = 0; i < timestampSize; i++) {
+            raw[rawLen++] = static_cast<uint8_t>(timestamp >> (8 * i));
+        }
+    }
+    else {
+        // Everything else goes in its ASCII form, minus the terminator. The channel is already in front.
+        Packet ascii  = *this;
+        ascii.channel = 0;
+        raw[rawLen++] = s_binaryControl;
+        if (ascii.toSerial(&raw[rawLen], sizeof(raw) - rawLen) < 0) { return -1; }
+        rawLen += ascii.sizeOfSerialPacket() - 1;
+    }
+
+    size_t encodedLen     = Cobs::encode(&raw[0], rawLen, outBuff);
+    outBuff[encodedLen++] = Cobs::s_delimiter;
+
+    return static_cast<int16_t>(encodedLen);
 }
 
-int8_t Packet::toSerial(uint8_t* outBuff, size_t outBuffLen) const
+int16_t Packet::toSerial(uint8_t* outBuff, size_t outBuffLen, TimestampMode timestampMode) const
 {
-    if (outBuffLen < sizeOfSerialPacket()) {
+    if (outBuffLen < sizeOfSerialPacket(timestampMode)) {
         // Buffer not big enough!
         return -1;
     }
 
     uint8_t* ptr = outBuff;
 
+    if (channel != 0) { *ptr++ = '0' + channel; }
+
     // Add character for frame type.
-    *ptr = static_cast<uint8_t>(command);
+    *ptr = commandToChar(command);
     ++ptr;
 
-    auto addToBuff = [](uint8_t* buff, uint8_t val) -> uint8_t* {
-        // Convert the value to ASCII.
-        if (val <= 9) { val += '0'; }
-        else if (val >= 0xA && val <= 0xF) {
-            val = (val - 10) + 'A';
-        }
-        *buff = val;
-        buff++;
-        return buff;
-    };
-
-    auto addIdToBuff = [&addToBuff](uint8_t* buff, uint32_t id, size_t idLen) -> uint8_t* {
-        for (size_t i = idLen; i > 0; i--) {
-            addToBuff(&buff[i - 1], id & 0xF);
-            id >>= 4;
-        }
-        return buff + idLen;
+    auto addValueToBuff = [](uint8_t* buff, auto value) -> uint8_t* {
+        *buff = Hex::s_digits[static_cast<uint8_t>(value) & 0x0F];
+        return buff + 1;
     };
 
-    auto addDataToBuff = [&addToBuff](uint8_t* buff, const uint8_t* data, uint8_t len) -> uint8_t* {
-        buff = addToBuff(buff, len);
-        for (uint8_t i = 0; i < len; i++) {
-            buff = addToBuff(buff, data[i] >> 4);
-            buff = addToBuff(buff, data[i] & 0xF);
-        }
-        return buff;
+    auto addDataToBuff = [](uint8_t* buff, const uint8_t* data, uint8_t len) -> uint8_t* {
+        *buff++ = Hex::s_digits[lenToDlc(len)];
+        return Hex::encodeBytes(buff, data, len);
     };
 
     switch (command) {
-        case Command::SetBitRate: ptr = addToBuff(ptr, static_cast<uint8_t>(data.bitrate)); break;
-        case Command::SetMode: ptr = addToBuff(ptr, static_cast<uint8_t>(data.mode)); break;
-        case Command::SetAutoRetry: ptr = addToBuff(ptr, static_cast<uint8_t>(data.autoRetransmit)); break;
+        case Command::SetBitRate: ptr = addValueToBuff(ptr, data.bitrate); break;
+        case Command::SetMode: ptr = addValueToBuff(ptr, data.mode); break;
+        case Command::SetAutoRetry: ptr = addValueToBuff(ptr, data.autoRetransmit); break;
+        case Command::SetFraming: ptr = addValueToBuff(ptr, data.framing); break;
+        case Command::SetTimestamp: ptr = addValueToBuff(ptr, data.timestampMode); break;
+        case Command::SetBusStatusPeriod: ptr = addValueToBuff(ptr, data.busStatusPeriod); break;
+        case Command::ReportBusStatus:
+            ptr = Hex::encodeValue(ptr, data.busStatus.loadPermille, s_busStatusLen);
+            ptr = Hex::encodeValue(ptr, data.busStatus.framesPerSecond, s_busStatusLen);
+            ptr = Hex::encodeValue(ptr, data.busStatus.errorsPerSecond, s_busStatusLen);
+            break;
+        case Command::SetAcceptanceCode:
+        case Command::SetAcceptanceMask: ptr = Hex::encodeValue(ptr, data.acceptance, s_acceptanceLen); break;
+        case Command::SetFilterRange:
+            if (!data.filterRange.clear) {
+                size_t idLen = data.filterRange.isExtended ? s_extIdLen : s_stdIdLen;
+                ptr          = Hex::encodeValue(ptr, data.filterRange.first, idLen);
+                ptr          = Hex::encodeValue(ptr, data.filterRange.last, idLen);
+            }
+            break;
+        case Command::SetPeriodicFrame: {
+            // The frame writes its own terminator.
+            const auto& frameData = data.packetData;
+            Packet      frame     = *this;
+            frame.channel         = 0;
+            frame.command =
+              commandFromFrame(frameData.isExtended, frameData.isRemote, frameData.isFd, frameData.bitRateSwitch);
+            auto written = static_cast<size_t>(ptr - outBuff);
+            return static_cast<int16_t>(written + frame.toSerial(ptr, outBuffLen - written));
+        }
+        case Command::SetIsoTpLink:
+            if (!data.isoTpLink.closeAll) {
+                const auto& link  = data.isoTpLink;
+                size_t      idLen = link.isExtended ? s_extIdLen : s_stdIdLen;
+                ptr               = Hex::encodeValue(ptr, link.txId, idLen);
+                if (!link.close) {
+                    ptr = Hex::encodeValue(ptr, link.rxId, idLen);
+                    ptr = Hex::encodeValue(ptr, link.blockSize, s_isoTpParamLen);
+                    ptr = Hex::encodeValue(ptr, link.stMin, s_isoTpParamLen);
+                }
+            }
+            break;
+        case Command::ReportIsoTpStatus:
+            ptr = Hex::encodeValue(ptr, data.isoTpStatus.txId, data.isoTpStatus.isExtended ? s_extIdLen : s_stdIdLen);
+            ptr = addValueToBuff(ptr, data.isoTpStatus.status);
+            break;
+        case Command::TransferIsoTpData: {
+            const auto& segment = data.isoTpData;
+            ptr                 = Hex::encodeValue(ptr, segment.id, segment.isExtended ? s_extIdLen : s_stdIdLen);
+            ptr                 = addValueToBuff(ptr, segment.isLast);
+            ptr                 = Hex::encodeBytes(ptr, &segment.data[0], segment.len);
+            break;
+        }
+        case Command::SetPeriodicTiming:
+            if (!data.periodicTiming.clear) {
+                const auto& timing = data.periodicTiming;
+                ptr = Hex::encodeValue(ptr, timing.id, timing.isExtended ? s_extIdLen : s_stdIdLen);
+                if (!timing.remove) {
+                    ptr = Hex::encodeValue(ptr, timing.periodUs, s_periodicTimeLen);
+                    ptr = Hex::encodeValue(ptr, timing.phaseUs, s_periodicTimeLen);
+                    ptr = Hex::encodeValue(ptr, timing.count, s_periodicCountLen);
+                }
+            }
+            break;
         case Command::TransmitDataFrame:
-            ptr = addIdToBuff(ptr, data.packetData.id, s_stdIdLen);
+        case Command::TransmitFdFrame:
+        case Command::TransmitFdBrsFrame:
+            ptr = Hex::encodeValue(ptr, data.packetData.id, s_stdIdLen);
             ptr = addDataToBuff(ptr, &data.packetData.data[0], data.packetData.dataLen);
             break;
         case Command::TransmitExtDataFrame:
-            ptr = addIdToBuff(ptr, data.packetData.id, s_extIdLen);
+        case Command::TransmitExtFdFrame:
+        case Command::TransmitExtFdBrsFrame:
+            ptr = Hex::encodeValue(ptr, data.packetData.id, s_extIdLen);
             ptr = addDataToBuff(ptr, &data.packetData.data[0], data.packetData.dataLen);
             break;
-        case Command::TransmitRemoteFrame: ptr = addIdToBuff(ptr, data.packetData.id, s_stdIdLen); break;
-        case Command::TransmitExtRemoteFrame: ptr = addIdToBuff(ptr, data.packetData.id, s_extIdLen); break;
+        case Command::TransmitRemoteFrame: ptr = Hex::encodeValue(ptr, data.packetData.id, s_stdIdLen); break;
+        case Command::TransmitExtRemoteFrame: ptr = Hex::encodeValue(ptr, data.packetData.id, s_extIdLen); break;
         case Command::GetVersion:
         case Command::ReportError:
         case Command::OpenChannel:
@@ -270,11 +720,17 @@ int8_t Packet::toSerial(uint8_t* outBuff, size_t outBuffLen) const
         default: break;
     }
 
+    if (commandIsTransmit(command) && timestampMode != TimestampMode::Disabled) {
+        // Same format as the identifier: big endian hex digits.
+        ptr = Hex::encodeValue(
+          ptr, timestampValue(data.packetData.timestamp, timestampMode), 2 * timestampModeSize(timestampMode));
+    }
+
     // Line terminator.
     *ptr = '\r';
     ++ptr;
 
-    return static_cast<int8_t>(ptr - outBuff);
+    return static_cast<int16_t>(ptr - outBuff);
 }
 
 std::optional<FDCAN_RxHeaderTypeDef> Packet::toFDCANRxHeader() const
@@ -284,10 +740,10 @@ std::optional<FDCAN_RxHeaderTypeDef> Packet::toFDCANRxHeader() const
       .Identifier            = data.packetData.id,
       .IdType                = data.packetData.isExtended ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID,
       .RxFrameType           = data.packetData.isRemote ? FDCAN_REMOTE_FRAME : FDCAN_DATA_FRAME,
-      .DataLength            = data.packetData.dataLen,
+      .DataLength            = headerDataLength(),
       .ErrorStateIndicator   = FDCAN_ESI_ACTIVE,
-      .BitRateSwitch         = FDCAN_BRS_OFF,
-      .FDFormat              = FDCAN_CLASSIC_CAN,
+      .BitRateSwitch         = data.packetData.bitRateSwitch ? FDCAN_BRS_ON : FDCAN_BRS_OFF,
+      .FDFormat              = data.packetData.isFd ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN,
       .RxTimestamp           = 0,
       .FilterIndex           = 0,
       .IsFilterMatchingFrame = 0,
@@ -301,16 +757,31 @@ std::optional<FDCAN_TxHeaderTypeDef> Packet::toFDCANTxHeader() const
       .Identifier          = data.packetData.id,
       .IdType              = data.packetData.isExtended ? FDCAN_EXTENDED_ID : FDCAN_STANDARD_ID,
       .TxFrameType         = data.packetData.isRemote ? FDCAN_REMOTE_FRAME : FDCAN_DATA_FRAME,
-      .DataLength          = data.packetData.dataLen,
+      .DataLength          = headerDataLength(),
       .ErrorStateIndicator = FDCAN_ESI_ACTIVE,
-      .BitRateSwitch       = FDCAN_BRS_OFF,
-      .FDFormat            = FDCAN_CLASSIC_CAN,
+      .BitRateSwitch       = data.packetData.bitRateSwitch ? FDCAN_BRS_ON : FDCAN_BRS_OFF,
+      .FDFormat            = data.packetData.isFd ? FDCAN_FD_CAN : FDCAN_CLASSIC_CAN,
       .TxEventFifoControl  = FDCAN_NO_TX_EVENTS,
       .MessageMarker       = 0,
     };
 }
 
-size_t Packet::sizeOfSerialPacket() const
+uint32_t Packet::headerDataLength() const
+{
+    // Remote frames already hold their DLC.
+    return data.packetData.isRemote ? data.packetData.dataLen : lenToDlc(data.packetData.dataLen);
+}
+
+size_t Packet::sizeOfSerialPacket(TimestampMode timestampMode) const
+{
+    // Frames end with the timestamp, in hex digits.
+    size_t timestampLen = commandIsTransmit(command) ? 2 * timestampModeSize(timestampMode) : 0;
+    size_t len          = sizeOfSerialPacketWithoutTimestamp();
+    if (len == 0) { return 0; }
+    return (channel != 0 ? 1 : 0) + len + timestampLen;
+}
+
+size_t Packet::sizeOfSerialPacketWithoutTimestamp() const
 {
     switch (command) {
         case Command::OpenChannel:
@@ -319,13 +790,74 @@ size_t Packet::sizeOfSerialPacket() const
         case Command::ReportError: return 2;    // Command byte + \r
         case Command::SetBitRate:
         case Command::SetMode:
-        case Command::SetAutoRetry: return 3;    // Command byte + value byte + \r
-        case Command::TransmitDataFrame: return 3 + s_stdIdLen + data.packetData.dataLen;       // "t123dxxxx\r"
-        case Command::TransmitExtDataFrame: return 3 + s_extIdLen + data.packetData.dataLen;    // "T12345678dxxxx\r"
-        case Command::TransmitRemoteFrame: return 1 + s_stdIdLen + 1;                           // "r123\r"
-        case Command::TransmitExtRemoteFrame: return 1 + s_extIdLen + 1;                        // "R12345678\r"
+        case Command::SetAutoRetry:
+        case Command::SetFraming:
+        case Command::SetTimestamp:
+        case Command::SetBusStatusPeriod: return 3;                      // Command byte + value byte + \r
+        case Command::ReportBusStatus: return 2 + 3 * s_busStatusLen;    // "uLLLLFFFFEEEE\r"
+        case Command::SetAcceptanceCode:
+        case Command::SetAcceptanceMask: return 2 + s_acceptanceLen;    // "M12345678\r"
+        case Command::SetFilterRange:
+            if (data.filterRange.clear) { return 2; }
+            return 2 + 2 * (data.filterRange.isExtended ? s_extIdLen : s_stdIdLen);    // "f123456\r"
+        case Command::SetPeriodicFrame: {
+            // "pt1232AABB\r"
+            const auto& frameData = data.packetData;
+            Packet      frame     = *this;
+            frame.command =
+              commandFromFrame(frameData.isExtended, frameData.isRemote, frameData.isFd, frameData.bitRateSwitch);
+            return 1 + frame.sizeOfSerialPacketWithoutTimestamp();
+        }
+        case Command::SetIsoTpLink: {
+            // "I7E07E80800\r"
+            const auto& link = data.isoTpLink;
+            if (link.closeAll) { return 2; }
+            size_t idLen = link.isExtended ? s_extIdLen : s_stdIdLen;
+            return 2 + idLen + (link.close ? 0 : idLen + 2 * s_isoTpParamLen);
+        }
+        case Command::ReportIsoTpStatus:
+            // "I7E00\r"
+            return 3 + (data.isoTpStatus.isExtended ? s_extIdLen : s_stdIdLen);
+        case Command::TransferIsoTpData:
+            // "i7E81AABB\r"
+            return 3 + (data.isoTpData.isExtended ? s_extIdLen : s_stdIdLen) + 2 * data.isoTpData.len;
+        case Command::SetPeriodicTiming: {
+            // "P123000F4240000000000000\r"
+            const auto& timing = data.periodicTiming;
+            if (timing.clear) { return 2; }
+            size_t idLen = timing.isExtended ? s_extIdLen : s_stdIdLen;
+            return 2 + idLen + (timing.remove ? 0 : 2 * s_periodicTimeLen + s_periodicCountLen);
+        }
+        case Command::TransmitDataFrame:
+        case Command::TransmitFdFrame:
+        case Command::TransmitFdBrsFrame: return 3 + s_stdIdLen + 2 * data.packetData.dataLen;    // "t123dxxxx\r"
+        case Command::TransmitExtDataFrame:
+        case Command::TransmitExtFdFrame:
+        case Command::TransmitExtFdBrsFrame: return 3 + s_extIdLen + 2 * data.packetData.dataLen;    // "T12345678dxxxx\r"
+        case Command::TransmitRemoteFrame: return 1 + s_stdIdLen + 1;                               // "r123\r"
+        case Command::TransmitExtRemoteFrame: return 1 + s_extIdLen + 1;                            // "R12345678\r"
         case Command::Invalid:
         default: return 0;
     }
 }
+
+size_t Packet::sizeOfBinaryPacket(TimestampMode timestampMode) const
+{
+    size_t rawLen = 0;
+    if (commandIsTransmit(command)) {
+        const auto& frame = data.packetData;
+        rawLen = (channel != 0 ? 1 : 0) + (frame.isFd ? 2 : 1) +
+                 (frame.isExtended ? sizeof(uint32_t) : sizeof(uint16_t)) + (frame.isRemote ? 0 : frame.dataLen) +
+                 timestampModeSize(timestampMode);
+    }
+    else {
+        size_t serialLen = sizeOfSerialPacket();
+        if (serialLen == 0) { return 0; }
+        rawLen = serialLen;    // Channel prefix, control byte + command, without the \r
+    }
+
+    // Records are always shorter than a COBS group, plus the delimiter.
+    static_assert(s_binaryMtu - 2 < 254);
+    return Cobs::maxEncodedSize(rawLen) + 1;
+}
 }    // namespace SlCan
@@ -22,7 +22,11 @@
 #include "enums/auto_retransmit.h"
 #include "enums/bitrates.h"
 #include "enums/commands.h"
+#include "enums/framing.h"
 #include "enums/modes.h"
+#include "enums/timestamp_mode.h"
+
+#include "dlc.h"
 
 #include "fdcan.h"
 
@@ -32,23 +36,97 @@
 
 namespace SlCan {
 struct [[gnu::packed]] Packet {
-    // maximum rx buffer len: extended CAN frame with timestamp
-    static constexpr std::size_t s_mtu      = 30;    // (sizeof("T1111222281122334455667788EA5F\r")+1)
+    // maximum rx buffer len: extended FD frame on another channel, with 64 data bytes and a timestamp in µs
+    // (sizeof("2B11112222F<128 hex digits>TTTTTTTT\r")+1)
+    static constexpr std::size_t s_mtu      = 1 + 1 + 8 + 1 + 2 * s_maxFdDataLen + 8 + 1 + 1;
     static constexpr size_t      s_stdIdLen = 3;
     static constexpr size_t      s_extIdLen = 8;
+    static constexpr size_t      s_acceptanceLen    = 8;    //!< Digits of the acceptance code and mask.
+    static constexpr size_t      s_busStatusLen     = 4;    //!< Digits of each of the values of a bus status.
+    static constexpr size_t      s_periodicTimeLen  = 8;    //!< Digits of the period and phase of a periodic frame.
+    static constexpr size_t      s_periodicCountLen = 4;    //!< Digits of its number of transmissions.
+    static constexpr size_t      s_isoTpParamLen    = 2;    //!< Digits of the block size and STmin of a link.
+    //! Most bytes of a PDU in an 'i' line.
+    static constexpr size_t s_isoTpSegmentLen = s_maxFdDataLen;
+    //! Lines for the other channels than the first start with its number: "2t1232AABB\r".
+    static constexpr uint8_t s_maxChannel = 9;
+
+    // Binary records start with the DLC in the low nibble and these flags in the high one. Control records carry
+    // any other command in its ASCII form, without the terminator.
+    // FD frames can't be remote, they have both the remote and control flags. The BRS flag takes the low nibble and
+    // the DLC is in a second byte.
+    static constexpr uint8_t s_binaryExtended  = 0x10;
+    static constexpr uint8_t s_binaryRemote    = 0x20;
+    static constexpr uint8_t s_binaryTimestamp = 0x40;    //!< Followed by the timestamp, 16 bits in ms or 32 in µs.
+    static constexpr uint8_t s_binaryControl   = 0x80;
+    static constexpr uint8_t s_binaryFd        = s_binaryControl | s_binaryRemote;
+    static constexpr uint8_t s_binaryBrs       = 0x01;    //!< Only in FD records.
+    //! Put in front of the records of the other channels than the first, with the channel in the low nibble.
+    static constexpr uint8_t s_binaryChannel = s_binaryControl | s_binaryExtended;
+    //! Extended FD frame on another channel, with 64 data bytes and a timestamp, once encoded and delimited.
+    static constexpr size_t s_binaryMtu = 1 + 2 + 4 + s_maxFdDataLen + 4 + 2;
 
     Command command = Command::Invalid;
+    uint8_t channel = 0;    //!< Bus the packet comes from or goes to, at most s_maxChannel.
     union {
-        BitRates       bitrate;           // Active when command == Command::SetBitrate
-        Modes          mode;              // Active when command == Command::SetMode
-        AutoRetransmit autoRetransmit;    // Active when command == Command::SetAutoRetry
+        BitRates       bitrate;            // Active when command == Command::SetBitrate
+        Modes          mode;               // Active when command == Command::SetMode
+        AutoRetransmit autoRetransmit;     // Active when command == Command::SetAutoRetry
+        Framing        framing;            // Active when command == Command::SetFraming
+        TimestampMode  timestampMode;      // Active when command == Command::SetTimestamp
+        uint8_t        busStatusPeriod;    // Active when command == Command::SetBusStatusPeriod, in seconds
+        uint32_t       acceptance;         // Active when command == Command::SetAcceptanceCode/SetAcceptanceMask
+        struct {
+            uint32_t first;
+            uint32_t last;
+            bool     isExtended;
+            bool     clear;    //!< Removes all the ranges instead, the line has no digits.
+        } filterRange;    // Active when command == Command::SetFilterRange
+        struct {
+            uint16_t loadPermille;    //!< Share of the time during which the bus was busy.
+            uint16_t framesPerSecond;
+            uint16_t errorsPerSecond;    //!< Error frames.
+        } busStatus;    // Active when command == Command::ReportBusStatus
+        struct {
+            uint32_t id;
+            bool     isExtended;
+            bool     clear;     //!< Removes all the periodic frames of the channel, the line has no digits.
+            bool     remove;    //!< Removes the frame, the line only has its identifier.
+            uint32_t periodUs;
+            uint32_t phaseUs;    //!< Offset of the transmissions from the multiples of the period.
+            uint16_t count;      //!< Number of transmissions, 0 for no limit.
+        } periodicTiming;    // Active when command == Command::SetPeriodicTiming
+        struct {
+            uint32_t txId;
+            uint32_t rxId;
+            bool     isExtended;
+            bool     close;        //!< Closes the link, the line only has its transmit identifier.
+            bool     closeAll;     //!< Closes all the links of the channel, the line has no digits.
+            uint8_t  blockSize;    //!< Frames the peer sends before waiting for a flow control, 0 for no limit.
+            uint8_t  stMin;        //!< Separation time asked to the peer, encoded like in its flow control frames.
+        } isoTpLink;    // Active when command == Command::SetIsoTpLink
+        struct {
+            uint32_t txId;
+            bool     isExtended;
+            uint8_t  status;    //!< IsoTp::Status.
+        } isoTpStatus;    // Active when command == Command::ReportIsoTpStatus
+        struct {
+            uint32_t id;    //!< Transmit identifier of the link from the host, receive identifier to it.
+            bool     isExtended;
+            bool     isLast;    //!< The segment ends the PDU.
+            uint8_t  len;
+            uint8_t  data[s_isoTpSegmentLen];
+        } isoTpData;    // Active when command == Command::TransferIsoTpData
         struct {
             uint32_t id;
             bool     isExtended;
             bool     isRemote;
-            uint8_t  dataLen;
-            uint8_t  data[8];
-        } packetData;    // Active when command == Command::Transmit*
+            bool     isFd;
+            bool     bitRateSwitch;    //!< FD frames only, the data phase is sent at the data bit rate.
+            uint8_t  dataLen;          //!< Number of data bytes, not the DLC. The DLC of remote frames.
+            uint8_t  data[s_maxFdDataLen];
+            uint32_t timestamp;    //!< Start of frame, in microseconds. See Timestamp::nowUs.
+        } packetData;    // Active when command == Command::Transmit* or Command::SetPeriodicFrame
     } data {.bitrate = BitRates::bInvalid};
 
     Packet() = default;
@@ -58,6 +136,8 @@ struct [[gnu::packed]] Packet {
     : command(Command::SetAutoRetry), data {.autoRetransmit = autoRetransmit}
     {
     }
+    explicit Packet(Framing framing) : command(Command::SetFraming), data {.framing = framing} {}
+    explicit Packet(TimestampMode mode) : command(Command::SetTimestamp), data {.timestampMode = mode} {}
     static Packet openChannel()
     {
         Packet pkt {};
@@ -82,24 +162,84 @@ struct [[gnu::packed]] Packet {
         pkt.command = Command::GetVersion;
         return pkt;
     }
+    static Packet busStatus(uint8_t channel, uint16_t loadPermille, uint16_t framesPerSecond, uint16_t errorsPerSecond)
+    {
+        Packet pkt {};
+        pkt.command        = Command::ReportBusStatus;
+        pkt.channel        = channel;
+        pkt.data.busStatus = {
+          .loadPermille    = loadPermille,
+          .framesPerSecond = framesPerSecond,
+          .errorsPerSecond = errorsPerSecond,
+        };
+        return pkt;
+    }
+    static Packet isoTpStatus(uint8_t channel, uint32_t txId, bool isExtended, uint8_t status)
+    {
+        Packet pkt {};
+        pkt.command          = Command::ReportIsoTpStatus;
+        pkt.channel          = channel;
+        pkt.data.isoTpStatus = {
+          .txId       = txId,
+          .isExtended = isExtended,
+          .status     = status,
+        };
+        return pkt;
+    }
+
+    Packet(const uint8_t* data, size_t len);                                // Serial -> CAN
+    Packet(uint32_t id, bool extended);                                     // X -> CAN/Serial
+    Packet(uint32_t id, bool extended, const uint8_t* data, size_t len);    // X -> CAN/Serial
+    // The number of data bytes comes from the DLC of the header.
+    Packet(const FDCAN_RxHeaderTypeDef& header, const uint8_t* data);    // CAN -> Serial
+    Packet(const FDCAN_TxHeaderTypeDef& header, const uint8_t* data);    // CAN -> Serial
+    //! Makes the packet the frame of a received header, whose data bytes were already read in data.packetData.data.
+    void setRxHeader(const FDCAN_RxHeaderTypeDef& header);
+
+    /**
+     * Creates an FD data frame.
+     * @param len Number of data bytes, must be one of the lengths an FD frame can have.
+     * @param bitRateSwitch Send the data phase at the data bit rate.
+     */
+    static Packet fdFrame(uint32_t id, bool extended, const uint8_t* data, size_t len, bool bitRateSwitch);
 
-    Packet(const uint8_t* data, size_t len);                                         // Serial -> CAN
-    Packet(uint32_t id, bool extended);                                              // X -> CAN/Serial
-    Packet(uint32_t id, bool extended, const uint8_t* data, size_t len);             // X -> CAN/Serial
-    Packet(const FDCAN_RxHeaderTypeDef& header, const uint8_t* data, size_t len);    // CAN -> Serial
-    Packet(const FDCAN_TxHeaderTypeDef& header, const uint8_t* data, size_t len);    // CAN -> Serial
+    /**
+     * Decodes a binary record.
+     * @param record The COBS-encoded record, its delimiter is optional.
+     * @param len Number of bytes in the record.
+     * @return The packet, with Command::Invalid if the record is malformed.
+     */
+    static Packet fromBinary(const uint8_t* record, size_t len);    // Serial -> CAN
 
     /**
      * Translates the CAN packet in SLCAN format.
      * @param outBuff Buffer where to write the SLCAN packet.
      * @param outBuffLen Size of the output buffer.
+     * @param timestampMode Format of the timestamp appended to the frames.
+     * @return Number of bytes written to outBuff. -1 on error.
+     */
+    [[nodiscard]] int16_t toSerial(uint8_t*      outBuff,
+                                   size_t        outBuffLen,
+                                   TimestampMode timestampMode = TimestampMode::Disabled) const;
+    /**
+     * Translates the packet in a binary record, COBS-encoded and delimited.
+     * @param outBuff Buffer where to write the record.
+     * @param outBuffLen Size of the output buffer.
+     * @param timestampMode Format of the timestamp appended to the frames.
      * @return Number of bytes written to outBuff. -1 on error.
      */
-    [[nodiscard]] int8_t                               toSerial(uint8_t* outBuff, size_t outBuffLen) const;
+    [[nodiscard]] int16_t toBinary(uint8_t*      outBuff,
+                                   size_t        outBuffLen,
+                                   TimestampMode timestampMode = TimestampMode::Disabled) const;
     [[nodiscard]] std::optional<FDCAN_RxHeaderTypeDef> toFDCANRxHeader() const;
     [[nodiscard]] std::optional<FDCAN_TxHeaderTypeDef> toFDCANTxHeader() const;
 
-    [[nodiscard]] size_t sizeOfSerialPacket() const;
+    [[nodiscard]] size_t sizeOfSerialPacket(TimestampMode timestampMode = TimestampMode::Disabled) const;
+    [[nodiscard]] size_t sizeOfBinaryPacket(TimestampMode timestampMode = TimestampMode::Disabled) const;
+
+private:
+    [[nodiscard]] size_t   sizeOfSerialPacketWithoutTimestamp() const;
+    [[nodiscard]] uint32_t headerDataLength() const;
 };
 
 static_assert(std::is_trivially_copyable_v<Packet>);
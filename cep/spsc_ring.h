@@ -0,0 +1,126 @@
+/**
+ * @file    spsc_ring.h
+ * @author  Samuel Martel
+ * @date    2024-04-16
+ * @brief   Wait-free single-producer/single-consumer ring buffer.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_SPSC_RING_H
+#define CEP_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * Fixed-size ring shared between exactly one producer (typically an ISR) and exactly one consumer (typically a task).
+ *
+ * Neither side ever blocks nor disables interrupts: the producer only writes m_head, the consumer only writes m_tail,
+ * and the indices are published with release/acquire ordering so that an item is always fully written before the
+ * consumer can see it.
+ *
+ * @tparam T Type of the items, copied with memcpy semantics.
+ * @tparam N Number of slots, must be a power of two.
+ */
+template<typename T, size_t N>
+class SpscRing {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+public:
+    static constexpr size_t s_capacity = N;
+
+    // Producer side.
+
+    /**
+     * Gets the next free slot, so that the item can be constructed in place.
+     * The slot only becomes visible to the consumer once commit() is called.
+     * @returns A pointer to the slot, nullptr if the ring is full.
+     */
+    [[nodiscard]] T* reserve()
+    {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) >= N) { return nullptr; }
+        return &m_items[head & s_mask];
+    }
+
+    /**
+     * Publishes the slot obtained with reserve().
+     */
+    void commit() { m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    /**
+     * Copies an item in the ring.
+     * @returns False if the ring is full.
+     */
+    bool push(const T& item)
+    {
+        T* slot = reserve();
+        if (slot == nullptr) { return false; }
+        *slot = item;
+        commit();
+        return true;
+    }
+
+    // Consumer side.
+
+    /**
+     * Hands every available item to func, oldest first, then releases all of them at once.
+     * @param func Called as func(const T&) for each item.
+     * @param max Maximum number of items to handle.
+     * @returns The number of items that were handled.
+     */
+    template<typename Func>
+    size_t drain(Func&& func, size_t max = N)
+    {
+        uint32_t tail  = m_tail.load(std::memory_order_relaxed);
+        uint32_t count = m_head.load(std::memory_order_acquire) - tail;
+        if (count > max) { count = max; }
+
+        for (uint32_t i = 0; i < count; i++) {
+            func(static_cast<const T&>(m_items[(tail + i) & s_mask]));
+        }
+
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    /**
+     * Takes the oldest item out of the ring.
+     * @returns False if the ring is empty.
+     */
+    bool pop(T& out)
+    {
+        return drain([&out](const T& item) { out = item; }, 1) != 0;
+    }
+
+    // Either side.
+
+    [[nodiscard]] size_t size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+    [[nodiscard]] bool empty() const { return size() == 0; }
+
+private:
+    static constexpr uint32_t s_mask = N - 1;
+
+    T                     m_items[N] = {};
+    std::atomic<uint32_t> m_head     = 0;    //!< Next slot to be written, only modified by the producer.
+    std::atomic<uint32_t> m_tail     = 0;    //!< Next slot to be read, only modified by the consumer.
+};
+
+#endif    // CEP_SPSC_RING_H
@@ -0,0 +1,82 @@
+/**
+ * @file    timestamp.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-23
+ * @brief   Free-running microsecond clock used to timestamp the CAN frames.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "timestamp.h"
+
+#include <FreeRTOS.h>
+
+namespace Timestamp {
+namespace {
+TIM_HandleTypeDef g_htim          = {};
+AlarmHandler      g_alarmHandler  = nullptr;
+void*             g_alarmUserData = nullptr;
+}    // namespace
+
+void init()
+{
+    if (g_htim.Instance != nullptr) { return; }
+
+    // The timers of APB1 run at twice its clock when it's divided.
+    uint32_t clock = HAL_RCC_GetPCLK1Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) { clock *= 2; }
+
+    __HAL_RCC_TIM5_CLK_ENABLE();
+    g_htim.Instance               = TIM5;
+    g_htim.Init.Prescaler         = clock / 1'000'000 - 1;
+    g_htim.Init.CounterMode       = TIM_COUNTERMODE_UP;
+    g_htim.Init.Period            = UINT32_MAX;
+    g_htim.Init.ClockDivision     = TIM_CLOCKDIVISION_DIV1;
+    g_htim.Init.RepetitionCounter = 0;
+    g_htim.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+    auto res                      = HAL_TIM_Base_Init(&g_htim);
+    configASSERT(res == HAL_OK);
+    res = HAL_TIM_Base_Start(&g_htim);
+    configASSERT(res == HAL_OK);
+
+    // Same priority as the FDCAN interrupts, the alarm handler can use the FreeRTOS API.
+    HAL_NVIC_SetPriority(TIM5_IRQn, 6, 0);
+    HAL_NVIC_EnableIRQ(TIM5_IRQn);
+}
+
+void setAlarmHandler(AlarmHandler handler, void* userData)
+{
+    g_alarmUserData = userData;
+    g_alarmHandler  = handler;
+}
+
+void setAlarm(uint32_t atUs)
+{
+    TIM5->CCR1 = atUs;
+    TIM5->SR   = ~TIM_SR_CC1IF;
+    TIM5->DIER |= TIM_DIER_CC1IE;
+
+    // The compare only matches when the counter goes through the value, which it may have done already.
+    if (static_cast<int32_t>(nowUs() - atUs) >= 0) { NVIC_SetPendingIRQ(TIM5_IRQn); }
+}
+
+void cancelAlarm()
+{
+    TIM5->DIER &= ~TIM_DIER_CC1IE;
+    TIM5->SR = ~TIM_SR_CC1IF;
+}
+}    // namespace Timestamp
+
+extern "C" void TIM5_IRQHandler()
+{
+    // The alarm is the only interrupt of the timer.
+    TIM5->SR = ~TIM_SR_CC1IF;
+    if (Timestamp::g_alarmHandler != nullptr) { Timestamp::g_alarmHandler(Timestamp::g_alarmUserData); }
+}
@@ -0,0 +1,76 @@
+/**
+ * @file    timestamp.h
+ * @author  Samuel Martel
+ * @date    2024-04-23
+ * @brief   Free-running microsecond clock used to timestamp the CAN frames.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_TIMESTAMP_H
+#define CEP_TIMESTAMP_H
+
+#include "stm32g4xx_hal.h"
+
+#include <cstdint>
+
+/**
+ * TIM5 counts microseconds on its 32 bits, so reading the time is a single register access that is safe from any
+ * context. It wraps around every 71.6 minutes, like the timestamps of the Linux gs_usb driver.
+ *
+ * Its first compare channel provides a single alarm on the same clock, without driving its pin.
+ *
+ * TIM5 is borrowed from the M1 encoder, whose pins PF6 to PF8 stay mapped to its channels 1 to 3. None of the capture
+ * or compare channels are enabled in CCER, so those pins are inert while the timer is the clock. The M1 encoder can't
+ * be used at the same time.
+ */
+namespace Timestamp {
+/**
+ * Function called from the TIM5 interrupt when the alarm goes off. It may also be called a bit early, or after the
+ * alarm got cancelled, and must check for itself what is due.
+ *
+ * void*: User Data.
+ */
+using AlarmHandler = void (*)(void*);
+
+/**
+ * Starts the clock. Calling it again has no effect.
+ */
+void init();
+
+void setAlarmHandler(AlarmHandler handler, void* userData);
+
+/**
+ * Makes the alarm go off at a point in time, replacing the previous one. If that point already passed, it goes off
+ * right away.
+ * Must be called from the alarm handler, or with the TIM5 interrupt masked.
+ * @param atUs Point in time, see nowUs. Less than 2^31 µs away.
+ */
+void setAlarm(uint32_t atUs);
+void cancelAlarm();
+
+[[nodiscard]] inline uint32_t nowUs()
+{
+    return TIM5->CNT;
+}
+
+/**
+ * Converts a timestamp to the one of SLCAN, in milliseconds.
+ * There's a jump every time the microsecond counter wraps around.
+ */
+[[nodiscard]] constexpr uint16_t toSlCanMs(uint32_t timestampUs)
+{
+    return static_cast<uint16_t>((timestampUs / 1000) % 60000);
+}
+}    // namespace Timestamp
+
+#endif    // CEP_TIMESTAMP_H
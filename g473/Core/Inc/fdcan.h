@@ -29,16 +29,46 @@ extern "C" {
 #include "main.h"
 
 /* USER CODE BEGIN Includes */
+/* FDCAN2 and FDCAN3 are only used on boards that wire them to a transceiver, see the CEP_FDCAN2 and CEP_FDCAN3 options
+ * of CMakeLists.txt. Their pins are the ones labelled FDCAN2_RX/FDCAN2_TX and FDCAN3_RX/FDCAN3_TX in the .ioc, after
+ * checking them against the schematic. This board has none. */
+#ifndef CEP_FDCAN2
+#define CEP_FDCAN2 0
+#endif
+#ifndef CEP_FDCAN3
+#define CEP_FDCAN3 0
+#endif
 
+#if CEP_FDCAN2 && !(defined(FDCAN2_RX_Pin) && defined(FDCAN2_TX_Pin))
+#error "CEP_FDCAN2 needs the pins of the FDCAN2 transceiver labelled FDCAN2_RX and FDCAN2_TX in the .ioc"
+#endif
+#if CEP_FDCAN3 && !(defined(FDCAN3_RX_Pin) && defined(FDCAN3_TX_Pin))
+#error "CEP_FDCAN3 needs the pins of the FDCAN3 transceiver labelled FDCAN3_RX and FDCAN3_TX in the .ioc"
+#endif
 /* USER CODE END Includes */
 
 extern FDCAN_HandleTypeDef hfdcan1;
 
-/* USER CODE BEGIN Private defines */
+#if CEP_FDCAN2
+extern FDCAN_HandleTypeDef hfdcan2;
+#endif
 
+#if CEP_FDCAN3
+extern FDCAN_HandleTypeDef hfdcan3;
+#endif
+
+/* USER CODE BEGIN Private defines */
+/* Number of FDCAN peripherals bridged to the hosts. */
+#define CEP_FDCAN_COUNT (1 + CEP_FDCAN2 + CEP_FDCAN3)
 /* USER CODE END Private defines */
 
 void MX_FDCAN1_Init(void);
+#if CEP_FDCAN2
+void MX_FDCAN2_Init(void);
+#endif
+#if CEP_FDCAN3
+void MX_FDCAN3_Init(void);
+#endif
 
 /* USER CODE BEGIN Prototypes */
 
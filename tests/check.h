@@ -0,0 +1,44 @@
+/**
+ * @file    check.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Minimal assertions for the host unit tests.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_TESTS_CHECK_H
+#define CEP_TESTS_CHECK_H
+
+#include <cstdio>
+
+namespace test {
+inline int g_failures = 0;
+
+//! Exit code of the test, non-zero if a check failed.
+inline int result()
+{
+    if (g_failures != 0) { std::printf("%d check(s) failed\n", g_failures); }
+    return g_failures == 0 ? 0 : 1;
+}
+}    // namespace test
+
+//! Records a failure without stopping the test, so that every broken case is reported.
+#define CHECK(condition)                                                                                               \
+    do {                                                                                                               \
+        if (!(condition)) {                                                                                            \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);                                  \
+            ++test::g_failures;                                                                                        \
+        }                                                                                                              \
+    } while (false)
+
+#endif    // CEP_TESTS_CHECK_H
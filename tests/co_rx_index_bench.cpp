@@ -0,0 +1,93 @@
+/**
+ * @file    co_rx_index_bench.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Compares the cost of dispatching CANopen messages through the index and through the linear scan.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "CO_rxIndex.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr uint16_t s_flagRtr = 0x8000;
+constexpr size_t   s_lookups = 10'000'000;
+
+void onMessage(void* /*object*/, void* /*message*/)
+{
+}
+
+template<typename Func>
+double nsPerCall(size_t calls, Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(calls);
+}
+}    // namespace
+
+int main()
+{
+    // Receive buffers of a node with 4 RPDOs, an SDO server, the heartbeat consumers of 16 nodes, plus a few SDO
+    // clients and a masked buffer for a range of identifiers, in the order CANopenNode allocates them.
+    std::vector<CO_CANrx_t> buffers;
+    auto add = [&buffers](uint16_t ident, uint16_t mask) {
+        buffers.push_back({.ident          = ident,
+                           .mask           = static_cast<uint16_t>(mask | s_flagRtr),
+                           .object         = nullptr,
+                           .CANrx_callback = &onMessage});
+    };
+    add(0x000, 0x7FF);
+    add(0x080, 0x7FF);
+    for (uint16_t node = 1; node <= 16; node++) { add(0x700 + node, 0x7FF); }
+    for (uint16_t pdo = 0; pdo < 4; pdo++) { add(0x205 + 0x100 * pdo, 0x7FF); }
+    add(0x605, 0x7FF);
+    for (uint16_t node = 1; node <= 8; node++) { add(0x580 + node, 0x7FF); }
+    add(0x7E4, 0x7FE);
+    auto size = static_cast<uint16_t>(buffers.size());
+
+    // Mostly traffic for this node, with some that no buffer wants.
+    std::mt19937          rng(42);
+    std::vector<uint32_t> idents(4096);
+    for (auto& ident : idents) {
+        ident = rng() % 4 == 0 ? rng() % 0x800 : buffers[rng() % size].ident;
+    }
+
+    CO_rxIndex_t index = {};
+    double       build = nsPerCall(10'000, [&] {
+        for (size_t i = 0; i < 10'000; i++) { CO_rxIndexBuild(&index, buffers.data(), size); }
+    });
+
+    uintptr_t sink = 0;
+    double    scan = nsPerCall(s_lookups, [&] {
+        for (size_t i = 0; i < s_lookups; i++) {
+            sink += reinterpret_cast<uintptr_t>(CO_rxIndexScan(buffers.data(), size, idents[i % idents.size()]));
+        }
+    });
+    double    find = nsPerCall(s_lookups, [&] {
+        for (size_t i = 0; i < s_lookups; i++) {
+            sink +=
+              reinterpret_cast<uintptr_t>(CO_rxIndexFind(&index, buffers.data(), size, idents[i % idents.size()]));
+        }
+    });
+
+    std::printf("%u receive buffers (sink %zu)\n", static_cast<unsigned>(size), static_cast<size_t>(sink & 1));
+    std::printf("  build: %8.1f ns\n", build);
+    std::printf("  scan:  %8.1f ns/message\n", scan);
+    std::printf("  index: %8.1f ns/message\n", find);
+    return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file    co_rx_index_test.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Checks that the index of the CANopen receive buffers always agrees with the linear scan.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "check.h"
+
+#include "CO_rxIndex.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace {
+constexpr uint16_t s_idMask  = 0x07FF;
+constexpr uint16_t s_flagRtr = 0x8000;
+
+void onMessage(void* /*object*/, void* /*message*/)
+{
+}
+
+//! Same encoding as CO_CANrxBufferInit.
+CO_CANrx_t makeBuffer(uint16_t ident, uint16_t mask, bool rtr)
+{
+    return {
+      .ident          = static_cast<uint16_t>((ident & s_idMask) | (rtr ? s_flagRtr : 0)),
+      .mask           = static_cast<uint16_t>((mask & s_idMask) | s_flagRtr),
+      .object         = nullptr,
+      .CANrx_callback = &onMessage,
+    };
+}
+
+//! Looks every identifier up, with and without the RTR flag, and compares with the linear scan.
+void checkAgainstScan(std::vector<CO_CANrx_t>& buffers)
+{
+    CO_rxIndex_t index = {};
+    auto         size  = static_cast<uint16_t>(buffers.size());
+    CO_rxIndexBuild(&index, buffers.data(), size);
+    for (uint32_t id = 0; id < CO_RX_INDEX_ID_COUNT; id++) {
+        for (uint32_t ident : {id, id | s_flagRtr}) {
+            CO_CANrx_t* expected = CO_rxIndexScan(buffers.data(), size, ident);
+            CO_CANrx_t* found    = CO_rxIndexFind(&index, buffers.data(), size, ident);
+            CHECK(found == expected);
+            if (found != expected) { return; }
+        }
+    }
+}
+
+void testEmpty()
+{
+    CO_CANrx_t              unused  = {.ident = 0, .mask = 0xFFFF, .object = nullptr, .CANrx_callback = nullptr};
+    std::vector<CO_CANrx_t> buffers(8, unused);
+    CO_rxIndex_t            index = {};
+    CO_rxIndexBuild(&index, buffers.data(), 8);
+    CHECK(!index.incomplete);
+    CHECK(index.maskedCount == 0);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), 8, 0) == nullptr);
+    checkAgainstScan(buffers);
+}
+
+void testExactIdentifiers()
+{
+    // NMT, SYNC, EMCY, then the RPDOs and the SDO server of node 5.
+    std::vector<CO_CANrx_t> buffers = {
+      makeBuffer(0x000, 0x7FF, false),
+      makeBuffer(0x080, 0x7FF, false),
+      makeBuffer(0x085, 0x7FF, false),
+      makeBuffer(0x205, 0x7FF, false),
+      makeBuffer(0x305, 0x7FF, false),
+      makeBuffer(0x605, 0x7FF, false),
+    };
+    CO_rxIndex_t index = {};
+    CO_rxIndexBuild(&index, buffers.data(), static_cast<uint16_t>(buffers.size()));
+    CHECK(!index.incomplete);
+    CHECK(index.byId[0x205] == 3);
+    CHECK(index.byId[0x206] == CO_RX_INDEX_NONE);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), 6, 0x305) == &buffers[4]);
+    // Those buffers don't take remote frames.
+    CHECK(CO_rxIndexFind(&index, buffers.data(), 6, 0x305 | s_flagRtr) == nullptr);
+    checkAgainstScan(buffers);
+}
+
+void testFirstMatchWins()
+{
+    std::vector<CO_CANrx_t> buffers = {
+      makeBuffer(0x123, 0x7FF, true),     // Only the remote frames of 0x123.
+      makeBuffer(0x100, 0x700, false),    // Masked, comes before the exact match below.
+      makeBuffer(0x123, 0x7FF, false),
+      makeBuffer(0x123, 0x7FF, false),    // Duplicate, never reached.
+      makeBuffer(0x400, 0x000, false),    // Catch-all.
+    };
+    auto         size  = static_cast<uint16_t>(buffers.size());
+    CO_rxIndex_t index = {};
+    CO_rxIndexBuild(&index, buffers.data(), size);
+    CHECK(index.maskedCount == 2);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), size, 0x123 | s_flagRtr) == &buffers[0]);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), size, 0x123) == &buffers[1]);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), size, 0x223) == &buffers[4]);
+    checkAgainstScan(buffers);
+
+    // Without the masked buffer, the exact match takes it.
+    buffers[1].CANrx_callback = nullptr;
+    CO_rxIndexBuild(&index, buffers.data(), size);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), size, 0x123) == &buffers[2]);
+    checkAgainstScan(buffers);
+}
+
+void testTooManyMaskedBuffers()
+{
+    std::vector<CO_CANrx_t> buffers;
+    for (uint16_t i = 0; i <= CO_RX_INDEX_MASKED_MAX; i++) {
+        buffers.push_back(makeBuffer(static_cast<uint16_t>(i << 4), 0x7F0, false));
+    }
+    CO_rxIndex_t index = {};
+    CO_rxIndexBuild(&index, buffers.data(), static_cast<uint16_t>(buffers.size()));
+    CHECK(index.incomplete);
+    checkAgainstScan(buffers);
+}
+
+void testTooManyBuffers()
+{
+    std::vector<CO_CANrx_t> buffers;
+    for (uint16_t i = 0; i < CO_RX_INDEX_NONE; i++) {
+        buffers.push_back(makeBuffer(i, 0x7FF, false));
+    }
+    CO_rxIndex_t index = {};
+    CO_rxIndexBuild(&index, buffers.data(), static_cast<uint16_t>(buffers.size()));
+    CHECK(index.incomplete);
+    checkAgainstScan(buffers);
+}
+
+void testChangedSinceBuild()
+{
+    std::vector<CO_CANrx_t> buffers = {
+      makeBuffer(0x181, 0x7FF, false),
+      makeBuffer(0x281, 0x7FF, false),
+    };
+    CO_rxIndex_t index = {};
+    CO_rxIndexBuild(&index, buffers.data(), 2);
+
+    // A stale entry must never hand out a buffer that doesn't match anymore.
+    buffers[0] = makeBuffer(0x381, 0x7FF, false);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), 2, 0x181) == nullptr);
+    CHECK(CO_rxIndexFind(&index, buffers.data(), 2, 0x281) == &buffers[1]);
+
+    // Fewer buffers than when it was built.
+    CHECK(CO_rxIndexFind(&index, buffers.data(), 1, 0x281) == nullptr);
+}
+
+void testRandomConfigurations()
+{
+    std::mt19937 rng(1234);
+    for (int round = 0; round < 200; round++) {
+        std::vector<CO_CANrx_t> buffers(rng() % 64);
+        for (auto& buffer : buffers) {
+            auto     ident = static_cast<uint16_t>(rng() % 0x40);    // Small range to get collisions.
+            uint16_t mask  = 0x7FF;
+            if (rng() % 8 == 0) { mask = static_cast<uint16_t>(rng()); }
+            buffer = makeBuffer(ident, mask, rng() % 6 == 0);
+            if (rng() % 10 == 0) { buffer.CANrx_callback = nullptr; }
+        }
+        checkAgainstScan(buffers);
+    }
+}
+}    // namespace
+
+int main()
+{
+    testEmpty();
+    testExactIdentifiers();
+    testFirstMatchWins();
+    testTooManyMaskedBuffers();
+    testTooManyBuffers();
+    testChangedSinceBuild();
+    testRandomConfigurations();
+    return test::result();
+}
@@ -0,0 +1,56 @@
+/**
+ * @file    fake_peripherals.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Backs the registers of the MCU with plain memory, so that the modules under test can read them on the host.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_TESTS_FAKE_PERIPHERALS_H
+#define CEP_TESTS_FAKE_PERIPHERALS_H
+
+#include "stm32g4xx.h"
+
+#include <sys/mman.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace test {
+/**
+ * Maps zeroed memory at the address of a peripheral. The tests then drive its registers by hand, e.g. TIM5->CNT for
+ * the microsecond clock, or DWT->CYCCNT.
+ */
+inline void mapPeripheral(uintptr_t base)
+{
+    constexpr uintptr_t s_pageSize = 4096;
+    uintptr_t           page       = base & ~(s_pageSize - 1);
+    void* mapped = mmap(reinterpret_cast<void*>(page), s_pageSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mapped == MAP_FAILED) {
+        std::perror("mmap");
+        std::abort();
+    }
+}
+
+//! Maps the registers read by the time keeping of the firmware: the cycle counter and the microsecond clock.
+inline void mapClocks()
+{
+    mapPeripheral(DWT_BASE);
+    mapPeripheral(CoreDebug_BASE);
+    mapPeripheral(TIM5_BASE);
+}
+}    // namespace test
+
+#endif    // CEP_TESTS_FAKE_PERIPHERALS_H
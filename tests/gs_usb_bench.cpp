@@ -0,0 +1,172 @@
+/**
+ * @file    gs_usb_bench.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Compares what a frame sent to the host costs over gs_usb, SLCAN text and SLCAN binary records.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "fake_peripherals.h"
+
+#include "slcan/slcan.h"
+#include "usbd_gs_if.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+extern "C" {
+USBD_HandleTypeDef hUsbDeviceFS = {};
+}
+
+namespace {
+using namespace SlCan;
+
+constexpr size_t s_rounds = 2'000'000;
+
+/**
+ * A full-speed bulk endpoint moves at most 19 packets of 64 bytes per 1 ms frame. gs_usb sends each frame in its own
+ * short packet, while the CDC interface packs the SLCAN stream in full ones.
+ */
+constexpr double s_fsPacketsPerSecond = 19.0 * 1000.0;
+constexpr double s_fsBytesPerSecond   = s_fsPacketsPerSecond * 64.0;
+
+//! The IN endpoint, it completes every transfer right away.
+size_t g_transfers = 0;
+
+//! Same as the conversion done by CanManager before GS_Queue.
+GS_HostFrame gsFrameFromPacket(const Packet& packet)
+{
+    const auto&  data  = packet.data.packetData;
+    GS_HostFrame frame = {
+      .echo_id      = GS_ECHO_ID_RX,
+      .can_id       = data.id,
+      .can_dlc      = data.dataLen,
+      .channel      = packet.channel,
+      .flags        = 0,
+      .reserved     = 0,
+      .data         = {},
+      .timestamp_us = data.timestamp,
+    };
+    if (data.isExtended) { frame.can_id |= GS_CAN_EFF_FLAG; }
+    if (data.isRemote) { frame.can_id |= GS_CAN_RTR_FLAG; }
+    else {
+        std::copy(&data.data[0], &data.data[data.dataLen], &frame.data[0]);
+    }
+    return frame;
+}
+
+template<typename Func>
+double nsPerCall(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s_rounds; i++) { func(i); }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(s_rounds);
+}
+
+void report(const char* name, double bytesPerFrame, double ns, double framesPerSecond)
+{
+    std::printf("  %-24s %5.1f bytes/frame, %6.1f ns/frame, %7.0f frames/s on full-speed USB\n",
+                name,
+                bytesPerFrame,
+                ns,
+                framesPerSecond);
+}
+
+template<typename Encode>
+void benchSlCan(const char* name, const std::vector<Packet>& frames, uint32_t& sink, Encode&& encode)
+{
+    size_t  bytes = 0;
+    uint8_t buffer[Packet::s_binaryMtu + Packet::s_mtu];
+    for (const Packet& frame : frames) { bytes += static_cast<size_t>(encode(frame, &buffer[0], sizeof(buffer))); }
+    double bytesPerFrame = static_cast<double>(bytes) / static_cast<double>(frames.size());
+
+    double ns = nsPerCall([&](size_t i) {
+        sink += encode(frames[i % frames.size()], &buffer[0], sizeof(buffer)) + buffer[i % 4];
+    });
+    report(name, bytesPerFrame, ns, s_fsBytesPerSecond / bytesPerFrame);
+}
+
+void benchGsUsb(const char* name, const std::vector<Packet>& frames, bool timestamps, uint32_t& sink)
+{
+    uint32_t mode[2] = {1, timestamps ? GS_CAN_FEATURE_HW_TIMESTAMP : 0U};
+    uint16_t len     = sizeof(mode);
+    g_usbdGsFopsFs.Init();
+    g_usbdGsFopsFs.Control(2, 0, reinterpret_cast<uint8_t*>(&mode[0]), &len);
+
+    // Queued then sent right away, the queue never holds more than the frame in the endpoint.
+    double ns = nsPerCall([&](size_t i) {
+        GS_HostFrame frame = gsFrameFromPacket(frames[i % frames.size()]);
+        sink += GS_Queue(&frame);
+        g_usbdGsFopsFs.TransmitCplt();
+    });
+    sink += static_cast<uint32_t>(g_transfers);
+    size_t bytesPerFrame = timestamps ? sizeof(GS_HostFrame) : GS_HOST_FRAME_SIZE_NO_TS;
+    report(name, static_cast<double>(bytesPerFrame), ns, s_fsPacketsPerSecond);
+}
+}    // namespace
+
+extern "C" {
+uint8_t USBD_DCDC_GsTransmit(USBD_HandleTypeDef* /*pdev*/, uint8_t* /*pbuff*/, uint16_t /*length*/)
+{
+    ++g_transfers;
+    return USBD_OK;
+}
+
+uint32_t HAL_RCCEx_GetPeriphCLKFreq(uint32_t /*clock*/)
+{
+    return 160'000'000;
+}
+}
+
+int main()
+{
+    test::mapClocks();
+    GS_SetChannelCount(1);
+
+    // Classic frames received on the bus, the only ones gs_usb can carry: full data frames of both kinds, short ones
+    // like the NMT and heartbeat of CANopen, and remote frames.
+    std::mt19937        rng(1);
+    std::vector<Packet> frames;
+    for (size_t i = 0; i < 64; i++) {
+        uint8_t data[8];
+        for (auto& byte : data) { byte = static_cast<uint8_t>(rng()); }
+        frames.emplace_back(rng() & 0x7FF, false, &data[0], 8);
+        frames.emplace_back(rng() & 0x1FFFFFFF, true, &data[0], 8);
+        frames.emplace_back(rng() & 0x7FF, false, &data[0], 1 + i % 4);
+        frames.emplace_back(rng() & 0x7FF, false);
+        frames.emplace_back(rng() & 0x1FFFFFFF, true);
+    }
+    for (auto& frame : frames) { frame.data.packetData.timestamp = rng(); }
+
+    uint32_t sink = 0;
+    std::printf("%zu frames: std/ext with 8 bytes, std with 1 to 4 bytes, std/ext remote\n", frames.size());
+    benchGsUsb("gs_usb", frames, false, sink);
+    benchGsUsb("gs_usb, timestamps", frames, true, sink);
+    benchSlCan("SLCAN text", frames, sink, [](const Packet& frame, uint8_t* out, size_t len) {
+        return frame.toSerial(out, len);
+    });
+    benchSlCan("SLCAN text, timestamps", frames, sink, [](const Packet& frame, uint8_t* out, size_t len) {
+        return frame.toSerial(out, len, TimestampMode::Microseconds);
+    });
+    benchSlCan("SLCAN binary", frames, sink, [](const Packet& frame, uint8_t* out, size_t len) {
+        return frame.toBinary(out, len);
+    });
+    benchSlCan("SLCAN binary, timestamps", frames, sink, [](const Packet& frame, uint8_t* out, size_t len) {
+        return frame.toBinary(out, len, TimestampMode::Microseconds);
+    });
+    std::printf("(sink %u)\n", static_cast<unsigned>(sink & 1));
+    return 0;
+}
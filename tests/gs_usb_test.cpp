@@ -0,0 +1,317 @@
+/**
+ * @file    gs_usb_test.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Drives the gs_usb interface like the host and the USB class would, against a fake IN endpoint.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "check.h"
+#include "fake_peripherals.h"
+
+#include "usbd_gs_if.h"
+
+#include <cstring>
+#include <vector>
+
+extern "C" {
+USBD_HandleTypeDef hUsbDeviceFS = {};
+}
+
+namespace {
+constexpr uint8_t s_channelCount = 2;
+
+enum class Request : uint8_t {
+    HostFormat   = 0,
+    BitTiming    = 1,
+    Mode         = 2,
+    BitTimingCst = 4,
+    DeviceConfig = 5,
+    Timestamp    = 6,
+    Unknown      = 42,
+};
+
+//! The IN endpoint of the gs_usb interface, it takes a single transfer at a time.
+struct Endpoint {
+    bool                 isBusy = false;
+    const uint8_t*       buffer = nullptr;
+    std::vector<uint8_t> sent;          //!< Content of the buffer when the transfer started.
+    size_t               transfers = 0;
+    size_t               refused   = 0;    //!< Transfers started while it was busy.
+};
+Endpoint g_endpoint;
+
+struct Events {
+    std::vector<GS_HostFrame> frames;
+    std::vector<uint32_t>     sentCycles;
+    std::vector<uint8_t>      modeChannels;
+    std::vector<bool>         modeStarted;
+};
+Events g_events;
+
+int8_t control(Request request, uint16_t channel, void* data, uint16_t length)
+{
+    return g_usbdGsFopsFs.Control(static_cast<uint8_t>(request), channel, static_cast<uint8_t*>(data), &length);
+}
+
+int8_t setMode(uint16_t channel, bool start, uint32_t flags = 0)
+{
+    uint32_t mode[2] = {start ? 1U : 0U, flags};
+    return control(Request::Mode, channel, &mode[0], sizeof(mode));
+}
+
+//! The USB class got a transfer complete, the same way it calls the interface.
+void completeTransfer()
+{
+    // The frame must not have changed while the peripheral was reading it.
+    CHECK(g_endpoint.isBusy);
+    CHECK(std::memcmp(g_endpoint.buffer, g_endpoint.sent.data(), g_endpoint.sent.size()) == 0);
+    g_endpoint.isBusy = false;
+    g_usbdGsFopsFs.TransmitCplt();
+}
+
+GS_HostFrame makeFrame(uint8_t channel, uint32_t echoId)
+{
+    GS_HostFrame frame = {};
+    frame.echo_id      = echoId;
+    frame.can_id       = 0x100 + echoId;
+    frame.can_dlc      = 8;
+    frame.channel      = channel;
+    std::memset(&frame.data[0], static_cast<int>(echoId), sizeof(frame.data));
+    return frame;
+}
+
+uint32_t sentEchoId()
+{
+    GS_HostFrame frame = {};
+    std::memcpy(&frame, g_endpoint.sent.data(), std::min(sizeof(frame), g_endpoint.sent.size()));
+    return frame.echo_id;
+}
+
+//! Same as a new configuration set by the host, the class resets its endpoint before calling Init.
+void reset()
+{
+    g_endpoint = {};
+    g_usbdGsFopsFs.Init();
+    g_events = {};
+}
+
+void testDeviceConfig()
+{
+    reset();
+    uint8_t config[12] = {};
+    CHECK(control(Request::DeviceConfig, 0, &config[0], sizeof(config)) == USBD_OK);
+    CHECK(config[3] == s_channelCount - 1);
+
+    uint32_t bt[10] = {};
+    CHECK(control(Request::BitTimingCst, 1, &bt[0], sizeof(bt)) == USBD_OK);
+    CHECK(bt[0] == GS_CAN_FEATURE_HW_TIMESTAMP);
+    CHECK(bt[1] == 160'000'000);
+
+    TIM5->CNT    = 123456;
+    uint32_t now = 0;
+    CHECK(control(Request::Timestamp, 0, &now, sizeof(now)) == USBD_OK);
+    CHECK(now == 123456);
+
+    uint32_t format = 0x0000BEEF;
+    CHECK(control(Request::HostFormat, 0xFFFF, &format, sizeof(format)) == USBD_OK);
+    CHECK(control(Request::Unknown, 0, nullptr, 0) == USBD_FAIL);
+    CHECK(control(Request::DeviceConfig, s_channelCount, &config[0], sizeof(config)) == USBD_FAIL);
+    CHECK(control(Request::Mode, 0, &config[0], 4) == USBD_FAIL);    // Too short.
+}
+
+void testModes()
+{
+    reset();
+    CHECK(!GS_IsStarted(0));
+    CHECK(setMode(1, true) == USBD_OK);
+    CHECK(GS_IsStarted(1));
+    CHECK(!GS_IsStarted(0));
+    CHECK(!GS_IsStarted(s_channelCount));
+    CHECK(setMode(1, false) == USBD_OK);
+    CHECK(!GS_IsStarted(1));
+    CHECK(g_events.modeChannels == std::vector<uint8_t>({1, 1}));
+    CHECK(g_events.modeStarted == std::vector<bool>({true, false}));
+}
+
+void testReceive()
+{
+    reset();
+    setMode(0, true);
+    GS_HostFrame frame = makeFrame(0, 7);
+    auto*        bytes = reinterpret_cast<uint8_t*>(&frame);
+
+    CHECK(g_usbdGsFopsFs.Receive(bytes, GS_HOST_FRAME_SIZE_NO_TS) == USBD_OK);
+    CHECK(g_events.frames.size() == 1 && g_events.frames[0].echo_id == 7);
+
+    // Too short, a channel that isn't started, and a DLC that doesn't fit are all ignored.
+    g_usbdGsFopsFs.Receive(bytes, GS_HOST_FRAME_SIZE_NO_TS - 1);
+    frame.channel = 1;
+    g_usbdGsFopsFs.Receive(bytes, GS_HOST_FRAME_SIZE_NO_TS);
+    frame.channel = s_channelCount;
+    g_usbdGsFopsFs.Receive(bytes, GS_HOST_FRAME_SIZE_NO_TS);
+    frame         = makeFrame(0, 8);
+    frame.can_dlc = 9;
+    g_usbdGsFopsFs.Receive(bytes, GS_HOST_FRAME_SIZE_NO_TS);
+    CHECK(g_events.frames.size() == 1);
+}
+
+void testQueue()
+{
+    reset();
+    GS_HostFrame frame = makeFrame(0, 1);
+    CHECK(!GS_Queue(&frame));    // Not started.
+    CHECK(g_endpoint.transfers == 0);
+
+    setMode(0, true);
+    setMode(1, true, GS_CAN_FEATURE_HW_TIMESTAMP);
+    DWT->CYCCNT = 1000;
+    CHECK(GS_Queue(&frame));
+    CHECK(g_endpoint.transfers == 1 && g_endpoint.sent.size() == GS_HOST_FRAME_SIZE_NO_TS);
+
+    // Only one frame at a time in the endpoint, in order.
+    GS_HostFrame second = makeFrame(1, 2);
+    GS_HostFrame third  = makeFrame(0, 3);
+    DWT->CYCCNT         = 2000;
+    CHECK(GS_Queue(&second));
+    CHECK(GS_Queue(&third));
+    CHECK(g_endpoint.transfers == 1);
+
+    completeTransfer();
+    CHECK(g_endpoint.transfers == 2 && sentEchoId() == 2);
+    CHECK(g_endpoint.sent.size() == sizeof(GS_HostFrame));    // Channel 1 wants timestamps.
+    completeTransfer();
+    CHECK(sentEchoId() == 3);
+    completeTransfer();
+    CHECK(!g_endpoint.isBusy);
+    CHECK(g_events.sentCycles == std::vector<uint32_t>({1000, 2000, 2000}));
+
+    // A stray transfer complete doesn't release anything.
+    g_usbdGsFopsFs.TransmitCplt();
+    CHECK(g_events.sentCycles.size() == 3);
+    CHECK(g_endpoint.refused == 0);
+}
+
+void testQueueFull()
+{
+    reset();
+    setMode(0, true);
+    size_t queued = 0;
+    for (uint32_t i = 0; i < 40; i++) {
+        GS_HostFrame frame = makeFrame(0, i);
+        if (GS_Queue(&frame)) { ++queued; }
+    }
+    CHECK(queued == 32);
+    CHECK(GS_GetDroppedFrames() == 8);
+
+    // Starting a channel while none were started clears the count.
+    setMode(0, false);
+    setMode(0, true);
+    CHECK(GS_GetDroppedFrames() == 0);
+}
+
+void testFlushWhileInFlight()
+{
+    reset();
+    setMode(0, true);
+    GS_HostFrame first  = makeFrame(0, 100);
+    GS_HostFrame second = makeFrame(0, 101);
+    GS_Queue(&first);
+    GS_Queue(&second);
+    CHECK(g_endpoint.isBusy && sentEchoId() == 100);
+
+    // Resetting the last channel flushes the queue, but the endpoint is still sending the first frame.
+    setMode(0, false);
+    setMode(0, true);
+
+    // Fill the queue before the transfer completes, its slot must not be reused.
+    size_t queued = 0;
+    for (uint32_t i = 0; i < 40; i++) {
+        GS_HostFrame frame = makeFrame(0, 200 + i);
+        if (GS_Queue(&frame)) { ++queued; }
+    }
+    CHECK(queued == 31);
+    CHECK(g_endpoint.transfers == 1);
+
+    completeTransfer();
+    CHECK(g_events.sentCycles.size() == 1);
+    CHECK(g_endpoint.transfers == 2 && sentEchoId() == 200);    // The flushed second frame is gone.
+    for (uint32_t i = 1; i < queued; i++) {
+        completeTransfer();
+        CHECK(sentEchoId() == 200 + i);
+    }
+    completeTransfer();
+    CHECK(!g_endpoint.isBusy);
+    CHECK(g_events.sentCycles.size() == 1 + queued);
+    CHECK(g_endpoint.refused == 0);
+}
+
+void testInitWhileInFlight()
+{
+    reset();
+    setMode(0, true);
+    GS_HostFrame frame = makeFrame(0, 1);
+    GS_Queue(&frame);
+    CHECK(g_endpoint.isBusy);
+
+    // A new configuration kills the transfer, no transfer complete will come for it.
+    reset();
+    setMode(0, true);
+    frame = makeFrame(0, 2);
+    CHECK(GS_Queue(&frame));
+    CHECK(g_endpoint.transfers == 1 && sentEchoId() == 2);
+    completeTransfer();
+    CHECK(g_events.sentCycles.size() == 1);
+}
+}    // namespace
+
+extern "C" {
+uint8_t USBD_DCDC_GsTransmit(USBD_HandleTypeDef* /*pdev*/, uint8_t* pbuff, uint16_t length)
+{
+    if (g_endpoint.isBusy) {
+        ++g_endpoint.refused;
+        return USBD_BUSY;
+    }
+    g_endpoint.isBusy = true;
+    g_endpoint.buffer = pbuff;
+    g_endpoint.sent.assign(pbuff, pbuff + length);
+    ++g_endpoint.transfers;
+    return USBD_OK;
+}
+
+uint32_t HAL_RCCEx_GetPeriphCLKFreq(uint32_t /*clock*/)
+{
+    return 160'000'000;
+}
+}
+
+int main()
+{
+    test::mapClocks();
+    GS_SetChannelCount(s_channelCount);
+    GS_SetOnFrame([](void*, const GS_HostFrame* frame) { g_events.frames.push_back(*frame); }, nullptr);
+    GS_SetOnFrameSent([](void*, uint32_t cycles) { g_events.sentCycles.push_back(cycles); }, nullptr);
+    GS_SetOnModeChanged(
+      [](void*, uint8_t channel, bool started) {
+          g_events.modeChannels.push_back(channel);
+          g_events.modeStarted.push_back(started);
+      },
+      nullptr);
+
+    testDeviceConfig();
+    testModes();
+    testReceive();
+    testQueue();
+    testQueueFull();
+    testFlushWhileInFlight();
+    testInitWhileInFlight();
+    return test::result();
+}
@@ -0,0 +1,663 @@
+/**
+ * @file    iso_tp_test.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Runs the ISO-TP links against a virtual peer and a virtual SLCAN host, with a hand driven tick.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "check.h"
+
+#include "iso_tp.h"
+
+#include <portable.h>
+#include <task.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace {
+using namespace SlCan;
+using Bytes = std::vector<uint8_t>;
+
+constexpr uint8_t s_flowContinue = 0x30;
+constexpr uint8_t s_flowWait     = 0x31;
+constexpr uint8_t s_flowOverflow = 0x32;
+
+//! Frames handed to the bus by the device, in order.
+std::deque<Packet> g_bus;
+//! Frames the scheduler still takes, the sender refuses the others.
+size_t             g_txRoom       = 1000;
+//! Times the links told that the hardware filters must change.
+size_t             g_linksChanged = 0;
+
+bool sendFrame(void* /*userData*/, const Packet& frame)
+{
+    if (g_txRoom == 0) { return false; }
+    --g_txRoom;
+    g_bus.push_back(frame);
+    return true;
+}
+
+Packet line(const std::string& text)
+{
+    return {reinterpret_cast<const uint8_t*>(text.data()), text.size()};
+}
+
+Packet frame(uint32_t id, Bytes data, uint8_t channel = 0)
+{
+    Packet packet {id, false, data.data(), data.size()};
+    packet.channel = channel;
+    return packet;
+}
+
+Bytes pattern(size_t len, uint8_t seed)
+{
+    Bytes bytes(len);
+    for (size_t i = 0; i < len; i++) { bytes[i] = static_cast<uint8_t>(i * 7 + seed); }
+    return bytes;
+}
+
+//! What the SLCAN host got back.
+struct Host {
+    std::vector<Bytes>    pdus;
+    Bytes                 current;     //!< Segments of the PDU being received.
+    std::vector<uint32_t> statusIds;
+    std::vector<int>      statuses;
+    size_t                lines = 0;
+
+    [[nodiscard]] int lastStatus() const { return statuses.empty() ? -1 : statuses.back(); }
+};
+
+//! Sends every pending line to the host, through their text and binary forms.
+void drainHost(IsoTp& tp, Host& host)
+{
+    while (const Packet* packet = tp.peekHostPacket()) {
+        uint8_t buffer[200];
+        int     len = packet->toSerial(&buffer[0], sizeof(buffer));
+        CHECK(len > 0 && len == static_cast<int>(packet->sizeOfSerialPacket()));
+        CHECK(len <= static_cast<int>(Packet::s_mtu));
+        Packet back(&buffer[0], static_cast<size_t>(len));
+
+        len = packet->toBinary(&buffer[0], sizeof(buffer));
+        CHECK(Packet::fromBinary(&buffer[0], static_cast<size_t>(len)).command == packet->command);
+
+        if (back.command == Command::ReportIsoTpStatus) {
+            host.statusIds.push_back(back.data.isoTpStatus.txId);
+            host.statuses.push_back(static_cast<int>(back.data.isoTpStatus.status));
+        }
+        else {
+            CHECK(back.command == Command::TransferIsoTpData);
+            const auto& segment = back.data.isoTpData;
+            host.current.insert(host.current.end(), &segment.data[0], &segment.data[segment.len]);
+            if (segment.isLast) {
+                host.pdus.push_back(host.current);
+                host.current.clear();
+            }
+        }
+        ++host.lines;
+        tp.popHostPacket();
+    }
+    CHECK(!tp.hasHostOutput());
+}
+
+//! Sends a PDU from the host in 'i' lines of 64 bytes.
+void hostSend(IsoTp& tp, const char* txId, const Bytes& pdu)
+{
+    size_t offset = 0;
+    do {
+        size_t      len  = std::min<size_t>(Packet::s_isoTpSegmentLen, pdu.size() - offset);
+        std::string text = std::string("i") + txId + (offset + len == pdu.size() ? '1' : '0');
+        for (size_t i = 0; i < len; i++) {
+            char digits[3];
+            std::snprintf(&digits[0], sizeof(digits), "%02X", pdu[offset + i]);
+            text += &digits[0];
+        }
+        text += '\r';
+        Packet packet = line(text);
+        CHECK(packet.command == Command::TransferIsoTpData);
+        tp.handleHostCommand(packet);
+        offset += len;
+    } while (offset < pdu.size());
+}
+
+//! The other end of a link: gets the frames of the device and answers with flow controls.
+struct Peer {
+    Peer(uint32_t id, uint32_t deviceId, uint8_t blockSize, uint8_t stMin)
+    : id(id), deviceId(deviceId), blockSize(blockSize), stMin(stMin)
+    {
+    }
+
+    uint32_t id        = 0;    //!< Receive identifier of the link.
+    uint32_t deviceId  = 0;    //!< Transmit identifier of the link.
+    uint8_t  blockSize = 0;
+    uint8_t  stMin     = 0;
+
+    std::vector<Bytes>      received;
+    std::vector<TickType_t> consecutiveTicks;    //!< When each consecutive frame was handed to the bus.
+    size_t                  flowControls = 0;
+
+    Bytes   rx;
+    size_t  rxLen      = 0;
+    uint8_t sequence   = 0;
+    uint8_t blockCount = 0;
+
+    //! @returns The frames to send back.
+    std::vector<Packet> onDeviceFrame(const Packet& packet)
+    {
+        std::vector<Packet> replies;
+        const auto&         frameData = packet.data.packetData;
+        if (frameData.id != deviceId) { return replies; }
+        CHECK(frameData.dataLen == 8);
+
+        const uint8_t* data = &frameData.data[0];
+        switch (data[0] >> 4) {
+            case 0: received.emplace_back(&data[1], &data[1 + (data[0] & 0x0F)]); break;
+            case 1:
+                rxLen = (data[0] & 0x0F) << 8 | data[1];
+                rx.assign(&data[2], &data[8]);
+                sequence   = 1;
+                blockCount = 0;
+                replies.push_back(flowControl());
+                break;
+            case 2: {
+                CHECK((data[0] & 0x0F) == sequence);
+                sequence = (sequence + 1) & 0x0F;
+                consecutiveTicks.push_back(g_tick);
+                size_t len = std::min<size_t>(7, rxLen - rx.size());
+                rx.insert(rx.end(), &data[1], &data[1 + len]);
+                if (rx.size() == rxLen) {
+                    received.push_back(rx);
+                    rx.clear();
+                }
+                else if (blockSize != 0 && ++blockCount == blockSize) {
+                    blockCount = 0;
+                    replies.push_back(flowControl());
+                }
+                break;
+            }
+            default: CHECK(false); break;
+        }
+        return replies;
+    }
+
+    Packet flowControl()
+    {
+        ++flowControls;
+        return frame(id, {s_flowContinue, blockSize, stMin});
+    }
+};
+
+//! Runs the device and the peers, advancing the tick whenever nothing moves, until the device is idle.
+void run(IsoTp& tp, std::initializer_list<Peer*> peers, size_t maxSteps = 5000)
+{
+    for (size_t step = 0; step < maxSteps; step++) {
+        TickType_t wait  = tp.service();
+        bool       moved = !g_bus.empty();
+        while (!g_bus.empty()) {
+            Packet sent = g_bus.front();
+            g_bus.pop_front();
+            for (Peer* peer : peers) {
+                for (const Packet& reply : peer->onDeviceFrame(sent)) { CHECK(tp.onFrame(reply)); }
+            }
+        }
+        if (moved) { continue; }
+        if (wait == portMAX_DELAY) { return; }
+        g_tick += wait == 0 ? 1 : wait;
+    }
+    CHECK(false);
+}
+
+//! Takes the frames of the device off the bus until a flow control for the peer.
+bool nextFlowControl(IsoTp& tp, const Peer& peer, Bytes& flow)
+{
+    tp.service();
+    while (!g_bus.empty()) {
+        const auto& frameData = g_bus.front().data.packetData;
+        bool        isFlow    = frameData.id == peer.deviceId && (frameData.data[0] >> 4) == 3;
+        if (isFlow) { flow.assign(&frameData.data[0], &frameData.data[3]); }
+        g_bus.pop_front();
+        if (isFlow) { return true; }
+    }
+    return false;
+}
+
+/**
+ * The peer sends a PDU to the device, following its flow controls.
+ * @param corruptAt Index of the consecutive frame sent with a wrong sequence number, the transfer stops there.
+ * @returns The flow controls received.
+ */
+size_t peerSend(IsoTp& tp, const Peer& peer, const Bytes& pdu, int corruptAt = -1)
+{
+    if (pdu.size() <= 7) {
+        Bytes single = {static_cast<uint8_t>(pdu.size())};
+        single.insert(single.end(), pdu.begin(), pdu.end());
+        single.resize(8, 0xAA);
+        CHECK(tp.onFrame(frame(peer.id, single)));
+        return 0;
+    }
+
+    Bytes first = {static_cast<uint8_t>(0x10 | pdu.size() >> 8), static_cast<uint8_t>(pdu.size())};
+    first.insert(first.end(), pdu.begin(), pdu.begin() + 6);
+    CHECK(tp.onFrame(frame(peer.id, first)));
+
+    size_t flowControls = 0;
+    Bytes  flow;
+    CHECK(nextFlowControl(tp, peer, flow));
+    if (flow.empty() || flow[0] != s_flowContinue) { return flowControls; }
+    ++flowControls;
+
+    size_t  offset     = 6;
+    uint8_t sequence   = 1;
+    uint8_t blockCount = 0;
+    for (int index = 0; offset < pdu.size(); index++) {
+        size_t  len         = std::min<size_t>(7, pdu.size() - offset);
+        uint8_t sent        = index == corruptAt ? (sequence + 1) & 0x0F : sequence;
+        Bytes   consecutive = {static_cast<uint8_t>(0x20 | sent)};
+        consecutive.insert(consecutive.end(), pdu.begin() + offset, pdu.begin() + offset + len);
+        CHECK(tp.onFrame(frame(peer.id, consecutive)));
+        if (index == corruptAt) { return flowControls; }
+
+        offset += len;
+        sequence = (sequence + 1) & 0x0F;
+        if (offset < pdu.size() && flow[1] != 0 && ++blockCount == flow[1]) {
+            blockCount = 0;
+            CHECK(nextFlowControl(tp, peer, flow));
+            CHECK(flow.size() == 3 && flow[0] == s_flowContinue);
+            ++flowControls;
+        }
+    }
+    return flowControls;
+}
+
+//! The links of the tests: 0x7E0/0x7E8 asks for blocks of 4 frames, 0x7E1/0x7E9 has no limit.
+struct Fixture {
+    IsoTp tp {&sendFrame, [](void*) { ++g_linksChanged; }, nullptr};
+    Host  host;
+    Peer  a {0x7E8, 0x7E0, 4, 0};
+    Peer  b {0x7E9, 0x7E1, 0, 5};
+
+    Fixture()
+    {
+        g_bus.clear();
+        g_txRoom       = 1000;
+        g_linksChanged = 0;
+        tp.handleHostCommand(line("I7E07E80400\r"));
+        tp.handleHostCommand(line("I7E17E90003\r"));
+        CHECK(!tp.hasHostOutput());
+    }
+
+    ~Fixture()
+    {
+        // Closing every link gives all the buffers back.
+        tp.handleHostCommand(line("I\r"));
+        CHECK(g_liveAllocations == 0);
+    }
+};
+
+void testLineFormats()
+{
+    uint8_t buffer[200];
+    Packet  open = line("I7E07E80805\r");
+    CHECK(open.command == Command::SetIsoTpLink);
+    CHECK(open.data.isoTpLink.txId == 0x7E0 && open.data.isoTpLink.rxId == 0x7E8);
+    CHECK(open.data.isoTpLink.blockSize == 8 && open.data.isoTpLink.stMin == 5);
+    CHECK(!open.data.isoTpLink.close && !open.data.isoTpLink.closeAll);
+    CHECK(open.toSerial(&buffer[0], sizeof(buffer)) == 12 && std::memcmp(&buffer[0], "I7E07E80805\r", 12) == 0);
+
+    Packet extended = line("3I18DA10F118DAF1100000\r");
+    CHECK(extended.command == Command::SetIsoTpLink && extended.channel == 3);
+    CHECK(extended.data.isoTpLink.isExtended && extended.data.isoTpLink.rxId == 0x18DAF110);
+    int len = extended.toSerial(&buffer[0], sizeof(buffer));
+    CHECK(len == static_cast<int>(extended.sizeOfSerialPacket()));
+    CHECK(std::memcmp(&buffer[0], "3I18DA10F118DAF1100000\r", 23) == 0);
+
+    Packet close = line("I7E0\r");
+    CHECK(close.command == Command::SetIsoTpLink && close.data.isoTpLink.close);
+    CHECK(close.toSerial(&buffer[0], sizeof(buffer)) == 5);
+    Packet closeAll = line("I\r");
+    CHECK(closeAll.command == Command::SetIsoTpLink && closeAll.data.isoTpLink.closeAll);
+    CHECK(closeAll.toSerial(&buffer[0], sizeof(buffer)) == 2);
+
+    Packet status = line("I7E03\r");
+    CHECK(status.command == Command::ReportIsoTpStatus);
+    CHECK(status.data.isoTpStatus.status == 3 && status.data.isoTpStatus.txId == 0x7E0);
+    CHECK(status.toSerial(&buffer[0], sizeof(buffer)) == 6 && std::memcmp(&buffer[0], "I7E03\r", 6) == 0);
+    CHECK(line("I18DA10F10\r").data.isoTpStatus.isExtended);
+
+    Packet segment = line("i7E01AABBCC\r");
+    CHECK(segment.command == Command::TransferIsoTpData);
+    CHECK(segment.data.isoTpData.len == 3 && segment.data.isoTpData.isLast && segment.data.isoTpData.data[2] == 0xCC);
+    CHECK(segment.toSerial(&buffer[0], sizeof(buffer)) == 12 && std::memcmp(&buffer[0], "i7E01AABBCC\r", 12) == 0);
+    len = segment.toBinary(&buffer[0], sizeof(buffer));
+    Packet binary = Packet::fromBinary(&buffer[0], static_cast<size_t>(len));
+    CHECK(binary.command == Command::TransferIsoTpData && binary.data.isoTpData.len == 3);
+
+    Packet empty = line("i18DA10F10\r");
+    CHECK(empty.command == Command::TransferIsoTpData && empty.data.isoTpData.isExtended);
+    CHECK(empty.data.isoTpData.len == 0 && !empty.data.isoTpData.isLast);
+
+    CHECK(line("I7E\r").command == Command::Invalid);
+    CHECK(line("I7E07E8\r").command == Command::Invalid);
+    CHECK(line("I7E07E8080\r").command == Command::ReportIsoTpStatus);    // Same length as a status.
+    CHECK(line("i7E02AA\r").command == Command::Invalid);
+    CHECK(line("i7E1AA\r").command == Command::Invalid);
+
+    // Longest segment, then one byte too many.
+    std::string text = "i7E01";
+    for (size_t i = 0; i < Packet::s_isoTpSegmentLen; i++) { text += "5A"; }
+    text += '\r';
+    Packet longest = line(text);
+    CHECK(longest.command == Command::TransferIsoTpData && longest.data.isoTpData.len == Packet::s_isoTpSegmentLen);
+    text.insert(5, "00");
+    CHECK(line(text).command == Command::Invalid);
+}
+
+void testSingleFrame()
+{
+    Fixture f;
+    hostSend(f.tp, "7E0", {1, 2, 3});
+    run(f.tp, {&f.a, &f.b});
+    CHECK(f.a.received == std::vector<Bytes>({{1, 2, 3}}));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.statusIds == std::vector<uint32_t>({0x7E0}));
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::Sent));
+
+    peerSend(f.tp, f.a, {9, 8, 7});
+    drainHost(f.tp, f.host);
+    CHECK(f.host.pdus == std::vector<Bytes>({{9, 8, 7}}));
+}
+
+void testSegmentationToPeer()
+{
+    // Both links at once, the block size of a and the separation time of b.
+    Fixture f;
+    Bytes   pduA = pattern(100, 1);
+    Bytes   pduB = pattern(300, 2);
+    hostSend(f.tp, "7E0", pduA);
+    hostSend(f.tp, "7E1", pduB);
+    run(f.tp, {&f.a, &f.b});
+    CHECK(f.a.received == std::vector<Bytes>({pduA}));
+    CHECK(f.b.received == std::vector<Bytes>({pduB}));
+
+    // 14 consecutive frames in blocks of 4: a flow control after the first frame, then after the 4th, 8th and 12th.
+    CHECK(f.a.flowControls == 1 + 3);
+    CHECK(f.b.consecutiveTicks.size() == (300 - 6 + 6) / 7);
+    for (size_t i = 1; i < f.b.consecutiveTicks.size(); i++) {
+        CHECK(f.b.consecutiveTicks[i] - f.b.consecutiveTicks[i - 1] >= 6);
+    }
+    drainHost(f.tp, f.host);
+    CHECK(f.host.statuses == std::vector<int>({0, 0}));
+}
+
+void testSeparationInMicroseconds()
+{
+    // 0xF1 to 0xF9 can't be done with the tick, they are rounded up to the shortest wait.
+    Fixture f;
+    f.b.stMin = 0xF5;
+    Bytes pdu = pattern(60, 3);
+    hostSend(f.tp, "7E1", pdu);
+    run(f.tp, {&f.b});
+    CHECK(f.b.received == std::vector<Bytes>({pdu}));
+    for (size_t i = 1; i < f.b.consecutiveTicks.size(); i++) {
+        CHECK(f.b.consecutiveTicks[i] - f.b.consecutiveTicks[i - 1] == 2);
+    }
+    drainHost(f.tp, f.host);
+}
+
+void testSegmentationFromPeer()
+{
+    // Longest PDU, the device asks for blocks of 4 then gives it to the host in 64 byte segments.
+    Fixture f;
+    Bytes   pdu          = pattern(IsoTp::s_maxPduLen, 3);
+    size_t  consecutives = (pdu.size() - 6 + 6) / 7;
+    CHECK(peerSend(f.tp, f.a, pdu) == 1 + (consecutives - 1) / 4);
+    CHECK(f.tp.hasHostOutput());
+    drainHost(f.tp, f.host);
+    CHECK(f.host.pdus == std::vector<Bytes>({pdu}));
+    CHECK(f.host.lines == (pdu.size() + 63) / 64);
+}
+
+void testOverflowWhileDelivering()
+{
+    // A second PDU while the first one is still going to the host is refused with an overflow.
+    Fixture f;
+    Bytes   pdu = pattern(50, 4);
+    peerSend(f.tp, f.a, pdu);
+    CHECK(f.tp.hasHostOutput());
+    CHECK(f.tp.onFrame(frame(0x7E8, {0x10, 20, 1, 2, 3, 4, 5, 6})));
+    f.tp.service();
+    CHECK(g_bus.size() == 1 && g_bus.front().data.packetData.data[0] == s_flowOverflow);
+    g_bus.clear();
+    drainHost(f.tp, f.host);
+    CHECK(f.host.pdus == std::vector<Bytes>({pdu}));
+}
+
+void testWrongSequence()
+{
+    Fixture f;
+    peerSend(f.tp, f.a, pattern(40, 5), 2);
+    drainHost(f.tp, f.host);
+    CHECK(f.host.pdus.empty());
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::WrongSequence));
+    CHECK(f.host.statusIds.back() == 0x7E0);
+
+    // The link is usable again.
+    Bytes pdu = pattern(40, 6);
+    peerSend(f.tp, f.a, pdu);
+    drainHost(f.tp, f.host);
+    CHECK(f.host.pdus == std::vector<Bytes>({pdu}));
+}
+
+void testRxTimeout()
+{
+    Fixture f;
+    CHECK(f.tp.onFrame(frame(0x7E8, {0x10, 20, 1, 2, 3, 4, 5, 6})));
+    TickType_t wait = f.tp.service();
+    g_bus.clear();
+    CHECK(wait == IsoTp::s_timeout);
+    g_tick += wait - 1;
+    f.tp.service();
+    CHECK(!f.tp.hasHostOutput());
+    g_tick += 1;
+    f.tp.service();
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::RxTimeout));
+}
+
+void testTxTimeout()
+{
+    // No flow control from the peer.
+    Fixture f;
+    hostSend(f.tp, "7E0", pattern(20, 6));
+    f.tp.service();
+    CHECK(g_bus.size() == 1);
+    g_bus.clear();
+    TickType_t wait = f.tp.service();
+    CHECK(wait == IsoTp::s_timeout);
+    g_tick += wait;
+    f.tp.service();
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::TxTimeout));
+}
+
+void testCollectingTimeout()
+{
+    // The host stops in the middle of its PDU, the buffer doesn't stay allocated.
+    Fixture f;
+    f.tp.handleHostCommand(line("i7E00" + std::string(2 * Packet::s_isoTpSegmentLen, 'A') + "\r"));
+    CHECK(g_liveAllocations == 1);
+    TickType_t wait = f.tp.service();
+    CHECK(wait == IsoTp::s_timeout);
+    g_tick += wait - 1;
+    f.tp.service();
+    CHECK(!f.tp.hasHostOutput());
+    g_tick += 1;
+    f.tp.service();
+    CHECK(g_liveAllocations == 0);
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::TxTimeout));
+    CHECK(g_bus.empty());
+
+    // The next PDU goes through.
+    Bytes pdu = pattern(20, 12);
+    hostSend(f.tp, "7E0", pdu);
+    run(f.tp, {&f.a});
+    CHECK(f.a.received == std::vector<Bytes>({pdu}));
+}
+
+void testFlowWait()
+{
+    // Each wait from the peer restarts the timeout, then it continues.
+    Fixture f;
+    Bytes   pdu = pattern(20, 7);
+    hostSend(f.tp, "7E0", pdu);
+    f.tp.service();
+    CHECK(g_bus.size() == 1);
+    std::vector<Packet> continueFlow = f.a.onDeviceFrame(g_bus.front());
+    g_bus.clear();
+    for (int i = 0; i < 3; i++) {
+        g_tick += IsoTp::s_timeout - 1;
+        CHECK(f.tp.onFrame(frame(0x7E8, {s_flowWait, 0, 0})));
+        CHECK(f.tp.service() == IsoTp::s_timeout);
+        CHECK(g_bus.empty() && !f.tp.hasHostOutput());
+    }
+    for (const Packet& reply : continueFlow) { CHECK(f.tp.onFrame(reply)); }
+    run(f.tp, {&f.a});
+    CHECK(f.a.received == std::vector<Bytes>({pdu}));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.statuses == std::vector<int>({static_cast<int>(IsoTp::Status::Sent)}));
+}
+
+void testFlowOverflowAndInvalid()
+{
+    Fixture f;
+    hostSend(f.tp, "7E0", pattern(20, 8));
+    f.tp.service();
+    g_bus.clear();
+    CHECK(f.tp.onFrame(frame(0x7E8, {s_flowOverflow, 0, 0})));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::Overflow));
+
+    hostSend(f.tp, "7E0", pattern(20, 8));
+    f.tp.service();
+    g_bus.clear();
+    CHECK(f.tp.onFrame(frame(0x7E8, {0x35, 0, 0})));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::InvalidFlow));
+    f.tp.service();
+    CHECK(g_bus.empty());
+}
+
+void testBusy()
+{
+    Fixture f;
+    Bytes   pdu = pattern(20, 9);
+    hostSend(f.tp, "7E0", pdu);
+    f.tp.service();
+    hostSend(f.tp, "7E0", pattern(200, 9));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::Busy));
+
+    // The first one still goes out.
+    run(f.tp, {&f.a});
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::Sent));
+    CHECK(f.a.received == std::vector<Bytes>({pdu}));
+}
+
+void testTxRoom()
+{
+    // The scheduler refuses frames, the link waits for room.
+    Fixture f;
+    Bytes   pdu = pattern(200, 10);
+    f.b.stMin   = 0;
+    g_txRoom    = 3;
+    hostSend(f.tp, "7E1", pdu);
+    for (int i = 0; i < 5; i++) {
+        f.tp.service();
+        while (!g_bus.empty()) {
+            for (const Packet& reply : f.b.onDeviceFrame(g_bus.front())) { f.tp.onFrame(reply); }
+            g_bus.pop_front();
+        }
+    }
+    CHECK(f.tp.wantsTxRoom());
+    CHECK(f.b.received.empty());
+
+    g_txRoom = 1000;
+    run(f.tp, {&f.b});
+    CHECK(f.b.received == std::vector<Bytes>({pdu}));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.lastStatus() == static_cast<int>(IsoTp::Status::Sent));
+}
+
+void testLinks()
+{
+    Fixture f;
+    // Unknown link, then a receive identifier that's already taken.
+    hostSend(f.tp, "123", {1});
+    f.tp.handleHostCommand(line("I1237E80000\r"));
+    drainHost(f.tp, f.host);
+    CHECK(f.host.statuses == std::vector<int>(2, static_cast<int>(IsoTp::Status::Rejected)));
+    CHECK(!f.tp.onFrame(frame(0x7EA, {1, 1})));
+
+    // The hardware filters must let the frames of the open links through, and only those.
+    uint32_t ids[IsoTp::s_linkCount] = {};
+    CHECK(g_linksChanged == 2);
+    CHECK(f.tp.rxIds(0, false, &ids[0]) == 2 && ids[0] == 0x7E8 && ids[1] == 0x7E9);
+    CHECK(f.tp.rxIds(0, true, &ids[0]) == 0 && f.tp.rxIds(1, false, &ids[0]) == 0);
+    f.tp.handleHostCommand(line("I7E07E80800\r"));    // Same identifiers, new parameters.
+    CHECK(g_linksChanged == 2);
+
+    // Frames of a closed link aren't consumed anymore.
+    f.tp.handleHostCommand(line("I7E0\r"));
+    CHECK(g_linksChanged == 3);
+    CHECK(f.tp.rxIds(0, false, &ids[0]) == 1 && ids[0] == 0x7E9);
+    CHECK(!f.tp.onFrame(frame(0x7E8, {1, 1})));
+    CHECK(f.tp.onFrame(frame(0x7E9, {1, 1})));
+    drainHost(f.tp, f.host);
+    f.tp.handleHostCommand(line("I\r"));
+    CHECK(!f.tp.onFrame(frame(0x7E9, {1, 1})));
+
+    // Closing a link in the middle of transfers frees their buffers, checked when the fixture goes away.
+    f.tp.handleHostCommand(line("I7E07E80400\r"));
+    hostSend(f.tp, "7E0", pattern(100, 11));
+    CHECK(f.tp.onFrame(frame(0x7E8, {0x10, 20, 1, 2, 3, 4, 5, 6})));
+    f.tp.service();
+    g_bus.clear();
+}
+}    // namespace
+
+int main()
+{
+    // Close to the wrap around, so that the deadlines go through it.
+    g_tick = 0xFFFFFF00;
+
+    testLineFormats();
+    testSingleFrame();
+    testSegmentationToPeer();
+    testSeparationInMicroseconds();
+    testSegmentationFromPeer();
+    testOverflowWhileDelivering();
+    testWrongSequence();
+    testRxTimeout();
+    testTxTimeout();
+    testCollectingTimeout();
+    testFlowWait();
+    testFlowOverflowAndInvalid();
+    testBusy();
+    testTxRoom();
+    testLinks();
+    return test::result();
+}
@@ -0,0 +1,160 @@
+/**
+ * @file    slcan_hex_bench.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Compares the word-at-a-time hex decoding with a digit-at-a-time lookup, on SLCAN sized inputs, and times
+ *          the encoding and decoding of whole SLCAN frames.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "slcan/hex.h"
+#include "slcan/slcan.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string_view>
+#include <vector>
+
+namespace {
+using namespace SlCan;
+
+constexpr size_t s_rounds = 2'000'000;
+
+//! What the word-at-a-time decoding replaced: one table look up per digit.
+bool decodeBytesByDigit(const uint8_t* in, size_t len, uint8_t* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        uint8_t high = Hex::decodeDigit(in[2 * i]);
+        uint8_t low  = Hex::decodeDigit(in[2 * i + 1]);
+        if (high == Hex::s_invalid || low == Hex::s_invalid) { return false; }
+        out[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+}
+
+bool decodeValueByDigit(const uint8_t* in, size_t digits, uint32_t& out)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < digits; i++) {
+        uint8_t digit = Hex::decodeDigit(in[i]);
+        if (digit == Hex::s_invalid) { return false; }
+        value = (value << 4) | digit;
+    }
+    out = value;
+    return true;
+}
+
+template<typename Func>
+double nsPerCall(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < s_rounds; i++) { func(i); }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(s_rounds);
+}
+
+//! Times Packet::toSerial and the parsing of its output back into a packet, on inputs of a single kind of frame.
+void benchFrames(std::string_view name, const std::vector<Packet>& frames, uint32_t& sink)
+{
+    std::vector<std::vector<uint8_t>> lines;
+    for (const Packet& frame : frames) {
+        std::vector<uint8_t> line(Packet::s_mtu);
+        int16_t              len = frame.toSerial(line.data(), line.size());
+        if (len <= 0) {
+            std::printf("  %.*s: can't be encoded\n", static_cast<int>(name.size()), name.data());
+            return;
+        }
+        line.resize(static_cast<size_t>(len));
+        lines.push_back(std::move(line));
+    }
+
+    double encode = nsPerCall([&](size_t i) {
+        uint8_t line[Packet::s_mtu];
+        sink += frames[i % frames.size()].toSerial(&line[0], sizeof(line)) + line[i % 4];
+    });
+    double decode = nsPerCall([&](size_t i) {
+        const auto& line = lines[i % lines.size()];
+        Packet      packet(line.data(), line.size());
+        sink += static_cast<uint32_t>(packet.command) + packet.data.packetData.id;
+    });
+
+    std::printf("  %-14.*s %2zu chars: %7.1f ns/frame to encode, %7.1f ns/frame to decode\n",
+                static_cast<int>(name.size()),
+                name.data(),
+                lines.front().size(),
+                encode,
+                decode);
+}
+}    // namespace
+
+int main()
+{
+    // Payloads of an FD frame and identifiers of an extended one, as written by the host.
+    constexpr size_t     s_inputs = 64;
+    constexpr size_t     s_len    = 64;
+    std::mt19937         rng(1);
+    std::vector<uint8_t> payloads(s_inputs * 2 * s_len);
+    std::vector<uint8_t> ids(s_inputs * 8);
+    for (size_t i = 0; i < s_inputs; i++) {
+        uint8_t data[s_len];
+        for (auto& byte : data) { byte = static_cast<uint8_t>(rng()); }
+        Hex::encodeBytes(&payloads[i * 2 * s_len], &data[0], s_len);
+        Hex::encodeValue(&ids[i * 8], rng() & 0x1FFFFFFF, 8);
+    }
+
+    std::vector<uint8_t> out(s_len);
+    uint32_t             value = 0;
+    uint32_t             sink  = 0;
+
+    double bytesByDigit = nsPerCall([&](size_t i) {
+        sink += decodeBytesByDigit(&payloads[(i % s_inputs) * 2 * s_len], s_len, out.data()) + out[i % s_len];
+    });
+    double bytesByWord  = nsPerCall([&](size_t i) {
+        sink += Hex::decodeBytes(&payloads[(i % s_inputs) * 2 * s_len], s_len, out.data()) + out[i % s_len];
+    });
+    double valueByDigit = nsPerCall([&](size_t i) {
+        sink += decodeValueByDigit(&ids[(i % s_inputs) * 8], 8, value) + value;
+    });
+    double valueByWord  = nsPerCall([&](size_t i) {
+        sink += Hex::decodeValue(&ids[(i % s_inputs) * 8], 8, value) + value;
+    });
+    double encode       = nsPerCall([&](size_t i) {
+        uint8_t text[2 * s_len];
+        Hex::encodeBytes(&text[0], out.data(), s_len);
+        sink += text[i % sizeof(text)];
+    });
+
+    std::printf("  decode %zu bytes: %7.1f ns by digit, %7.1f ns by word\n", s_len, bytesByDigit, bytesByWord);
+    std::printf("  decode 8 digits:  %7.1f ns by digit, %7.1f ns by word\n", valueByDigit, valueByWord);
+    std::printf("  encode %zu bytes: %7.1f ns\n", s_len, encode);
+
+    // Classic frames with 8 data bytes, and remote frames, both as sent to the host and as written by it.
+    std::vector<Packet> stdFrames;
+    std::vector<Packet> extFrames;
+    std::vector<Packet> stdRemotes;
+    std::vector<Packet> extRemotes;
+    for (size_t i = 0; i < s_inputs; i++) {
+        uint8_t data[8];
+        for (auto& byte : data) { byte = static_cast<uint8_t>(rng()); }
+        stdFrames.emplace_back(rng() & 0x7FF, false, &data[0], sizeof(data));
+        extFrames.emplace_back(rng() & 0x1FFFFFFF, true, &data[0], sizeof(data));
+        stdRemotes.emplace_back(rng() & 0x7FF, false);
+        extRemotes.emplace_back(rng() & 0x1FFFFFFF, true);
+    }
+    benchFrames("standard", stdFrames, sink);
+    benchFrames("extended", extFrames, sink);
+    benchFrames("std remote", stdRemotes, sink);
+    benchFrames("ext remote", extRemotes, sink);
+    std::printf("(sink %u)\n", static_cast<unsigned>(sink & 1));
+    return 0;
+}
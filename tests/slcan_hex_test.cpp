@@ -0,0 +1,188 @@
+/**
+ * @file    slcan_hex_test.cpp
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Checks the word-at-a-time hex decoding against the lookup table, exhaustively where it's affordable.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+#include "check.h"
+
+#include "slcan/hex.h"
+
+#include <cstdint>
+#include <random>
+#include <string_view>
+
+namespace {
+using namespace SlCan;
+
+constexpr std::string_view s_validDigits = "0123456789ABCDEFabcdef";
+constexpr size_t           s_randomWords = 20'000'000;
+
+//! Same as decodeValue, one digit at a time through the lookup table.
+bool referenceDecode(const uint8_t* in, size_t digits, uint32_t& out)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < digits; i++) {
+        uint8_t digit = Hex::s_values[in[i]];
+        if (digit == Hex::s_invalid) { return false; }
+        value = (value << 4) | digit;
+    }
+    out = value;
+    return true;
+}
+
+//! Compares decode4 with the lookup table, stops reporting after the first mismatch to keep the output readable.
+bool checkWord(const uint8_t* in)
+{
+    uint32_t expected = 0;
+    bool     isValid  = referenceDecode(in, 4, expected);
+    uint16_t word     = 0xDEAD;
+    bool     decoded  = Hex::decode4(in, word);
+    if (decoded != isValid || (isValid && word != expected) || (!isValid && word != 0xDEAD)) {
+        std::printf("decode4(%02X %02X %02X %02X) = %d %04X, expected %d %04X\n",
+                    in[0],
+                    in[1],
+                    in[2],
+                    in[3],
+                    decoded,
+                    word,
+                    isValid,
+                    static_cast<unsigned>(expected));
+        CHECK(false);
+        return false;
+    }
+    return true;
+}
+
+//! Every byte at every position, the other three positions going through every valid digit.
+void testDecode4EveryBytePerPosition()
+{
+    uint8_t in[4];
+    for (size_t position = 0; position < 4; position++) {
+        for (unsigned byte = 0; byte < 256; byte++) {
+            for (size_t a = 0; a < s_validDigits.size(); a++) {
+                for (size_t b = 0; b < s_validDigits.size(); b++) {
+                    for (size_t c = 0; c < s_validDigits.size(); c++) {
+                        uint8_t others[3] = {static_cast<uint8_t>(s_validDigits[a]),
+                                             static_cast<uint8_t>(s_validDigits[b]),
+                                             static_cast<uint8_t>(s_validDigits[c])};
+                        for (size_t i = 0, o = 0; i < 4; i++) {
+                            in[i] = i == position ? static_cast<uint8_t>(byte) : others[o++];
+                        }
+                        if (!checkWord(&in[0])) { return; }
+                    }
+                }
+            }
+        }
+    }
+}
+
+//! Every combination of two bytes in each pair of positions, around valid digits.
+void testDecode4EveryPair()
+{
+    uint8_t in[4] = {'0', 'F', 'a', '9'};
+    for (size_t first = 0; first < 4; first++) {
+        for (size_t second = first + 1; second < 4; second++) {
+            uint8_t saved[4] = {in[0], in[1], in[2], in[3]};
+            for (unsigned x = 0; x < 256; x++) {
+                for (unsigned y = 0; y < 256; y++) {
+                    in[first]  = static_cast<uint8_t>(x);
+                    in[second] = static_cast<uint8_t>(y);
+                    if (!checkWord(&in[0])) { return; }
+                }
+            }
+            std::memcpy(&in[0], &saved[0], sizeof(in));
+        }
+    }
+}
+
+void testDecode4RandomWords()
+{
+    std::mt19937 rng(0x5EED);
+    for (size_t i = 0; i < s_randomWords; i++) {
+        uint32_t x = rng();
+        // Half of the words are made mostly of digits, otherwise nearly all of them are rejected by the first byte.
+        if ((i & 1) != 0) {
+            for (size_t shift = 0; shift < 32; shift += 8) {
+                if ((rng() & 7) != 0) {
+                    x = (x & ~(0xFFU << shift)) | uint32_t(s_validDigits[rng() % s_validDigits.size()]) << shift;
+                }
+            }
+        }
+        uint8_t in[4];
+        std::memcpy(&in[0], &x, sizeof(in));
+        if (!checkWord(&in[0])) { return; }
+    }
+}
+
+void testDecodeValue()
+{
+    std::mt19937 rng(42);
+    for (size_t round = 0; round < 1'000'000; round++) {
+        uint8_t in[8];
+        for (auto& c : in) {
+            c = (rng() % 16) != 0 ? static_cast<uint8_t>(s_validDigits[rng() % s_validDigits.size()])
+                                  : static_cast<uint8_t>(rng());
+        }
+        for (size_t digits = 0; digits <= 8; digits++) {
+            uint32_t expected = 0;
+            uint32_t value    = 0;
+            bool     isValid  = referenceDecode(&in[0], digits, expected);
+            CHECK(Hex::decodeValue(&in[0], digits, value) == isValid);
+            if (isValid) { CHECK(value == expected); }
+        }
+    }
+}
+
+void testRoundTrip()
+{
+    std::mt19937 rng(7);
+    for (size_t round = 0; round < 100'000; round++) {
+        uint32_t value  = rng();
+        size_t   digits = rng() % 9;
+        uint8_t  text[8];
+        CHECK(Hex::encodeValue(&text[0], value, digits) == &text[digits]);
+        uint32_t decoded = 0;
+        CHECK(Hex::decodeValue(&text[0], digits, decoded));
+        uint32_t mask = digits == 8 ? UINT32_MAX : (1UL << (4 * digits)) - 1;
+        CHECK(decoded == (value & mask));
+    }
+
+    // Every byte, at odd and even lengths.
+    uint8_t data[256];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = static_cast<uint8_t>(i);
+    }
+    for (size_t len : {0, 1, 2, 3, 255, 256}) {
+        uint8_t text[2 * sizeof(data)];
+        CHECK(Hex::encodeBytes(&text[0], &data[0], len) == &text[2 * len]);
+        uint8_t decoded[sizeof(data)] = {};
+        CHECK(Hex::decodeBytes(&text[0], len, &decoded[0]));
+        CHECK(std::memcmp(&decoded[0], &data[0], len) == 0);
+        if (len != 0) {
+            text[2 * len - 1] = 'g';
+            CHECK(!Hex::decodeBytes(&text[0], len, &decoded[0]));
+        }
+    }
+}
+}    // namespace
+
+int main()
+{
+    testDecode4EveryBytePerPosition();
+    testDecode4EveryPair();
+    testDecode4RandomWords();
+    testDecodeValue();
+    testRoundTrip();
+    return test::result();
+}
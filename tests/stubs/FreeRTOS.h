@@ -0,0 +1,48 @@
+/**
+ * @file    FreeRTOS.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Host stand-in for the parts of the FreeRTOS API used by the modules under test.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_TESTS_STUBS_FREERTOS_H
+#define CEP_TESTS_STUBS_FREERTOS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#define configASSERT(x)                                                                                                \
+    do {                                                                                                               \
+        if (!(x)) {                                                                                                    \
+            std::fprintf(stderr, "%s:%d: configASSERT(%s) failed\n", __FILE__, __LINE__, #x);                         \
+            std::abort();                                                                                              \
+        }                                                                                                              \
+    } while (false)
+
+using TickType_t  = uint32_t;
+using BaseType_t  = long;
+using UBaseType_t = unsigned long;
+
+#define pdFALSE            ((BaseType_t)0)
+#define pdTRUE             ((BaseType_t)1)
+#define pdPASS             pdTRUE
+#define pdFAIL             pdFALSE
+#define portMAX_DELAY      ((TickType_t)0xFFFFFFFFUL)
+#define portTICK_PERIOD_MS ((TickType_t)1)
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(ms))
+
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+#endif    // CEP_TESTS_STUBS_FREERTOS_H
@@ -0,0 +1,40 @@
+/**
+ * @file    portable.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Host stand-in for the FreeRTOS heap, which counts the live allocations to catch leaks.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_TESTS_STUBS_PORTABLE_H
+#define CEP_TESTS_STUBS_PORTABLE_H
+
+#include <cstddef>
+#include <cstdlib>
+
+//! Blocks allocated and not freed yet.
+inline int g_liveAllocations = 0;
+
+inline void* pvPortMalloc(size_t size)
+{
+    ++g_liveAllocations;
+    return std::malloc(size);
+}
+
+inline void vPortFree(void* ptr)
+{
+    if (ptr != nullptr) { --g_liveAllocations; }
+    std::free(ptr);
+}
+
+#endif    // CEP_TESTS_STUBS_PORTABLE_H
@@ -0,0 +1,45 @@
+/**
+ * @file    task.h
+ * @author  Samuel Martel
+ * @date    2024-04-24
+ * @brief   Host stand-in for the task API of FreeRTOS, the tick count is driven by the tests.
+ *
+ * @copyright
+ * This program is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ * This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with this program. If
+ * not, see <a href=https://www.gnu.org/licenses/>https://www.gnu.org/licenses/</a>.
+ */
+
+
+#ifndef CEP_TESTS_STUBS_TASK_H
+#define CEP_TESTS_STUBS_TASK_H
+
+#include "FreeRTOS.h"
+
+//! Tick count seen by the module under test, advanced by hand.
+inline TickType_t g_tick = 0;
+
+using TaskHandle_t = void*;
+
+inline TickType_t xTaskGetTickCount()
+{
+    return g_tick;
+}
+
+inline void vTaskNotifyGiveFromISR(TaskHandle_t /*task*/, BaseType_t* woken)
+{
+    if (woken != nullptr) { *woken = pdFALSE; }
+}
+
+// Everything runs on a single thread.
+#define taskENTER_CRITICAL()              ((void)0)
+#define taskEXIT_CRITICAL()               ((void)0)
+#define taskENTER_CRITICAL_FROM_ISR()     ((UBaseType_t)0)
+#define taskEXIT_CRITICAL_FROM_ISR(mask)  ((void)(mask))
+
+#endif    // CEP_TESTS_STUBS_TASK_H
@@ -26,6 +26,7 @@
 #include "usbd_desc.h"
 #include "usbd_dcdc.h"
 #include "usbd_cdc_if.h"
+#include "usbd_gs_if.h"
 
 /* USER CODE BEGIN Includes */
 
@@ -80,6 +81,9 @@ void MX_USB_Device_Init(void)
   if (USBD_DCDC_RegisterInterface(&hUsbDeviceFS, &g_usbdInterfaceFopsFs) != USBD_OK) {
     Error_Handler();
   }
+  if (USBD_DCDC_RegisterGsInterface(&hUsbDeviceFS, &g_usbdGsFopsFs) != USBD_OK) {
+    Error_Handler();
+  }
   if (USBD_Start(&hUsbDeviceFS) != USBD_OK) {
     Error_Handler();
   }
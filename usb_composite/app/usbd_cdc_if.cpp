@@ -26,6 +26,11 @@
 #include "vendor/logging/logger.h"
 
 #include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <string_view>
 
 #ifdef __cplusplus
@@ -128,68 +133,125 @@ static int8_t cdcInitFs(USBD_CDC_HandleTypeDef* cdc);
 static int8_t cdcDeInitFs(USBD_CDC_HandleTypeDef* cdc);
 static int8_t cdcControlFs(USBD_CDC_HandleTypeDef* cdc, uint8_t cmd, uint8_t* pbuf, uint16_t length);
 static int8_t cdcReceiveFs(USBD_CDC_HandleTypeDef* cdc, uint8_t* pbuf, uint32_t* len);
+static int8_t cdcTransmitCpltFs(USBD_CDC_HandleTypeDef* cdc, uint8_t* pbuf, uint32_t* len);
 
 /* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
 struct CDC_DeviceInfo {
+    //! One buffer is filled by the producers while the others are being sent.
+    static constexpr size_t s_txBufferCount = 2;
+
+    /**
+     * The state of a TX buffer is packed in a single word, so that producers can claim and release regions of it
+     * with a compare-and-swap instead of a lock:
+     *  <br>- bits 0-7: Number of regions reserved but not committed yet.
+     *  <br>- bits 8-23: Number of bytes reserved.
+     *  <br>- bits 24-31: Index of the buffer, only in txState.
+     */
+    static constexpr uint32_t s_writersMask = 0xFFUL;
+    static constexpr uint32_t s_offsetShift = 8;
+    static constexpr uint32_t s_offsetMask  = 0xFFFFUL;
+    static constexpr uint32_t s_indexShift  = 24;
+
+    static constexpr uint32_t writers(uint32_t state) { return state & s_writersMask; }
+    static constexpr uint32_t offset(uint32_t state) { return (state >> s_offsetShift) & s_offsetMask; }
+    static constexpr uint32_t index(uint32_t state) { return state >> s_indexShift; }
+
+    //! Number of USB frames (1 ms each) without any IN token before the host is considered to be gone.
+    static constexpr uint32_t s_staleAfterFrames = 5;
+
+    //! Received packets wait in a ring of slots until the USB worker task hands them to the application.
+    static constexpr size_t s_rxSlotCount = 8;
+    static constexpr size_t s_rxSlotSize  = DCDC_DATA_FS_OUT_PACKET_SIZE;
+    static_assert((s_rxSlotCount & (s_rxSlotCount - 1)) == 0, "s_rxSlotCount must be a power of two");
+    /**
+     * With double buffering, the peripheral can complete one more packet after the endpoint got NAKed. The HAL
+     * appends it to the packet of the last slot that was armed, spilling into the slot after it, so that slot must
+     * always be free: either the next slot of the ring, or a spare one after the end of the buffer.
+     */
+    using RxSlot = uint8_t[s_rxSlotSize];
+
     USBD_CDC_HandleTypeDef* handle = nullptr;
     const char*             logTag = nullptr;
     Logging::Level          logLevel;
-    uint8_t*                txBuffer     = nullptr;
-    size_t                  txBufferSize = 0;
-    uint8_t*                writeCursor  = nullptr;
-
-    uint8_t* rxBuffer     = nullptr;
-    size_t   rxBufferSize = 0;
-
-    size_t   lastFlushedTime    = 0;
-    uint32_t lastTxCompleteTime = 0;
+    uint8_t*                txBuffers[s_txBufferCount] = {};
+    size_t                  txBufferSize               = 0;    //!< Size of each of the TX buffers, at most 64 KiB.
+    std::atomic<uint32_t>   txState                    = 0;    //!< Buffer being filled by the producers.
+    std::atomic<uint32_t>   txSealed[s_txBufferCount]  = {};    //!< State of the buffers that are waiting to be sent.
+    size_t txPendingCount = 0;    //!< Buffers waiting to be sent, the oldest one is in flight. USB IRQ masked only.
+    //! DWT cycle count when the first region of each buffer was reserved, written by the producer that claimed it.
+    uint32_t txFirstReservedCycles[s_txBufferCount] = {};
+
+    RxSlot*               rxSlots                  = nullptr;    //!< s_rxSlotCount + 1 spare slot.
+    uint16_t              rxSlotLen[s_rxSlotCount] = {};
+    std::atomic<uint32_t> rxHead                   = 0;        //!< Next slot to be filled, only modified by the ISR.
+    std::atomic<uint32_t> rxTail                   = 0;        //!< Next slot to be read, only modified by the worker.
+    bool                  rxArmed                  = false;    //!< The OUT endpoint is waiting for a packet.
+
+    //! Consecutive USB frames during which an IN transfer stayed pending. Only touched by the USB interrupt.
+    uint32_t framesWithoutTxComplete = 0;
 
     CDC_onReceive_t onReceive   = [](CDC_DeviceInfo*, void*, const uint8_t*, size_t) {};
     void*           onReceiveUD = nullptr;
 
+    CDC_onTxRoom_t onTxRoom   = [](CDC_DeviceInfo*, void*, uint32_t) {};
+    void*          onTxRoomUD = nullptr;
+
     bool connected = false;
 
     /**
-     * We can't know for sure (through the existing API, afaik) whether an endpoint is being read or not, we
-     * can only make assumptions:
-     *  <br>- If we've never flushed, assume we're not stale
-     *  <br>- If the last TxCompleteTime is more recent than the lastFlushedTime, we definitely aren't stale
-     *  <br>- Since the host is supposed to poll the device every milliseconds, if the last TxCompleteTime is more than
-     * 5ms older than the lastFlushedTTime, we can maybe assume we're stale?
+     * A host that reads the endpoint sends IN tokens in every frame, so a transfer can't stay pending for long.
+     * If it does, nobody is listening on the other end (port closed, application hung, etc.)
      *
      * @returns True if we can assume that the Tx endpoint is stale
      * @returns False if we can assume that the Tx endpoint is not stale
      */
-    [[nodiscard]] bool isTxStale() const
+    [[nodiscard]] bool isTxStale() const { return framesWithoutTxComplete >= s_staleAfterFrames; }
+
+    [[nodiscard]] size_t oldestPendingIndex() const
     {
-        if (lastFlushedTime == 0) { return false; }
-        if (lastTxCompleteTime >= lastFlushedTime) { return false; }
-        if ((lastFlushedTime - lastTxCompleteTime) < 5) { return false; }
-        return true;
+        return (index(txState.load(std::memory_order_relaxed)) + s_txBufferCount - txPendingCount) % s_txBufferCount;
+    }
+
+    void resetTxBuffers()
+    {
+        txState.store(0, std::memory_order_relaxed);
+        for (auto& sealed : txSealed) {
+            sealed.store(0, std::memory_order_relaxed);
+        }
+        txPendingCount          = 0;
+        framesWithoutTxComplete = 0;
+    }
+
+    void resetRxSlots()
+    {
+        rxHead.store(0, std::memory_order_relaxed);
+        rxTail.store(0, std::memory_order_relaxed);
+        rxArmed = false;
     }
 };
 
 namespace {
-constexpr Logging::Level s_Frasylevel       = Logging::Level::debug;
-constexpr Logging::Level s_Debuglevel       = Logging::Level::debug;
-constexpr size_t         s_autoFlushAfterMs = 5;
+constexpr Logging::Level s_Frasylevel = Logging::Level::debug;
+constexpr Logging::Level s_Debuglevel = Logging::Level::debug;
 
-/* Define size for the receive and transmit buffer over CDC */
+/* Define size for the transmit buffer over CDC */
 /* It's up to user to redefine and/or remove those define */
-constexpr size_t s_frasyRxDataSize = 512;
-constexpr size_t s_frasyTxDataSize = 2048;
-constexpr size_t s_debugRxDataSize = 512;
-constexpr size_t s_debugTxDataSize = 1024;
+constexpr size_t s_frasyTxDataSize = 1024;    //!< Per buffer.
+constexpr size_t s_debugTxDataSize = 512;     //!< Per buffer.
 
 /* Create buffer for reception and transmission           */
 /* It's up to user to redefine and/or remove those define */
-/** Received data over USB are stored in this buffer      */
-uint8_t g_usbFrasyRxBuffer[s_frasyRxDataSize];
-uint8_t g_usbDebugRxBuffer[s_debugRxDataSize];
+/** Received data over USB are stored in these slots      */
+CDC_DeviceInfo::RxSlot g_usbFrasyRxSlots[CDC_DeviceInfo::s_rxSlotCount + 1];
+CDC_DeviceInfo::RxSlot g_usbDebugRxSlots[CDC_DeviceInfo::s_rxSlotCount + 1];
+
+constexpr size_t s_rxTaskStackSize = 384;
+constexpr size_t s_rxTaskPriority  = 6;
+TaskHandle_t     g_rxTask          = nullptr;
 
-/** Data to send over USB CDC are stored in this buffer   */
-uint8_t g_usbFrasyTxBuffer[s_frasyTxDataSize];
-uint8_t g_usbDebugTxBuffer[s_debugTxDataSize];
+/** Data to send over USB CDC are stored in these buffers */
+uint8_t g_usbFrasyTxBuffer[CDC_DeviceInfo::s_txBufferCount][s_frasyTxDataSize];
+uint8_t g_usbDebugTxBuffer[CDC_DeviceInfo::s_txBufferCount][s_debugTxDataSize];
 
 CDC_DeviceInfo& deviceFromCdc(USBD_CDC_HandleTypeDef* handle)
 {
@@ -198,6 +260,123 @@ CDC_DeviceInfo& deviceFromCdc(USBD_CDC_HandleTypeDef* handle)
     configASSERT(false && "Invalid CDC handle!");
 }
 
+/**
+ * Hands a buffer to the IN endpoint.
+ * @returns USBD_OK if the transfer started.
+ */
+uint8_t cdcTransmit(CDC_DeviceInfo& device, const uint8_t* buf, size_t len)
+{
+    if (device.handle == nullptr) { return USBD_FAIL; }
+    if (device.handle->TxState != 0) { return USBD_BUSY; }
+    USBD_DCDC_SetTxBuffer(&hUsbDeviceFS, device.handle, const_cast<uint8_t*>(buf), len);
+    return USBD_DCDC_TransmitPacket(&hUsbDeviceFS, device.handle);
+}
+
+/**
+ * Hands the buffer being filled over to the sender, the producers continue in the next one.
+ * The regions that are still being written to will be committed in txSealed.
+ *
+ * Must be called from the USB interrupt, or with it masked.
+ * @returns False if there's nothing to seal, or if every other buffer is waiting to be sent.
+ */
+bool cdcSealFillBuffer(CDC_DeviceInfo& device)
+{
+    if (device.txPendingCount == CDC_DeviceInfo::s_txBufferCount - 1) { return false; }
+    if (CDC_DeviceInfo::offset(device.txState.load(std::memory_order_relaxed)) == 0) { return false; }
+
+    // Nothing else can touch the index while the USB interrupt is masked, the producers only change the low bits.
+    uint32_t next  = (CDC_DeviceInfo::index(device.txState.load(std::memory_order_relaxed)) + 1) %
+                    CDC_DeviceInfo::s_txBufferCount;
+    uint32_t state = device.txState.exchange(next << CDC_DeviceInfo::s_indexShift, std::memory_order_acq_rel);
+    device.txSealed[CDC_DeviceInfo::index(state)].store(state & ((1UL << CDC_DeviceInfo::s_indexShift) - 1),
+                                                        std::memory_order_release);
+    ++device.txPendingCount;
+    return true;
+}
+
+/**
+ * Sends the oldest pending TX buffer if the endpoint is idle and all of its regions are committed.
+ *
+ * Must be called from the USB interrupt, or with it masked.
+ * @param flush If none are pending, send the buffer being filled instead of waiting for more data to coalesce.
+ * @returns USBD_OK if a transfer started or if there's nothing to send, USBD_BUSY if a transfer is in progress.
+ */
+uint8_t cdcStartNextTransfer(CDC_DeviceInfo& device, bool flush)
+{
+    if (device.handle == nullptr) { return USBD_FAIL; }
+    if (device.handle->TxState != 0) { return USBD_BUSY; }
+
+    if (device.txPendingCount == 0 && !(flush && cdcSealFillBuffer(device))) { return USBD_OK; }
+
+    size_t   oldest = device.oldestPendingIndex();
+    uint32_t sealed = device.txSealed[oldest].load(std::memory_order_acquire);
+    if (CDC_DeviceInfo::writers(sealed) != 0) {
+        // The last producer to commit will start the transfer.
+        return USBD_OK;
+    }
+
+    return cdcTransmit(device, device.txBuffers[oldest], CDC_DeviceInfo::offset(sealed));
+}
+
+/**
+ * Arms the OUT endpoint with the next free slot, as long as the receive ring has room for one more packet.
+ * Otherwise the endpoint stays NAKed until the worker releases a slot.
+ *
+ * Must be called from the USB interrupt, or with it masked.
+ */
+void cdcArmReceive(CDC_DeviceInfo& device)
+{
+    if (device.handle == nullptr || device.rxArmed) { return; }
+
+    uint32_t head = device.rxHead.load(std::memory_order_relaxed);
+    uint32_t tail = device.rxTail.load(std::memory_order_acquire);
+    // The slot after the armed one must stay free, see CDC_DeviceInfo::RxSlot.
+    if (head - tail >= CDC_DeviceInfo::s_rxSlotCount - 1) { return; }
+
+    USBD_DCDC_SetRxBuffer(&hUsbDeviceFS, device.handle, &device.rxSlots[head % CDC_DeviceInfo::s_rxSlotCount][0]);
+    device.rxArmed = USBD_DCDC_ReceivePacket(&hUsbDeviceFS, device.handle) == USBD_OK;
+}
+
+/**
+ * Hands the received packets to the application.
+ * @returns The number of packets that were handled.
+ */
+size_t cdcDrainRxSlots(CDC_DeviceInfo& device)
+{
+    uint32_t tail  = device.rxTail.load(std::memory_order_relaxed);
+    uint32_t head  = device.rxHead.load(std::memory_order_acquire);
+    size_t   count = head - tail;
+
+    for (; tail != head; ++tail) {
+        size_t   index = tail % CDC_DeviceInfo::s_rxSlotCount;
+        uint8_t* data  = &device.rxSlots[index][0];
+        size_t   len   = device.rxSlotLen[index];
+
+        device.onReceive(&device, device.onReceiveUD, data, len);
+        LOGD(device.logTag, "Received %d bytes", len);
+        LOG_BUFFER_HEXDUMP_LEVEL(g_usbDebugTag, Logging::Level::trace, data, len);
+
+        device.rxTail.store(tail + 1, std::memory_order_release);
+    }
+
+    if (count != 0) {
+        // The endpoint might have run out of slots.
+        taskENTER_CRITICAL();
+        cdcArmReceive(device);
+        taskEXIT_CRITICAL();
+    }
+
+    return count;
+}
+
+[[noreturn]] void cdcRxTask([[maybe_unused]] void* args)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (cdcDrainRxSlots(g_usbFrasy) + cdcDrainRxSlots(g_usbDebug) != 0) {}
+    }
+}
+
 constexpr const char* cdcCmdToStr(uint8_t cmd)
 {
     switch (cmd) {
@@ -252,22 +431,18 @@ CDC_DeviceInfo g_usbFrasy {
   .handle       = &((USBD_DCDC_HandleTypeDef*)hUsbDeviceFS.pClassData)->frasyCdc,
   .logTag       = g_usbFrasyTag,
   .logLevel     = Logging::Level::info,
-  .txBuffer     = &g_usbFrasyTxBuffer[0],
+  .txBuffers    = {&g_usbFrasyTxBuffer[0][0], &g_usbFrasyTxBuffer[1][0]},
   .txBufferSize = s_frasyTxDataSize,
-  .writeCursor  = &g_usbFrasyTxBuffer[0],
-  .rxBuffer     = &g_usbFrasyRxBuffer[0],
-  .rxBufferSize = s_frasyRxDataSize,
+  .rxSlots      = &g_usbFrasyRxSlots[0],
 };
 
 CDC_DeviceInfo g_usbDebug {
   .handle       = &((USBD_DCDC_HandleTypeDef*)hUsbDeviceFS.pClassData)->debugCdc,
   .logTag       = g_usbDebugTag,
   .logLevel     = Logging::Level::info,
-  .txBuffer     = &g_usbDebugTxBuffer[0],
+  .txBuffers    = {&g_usbDebugTxBuffer[0][0], &g_usbDebugTxBuffer[1][0]},
   .txBufferSize = s_debugTxDataSize,
-  .writeCursor  = &g_usbDebugTxBuffer[0],
-  .rxBuffer     = &g_usbDebugRxBuffer[0],
-  .rxBufferSize = s_debugRxDataSize,
+  .rxSlots      = &g_usbDebugRxSlots[0],
 };
 /* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
 
@@ -275,7 +450,7 @@ CDC_DeviceInfo g_usbDebug {
  * @}
  */
 
-USBD_DCDC_ItfTypeDef g_usbdInterfaceFopsFs = {cdcInitFs, cdcDeInitFs, cdcControlFs, cdcReceiveFs};
+USBD_DCDC_ItfTypeDef g_usbdInterfaceFopsFs = {cdcInitFs, cdcDeInitFs, cdcControlFs, cdcReceiveFs, cdcTransmitCpltFs};
 
 /* Private functions ---------------------------------------------------------*/
 /**
@@ -291,8 +466,12 @@ static int8_t cdcInitFs(USBD_CDC_HandleTypeDef* cdc)
     if (&hcdc->debugCdc == cdc) { g_usbDebug.handle = cdc; }
 
     auto& device = deviceFromCdc(cdc);
-    USBD_DCDC_SetTxBuffer(&hUsbDeviceFS, cdc, &device.txBuffer[0], 0);
-    USBD_DCDC_SetRxBuffer(&hUsbDeviceFS, cdc, &device.rxBuffer[0]);
+    device.resetTxBuffers();
+    device.resetRxSlots();
+    USBD_DCDC_SetTxBuffer(&hUsbDeviceFS, cdc, device.txBuffers[0], 0);
+    USBD_DCDC_SetRxBuffer(&hUsbDeviceFS, cdc, &device.rxSlots[0][0]);
+    // The class arms the OUT endpoint with that slot once every interface is initialized.
+    device.rxArmed = true;
     Logging::Logger::setLevel(device.logTag, device.logLevel);
     LOGI(device.logTag, "Initialized endpoints");
 
@@ -307,10 +486,10 @@ static int8_t cdcInitFs(USBD_CDC_HandleTypeDef* cdc)
 static int8_t cdcDeInitFs([[maybe_unused]] USBD_CDC_HandleTypeDef* cdc)
 {
     /* USER CODE BEGIN 4 */
-    auto& device              = deviceFromCdc(cdc);
-    device.handle             = nullptr;
-    device.lastFlushedTime    = 0;
-    device.lastTxCompleteTime = 0;
+    auto& device  = deviceFromCdc(cdc);
+    device.handle = nullptr;
+    device.resetTxBuffers();
+    device.resetRxSlots();
     LOGI(device.logTag, "De-initialized");
 
     return (USBD_OK);
@@ -377,43 +556,81 @@ static int8_t cdcControlFs(USBD_CDC_HandleTypeDef* cdc, uint8_t cmd, uint8_t* pb
  *         through this function.
  *
  *         @note
- *         This function will block any OUT packet reception on USB endpoint
- *         until exiting this function. If you exit this function before transfer
- *         is complete on CDC interface (ie. using DMA controller) it will result
- *         in receiving more data while previous ones are still not sent.
+ *         Called from the USB interrupt. The packet stays in its slot until the USB
+ *         worker task hands it to the application, the endpoint is re-armed with the
+ *         next slot right away, and only NAKs once all of the slots are taken.
  *
  * @param  pbuf: Buffer of data to be received
  * @param  len: Number of data received (in bytes)
  * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
  */
-static int8_t cdcReceiveFs(USBD_CDC_HandleTypeDef* cdc, uint8_t* pbuf, uint32_t* len)
+static int8_t cdcReceiveFs(USBD_CDC_HandleTypeDef* cdc, [[maybe_unused]] uint8_t* pbuf, uint32_t* len)
 {
     /* USER CODE BEGIN 6 */
-    //    USBD_DCDC_HandleTypeDef* hcdc = (USBD_DCDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
-    //    if (&hcdc->frasyCdc == cdc) { CDC_Transmit_FS(&hcdc->frasyCdc, pbuf, *len); }
-    //    if (&hcdc->debugCdc == cdc) { CDC_Transmit_FS(&hcdc->debugCdc, pbuf, *len); }
+    auto&    device = deviceFromCdc(cdc);
+    uint32_t head   = device.rxHead.load(std::memory_order_relaxed);
+    uint8_t* slot   = &device.rxSlots[head % CDC_DeviceInfo::s_rxSlotCount][0];
+    uint32_t length = *len;
+    if (!device.rxArmed) {
+        // Completed by the peripheral after the endpoint ran out of slots. The HAL appended it to the packet of the
+        // last slot and counts both in len, it spilled into the free slot after it, or into the spare slot when the
+        // last one is at the end of the ring. Move it to the start of the free slot.
+        uint8_t* last    = &device.rxSlots[(head - 1) % CDC_DeviceInfo::s_rxSlotCount][0];
+        uint32_t lastLen = device.rxSlotLen[(head - 1) % CDC_DeviceInfo::s_rxSlotCount];
+        if (length <= lastLen) { return (USBD_OK); }
+        length -= lastLen;
+        std::memmove(slot, last + lastLen, length);
+    }
 
-    auto& device = deviceFromCdc(cdc);
-    device.onReceive(&device, device.onReceiveUD, pbuf, *len);
+    // Only store the packet, the worker task hands it to the application.
+    device.rxSlotLen[head % CDC_DeviceInfo::s_rxSlotCount] = static_cast<uint16_t>(length);
+    device.rxHead.store(head + 1, std::memory_order_release);
+    device.rxArmed = false;
 
-    if (auto status = USBD_DCDC_SetRxBuffer(&hUsbDeviceFS, device.handle, &device.rxBuffer[0]); status != USBD_OK) {
-        LOGE(device.logTag,
-             "Unable to set rx buffer: (%#02x) %s",
-             status,
-             usbStatusToStr(static_cast<USBD_StatusTypeDef>(status)));
+    // Accept the next packet right away while there are slots left.
+    cdcArmReceive(device);
+
+    if (g_rxTask != nullptr) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(g_rxTask, &woken);
+        portYIELD_FROM_ISR(woken);
     }
-    if (auto status = USBD_DCDC_ReceivePacket(&hUsbDeviceFS, device.handle); status != USBD_OK) {
-        LOGE(device.logTag,
-             "Unable to receive packet: (%#02x) %s",
-             status,
-             usbStatusToStr(static_cast<USBD_StatusTypeDef>(status)));
+
+    return (USBD_OK);
+    /* USER CODE END 6 */
+}
+
+/**
+ * @brief  Called from the USB interrupt once an IN transfer completed.
+ * @param  pbuf: Buffer that was sent
+ * @param  len: Number of bytes sent
+ * @retval Result of the operation: USBD_OK if all operations are OK else USBD_FAIL
+ */
+static int8_t cdcTransmitCpltFs(USBD_CDC_HandleTypeDef* cdc, uint8_t* pbuf, [[maybe_unused]] uint32_t* len)
+{
+    /* USER CODE BEGIN 13 */
+    auto& device = deviceFromCdc(cdc);
+
+    // The transfer could have been started with CDC_Transmit_FS, in which case none of our buffers got freed.
+    bool     freed               = false;
+    uint32_t firstReservedCycles = 0;
+    if (device.txPendingCount != 0 && pbuf == device.txBuffers[device.oldestPendingIndex()]) {
+        firstReservedCycles = device.txFirstReservedCycles[device.oldestPendingIndex()];
+        device.txSealed[device.oldestPendingIndex()].store(0, std::memory_order_relaxed);
+        --device.txPendingCount;
+        freed = true;
     }
 
-    LOGD(device.logTag, "Received %d bytes", *len);
-    LOG_BUFFER_HEXDUMP_LEVEL(g_usbDebugTag, Logging::Level::trace, pbuf, *len);
+    device.framesWithoutTxComplete = 0;
+
+    // Full buffers go out right away, the rest waits for the next frame so that it can be coalesced.
+    cdcStartNextTransfer(device, false);
+
+    // Producers that ran out of room can go on.
+    if (freed) { device.onTxRoom(&device, device.onTxRoomUD, firstReservedCycles); }
 
     return (USBD_OK);
-    /* USER CODE END 6 */
+    /* USER CODE END 13 */
 }
 
 /**
@@ -431,16 +648,15 @@ uint8_t CDC_Transmit_FS(CDC_DeviceInfo* device, const uint8_t* buf, uint16_t len
 {
     uint8_t result = USBD_OK;
     /* USER CODE BEGIN 7 */
-    if (device->handle->TxState != 0) { return USBD_BUSY; }
-    USBD_DCDC_SetTxBuffer(&hUsbDeviceFS, device->handle, const_cast<uint8_t*>(buf), len);
-    result = USBD_DCDC_TransmitPacket(&hUsbDeviceFS, device->handle);
-    if (result != USBD_OK) {
+    UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+    result           = cdcTransmit(*device, buf, len);
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+    if (result != USBD_OK && result != USBD_BUSY) {
         LOGE(device->logTag,
              "Unable to transmit packet: (%#02x) %s",
              result,
              usbStatusToStr(static_cast<USBD_StatusTypeDef>(result)));
     }
-    device->lastFlushedTime = HAL_GetTick();
     /* USER CODE END 7 */
     return result;
 }
@@ -452,6 +668,16 @@ void CDC_InitLoggers(void)
     Logging::Logger::setLevel(g_usbDebug.logTag, g_usbDebug.logLevel);
 }
 
+void CDC_StartRxTask(void)
+{
+    configASSERT(g_rxTask == nullptr);
+    auto res = xTaskCreate(&cdcRxTask, "usb_rx", s_rxTaskStackSize, nullptr, s_rxTaskPriority, &g_rxTask);
+    configASSERT(res == pdPASS);
+
+    // Packets might have arrived before the task existed.
+    xTaskNotifyGive(g_rxTask);
+}
+
 void CDC_SetOnReceived(CDC_DeviceInfo* device, CDC_onReceive_t onReceive, void* userData)
 {
     configASSERT(device != nullptr);
@@ -461,6 +687,17 @@ void CDC_SetOnReceived(CDC_DeviceInfo* device, CDC_onReceive_t onReceive, void*
     device->onReceiveUD = userData;
 }
 
+void CDC_SetOnTxRoom(CDC_DeviceInfo* device, CDC_onTxRoom_t onTxRoom, void* userData)
+{
+    configASSERT(device != nullptr);
+    configASSERT(onTxRoom != nullptr);
+
+    UBaseType_t mask   = taskENTER_CRITICAL_FROM_ISR();
+    device->onTxRoom   = onTxRoom;
+    device->onTxRoomUD = userData;
+    taskEXIT_CRITICAL_FROM_ISR(mask);
+}
+
 bool CDC_IsConnected(CDC_DeviceInfo* device)
 {
     return device->handle != nullptr && device->connected && !device->isTxStale();
@@ -473,7 +710,7 @@ bool CDC_IsBusy(CDC_DeviceInfo* device)
 
 size_t CDC_GetRxBufferSize(CDC_DeviceInfo* device)
 {
-    return device->rxBufferSize;
+    return CDC_DeviceInfo::s_rxSlotCount * CDC_DeviceInfo::s_rxSlotSize;
 }
 
 size_t CDC_GetTxBufferSize(CDC_DeviceInfo* device)
@@ -483,7 +720,7 @@ size_t CDC_GetTxBufferSize(CDC_DeviceInfo* device)
 
 size_t CDC_GetTxBufferTakenSize(CDC_DeviceInfo* device)
 {
-    return std::distance(&device->txBuffer[0], device->writeCursor);
+    return CDC_DeviceInfo::offset(device->txState.load(std::memory_order_relaxed));
 }
 
 size_t CDC_GetTxBufferAvailableSize(CDC_DeviceInfo* device)
@@ -491,35 +728,101 @@ size_t CDC_GetTxBufferAvailableSize(CDC_DeviceInfo* device)
     return device->txBufferSize - CDC_GetTxBufferTakenSize(device);
 }
 
-size_t CDC_Queue(CDC_DeviceInfo* device, const uint8_t* buf, size_t len)
+bool CDC_Reserve(CDC_DeviceInfo* device, size_t len, CDC_Reservation* reservation)
 {
-    if (CDC_IsBusy(device) || CDC_GetTxBufferAvailableSize(device) < len) {
-        // not enough room, send the buffer.
-        CDC_SendQueue(device);
-        return 0;
+    configASSERT(reservation != nullptr);
+    if (len == 0 || len > device->txBufferSize) { return false; }
+
+    uint32_t state = device->txState.load(std::memory_order_relaxed);
+    while (true) {
+        if (CDC_DeviceInfo::offset(state) + len <= device->txBufferSize &&
+            CDC_DeviceInfo::writers(state) != CDC_DeviceInfo::s_writersMask) {
+            // Claim the region and register as a writer of the buffer at once.
+            uint32_t claimed = state + (len << CDC_DeviceInfo::s_offsetShift) + 1;
+            if (device->txState.compare_exchange_weak(
+                  state, claimed, std::memory_order_acquire, std::memory_order_relaxed)) {
+                reservation->data   = device->txBuffers[CDC_DeviceInfo::index(state)] + CDC_DeviceInfo::offset(state);
+                reservation->len    = len;
+                reservation->buffer = static_cast<uint8_t>(CDC_DeviceInfo::index(state));
+                // Committing happens after this, so the stamp is visible once the buffer gets sent.
+                if (CDC_DeviceInfo::offset(state) == 0) {
+                    device->txFirstReservedCycles[reservation->buffer] = DWT->CYCCNT;
+                }
+                return true;
+            }
+            continue;
+        }
+
+        // Not enough room, continue in the next buffer. Another producer might have done it in the mean time.
+        UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+        bool        hasRoom = device->txState.load(std::memory_order_relaxed) != state || cdcSealFillBuffer(*device);
+        if (hasRoom) { cdcStartNextTransfer(*device, false); }
+        taskEXIT_CRITICAL_FROM_ISR(mask);
+
+        if (!hasRoom) {
+            // Every other buffer is waiting to be sent.
+            return false;
+        }
+        state = device->txState.load(std::memory_order_relaxed);
     }
+}
 
-    device->writeCursor = std::copy(buf, buf + len, device->writeCursor);
+void CDC_Commit(CDC_DeviceInfo* device, const CDC_Reservation* reservation)
+{
+    configASSERT(reservation != nullptr);
+
+    uint32_t state = device->txState.load(std::memory_order_relaxed);
+    while (CDC_DeviceInfo::index(state) == reservation->buffer) {
+        // Still being filled, it goes out with the next start of frame.
+        if (device->txState.compare_exchange_weak(state, state - 1, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
 
-    // We haven't flushed in a while, or we've just never flushed.
-    if ((HAL_GetTick() >= device->lastFlushedTime + s_autoFlushAfterMs) || device->lastFlushedTime == 0) {
-        CDC_SendQueue(device);
+    // The buffer got sealed, it can only be sent once all of its writers are done.
+    uint32_t sealed = device->txSealed[reservation->buffer].fetch_sub(1, std::memory_order_acq_rel);
+    if (CDC_DeviceInfo::writers(sealed) == 1 && device->handle != nullptr && device->handle->TxState == 0) {
+        // If a transfer is in progress, its completion will pick the data up.
+        UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+        cdcStartNextTransfer(*device, false);
+        taskEXIT_CRITICAL_FROM_ISR(mask);
     }
+}
+
+size_t CDC_Queue(CDC_DeviceInfo* device, const uint8_t* buf, size_t len)
+{
+    CDC_Reservation reservation;
+    if (!CDC_Reserve(device, len, &reservation)) { return 0; }
 
+    std::copy(buf, buf + len, reservation.data);
+    CDC_Commit(device, &reservation);
     return len;
 }
 
 uint8_t CDC_SendQueue(CDC_DeviceInfo* device)
 {
-    auto res = CDC_Transmit_FS(device, &device->txBuffer[0], CDC_GetTxBufferTakenSize(device));
-    if (res == USBD_OK) { device->writeCursor = &device->txBuffer[0]; }
+    UBaseType_t mask = taskENTER_CRITICAL_FROM_ISR();
+    auto        res  = cdcStartNextTransfer(*device, true);
+    taskEXIT_CRITICAL_FROM_ISR(mask);
     return res;
 }
 
-void CDCInternal_SetLastTxCompleteTimestamp(uint32_t timestamp, uint8_t endpoint)
+void CDCInternal_OnStartOfFrame(void)
 {
-    if (endpoint == 1) { g_usbFrasy.lastTxCompleteTime = timestamp; }
-    if (endpoint == 2) { g_usbDebug.lastTxCompleteTime = timestamp; }
+    for (CDC_DeviceInfo* device : {&g_usbFrasy, &g_usbDebug}) {
+        if (device->handle == nullptr) { continue; }
+
+        if (device->handle->TxState != 0) {
+            // The host didn't take the data sent during the previous frame.
+            if (device->framesWithoutTxComplete < CDC_DeviceInfo::s_staleAfterFrames) {
+                ++device->framesWithoutTxComplete;
+            }
+            continue;
+        }
+
+        // Whatever accumulated during the previous frame goes out in this one.
+        cdcStartNextTransfer(*device, true);
+    }
 }
 
 void CDCInternal_SetConnectedState(CDC_DeviceInfo* device, bool state)
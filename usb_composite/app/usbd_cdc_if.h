@@ -67,7 +67,7 @@ extern "C" {
 typedef struct CDC_DeviceInfo CDC_DeviceInfo;
 
 /**
- * Function called upon receiving data on a USB endpoint.
+ * Function called upon receiving data on a USB endpoint, from the USB worker task (see CDC_StartRxTask).
  *
  * CDC_DeviceInfo*: Pointer to the device that received the data.
  * void*: User Data.
@@ -76,6 +76,25 @@ typedef struct CDC_DeviceInfo CDC_DeviceInfo;
  */
 typedef void (*CDC_onReceive_t)(CDC_DeviceInfo*, void*, const uint8_t*, size_t);
 
+/**
+ * Function called once a TX buffer got sent and is free again, from the USB interrupt.
+ * A CDC_Reserve that failed before this is worth retrying.
+ *
+ * CDC_DeviceInfo*: Pointer to the device that sent the data.
+ * void*: User Data.
+ * uint32_t: DWT cycle count when the first region of the buffer was reserved, to trace the latency of the data.
+ */
+typedef void (*CDC_onTxRoom_t)(CDC_DeviceInfo*, void*, uint32_t);
+
+/**
+ * Region of a TX buffer claimed with CDC_Reserve.
+ */
+typedef struct {
+    uint8_t* data;      //!< Where to write the data.
+    size_t   len;       //!< Number of bytes that must be written.
+    uint8_t  buffer;    //!< TX buffer that contains the region.
+} CDC_Reservation;
+
 /* USER CODE END EXPORTED_TYPES */
 
 /**
@@ -134,36 +153,62 @@ uint8_t CDC_Transmit_FS(CDC_DeviceInfo* device, const uint8_t* buf, uint16_t len
 
 /* USER CODE BEGIN EXPORTED_FUNCTIONS */
 void CDC_InitLoggers(void);
+/**
+ * Starts the task that hands the received packets to the onReceive callbacks.
+ * Until then, the packets accumulate and the OUT endpoints get NAKed once they are full.
+ */
+void CDC_StartRxTask(void);
 void CDC_SetOnReceived(CDC_DeviceInfo* device, CDC_onReceive_t onReceive, void* userData);
+void CDC_SetOnTxRoom(CDC_DeviceInfo* device, CDC_onTxRoom_t onTxRoom, void* userData);
 
 bool CDC_IsConnected(CDC_DeviceInfo* device);
 bool CDC_IsBusy(CDC_DeviceInfo* device);
 
 size_t CDC_GetRxBufferSize(CDC_DeviceInfo* device);
 
-size_t CDC_GetTxBufferSize(CDC_DeviceInfo* device);
+size_t CDC_GetTxBufferSize(CDC_DeviceInfo* device);    //!< Size of each of the TX buffers.
 size_t CDC_GetTxBufferTakenSize(CDC_DeviceInfo* device);
 size_t CDC_GetTxBufferAvailableSize(CDC_DeviceInfo* device);
 /**
- * Adds data to the TX queue.
+ * Claims a region of the TX queue, so that the data can be written directly in it.
  *
- * Automatically schedules the buffer to be sent when full, or when a message bigger than the space available tries to
- * be added.
+ * Any number of tasks and interrupts can have reservations at the same time. Nothing in the TX buffer containing the
+ * region gets sent until it is committed with CDC_Commit, which must be done promptly.
+ * Safe to call from an interrupt.
+ * @param device
+ * @param len Number of bytes to claim, at most CDC_GetTxBufferSize.
+ * @param reservation Filled with the region.
+ * @return False if all of the TX buffers are full.
+ */
+bool CDC_Reserve(CDC_DeviceInfo* device, size_t len, CDC_Reservation* reservation);
+/**
+ * Releases a region obtained with CDC_Reserve, once all of its bytes have been written.
+ *
+ * The data accumulates in the TX buffer, which gets sent at the next start of frame, or as soon as it is full.
+ * Safe to call from an interrupt.
+ */
+void CDC_Commit(CDC_DeviceInfo* device, const CDC_Reservation* reservation);
+/**
+ * Copies data in the TX queue, see CDC_Reserve and CDC_Commit.
+ * Safe to call from an interrupt.
  * @param device
  * @param buf
  * @param len
- * @return Number of bytes written to the queue, 0 on error.
+ * @return Number of bytes written to the queue, 0 if all of the TX buffers are full.
  */
 size_t CDC_Queue(CDC_DeviceInfo* device, const uint8_t* buf, size_t len);
 /**
- * Transmit all queued data.
+ * Transmit all queued data without waiting for the next start of frame.
  * @param device
- * @return
+ * @return USBD_OK if the data is being sent, USBD_BUSY if it will be once the current transfer completes.
  */
 uint8_t CDC_SendQueue(CDC_DeviceInfo* device);
 
 
-void CDCInternal_SetLastTxCompleteTimestamp(uint32_t timestamp, uint8_t endpoint);
+/**
+ * Flushes the TX queues and keeps track of the host's activity, must be called from the USB SOF interrupt.
+ */
+void CDCInternal_OnStartOfFrame(void);
 void CDCInternal_SetConnectedState(CDC_DeviceInfo* device, bool state);
 
 inline const char* usbdResToStr(USBD_StatusTypeDef res)
@@ -0,0 +1,404 @@
+/* USER CODE BEGIN Header */
+/**
+ ******************************************************************************
+ * @file           : usbd_gs_if.cpp
+ * @brief          : Binary CAN interface, speaking the gs_usb protocol.
+ ******************************************************************************
+ * @attention
+ *
+ * The host configures the channel with vendor requests on EP0, then exchanges GS_HostFrame on the bulk endpoints,
+ * one frame per transfer.
+ *
+ ******************************************************************************
+ */
+/* USER CODE END Header */
+
+/* Includes ------------------------------------------------------------------*/
+#include "usbd_gs_if.h"
+
+/* USER CODE BEGIN INCLUDE */
+#include "timestamp.h"
+#include "vendor/logging/logger.h"
+
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/* USER CODE END INCLUDE */
+
+/* USER CODE BEGIN PRIVATE_TYPES */
+namespace {
+//! Vendor requests, in bRequest.
+enum class Request : uint8_t {
+    HostFormat   = 0,
+    BitTiming    = 1,
+    Mode         = 2,
+    BusError     = 3,
+    BitTimingCst = 4,
+    DeviceConfig = 5,
+    Timestamp    = 6,
+    Identify     = 7,
+};
+
+//! Values of DeviceMode::mode.
+enum class ModeCmd : uint32_t {
+    Reset = 0,
+    Start = 1,
+};
+
+struct [[gnu::packed]] DeviceConfig {
+    uint8_t  reserved[3];
+    uint8_t  interfaceCount;    //!< Number of channels minus one.
+    uint32_t swVersion;
+    uint32_t hwVersion;
+};
+
+struct [[gnu::packed]] DeviceMode {
+    uint32_t mode;
+    uint32_t flags;
+};
+
+struct [[gnu::packed]] BitTiming {
+    uint32_t propSeg;
+    uint32_t phaseSeg1;
+    uint32_t phaseSeg2;
+    uint32_t sjw;
+    uint32_t brp;
+};
+
+struct [[gnu::packed]] BitTimingConst {
+    uint32_t feature;
+    uint32_t fclkCan;
+    uint32_t tseg1Min;
+    uint32_t tseg1Max;
+    uint32_t tseg2Min;
+    uint32_t tseg2Max;
+    uint32_t sjwMax;
+    uint32_t brpMin;
+    uint32_t brpMax;
+    uint32_t brpInc;
+};
+}    // namespace
+/* USER CODE END PRIVATE_TYPES */
+
+/* USER CODE BEGIN PRIVATE_VARIABLES */
+extern "C" USBD_HandleTypeDef hUsbDeviceFS;
+
+namespace {
+constexpr const char*    s_tag   = "USB_GS";
+constexpr Logging::Level s_level = Logging::Level::info;
+
+constexpr uint32_t s_swVersion = 2;
+constexpr uint32_t s_hwVersion = 1;
+
+//! Frames waiting to be sent, must be a power of two.
+constexpr size_t s_txQueueSize = 32;
+
+// Written by the tasks with the USB interrupt masked, read by the USB interrupt.
+GS_HostFrame g_txQueue[s_txQueueSize]        = {};
+uint32_t     g_txQueuedCycles[s_txQueueSize] = {};       //!< DWT cycle count when each frame was queued.
+uint32_t     g_txHead                        = 0;        //!< Next frame to be queued.
+uint32_t     g_txTail                        = 0;        //!< Frame being sent, if g_txInFlight.
+bool         g_txInFlight                    = false;    //!< The frame at g_txTail is in the endpoint.
+size_t       g_txDropped                     = 0;
+
+uint8_t       g_channelCount                 = 1;
+volatile bool g_started[GS_MAX_CHANNELS]    = {};
+volatile bool g_timestamps[GS_MAX_CHANNELS] = {};    //!< The host enabled GS_CAN_FEATURE_HW_TIMESTAMP.
+
+GS_onFrame_t g_onFrame         = nullptr;
+void*        g_onFrameUserData = nullptr;
+
+GS_onModeChanged_t g_onModeChanged         = nullptr;
+void*              g_onModeChangedUserData = nullptr;
+
+GS_onFrameSent_t g_onFrameSent         = nullptr;
+void*            g_onFrameSentUserData = nullptr;
+}    // namespace
+/* USER CODE END PRIVATE_VARIABLES */
+
+/* USER CODE BEGIN PRIVATE_FUNCTIONS_DECLARATION */
+static int8_t gsInitFs(void);
+static int8_t gsControlFs(uint8_t request, uint16_t value, uint8_t* pbuf, uint16_t* length);
+static int8_t gsReceiveFs(uint8_t* buf, uint32_t len);
+static int8_t gsTransmitCpltFs(void);
+
+static void gsStartNextTransfer(void);
+static void gsFlushTxQueue(void);
+static bool gsIsAnyStarted(void);
+static void gsNotifyModeChanged(uint8_t channel);
+/* USER CODE END PRIVATE_FUNCTIONS_DECLARATION */
+
+USBD_DCDC_GsItfTypeDef g_usbdGsFopsFs = {gsInitFs, gsControlFs, gsReceiveFs, gsTransmitCpltFs};
+
+/* Private functions ---------------------------------------------------------*/
+/**
+ * @brief  Called every time the host configures the device.
+ * @retval USBD_OK
+ */
+static int8_t gsInitFs(void)
+{
+    /* USER CODE BEGIN 3 */
+    // Whatever was in flight died with the previous configuration, no transfer complete will release it.
+    for (uint8_t channel = 0; channel < g_channelCount; channel++) {
+        g_started[channel] = false;
+        gsNotifyModeChanged(channel);
+    }
+    g_txInFlight = false;
+    gsFlushTxQueue();
+    Logging::Logger::setLevel(s_tag, s_level);
+    return USBD_OK;
+    /* USER CODE END 3 */
+}
+
+/**
+ * @brief  Handles the vendor requests, from the USB interrupt.
+ * @param  request: bRequest
+ * @param  value: wValue, the channel
+ * @param  pbuf: Data stage
+ * @param  length: wLength on entry, number of bytes to send back on return for the IN requests
+ * @retval USBD_OK, or USBD_FAIL to stall the request
+ */
+static int8_t gsControlFs(uint8_t request, uint16_t value, uint8_t* pbuf, uint16_t* length)
+{
+    /* USER CODE BEGIN 5 */
+    // The host format is sent before the channel is known.
+    if (value >= g_channelCount && static_cast<Request>(request) != Request::HostFormat) { return USBD_FAIL; }
+
+    switch (static_cast<Request>(request)) {
+        // The host announces its byte order with 0x0000beef, everything here is little endian like the host.
+        case Request::HostFormat:
+        case Request::BusError:
+        case Request::Identify: return USBD_OK;
+        case Request::BitTiming:
+        {
+            if (*length < sizeof(BitTiming)) { return USBD_FAIL; }
+            BitTiming timing;
+            std::memcpy(&timing, pbuf, sizeof(timing));
+            // The nominal bit timing is owned by the CANopen stack, the bus keeps running at its rate.
+            LOGI(s_tag,
+                 "Host asked for brp %lu, tseg1 %lu, tseg2 %lu, sjw %lu; keeping the current bit timing",
+                 static_cast<unsigned long>(timing.brp),
+                 static_cast<unsigned long>(timing.propSeg + timing.phaseSeg1),
+                 static_cast<unsigned long>(timing.phaseSeg2),
+                 static_cast<unsigned long>(timing.sjw));
+            return USBD_OK;
+        }
+        case Request::Mode:
+        {
+            if (*length < sizeof(DeviceMode)) { return USBD_FAIL; }
+            DeviceMode mode;
+            std::memcpy(&mode, pbuf, sizeof(mode));
+            if (static_cast<ModeCmd>(mode.mode) == ModeCmd::Start) {
+                if (!gsIsAnyStarted()) { g_txDropped = 0; }
+                g_timestamps[value] = (mode.flags & GS_CAN_FEATURE_HW_TIMESTAMP) != 0;
+                g_started[value]    = true;
+            }
+            else {
+                g_started[value] = false;
+                // The frames of the other channels are still wanted.
+                if (!gsIsAnyStarted()) { gsFlushTxQueue(); }
+            }
+            LOGI(s_tag,
+                 "Channel %d %s%s",
+                 value,
+                 g_started[value] ? "started" : "reset",
+                 g_timestamps[value] ? ", with timestamps" : "");
+            gsNotifyModeChanged(value);
+            return USBD_OK;
+        }
+        case Request::BitTimingCst:
+        {
+            // Nominal bit timing ranges of the FDCAN peripheral.
+            BitTimingConst bt = {
+              .feature  = GS_CAN_FEATURE_HW_TIMESTAMP,
+              .fclkCan  = HAL_RCCEx_GetPeriphCLKFreq(RCC_PERIPHCLK_FDCAN),
+              .tseg1Min = 1,
+              .tseg1Max = 256,
+              .tseg2Min = 1,
+              .tseg2Max = 128,
+              .sjwMax   = 128,
+              .brpMin   = 1,
+              .brpMax   = 512,
+              .brpInc   = 1,
+            };
+            *length = std::min<uint16_t>(*length, sizeof(bt));
+            std::memcpy(pbuf, &bt, *length);
+            return USBD_OK;
+        }
+        case Request::DeviceConfig:
+        {
+            DeviceConfig config = {
+              .reserved       = {},
+              .interfaceCount = static_cast<uint8_t>(g_channelCount - 1),
+              .swVersion      = s_swVersion,
+              .hwVersion      = s_hwVersion,
+            };
+            *length = std::min<uint16_t>(*length, sizeof(config));
+            std::memcpy(pbuf, &config, *length);
+            return USBD_OK;
+        }
+        case Request::Timestamp:
+        {
+            // Lets the host match the timestamps of the frames with its own clock.
+            uint32_t now = Timestamp::nowUs();
+            *length      = std::min<uint16_t>(*length, sizeof(now));
+            std::memcpy(pbuf, &now, *length);
+            return USBD_OK;
+        }
+        default: return USBD_FAIL;
+    }
+    /* USER CODE END 5 */
+}
+
+/**
+ * @brief  Hands a frame received from the host to the application, from the USB interrupt.
+ * @param  buf: The frame
+ * @param  len: Number of bytes received
+ * @retval USBD_OK
+ */
+static int8_t gsReceiveFs(uint8_t* buf, uint32_t len)
+{
+    /* USER CODE BEGIN 6 */
+    if (len < GS_HOST_FRAME_SIZE_NO_TS || g_onFrame == nullptr) { return USBD_OK; }
+
+    GS_HostFrame frame = {};
+    std::memcpy(&frame, buf, GS_HOST_FRAME_SIZE_NO_TS);
+    if (frame.channel >= g_channelCount || !g_started[frame.channel] || frame.can_dlc > sizeof(frame.data)) {
+        return USBD_OK;
+    }
+
+    g_onFrame(g_onFrameUserData, &frame);
+    return USBD_OK;
+    /* USER CODE END 6 */
+}
+
+/**
+ * @brief  Called once the frame at the tail of the TX queue was sent, from the USB interrupt.
+ * @retval USBD_OK
+ */
+static int8_t gsTransmitCpltFs(void)
+{
+    /* USER CODE BEGIN 13 */
+    if (g_txInFlight) {
+        g_txInFlight = false;
+        if (g_onFrameSent != nullptr) {
+            g_onFrameSent(g_onFrameSentUserData, g_txQueuedCycles[g_txTail % s_txQueueSize]);
+        }
+        ++g_txTail;
+    }
+    gsStartNextTransfer();
+    return USBD_OK;
+    /* USER CODE END 13 */
+}
+
+/* USER CODE BEGIN PRIVATE_FUNCTIONS_IMPLEMENTATION */
+/**
+ * Puts the oldest frame in the IN endpoint, if it's free. Must be called with the USB interrupt masked.
+ */
+static void gsStartNextTransfer(void)
+{
+    if (g_txInFlight || g_txHead == g_txTail) { return; }
+
+    auto*  frame = &g_txQueue[g_txTail % s_txQueueSize];
+    size_t size  = g_timestamps[frame->channel] ? sizeof(*frame) : GS_HOST_FRAME_SIZE_NO_TS;
+    if (USBD_DCDC_GsTransmit(&hUsbDeviceFS, reinterpret_cast<uint8_t*>(frame), size) == USBD_OK) {
+        g_txInFlight = true;
+    }
+}
+
+/**
+ * Drops the frames that are still waiting. Must be called with the USB interrupt masked.
+ */
+static void gsFlushTxQueue(void)
+{
+    // The frame in the endpoint, if any, keeps its slot until its transfer complete releases it.
+    g_txHead = g_txTail + (g_txInFlight ? 1 : 0);
+}
+
+static bool gsIsAnyStarted(void)
+{
+    return std::any_of(&g_started[0], &g_started[g_channelCount], [](bool started) { return started; });
+}
+
+/**
+ * Tells the application that a channel got started or reset, from the USB interrupt.
+ */
+static void gsNotifyModeChanged(uint8_t channel)
+{
+    if (g_onModeChanged != nullptr) { g_onModeChanged(g_onModeChangedUserData, channel, g_started[channel]); }
+}
+/* USER CODE END PRIVATE_FUNCTIONS_IMPLEMENTATION */
+
+/* USER CODE BEGIN EXPORTED_FUNCTIONS_IMPLEMENTATION */
+void GS_SetOnFrame(GS_onFrame_t onFrame, void* userData)
+{
+    taskENTER_CRITICAL();
+    g_onFrame         = onFrame;
+    g_onFrameUserData = userData;
+    taskEXIT_CRITICAL();
+}
+
+void GS_SetOnModeChanged(GS_onModeChanged_t onModeChanged, void* userData)
+{
+    taskENTER_CRITICAL();
+    g_onModeChanged         = onModeChanged;
+    g_onModeChangedUserData = userData;
+    taskEXIT_CRITICAL();
+}
+
+void GS_SetOnFrameSent(GS_onFrameSent_t onFrameSent, void* userData)
+{
+    taskENTER_CRITICAL();
+    g_onFrameSent         = onFrameSent;
+    g_onFrameSentUserData = userData;
+    taskEXIT_CRITICAL();
+}
+
+void GS_SetChannelCount(uint8_t count)
+{
+    configASSERT(count != 0 && count <= GS_MAX_CHANNELS);
+    g_channelCount = count;
+}
+
+bool GS_IsStarted(uint8_t channel)
+{
+    return channel < g_channelCount && g_started[channel];
+}
+
+bool GS_Queue(const GS_HostFrame* frame)
+{
+    bool queued = false;
+
+    taskENTER_CRITICAL();
+    if (GS_IsStarted(frame->channel)) {
+        if (g_txHead - g_txTail < s_txQueueSize) {
+            g_txQueue[g_txHead % s_txQueueSize]        = *frame;
+            g_txQueuedCycles[g_txHead % s_txQueueSize] = DWT->CYCCNT;
+            ++g_txHead;
+            gsStartNextTransfer();
+            queued = true;
+        }
+        else {
+            ++g_txDropped;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    return queued;
+}
+
+size_t GS_GetDroppedFrames(void)
+{
+    return g_txDropped;
+}
+/* USER CODE END EXPORTED_FUNCTIONS_IMPLEMENTATION */
+
+#ifdef __cplusplus
+}
+#endif
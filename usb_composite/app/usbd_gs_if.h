@@ -0,0 +1,128 @@
+/* USER CODE BEGIN Header */
+/**
+ ******************************************************************************
+ * @file           : usbd_gs_if.h
+ * @brief          : Header for usbd_gs_if.cpp file.
+ ******************************************************************************
+ * @attention
+ *
+ * Binary CAN interface, speaking the gs_usb protocol used by candleLight and the Linux gs_usb driver.
+ *
+ ******************************************************************************
+ */
+/* USER CODE END Header */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef USB_COMPOSITE_APP_USBD_GS_IF_H
+#    define USB_COMPOSITE_APP_USBD_GS_IF_H
+
+#    ifdef __cplusplus
+extern "C" {
+#    endif
+
+/* Includes ------------------------------------------------------------------*/
+#    include "usbd_dcdc.h"
+
+/* USER CODE BEGIN INCLUDE */
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+/* USER CODE END INCLUDE */
+
+/* USER CODE BEGIN EXPORTED_DEFINES */
+/* Flags of GS_HostFrame::can_id, same as the ones of Linux' struct can_frame. */
+#    define GS_CAN_EFF_FLAG 0x80000000U    //!< Extended identifier.
+#    define GS_CAN_RTR_FLAG 0x40000000U    //!< Remote frame.
+#    define GS_CAN_ERR_FLAG 0x20000000U    //!< Error frame.
+#    define GS_CAN_EFF_MASK 0x1FFFFFFFU
+#    define GS_CAN_SFF_MASK 0x000007FFU
+
+/* Feature of the channel, advertised in BT_CONST and requested in the flags of MODE. */
+#    define GS_CAN_FEATURE_HW_TIMESTAMP (1U << 4)
+
+/* Number of CAN channels the interface can expose, see GS_SetChannelCount. */
+#    define GS_MAX_CHANNELS 3U
+
+/* Echo identifier of the frames received on the bus, as opposed to the echoes of the frames sent by the host. */
+#    define GS_ECHO_ID_RX 0xFFFFFFFFU
+/* USER CODE END EXPORTED_DEFINES */
+
+/* USER CODE BEGIN EXPORTED_TYPES */
+/**
+ * CAN frame as exchanged on the bulk endpoints, little endian.
+ * timestamp_us is only sent to the host, if it enabled GS_CAN_FEATURE_HW_TIMESTAMP. The host never sends it.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t echo_id;    //!< Given by the host, sent back once the frame is on its way. GS_ECHO_ID_RX otherwise.
+    uint32_t can_id;     //!< Identifier and GS_CAN_*_FLAG.
+    uint8_t  can_dlc;
+    uint8_t  channel;
+    uint8_t  flags;
+    uint8_t  reserved;
+    uint8_t  data[8];
+    uint32_t timestamp_us;    //!< Start of frame, or time of the echo. See Timestamp::nowUs.
+} GS_HostFrame;
+
+/* Size of a frame without the timestamp. */
+#    define GS_HOST_FRAME_SIZE_NO_TS (sizeof(GS_HostFrame) - sizeof(uint32_t))
+
+/**
+ * Function called upon receiving a frame from the host, from the USB interrupt.
+ *
+ * void*: User Data.
+ * const GS_HostFrame*: The frame, only valid for the duration of the call.
+ */
+typedef void (*GS_onFrame_t)(void*, const GS_HostFrame*);
+
+/**
+ * Function called when the host starts or resets a channel, from the USB interrupt.
+ *
+ * void*: User Data.
+ * uint8_t: The channel.
+ * bool: True if the channel is now started.
+ */
+typedef void (*GS_onModeChanged_t)(void*, uint8_t, bool);
+
+/**
+ * Function called once a frame queued with GS_Queue got sent to the host, from the USB interrupt.
+ *
+ * void*: User Data.
+ * uint32_t: DWT cycle count when the frame was queued, to trace its latency.
+ */
+typedef void (*GS_onFrameSent_t)(void*, uint32_t);
+/* USER CODE END EXPORTED_TYPES */
+
+/** gs_usb Interface callback. */
+extern USBD_DCDC_GsItfTypeDef g_usbdGsFopsFs;
+
+/* USER CODE BEGIN EXPORTED_FUNCTIONS */
+void GS_SetOnFrame(GS_onFrame_t onFrame, void* userData);
+void GS_SetOnModeChanged(GS_onModeChanged_t onModeChanged, void* userData);
+void GS_SetOnFrameSent(GS_onFrameSent_t onFrameSent, void* userData);
+
+/**
+ * Sets the number of channels advertised to the host, at most GS_MAX_CHANNELS. Must be called before the host
+ * configures the device.
+ */
+void GS_SetChannelCount(uint8_t count);
+
+/**
+ * Checks if the host started a channel, frames should only be queued for it while it is.
+ */
+bool GS_IsStarted(uint8_t channel);
+
+/**
+ * Copies a frame in the TX queue, it gets sent as soon as the frames before it are.
+ * Must be called from a task.
+ * @return False if the queue is full or the channel of the frame isn't started.
+ */
+bool GS_Queue(const GS_HostFrame* frame);
+
+size_t GS_GetDroppedFrames(void);    //!< Frames that didn't fit in the TX queue since a channel was started.
+/* USER CODE END EXPORTED_FUNCTIONS */
+
+#    ifdef __cplusplus
+}
+#    endif
+
+#endif /* USB_COMPOSITE_APP_USBD_GS_IF_H */
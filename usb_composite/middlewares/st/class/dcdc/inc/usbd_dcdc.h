@@ -42,13 +42,19 @@ extern "C" {
   * @{
   */
 #define DCDC_IN_EP                                   0x81U  /* EP1 for data IN */
-#define DCDC_OUT_EP                                  0x01U  /* EP1 for data OUT */
+#define DCDC_OUT_EP                                  0x05U  /* EP5 for data OUT, EP1 is double-buffered for IN only */
 #define DCDC_CMD_EP                                  0x83U  /* EP2 for DCDC commands */
 
 #define DCDC_IN_EP2                                  0x82U
 #define DCDC_OUT_EP2                                 0x02U
 #define DCDC_CMD_EP2                                 0x84U
 
+/* Vendor interface carrying binary CAN frames, laid out like the gs_usb (candleLight) protocol. */
+#define DCDC_GS_INTERFACE                            0x04U
+#define DCDC_GS_IN_EP                                0x86U
+#define DCDC_GS_OUT_EP                               0x06U
+#define DCDC_GS_PACKET_SIZE                          32U  /* A whole host frame fits in a single packet */
+
 #ifndef DCDC_HS_BINTERVAL
 #define DCDC_HS_BINTERVAL                          0x10U
 #endif /* DCDC_HS_BINTERVAL */
@@ -121,13 +127,35 @@ typedef struct _USBD_DCDC_Itf
   int8_t (* DeInit)(USBD_CDC_HandleTypeDef *cdc);
   int8_t (* Control)(USBD_CDC_HandleTypeDef *cdc, uint8_t cmd, uint8_t *pbuf, uint16_t length);
   int8_t (* Receive)(USBD_CDC_HandleTypeDef *cdc, uint8_t *Buf, uint32_t *Len);
+  int8_t (* TransmitCplt)(USBD_CDC_HandleTypeDef *cdc, uint8_t *Buf, uint32_t *Len);
 
 } USBD_DCDC_ItfTypeDef;
 
+typedef struct {
+    uint32_t data[64U / 4U];      /* Control requests, force 32bits alignment */
+    uint32_t RxBuffer[DCDC_GS_PACKET_SIZE / 4U];
+    uint8_t  CmdOpCode;
+    uint16_t CmdValue;
+    uint16_t CmdLength;
+
+    __IO uint32_t TxState;
+} USBD_GS_HandleTypeDef;
+
+typedef struct _USBD_DCDC_GsItf
+{
+  int8_t (* Init)(void);
+  /* Vendor requests, length holds wLength on entry and the number of bytes to send back on return. */
+  int8_t (* Control)(uint8_t request, uint16_t value, uint8_t *pbuf, uint16_t *length);
+  /* A host frame was received, the buffer is re-armed as soon as this returns. */
+  int8_t (* Receive)(uint8_t *Buf, uint32_t Len);
+  int8_t (* TransmitCplt)(void);
+} USBD_DCDC_GsItfTypeDef;
+
 typedef struct
 {
   USBD_CDC_HandleTypeDef frasyCdc;
   USBD_CDC_HandleTypeDef debugCdc;
+  USBD_GS_HandleTypeDef  gsCan;
 }
 USBD_DCDC_HandleTypeDef;
 
@@ -169,6 +197,11 @@ uint8_t  USBD_DCDC_SetRxBuffer(USBD_HandleTypeDef   *pdev,
 uint8_t  USBD_DCDC_ReceivePacket(USBD_HandleTypeDef *pdev, USBD_CDC_HandleTypeDef *cdc);
 
 uint8_t  USBD_DCDC_TransmitPacket(USBD_HandleTypeDef *pdev, USBD_CDC_HandleTypeDef *cdc);
+
+uint8_t  USBD_DCDC_RegisterGsInterface(USBD_HandleTypeDef     *pdev,
+                                      USBD_DCDC_GsItfTypeDef *fops);
+
+uint8_t  USBD_DCDC_GsTransmit(USBD_HandleTypeDef *pdev, uint8_t *pbuff, uint16_t length);
 /**
   * @}
   */
@@ -121,6 +121,9 @@ static uint8_t* USBD_DCDC_GetOtherSpeedCfgDesc(uint16_t* length);
 
 uint8_t* USBD_DCDC_GetDeviceQualifierDescriptor(uint16_t* length);
 
+/* Callbacks of the gs_usb interface, NULL until the application registers them */
+static USBD_DCDC_GsItfTypeDef* USBD_DCDC_GsFops = NULL;
+
 /* USB Standard Device Descriptor */
 __ALIGN_BEGIN static uint8_t USBD_DCDC_DeviceQualifierDesc[USB_LEN_DEV_QUALIFIER_DESC] __ALIGN_END = {
   USB_LEN_DEV_QUALIFIER_DESC,
@@ -360,9 +363,9 @@ __ALIGN_BEGIN uint8_t USBD_DCDC_CfgFSDesc[] __ALIGN_END = {
   /*Configuration Descriptor*/
   0x09,                        /* bLength: Configuration Descriptor size */
   USB_DESC_TYPE_CONFIGURATION, /* bDescriptorType: Configuration */
-  0x8D,                        /* wTotalLength:no of returned bytes */
+  0xA4,                        /* wTotalLength:no of returned bytes */
   0x00,
-  0x04, /* bNumInterfaces: 2 interface */
+  0x05, /* bNumInterfaces: 2 CDCs and the gs_usb interface */
   0x01, /* bConfigurationValue: Configuration value */
   0x00, /* iConfiguration: Index of string descriptor describing the configuration */
   0xC0, /* bmAttributes: self powered */
@@ -544,10 +547,37 @@ __ALIGN_BEGIN uint8_t USBD_DCDC_CfgFSDesc[] __ALIGN_END = {
   0x02,                                 /* bmAttributes: Bulk */
   LOBYTE(DCDC_DATA_FS_MAX_PACKET_SIZE), /* wMaxPacketSize: */
   HIBYTE(DCDC_DATA_FS_MAX_PACKET_SIZE),
-  0x00 /* bInterval: ignore for Bulk transfer */
+  0x00, /* bInterval: ignore for Bulk transfer */
 
+  /*---------------------------------------------------------------------------*/
+  /*gs_usb vendor interface descriptor*/
+  0x09,                    /* bLength: Interface Descriptor size */
+  USB_DESC_TYPE_INTERFACE, /* bDescriptorType: */
+  DCDC_GS_INTERFACE,       /* bInterfaceNumber: Number of Interface */
+  0x00,                    /* bAlternateSetting: Alternate setting */
+  0x02,                    /* bNumEndpoints: Two endpoints used */
+  0xFF,                    /* bInterfaceClass: Vendor specific */
+  0xFF,                    /* bInterfaceSubClass: */
+  0xFF,                    /* bInterfaceProtocol: */
+  0x00,                    /* iInterface: */
 
+  /*Endpoint IN Descriptor*/
+  0x07,                        /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  DCDC_GS_IN_EP,               /* bEndpointAddress */
+  0x02,                        /* bmAttributes: Bulk */
+  LOBYTE(DCDC_GS_PACKET_SIZE), /* wMaxPacketSize: */
+  HIBYTE(DCDC_GS_PACKET_SIZE),
+  0x00, /* bInterval: ignore for Bulk transfer */
 
+  /*Endpoint OUT Descriptor*/
+  0x07,                        /* bLength: Endpoint Descriptor size */
+  USB_DESC_TYPE_ENDPOINT,      /* bDescriptorType: Endpoint */
+  DCDC_GS_OUT_EP,              /* bEndpointAddress */
+  0x02,                        /* bmAttributes: Bulk */
+  LOBYTE(DCDC_GS_PACKET_SIZE), /* wMaxPacketSize: */
+  HIBYTE(DCDC_GS_PACKET_SIZE),
+  0x00 /* bInterval: ignore for Bulk transfer */
 };
 
 __ALIGN_BEGIN uint8_t USBD_DCDC_OtherSpeedCfgDesc[USB_DCDC_CONFIG_DESC_SIZ] __ALIGN_END = {
@@ -716,6 +746,13 @@ static uint8_t USBD_DCDC_Init(USBD_HandleTypeDef* pdev, uint8_t cfgidx)
     USBD_LL_OpenEP(pdev, DCDC_CMD_EP2, USBD_EP_TYPE_INTR, DCDC_CMD_PACKET_SIZE);
     pdev->ep_in[DCDC_CMD_EP2 & 0xFU].is_used = 1U;
 
+    /* Open gs_usb EPs */
+    USBD_LL_OpenEP(pdev, DCDC_GS_IN_EP, USBD_EP_TYPE_BULK, DCDC_GS_PACKET_SIZE);
+    pdev->ep_in[DCDC_GS_IN_EP & 0xFU].is_used = 1U;
+
+    USBD_LL_OpenEP(pdev, DCDC_GS_OUT_EP, USBD_EP_TYPE_BULK, DCDC_GS_PACKET_SIZE);
+    pdev->ep_out[DCDC_GS_OUT_EP & 0xFU].is_used = 1U;
+
     pdev->pClassData = USBD_malloc(sizeof(USBD_DCDC_HandleTypeDef));
 
     if (pdev->pClassData == NULL) { ret = 1U; }
@@ -734,6 +771,10 @@ static uint8_t USBD_DCDC_Init(USBD_HandleTypeDef* pdev, uint8_t cfgidx)
         hDCDC->debugCdc.TxState = 0U;
         hDCDC->debugCdc.RxState = 0U;
 
+        hDCDC->gsCan.TxState   = 0U;
+        hDCDC->gsCan.CmdOpCode = 0xFFU;
+        if (USBD_DCDC_GsFops != NULL) { USBD_DCDC_GsFops->Init(); }
+
 
         if (pdev->dev_speed == USBD_SPEED_HIGH) {
             /* Prepare Out endpoint to receive next packet */
@@ -753,6 +794,9 @@ static uint8_t USBD_DCDC_Init(USBD_HandleTypeDef* pdev, uint8_t cfgidx)
             /* Prepare Out endpoint to receive next packet */
             USBD_LL_PrepareReceive(pdev, DCDC_OUT_EP2, hDCDC->debugCdc.RxBuffer, DCDC_DATA_FS_OUT_PACKET_SIZE);
         }
+
+        /* The gs_usb frames always go in the class' own buffer */
+        USBD_LL_PrepareReceive(pdev, DCDC_GS_OUT_EP, (uint8_t*)(void*)hDCDC->gsCan.RxBuffer, DCDC_GS_PACKET_SIZE);
     }
     return ret;
 }
@@ -792,6 +836,13 @@ static uint8_t USBD_DCDC_DeInit(USBD_HandleTypeDef* pdev, uint8_t cfgidx)
     USBD_LL_CloseEP(pdev, DCDC_CMD_EP2);
     pdev->ep_in[DCDC_CMD_EP2 & 0xFU].is_used = 0U;
 
+    /* Close gs_usb EPs */
+    USBD_LL_CloseEP(pdev, DCDC_GS_IN_EP);
+    pdev->ep_in[DCDC_GS_IN_EP & 0xFU].is_used = 0U;
+
+    USBD_LL_CloseEP(pdev, DCDC_GS_OUT_EP);
+    pdev->ep_out[DCDC_GS_OUT_EP & 0xFU].is_used = 0U;
+
     /* DeInit  physical Interface components */
     if (pdev->pClassData != NULL) {
 
@@ -822,6 +873,40 @@ static uint8_t USBD_DCDC_Setup(USBD_HandleTypeDef* pdev, USBD_SetupReqTypedef* r
 
 
     switch (req->bmRequest & USB_REQ_TYPE_MASK) {
+        case USB_REQ_TYPE_VENDOR:
+            if (LOBYTE(req->wIndex) != DCDC_GS_INTERFACE || USBD_DCDC_GsFops == NULL ||
+                req->wLength > sizeof(hDCDC->gsCan.data)) {
+                USBD_CtlError(pdev, req);
+                ret = USBD_FAIL;
+            }
+            else if ((req->bmRequest & 0x80U) != 0U) {
+                uint16_t length = req->wLength;
+                if (USBD_DCDC_GsFops->Control(req->bRequest, req->wValue, (uint8_t*)(void*)hDCDC->gsCan.data, &length) !=
+                    USBD_OK) {
+                    USBD_CtlError(pdev, req);
+                    ret = USBD_FAIL;
+                }
+                else {
+                    USBD_CtlSendData(pdev, (uint8_t*)(void*)hDCDC->gsCan.data, MIN(length, req->wLength));
+                }
+            }
+            else if (req->wLength != 0U) {
+                /* Handled once the data stage completes */
+                hDCDC->gsCan.CmdOpCode = req->bRequest;
+                hDCDC->gsCan.CmdValue  = req->wValue;
+                hDCDC->gsCan.CmdLength = req->wLength;
+                USBD_CtlPrepareRx(pdev, (uint8_t*)(void*)hDCDC->gsCan.data, req->wLength);
+            }
+            else {
+                uint16_t length = 0U;
+                if (USBD_DCDC_GsFops->Control(req->bRequest, req->wValue, (uint8_t*)(void*)hDCDC->gsCan.data, &length) !=
+                    USBD_OK) {
+                    USBD_CtlError(pdev, req);
+                    ret = USBD_FAIL;
+                }
+            }
+            break;
+
         case USB_REQ_TYPE_CLASS:
             if (req->wLength) {
                 if (req->bmRequest & 0x80U) {
@@ -914,10 +999,25 @@ static uint8_t USBD_DCDC_DataIn(USBD_HandleTypeDef* pdev, uint8_t epnum)
             USBD_LL_Transmit(pdev, epnum, NULL, 0U);
         }
         else {
+            if (epnum == (DCDC_GS_IN_EP & 0xFU)) {
+                hDCDC->gsCan.TxState = 0U;
+                if (USBD_DCDC_GsFops != NULL) { USBD_DCDC_GsFops->TransmitCplt(); }
+                return USBD_OK;
+            }
+
+            USBD_CDC_HandleTypeDef* cdc = NULL;
             // if(epnum == DCDC_IN_EP & EP_ADDR_MSK)
-            if (epnum == (DCDC_IN_EP & 0xFU)) { hDCDC->frasyCdc.TxState = 0U; }
+            if (epnum == (DCDC_IN_EP & 0xFU)) { cdc = &hDCDC->frasyCdc; }
             // if(epnum == DCDC_IN_EP2 & EP_ADDR_MSK)
-            if (epnum == (DCDC_IN_EP2 & 0xFU)) { hDCDC->debugCdc.TxState = 0U; }
+            if (epnum == (DCDC_IN_EP2 & 0xFU)) { cdc = &hDCDC->debugCdc; }
+
+            if (cdc != NULL) {
+                cdc->TxState = 0U;
+                // Lets the interface queue its next buffer right away.
+                if (((USBD_DCDC_ItfTypeDef*)pdev->pUserData)->TransmitCplt != NULL) {
+                    ((USBD_DCDC_ItfTypeDef*)pdev->pUserData)->TransmitCplt(cdc, cdc->TxBuffer, &cdc->TxLength);
+                }
+            }
         }
         return USBD_OK;
     }
@@ -940,9 +1040,18 @@ static uint8_t USBD_DCDC_DataOut(USBD_HandleTypeDef* pdev, uint8_t epnum)
     /* Get the received data length */
     uint32_t rxSize = USBD_LL_GetRxDataSize(pdev, epnum);
 
-    /* USB data will be immediately processed, this allows next USB traffic being
-    NAKed till the end of the application Xfer */
+    /* USB data will be immediately processed. The debug endpoint NAKs the next USB traffic till the end of the
+    application Xfer, the double-buffered frasy endpoint keeps accepting one more packet in the meantime. */
     if (pdev->pClassData != NULL) {
+        if (epnum == DCDC_GS_OUT_EP) {
+            /* A frame is always a single packet, hand it over and get ready for the next one */
+            if (USBD_DCDC_GsFops != NULL) {
+                USBD_DCDC_GsFops->Receive((uint8_t*)(void*)hDCDC->gsCan.RxBuffer, rxSize);
+            }
+            USBD_LL_PrepareReceive(pdev, DCDC_GS_OUT_EP, (uint8_t*)(void*)hDCDC->gsCan.RxBuffer, DCDC_GS_PACKET_SIZE);
+            return USBD_OK;
+        }
+
         USBD_CDC_HandleTypeDef* cdc = &hDCDC->frasyCdc;
         if (epnum == DCDC_OUT_EP2) { cdc = &hDCDC->debugCdc; }
         cdc->RxLength = rxSize;
@@ -973,6 +1082,12 @@ static uint8_t USBD_DCDC_EP0_RxReady(USBD_HandleTypeDef* pdev)
                     (uint16_t)hDCDC->frasyCdc.CmdLength);
         hDCDC->frasyCdc.CmdOpCode = 0xFFU;
     }
+    if ((USBD_DCDC_GsFops != NULL) && (hDCDC->gsCan.CmdOpCode != 0xFFU)) {
+        uint16_t length = hDCDC->gsCan.CmdLength;
+        USBD_DCDC_GsFops->Control(
+          hDCDC->gsCan.CmdOpCode, hDCDC->gsCan.CmdValue, (uint8_t*)(void*)hDCDC->gsCan.data, &length);
+        hDCDC->gsCan.CmdOpCode = 0xFFU;
+    }
     return USBD_OK;
 }
 
@@ -1112,6 +1227,45 @@ uint8_t USBD_DCDC_TransmitPacket(USBD_HandleTypeDef* pdev, USBD_CDC_HandleTypeDe
 }
 
 
+/**
+ * @brief  USBD_DCDC_RegisterGsInterface
+ * @param  pdev: device instance
+ * @param  fops: gs_usb Interface callback
+ * @retval status
+ */
+uint8_t USBD_DCDC_RegisterGsInterface(USBD_HandleTypeDef* pdev, USBD_DCDC_GsItfTypeDef* fops)
+{
+    UNUSED(pdev);
+    if (fops == NULL) { return USBD_FAIL; }
+
+    USBD_DCDC_GsFops = fops;
+    return USBD_OK;
+}
+
+/**
+ * @brief  USBD_DCDC_GsTransmit
+ *         Transmit a host frame on the gs_usb IN endpoint
+ * @param  pdev: device instance
+ * @param  pbuff: frame, must stay valid until TransmitCplt is called
+ * @param  length: size of the frame, at most DCDC_GS_PACKET_SIZE
+ * @retval status
+ */
+uint8_t USBD_DCDC_GsTransmit(USBD_HandleTypeDef* pdev, uint8_t* pbuff, uint16_t length)
+{
+    USBD_DCDC_HandleTypeDef* hDCDC = (USBD_DCDC_HandleTypeDef*)pdev->pClassData;
+
+    if (pdev->pClassData == NULL || length > DCDC_GS_PACKET_SIZE) { return USBD_FAIL; }
+    if (hDCDC->gsCan.TxState != 0U) { return USBD_BUSY; }
+
+    /* Tx Transfer in progress */
+    hDCDC->gsCan.TxState = 1U;
+
+    pdev->ep_in[DCDC_GS_IN_EP & 0xFU].total_length = length;
+    USBD_LL_Transmit(pdev, DCDC_GS_IN_EP, pbuff, length);
+
+    return USBD_OK;
+}
+
 /**
  * @brief  USBD_DCDC_ReceivePacket
  *         prepare OUT Endpoint for reception
@@ -33,6 +33,41 @@
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+/* USER CODE BEGIN PD */
+/* Number of endpoint registers, each one has an 8 bytes entry in the buffer descriptor table. */
+#define USB_ENDPOINT_COUNT        8U
+/* Size of the packet memory area, shared by the buffer descriptor table and the endpoint buffers. */
+#define PMA_SIZE                  1024U
+#define PMA_BTABLE_SIZE           (USB_ENDPOINT_COUNT * 8U)
+
+/* The endpoint buffers are laid out one after the other, right after the buffer descriptor table. */
+#define PMA_EP0_OUT_ADDR          PMA_BTABLE_SIZE
+#define PMA_EP0_IN_ADDR           (PMA_EP0_OUT_ADDR + USB_MAX_EP0_SIZE)
+#define PMA_FRASY_IN_ADDR0        (PMA_EP0_IN_ADDR + USB_MAX_EP0_SIZE)
+#define PMA_FRASY_IN_ADDR1        (PMA_FRASY_IN_ADDR0 + DCDC_DATA_FS_IN_PACKET_SIZE)
+#define PMA_FRASY_OUT_ADDR0       (PMA_FRASY_IN_ADDR1 + DCDC_DATA_FS_IN_PACKET_SIZE)
+#define PMA_FRASY_OUT_ADDR1       (PMA_FRASY_OUT_ADDR0 + DCDC_DATA_FS_OUT_PACKET_SIZE)
+#define PMA_FRASY_CMD_ADDR        (PMA_FRASY_OUT_ADDR1 + DCDC_DATA_FS_OUT_PACKET_SIZE)
+#define PMA_DEBUG_IN_ADDR         (PMA_FRASY_CMD_ADDR + DCDC_CMD_PACKET_SIZE)
+#define PMA_DEBUG_OUT_ADDR        (PMA_DEBUG_IN_ADDR + DCDC_DATA_FS_IN_PACKET_SIZE)
+#define PMA_DEBUG_CMD_ADDR        (PMA_DEBUG_OUT_ADDR + DCDC_DATA_FS_OUT_PACKET_SIZE)
+#define PMA_GS_IN_ADDR            (PMA_DEBUG_CMD_ADDR + DCDC_CMD_PACKET_SIZE)
+#define PMA_GS_OUT_ADDR           (PMA_GS_IN_ADDR + DCDC_GS_PACKET_SIZE)
+#define PMA_END                   (PMA_GS_OUT_ADDR + DCDC_GS_PACKET_SIZE)
+
+/* Double-buffered endpoints take the address of both of their buffers in a single word. */
+#define PMA_DBL_BUF_ADDR(buf0, buf1) (((uint32_t)(buf1) << 16U) | (uint32_t)(buf0))
+
+_Static_assert(PMA_END <= PMA_SIZE, "The endpoint buffers don't fit in the PMA");
+_Static_assert(((USB_MAX_EP0_SIZE | DCDC_DATA_FS_IN_PACKET_SIZE | DCDC_DATA_FS_OUT_PACKET_SIZE |
+                 DCDC_CMD_PACKET_SIZE | DCDC_GS_PACKET_SIZE) & 1U) == 0U,
+               "The PMA buffers must be aligned on half-words");
+/* A double-buffered endpoint uses both the TX and RX descriptors of its register, it can only go in one direction. */
+_Static_assert((DCDC_IN_EP & 0xFU) != (DCDC_OUT_EP & 0xFU), "The frasy IN and OUT endpoints can't share a register");
+_Static_assert((DCDC_OUT_EP & 0xFU) < USB_ENDPOINT_COUNT && (DCDC_CMD_EP2 & 0xFU) < USB_ENDPOINT_COUNT &&
+                 (DCDC_GS_IN_EP & 0xFU) < USB_ENDPOINT_COUNT,
+               "Not enough endpoint registers");
+/* USER CODE END PD */
 /* Private macro -------------------------------------------------------------*/
 
 /* Private variables ---------------------------------------------------------*/
@@ -185,7 +220,7 @@ void HAL_PCD_DataInStageCallback(PCD_HandleTypeDef *hpcd, uint8_t epnum)
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
 {
   /* USER CODE BEGIN HAL_PCD_DataInStageCallback_PreTreatment */
-  CDCInternal_SetLastTxCompleteTimestamp(HAL_GetTick(), epnum);
+
   /* USER CODE END HAL_PCD_DataInStageCallback_PreTreatment */
   USBD_LL_DataInStage((USBD_HandleTypeDef*)hpcd->pData, epnum, hpcd->IN_ep[epnum].xfer_buff);
   /* USER CODE BEGIN HAL_PCD_DataInStageCallback_PostTreatment  */
@@ -205,7 +240,7 @@ void HAL_PCD_SOFCallback(PCD_HandleTypeDef *hpcd)
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
 {
   /* USER CODE BEGIN HAL_PCD_SOFCallback_PreTreatment */
-  // TODO potentially could be used as an activity marker?
+  CDCInternal_OnStartOfFrame();
   /* USER CODE END HAL_PCD_SOFCallback_PreTreatment */
   USBD_LL_SOF((USBD_HandleTypeDef*)hpcd->pData);
   /* USER CODE BEGIN HAL_PCD_SOFCallback_PostTreatment */
@@ -404,10 +439,10 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
   pdev->pData = &hpcd_USB_FS;
 
   hpcd_USB_FS.Instance = USB;
-  hpcd_USB_FS.Init.dev_endpoints = 8;
+  hpcd_USB_FS.Init.dev_endpoints = USB_ENDPOINT_COUNT;
   hpcd_USB_FS.Init.speed = PCD_SPEED_FULL;
   hpcd_USB_FS.Init.phy_itface = PCD_PHY_EMBEDDED;
-  hpcd_USB_FS.Init.Sof_enable = DISABLE;
+  hpcd_USB_FS.Init.Sof_enable = ENABLE;
   hpcd_USB_FS.Init.low_power_enable = DISABLE;
   hpcd_USB_FS.Init.lpm_enable = DISABLE;
   hpcd_USB_FS.Init.battery_charging_enable = DISABLE;
@@ -445,22 +480,24 @@ USBD_StatusTypeDef USBD_LL_Init(USBD_HandleTypeDef *pdev)
   /* USER CODE END RegisterCallBackSecondPart */
 #endif /* USE_HAL_PCD_REGISTER_CALLBACKS */
   /* USER CODE BEGIN EndPoint_Configuration */
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, 0x18);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, 0x58);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x00 , PCD_SNG_BUF, PMA_EP0_OUT_ADDR);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x80 , PCD_SNG_BUF, PMA_EP0_IN_ADDR);
   /* USER CODE END EndPoint_Configuration */
   /* USER CODE BEGIN EndPoint_Configuration_CDC */
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_IN_EP , PCD_SNG_BUF, 0x98);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_OUT_EP , PCD_SNG_BUF, 0xD8);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_CMD_EP , PCD_SNG_BUF, 0x118);
-
-  //HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x83 , PCD_SNG_BUF, 0x150);
-  //HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x02 , PCD_SNG_BUF, 0x1A0);
-  //HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , 0x84 , PCD_SNG_BUF, 0x190);
-
-
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_IN_EP2 , PCD_SNG_BUF, 0x128);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_OUT_EP2, PCD_SNG_BUF, 0x168);
-  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_CMD_EP2, PCD_SNG_BUF, 0x1A8);
+  /* The peripheral sends/accepts the next packet of the frasy CDC while the firmware handles the current one. */
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_IN_EP , PCD_DBL_BUF,
+                      PMA_DBL_BUF_ADDR(PMA_FRASY_IN_ADDR0, PMA_FRASY_IN_ADDR1));
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_OUT_EP , PCD_DBL_BUF,
+                      PMA_DBL_BUF_ADDR(PMA_FRASY_OUT_ADDR0, PMA_FRASY_OUT_ADDR1));
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_CMD_EP , PCD_SNG_BUF, PMA_FRASY_CMD_ADDR);
+
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_IN_EP2 , PCD_SNG_BUF, PMA_DEBUG_IN_ADDR);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_OUT_EP2, PCD_SNG_BUF, PMA_DEBUG_OUT_ADDR);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_CMD_EP2, PCD_SNG_BUF, PMA_DEBUG_CMD_ADDR);
+
+  /* Single-buffered, so the IN and OUT endpoints of the gs_usb interface share a register. */
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_GS_IN_EP , PCD_SNG_BUF, PMA_GS_IN_ADDR);
+  HAL_PCDEx_PMAConfig((PCD_HandleTypeDef*)pdev->pData , DCDC_GS_OUT_EP, PCD_SNG_BUF, PMA_GS_OUT_ADDR);
   /* USER CODE END EndPoint_Configuration_CDC */
   return USBD_OK;
 }